@@ -36,6 +36,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/time.h>
 
@@ -46,6 +47,7 @@
 #include <wayland-client.h>
 #include "shared/helpers.h"
 #include "shared/platform.h"
+#include "shared/timespec-util.h"
 #include <libweston/zalloc.h>
 #include "xdg-shell-client-protocol.h"
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
@@ -69,6 +71,15 @@
 #define OPT_IMPLICIT_SYNC (1 << 1)  /* force implicit sync */
 #define OPT_MANDELBROT    (1 << 2)  /* render mandelbrot */
 #define OPT_DIRECT_DISPLAY     (1 << 3)  /* direct-display */
+#define OPT_RELEASE_LATENCY (1 << 4)  /* print buffer release latency */
+
+/* How long buffers stay with the compositor after being committed */
+struct release_stats {
+	bool enabled;
+	unsigned int count;
+	int64_t min_nsec, max_nsec, total_nsec;
+	struct timespec begin;
+};
 
 #define BUFFER_FORMAT DRM_FORMAT_XRGB8888
 #define MAX_BUFFER_PLANES 4
@@ -86,6 +97,7 @@ struct display {
 	int modifiers_count;
 	int req_dmabuf_immediate;
 	bool use_explicit_sync;
+	struct release_stats release_stats;
 	struct {
 		EGLDisplay display;
 		EGLContext context;
@@ -132,6 +144,8 @@ struct buffer {
 	/* The buffer owns the release_fence_fd, until it passes ownership
 	 * to it to EGL (see wait_for_buffer_release_fence). */
 	int release_fence_fd;
+
+	struct timespec commit_time;
 };
 
 #define NUM_BUFFERS 3
@@ -161,12 +175,47 @@ static sig_atomic_t running = 1;
 static void
 redraw(void *data, struct wl_callback *callback, uint32_t time);
 
+static void
+buffer_released(struct buffer *buffer)
+{
+	struct release_stats *stats = &buffer->display->release_stats;
+	struct timespec now;
+	int64_t held;
+
+	buffer->busy = 0;
+
+	if (!stats->enabled)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	held = timespec_sub_to_nsec(&now, &buffer->commit_time);
+	if (stats->count == 0 || held < stats->min_nsec)
+		stats->min_nsec = held;
+	if (held > stats->max_nsec)
+		stats->max_nsec = held;
+	stats->total_nsec += held;
+	stats->count++;
+
+	if (timespec_sub_to_msec(&now, &stats->begin) < 5000)
+		return;
+
+	printf("%u buffers released %.2f ms after commit on average, "
+	       "min %.2f ms, max %.2f ms\n", stats->count,
+	       stats->total_nsec / (double) stats->count / 1e6,
+	       stats->min_nsec / 1e6, stats->max_nsec / 1e6);
+
+	stats->count = 0;
+	stats->max_nsec = 0;
+	stats->total_nsec = 0;
+	stats->begin = now;
+}
+
 static void
 buffer_release(void *data, struct wl_buffer *buffer)
 {
 	struct buffer *mybuf = data;
 
-	mybuf->busy = 0;
+	buffer_released(mybuf);
 }
 
 static const struct wl_buffer_listener buffer_listener = {
@@ -890,7 +939,7 @@ buffer_fenced_release(void *data,
 	assert(release == buffer->buffer_release);
 	assert(buffer->release_fence_fd == -1);
 
-	buffer->busy = 0;
+	buffer_released(buffer);
 	buffer->release_fence_fd = fence;
 	zwp_linux_buffer_release_v1_destroy(buffer->buffer_release);
 	buffer->buffer_release = NULL;
@@ -905,7 +954,7 @@ buffer_immediate_release(void *data,
 	assert(release == buffer->buffer_release);
 	assert(buffer->release_fence_fd == -1);
 
-	buffer->busy = 0;
+	buffer_released(buffer);
 	zwp_linux_buffer_release_v1_destroy(buffer->buffer_release);
 	buffer->buffer_release = NULL;
 }
@@ -988,6 +1037,8 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 
 	window->callback = wl_surface_frame(window->surface);
 	wl_callback_add_listener(window->callback, &frame_listener, window);
+	if (window->display->release_stats.enabled)
+		clock_gettime(CLOCK_MONOTONIC, &buffer->commit_time);
 	wl_surface_commit(window->surface);
 	buffer->busy = 1;
 }
@@ -1375,6 +1426,8 @@ create_display(char const *drm_render_node, int opts)
 	assert(display->display);
 
 	display->req_dmabuf_immediate = opts & OPT_IMMEDIATE;
+	display->release_stats.enabled = opts & OPT_RELEASE_LATENCY;
+	clock_gettime(CLOCK_MONOTONIC, &display->release_stats.begin);
 
 	display->registry = wl_display_get_registry(display->display);
 	wl_registry_add_listener(display->registry,
@@ -1460,7 +1513,10 @@ print_usage_and_exit(void)
 		"\n\t\tenables weston-direct-display extension to attempt "
 		"direct scan-out;\n\t\tnote this will cause the image to be "
 		"displayed inverted as GL uses a\n\t\tdifferent texture "
-		"coordinate system\n");
+		"coordinate system\n"
+		"\t'-l,--release-latency'"
+		"\n\t\tprint how long the compositor holds on to buffers "
+		"after they\n\t\tare committed, every 5 seconds\n");
 	exit(0);
 }
 
@@ -1495,11 +1551,12 @@ main(int argc, char **argv)
 		{"explicit-sync",    required_argument, 0,  'e' },
 		{"mandelbrot",       no_argument,	0,  'm' },
 		{"direct-display",   no_argument,	0,  'g' },
+		{"release-latency",  no_argument,	0,  'l' },
 		{"help",             no_argument      , 0,  'h' },
 		{0, 0, 0, 0}
 	};
 
-	while ((c = getopt_long(argc, argv, "hi:d:s:e:mg",
+	while ((c = getopt_long(argc, argv, "hi:d:s:e:mgl",
 				long_options, &option_index)) != -1) {
 		switch (c) {
 		case 'i':
@@ -1522,6 +1579,9 @@ main(int argc, char **argv)
 		case 'g':
 			opts |= OPT_DIRECT_DISPLAY;
 			break;
+		case 'l':
+			opts |= OPT_RELEASE_LATENCY;
+			break;
 		default:
 			print_usage_and_exit();
 		}
@@ -667,6 +667,9 @@ usage(int error_code)
 		"  -f, --flight-rec-scopes=SCOPE\n\t\t\tSpecify log scopes to "
 			"subscribe to.\n\t\t\tCan specify multiple scopes, "
 			"each followed by comma\n"
+		"  --flight-rec-file=FILE\n\t\t\tKeep the flight recorder in FILE, "
+			"which can be read\n\t\t\twith flight-rec-decode even "
+			"after a crash\n"
 		"  -h, --help\t\tThis help message\n\n");
 
 #if defined(BUILD_DRM_COMPOSITOR)
@@ -702,6 +705,12 @@ usage(int error_code)
 		"  --use-gbm\t\tUse the GL renderer with GBM (default: no rendering)\n"
 		"  --no-outputs\t\tDo not create any virtual outputs\n"
 		"  --tty=TTY\t\tThe tty to use\n"
+		"  --refresh-rate=RATE\tThe output refresh rate in mHz (default: 60000)\n"
+		"  --unthrottled\t\tPresent frames as soon as they are repainted\n"
+		"  --virtual-clock\tRun on a clock advanced only by the test plugin\n"
+		"  --vrr-min-refresh-rate=RATE\n"
+		"\t\t\tThe lowest variable refresh rate in mHz (default: none)\n"
+		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"\n");
 #endif
 
@@ -1091,6 +1100,33 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_bool(s, "adaptive-repaint-window",
+				       &ec->adaptive_repaint_window, false);
+	if (ec->adaptive_repaint_window)
+		weston_log("Output repaint windows adapt to repaint times.\n");
+
+	weston_config_section_get_bool(s, "parallel-repaint",
+				       &ec->parallel_repaint, false);
+
+	weston_config_section_get_int(s, "renderer-threads",
+				      &ec->renderer_threads, 1);
+	if (ec->renderer_threads == 0)
+		ec->renderer_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ec->renderer_threads < 1) {
+		weston_log("Invalid renderer-threads value in config: %d\n",
+			   ec->renderer_threads);
+		ec->renderer_threads = 1;
+	}
+
+	weston_config_section_get_int(s, "renderer-damage-history",
+				      &ec->renderer_damage_history, 0);
+	if (ec->renderer_damage_history < 0 ||
+	    ec->renderer_damage_history > 16) {
+		weston_log("Invalid renderer-damage-history value in config: "
+			   "%d\n", ec->renderer_damage_history);
+		ec->renderer_damage_history = 0;
+	}
+
 	/* weston.ini [libinput] */
 	s = weston_config_get_section(config, "libinput", NULL, NULL);
 	weston_config_section_get_bool(s, "touchscreen_calibrator", &cal, 0);
@@ -1261,6 +1297,17 @@ allow_content_protection(struct weston_output *output,
 	weston_output_allow_protection(output, allow_hdcp);
 }
 
+static void
+allow_vrr(struct weston_output *output, struct weston_config_section *section)
+{
+	bool vrr = false;
+
+	if (section)
+		weston_config_section_get_bool(section, "vrr", &vrr, false);
+
+	weston_output_allow_vrr(output, vrr);
+}
+
 static int
 wet_configure_windowed_output_from_config(struct weston_output *output,
 					  struct wet_output_config *defaults)
@@ -1299,6 +1346,7 @@ wet_configure_windowed_output_from_config(struct weston_output *output,
 	}
 
 	allow_content_protection(output, section);
+	allow_vrr(output, section);
 
 	if (parsed_options->width)
 		width = parsed_options->width;
@@ -1764,6 +1812,7 @@ drm_backend_output_configure(struct weston_output *output,
 	free(seat);
 
 	allow_content_protection(output, section);
+	allow_vrr(output, section);
 
 	return 0;
 }
@@ -2584,8 +2633,11 @@ load_headless_backend(struct weston_compositor *c,
 	struct weston_headless_backend_config config = {{ 0, }};
 	struct weston_config_section *section;
 	bool no_outputs = false;
+	int output_count;
 	int ret = 0;
 	char *transform = NULL;
+	char *name;
+	int i;
 
 	struct wet_output_config *parsed_options = wet_init_parsed_options(c);
 	if (!parsed_options)
@@ -2599,6 +2651,18 @@ load_headless_backend(struct weston_compositor *c,
 	weston_config_section_get_bool(section, "use-gbm", &config.use_gbm,
 				       false);
 
+	section = weston_config_get_section(wc, "headless", NULL, NULL);
+	weston_config_section_get_int(section, "refresh-rate", &config.refresh,
+				      60000);
+	weston_config_section_get_bool(section, "unthrottled",
+				       &config.unthrottled, false);
+	weston_config_section_get_bool(section, "virtual-clock",
+				       &config.virtual_clock, false);
+	weston_config_section_get_int(section, "vrr-min-refresh-rate",
+				      &config.vrr_min_refresh, 0);
+	weston_config_section_get_int(section, "output-count", &output_count,
+				      1);
+
 	const struct weston_option options[] = {
 		{ WESTON_OPTION_INTEGER, "width", 0, &parsed_options->width },
 		{ WESTON_OPTION_INTEGER, "height", 0, &parsed_options->height },
@@ -2609,6 +2673,13 @@ load_headless_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_INTEGER, "tty", 0, &config.tty },
 		{ WESTON_OPTION_STRING, "transform", 0, &transform },
 		{ WESTON_OPTION_BOOLEAN, "no-outputs", 0, &no_outputs },
+		{ WESTON_OPTION_INTEGER, "refresh-rate", 0, &config.refresh },
+		{ WESTON_OPTION_BOOLEAN, "unthrottled", 0, &config.unthrottled },
+		{ WESTON_OPTION_BOOLEAN, "virtual-clock", 0,
+		  &config.virtual_clock },
+		{ WESTON_OPTION_INTEGER, "vrr-min-refresh-rate", 0,
+		  &config.vrr_min_refresh },
+		{ WESTON_OPTION_INTEGER, "output-count", 0, &output_count },
 	};
 
 	parse_options(options, ARRAY_LENGTH(options), argc, argv);
@@ -2644,6 +2715,17 @@ load_headless_backend(struct weston_compositor *c,
 
 		if (api->create_head(c, "headless") < 0)
 			return -1;
+
+		for (i = 1; i < output_count; i++) {
+			if (asprintf(&name, "headless-%d", i) < 0)
+				return -1;
+
+			if (api->create_head(c, name) < 0) {
+				free(name);
+				return -1;
+			}
+			free(name);
+		}
 	}
 
 	load_remoting(c, wc);
@@ -3140,6 +3222,7 @@ wet_main(int argc, char *argv[])
 	char *log = NULL;
 	char *log_scopes = NULL;
 	char *flight_rec_scopes = NULL;
+	char *flight_rec_file = NULL;
 	char *server_socket = NULL;
 	int32_t idle_time = -1;
 	int32_t help = 0;
@@ -3151,6 +3234,8 @@ wet_main(int argc, char *argv[])
 	char *config_file = NULL;
 	struct weston_config *config = NULL;
 	struct weston_config_section *section;
+	struct weston_config_section *libinput_section;
+	uint32_t clipboard_size_limit;
 	struct wl_client *primary_client;
 	struct wl_listener primary_client_destroyed;
 	struct weston_seat *seat;
@@ -3181,6 +3266,7 @@ wet_main(int argc, char *argv[])
 		{ WESTON_OPTION_BOOLEAN, "debug", 0, &debug_protocol },
 		{ WESTON_OPTION_STRING, "logger-scopes", 'l', &log_scopes },
 		{ WESTON_OPTION_STRING, "flight-rec-scopes", 'f', &flight_rec_scopes },
+		{ WESTON_OPTION_STRING, "flight-rec-file", 0, &flight_rec_file },
 	};
 
 	wl_list_init(&wet.layoutput_list);
@@ -3217,7 +3303,15 @@ wet_main(int argc, char *argv[])
 	weston_log_set_handler(vlog, vlog_continue);
 
 	logger = weston_log_subscriber_create_log(weston_logfile);
-	flight_rec = weston_log_subscriber_create_flight_rec(DEFAULT_FLIGHT_REC_SIZE);
+	if (flight_rec_file) {
+		flight_rec = weston_log_subscriber_create_flight_rec_file(flight_rec_file,
+									  DEFAULT_FLIGHT_REC_SIZE);
+		if (!flight_rec)
+			weston_log("Error: failed to create flight recorder file "
+				   "%s: %s\n", flight_rec_file, strerror(errno));
+	}
+	if (!flight_rec)
+		flight_rec = weston_log_subscriber_create_flight_rec(DEFAULT_FLIGHT_REC_SIZE);
 
 	weston_log_subscribe_to_scopes(log_ctx, logger, flight_rec,
 				       log_scopes, flight_rec_scopes);
@@ -3315,6 +3409,18 @@ wet_main(int argc, char *argv[])
 
 	weston_config_section_get_bool(section, "require-input",
 				       &wet.compositor->require_input, true);
+	weston_config_section_get_bool(section, "coalesce-pointer-motion",
+				       &wet.compositor->coalesce_pointer_motion,
+				       false);
+	weston_config_section_get_uint(section, "clipboard-size-limit",
+				       &clipboard_size_limit, 0);
+	wet.compositor->clipboard_size_limit =
+		(size_t)clipboard_size_limit << 20;
+
+	libinput_section = weston_config_get_section(config, "libinput",
+						     NULL, NULL);
+	weston_config_section_get_bool(libinput_section, "input-thread",
+				       &wet.compositor->input_thread, false);
 
 	if (load_backend(wet.compositor, backend, &argc, argv, config) < 0) {
 		weston_log("fatal: failed to create compositor backend\n");
@@ -3446,6 +3552,7 @@ out_display:
 		weston_config_destroy(config);
 	free(config_file);
 	free(backend);
+	free(flight_rec_file);
 	free(shell);
 	free(socket_name);
 	free(option_modules);
@@ -28,6 +28,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -47,9 +48,12 @@
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "shared/timespec-util.h"
+#include <libweston/weston-log.h>
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
 
 struct shared_output {
+	struct screen_share *ss;
+	struct wl_list link; /* screen_share::output_list */
 	struct weston_output *output;
 	struct wl_listener output_destroyed;
 	struct wl_list seat_list;
@@ -81,6 +85,20 @@ struct shared_output {
 	pixman_image_t *cache_image;
 	uint32_t *tmp_data;
 	size_t tmp_data_size;
+
+	/* Without transform or scale the renderer reads straight into the
+	 * shm buffer, which is attached as is. The pending buffer is being
+	 * filled while the parent has not asked for a new frame yet. */
+	struct ss_shm_buffer *pending;
+	struct ss_shm_buffer *front;
+	pixman_region32_t commit_damage;
+
+	struct {
+		uint64_t frames;
+		uint64_t damage_bytes;
+		uint64_t bytes_read;
+		uint64_t bytes_copied;
+	} stats;
 };
 
 struct ss_seat {
@@ -114,10 +132,11 @@ struct ss_shm_buffer {
 
 struct screen_share {
 	struct weston_compositor *compositor;
-	/* XXX: missing compositor destroy listener
-	 * https://gitlab.freedesktop.org/wayland/weston/issues/298
-	 */
+	struct wl_listener destroy_listener;
 	char *command;
+
+	struct wl_list output_list;
+	struct weston_log_scope *debug;
 };
 
 static void
@@ -446,6 +465,12 @@ shared_output_get_shm_buffer(struct shared_output *so)
 	if (so->shm.width != width ||
 	    so->shm.height != height) {
 
+		/* Nobody is going to release the pending buffer */
+		if (so->pending)
+			ss_shm_buffer_destroy(so->pending);
+		so->pending = NULL;
+		so->front = NULL;
+
 		/* Destroy free buffers */
 		wl_list_for_each_safe(sb, bnext, &so->shm.free_buffers, free_link)
 			ss_shm_buffer_destroy(sb);
@@ -610,6 +635,39 @@ shared_output_ensure_tmp_data(struct shared_output *so,
 	return 0;
 }
 
+static uint64_t
+region_bytes(pixman_region32_t *region)
+{
+	pixman_box32_t *r;
+	uint64_t area = 0;
+	int i, nrects;
+
+	r = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++)
+		area += (uint64_t)(r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+
+	return area * 4;
+}
+
+static void
+ss_shm_buffer_copy_region(struct ss_shm_buffer *dst, struct ss_shm_buffer *src,
+			  int stride, pixman_region32_t *region)
+{
+	pixman_box32_t *r;
+	size_t offset, len;
+	int i, nrects, y;
+
+	r = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++) {
+		len = (r[i].x2 - r[i].x1) * 4;
+		for (y = r[i].y1; y < r[i].y2; y++) {
+			offset = (size_t)y * stride + r[i].x1 * 4;
+			memcpy((uint8_t *)dst->data + offset,
+			       (uint8_t *)src->data + offset, len);
+		}
+	}
+}
+
 static void
 shared_output_update(struct shared_output *so);
 
@@ -632,23 +690,10 @@ static const struct wl_callback_listener shared_output_frame_listener = {
 };
 
 static void
-shared_output_update(struct shared_output *so)
+shared_output_compose_cache(struct shared_output *so, struct ss_shm_buffer *sb)
 {
-	struct ss_shm_buffer *sb;
-	pixman_box32_t *r;
-	int i, nrects;
 	pixman_transform_t transform;
 
-	/* Only update if we need to */
-	if (!so->cache_dirty || so->parent.frame_cb)
-		return;
-
-	sb = shared_output_get_shm_buffer(so);
-	if (sb == NULL) {
-		shared_output_destroy(so);
-		return;
-	}
-
 	output_compute_transform(so->output, &transform);
 	pixman_image_set_transform(so->cache_image, &transform);
 
@@ -675,7 +720,38 @@ shared_output_update(struct shared_output *so)
 	pixman_image_set_transform(sb->pm_image, NULL);
 	pixman_image_set_clip_region32(sb->pm_image, NULL);
 
-	r = pixman_region32_rectangles(&sb->damage, &nrects);
+	so->stats.bytes_copied += region_bytes(&sb->damage);
+}
+
+static void
+shared_output_update(struct shared_output *so)
+{
+	struct ss_shm_buffer *sb;
+	pixman_region32_t *damage;
+	pixman_box32_t *r;
+	int i, nrects;
+
+	/* Only update if we need to */
+	if (!so->cache_dirty || so->parent.frame_cb)
+		return;
+
+	if (so->pending) {
+		/* Filled in place by shared_output_repaint_direct() */
+		sb = so->pending;
+		so->pending = NULL;
+		damage = &so->commit_damage;
+	} else {
+		sb = shared_output_get_shm_buffer(so);
+		if (sb == NULL) {
+			shared_output_destroy(so);
+			return;
+		}
+
+		shared_output_compose_cache(so, sb);
+		damage = &sb->damage;
+	}
+
+	r = pixman_region32_rectangles(damage, &nrects);
 	for (i = 0; i < nrects; ++i)
 		wl_surface_damage(so->parent.surface, r[i].x1, r[i].y1,
 				  r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
@@ -691,8 +767,10 @@ shared_output_update(struct shared_output *so)
 	wl_display_flush(so->parent.display);
 
 	/* Clear the buffer damage */
-	pixman_region32_fini(&sb->damage);
-	pixman_region32_init(&sb->damage);
+	pixman_region32_clear(damage);
+
+	so->front = sb;
+	so->cache_dirty = 0;
 }
 
 static void
@@ -813,6 +891,191 @@ struct zwp_fullscreen_shell_mode_feedback_v1_listener mode_feedback_listener = {
 	mode_feedback_ok,
 };
 
+static void
+shared_output_debug_frame(struct shared_output *so, const char *path,
+			  uint64_t damage, uint64_t bytes_read,
+			  uint64_t bytes_copied)
+{
+	struct weston_log_scope *debug = so->ss->debug;
+
+	if (!weston_log_scope_is_enabled(debug))
+		return;
+
+	weston_log_scope_printf(debug,
+		"[screen-share] %s: frame %"PRIu64" (%s): damage %"PRIu64
+		" bytes, read %"PRIu64", copied %"PRIu64"\n",
+		so->output->name, so->stats.frames, path, damage, bytes_read,
+		bytes_copied);
+}
+
+/* Whether output coordinates are buffer coordinates */
+static bool
+shared_output_can_read_direct(struct shared_output *so)
+{
+	return so->output->transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+	       so->output->current_scale == 1;
+}
+
+/* Hand a half-filled pending buffer back, e.g. when the transform changed */
+static void
+shared_output_drop_pending(struct shared_output *so)
+{
+	struct ss_shm_buffer *sb = so->pending;
+
+	if (!sb)
+		return;
+
+	so->pending = NULL;
+	pixman_region32_union_rect(&sb->damage, &sb->damage, 0, 0,
+				   so->shm.width, so->shm.height);
+	pixman_region32_clear(&so->commit_damage);
+	wl_list_insert(&so->shm.free_buffers, &sb->free_link);
+}
+
+/* Read the region back from the renderer into the shm buffer.
+ *
+ * read_pixels() only produces tightly packed rows. When a rectangle
+ * spans at least half the buffer width, reading its rows in full lets
+ * them land in place in a single copy, at the cost of some pixels which
+ * are read again but are just as current. Narrower rectangles and
+ * y-flipped renderers go through tmp_data and one more copy. */
+static int
+shared_output_read_region(struct shared_output *so, struct ss_shm_buffer *sb,
+			  pixman_region32_t *region)
+{
+	struct weston_renderer *renderer = so->output->compositor->renderer;
+	int stride = so->shm.width * 4;
+	int i, j, nrects, do_yflip, y_orig, src_row;
+	int32_t width, height;
+	pixman_box32_t *r;
+	uint8_t *dst;
+	size_t len;
+
+	if (shared_output_ensure_tmp_data(so, region) < 0)
+		return -1;
+
+	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	r = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		if (!do_yflip && 2 * width >= so->shm.width) {
+			dst = (uint8_t *)sb->data + (size_t)r[i].y1 * stride;
+			if (renderer->read_pixels(so->output, PIXMAN_a8r8g8b8,
+						  dst, 0, r[i].y1,
+						  so->shm.width, height) < 0)
+				return -1;
+
+			so->stats.bytes_read += (uint64_t)stride * height;
+			continue;
+		}
+
+		if (do_yflip)
+			y_orig = so->output->current_mode->height - r[i].y2;
+		else
+			y_orig = r[i].y1;
+
+		if (renderer->read_pixels(so->output, PIXMAN_a8r8g8b8,
+					  so->tmp_data, r[i].x1, y_orig,
+					  width, height) < 0)
+			return -1;
+
+		len = width * 4;
+		for (j = 0; j < height; j++) {
+			src_row = do_yflip ? height - 1 - j : j;
+			dst = (uint8_t *)sb->data +
+			      (size_t)(r[i].y1 + j) * stride + r[i].x1 * 4;
+			memcpy(dst, (uint8_t *)so->tmp_data + src_row * len,
+			       len);
+		}
+
+		so->stats.bytes_read += (uint64_t)len * height;
+		so->stats.bytes_copied += (uint64_t)len * height;
+	}
+
+	return 0;
+}
+
+static int
+shared_output_repaint_direct(struct shared_output *so,
+			     pixman_region32_t *current_damage)
+{
+	struct ss_shm_buffer *sb, *b;
+	pixman_region32_t damage, catch_up;
+	uint64_t read_before = so->stats.bytes_read;
+	uint64_t copied_before = so->stats.bytes_copied;
+	uint64_t damage_bytes;
+	int ret = 0;
+
+	/* Rebuilt from scratch should the transform come back */
+	if (so->cache_image) {
+		pixman_image_unref(so->cache_image);
+		so->cache_image = NULL;
+	}
+
+	if (so->pending && (so->shm.width != so->output->width ||
+			    so->shm.height != so->output->height)) {
+		ss_shm_buffer_destroy(so->pending);
+		so->pending = NULL;
+	}
+
+	sb = so->pending;
+	if (!sb) {
+		sb = shared_output_get_shm_buffer(so);
+		if (!sb)
+			return -1;
+	}
+
+	/* Damage in output coordinates, which are buffer coordinates here */
+	pixman_region32_init(&damage);
+	pixman_region32_intersect(&damage, &so->output->region, current_damage);
+	pixman_region32_translate(&damage, -so->output->x, -so->output->y);
+
+	/* Apply damage to all buffers */
+	wl_list_for_each(b, &so->shm.buffers, link)
+		pixman_region32_union(&b->damage, &b->damage, &damage);
+
+	/* What the buffer missed in earlier frames is in the one the parent
+	 * has, only this frame's damage needs reading back. */
+	pixman_region32_init(&catch_up);
+	pixman_region32_subtract(&catch_up, &sb->damage, &damage);
+	if (pixman_region32_not_empty(&catch_up)) {
+		if (so->front && so->front != sb) {
+			ss_shm_buffer_copy_region(sb, so->front,
+						  so->shm.width * 4, &catch_up);
+			so->stats.bytes_copied += region_bytes(&catch_up);
+		} else {
+			pixman_region32_union(&damage, &damage, &catch_up);
+		}
+	}
+	pixman_region32_fini(&catch_up);
+
+	damage_bytes = region_bytes(&damage);
+	if (shared_output_read_region(so, sb, &damage) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	pixman_region32_clear(&sb->damage);
+	pixman_region32_union(&so->commit_damage, &so->commit_damage, &damage);
+	so->pending = sb;
+	so->cache_dirty = 1;
+
+	so->stats.frames++;
+	so->stats.damage_bytes += damage_bytes;
+	shared_output_debug_frame(so, "direct", damage_bytes,
+				  so->stats.bytes_read - read_before,
+				  so->stats.bytes_copied - copied_before);
+
+	shared_output_update(so);
+
+out:
+	pixman_region32_fini(&damage);
+	return ret;
+}
+
 static void
 shared_output_repainted(struct wl_listener *listener, void *data)
 {
@@ -826,6 +1089,17 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 	pixman_box32_t *r;
 	pixman_image_t *damaged_image;
 	pixman_transform_t transform;
+	uint64_t read_before = so->stats.bytes_read;
+	uint64_t copied_before = so->stats.bytes_copied;
+	uint64_t damage_bytes;
+
+	if (shared_output_can_read_direct(so)) {
+		if (shared_output_repaint_direct(so, current_damage) < 0)
+			shared_output_destroy(so);
+		return;
+	}
+
+	shared_output_drop_pending(so);
 
 	width = so->output->current_mode->width;
 	height = so->output->current_mode->height;
@@ -911,10 +1185,23 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 					 x, y,
 					 width, height);
 		pixman_image_unref(damaged_image);
+
+		so->stats.bytes_read += (uint64_t)width * height * 4;
+		so->stats.bytes_copied += (uint64_t)width * height * 4;
 	}
 
 	so->cache_dirty = 1;
 
+	damage_bytes = region_bytes(&damage);
+	so->stats.frames++;
+	so->stats.damage_bytes += damage_bytes;
+
+	/* The copy into the shm buffer is only counted in the totals, it
+	 * happens whenever the parent asks for the next frame */
+	shared_output_debug_frame(so, "cache", damage_bytes,
+				  so->stats.bytes_read - read_before,
+				  so->stats.bytes_copied - copied_before);
+
 	pixman_region32_fini(&damage);
 	shared_output_update(so);
 
@@ -927,7 +1214,8 @@ err_shared_output:
 }
 
 static struct shared_output *
-shared_output_create(struct weston_output *output, int parent_fd)
+shared_output_create(struct screen_share *ss, struct weston_output *output,
+		     int parent_fd)
 {
 	struct shared_output *so;
 	struct wl_event_loop *loop;
@@ -938,7 +1226,9 @@ shared_output_create(struct weston_output *output, int parent_fd)
 	if (so == NULL)
 		goto err_close;
 
+	so->ss = ss;
 	wl_list_init(&so->seat_list);
+	pixman_region32_init(&so->commit_damage);
 
 	so->parent.display = wl_display_connect_to_fd(parent_fd);
 	if (!so->parent.display)
@@ -1013,6 +1303,7 @@ shared_output_create(struct weston_output *output, int parent_fd)
 
 	so->frame_listener.notify = shared_output_repainted;
 	wl_signal_add(&output->frame_signal, &so->frame_listener);
+	wl_list_insert(&ss->output_list, &so->link);
 	weston_output_disable_planes_incr(output);
 	weston_output_damage(output);
 
@@ -1046,15 +1337,18 @@ shared_output_destroy(struct shared_output *so)
 
 	wl_list_remove(&so->output_destroyed.link);
 	wl_list_remove(&so->frame_listener.link);
+	wl_list_remove(&so->link);
 
-	pixman_image_unref(so->cache_image);
+	if (so->cache_image)
+		pixman_image_unref(so->cache_image);
 	free(so->tmp_data);
+	pixman_region32_fini(&so->commit_damage);
 
 	free(so);
 }
 
 static struct shared_output *
-weston_output_share(struct weston_output *output, const char* command)
+weston_output_share(struct screen_share *ss, struct weston_output *output)
 {
 	int sv[2];
 	char str[32];
@@ -1063,7 +1357,7 @@ weston_output_share(struct weston_output *output, const char* command)
 	char *const argv[] = {
 	  "/bin/sh",
 	  "-c",
-	  (char*)command,
+	  ss->command,
 	  NULL
 	};
 
@@ -1112,7 +1406,7 @@ weston_output_share(struct weston_output *output, const char* command)
 		abort();
 	} else {
 		close(sv[1]);
-		return shared_output_create(output, sv[0]);
+		return shared_output_create(ss, output, sv[0]);
 	}
 
 	return NULL;
@@ -1155,7 +1449,45 @@ share_output_binding(struct weston_keyboard *keyboard,
 		return;
 	}
 
-	weston_output_share(output, ss->command);
+	weston_output_share(ss, output);
+}
+
+static void
+screen_share_debug_subscribe(struct weston_log_subscription *sub, void *data)
+{
+	struct screen_share *ss = data;
+	struct shared_output *so;
+	uint64_t moved;
+
+	wl_list_for_each(so, &ss->output_list, link) {
+		moved = so->stats.bytes_read + so->stats.bytes_copied;
+
+		weston_log_subscription_printf(sub,
+			"%s: %"PRIu64" frames, %"PRIu64" bytes damaged, "
+			"%"PRIu64" read, %"PRIu64" copied, "
+			"%"PRIu64" bytes per frame, %.2f per damaged byte\n",
+			so->output->name, so->stats.frames,
+			so->stats.damage_bytes, so->stats.bytes_read,
+			so->stats.bytes_copied,
+			so->stats.frames ? moved / so->stats.frames : 0,
+			so->stats.damage_bytes ?
+				(double)moved / so->stats.damage_bytes : 0.0);
+	}
+}
+
+static void
+screen_share_destroy(struct wl_listener *listener, void *data)
+{
+	struct screen_share *ss =
+		container_of(listener, struct screen_share, destroy_listener);
+	struct shared_output *so, *tmp;
+
+	wl_list_for_each_safe(so, tmp, &ss->output_list, link)
+		shared_output_destroy(so);
+
+	weston_log_scope_destroy(ss->debug);
+	free(ss->command);
+	free(ss);
 }
 
 WL_EXPORT int
@@ -1170,6 +1502,20 @@ wet_module_init(struct weston_compositor *compositor,
 	if (ss == NULL)
 		return -1;
 	ss->compositor = compositor;
+	wl_list_init(&ss->output_list);
+
+	if (!weston_compositor_add_destroy_listener_once(compositor,
+							 &ss->destroy_listener,
+							 screen_share_destroy)) {
+		free(ss);
+		return 0;
+	}
+
+	ss->debug = weston_compositor_add_log_scope(compositor, "screen-share",
+						    "Bytes read back and copied "
+						    "per shared frame\n",
+						    screen_share_debug_subscribe,
+						    NULL, ss);
 
 	config = wet_get_config(compositor);
 
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2019 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "flight-rec-format.h"
+#include "flight-rec-decode.h"
+
+/** Print a file-backed flight recorder
+ *
+ * @param map the contents of the file
+ * @param file_size the length of \c map in bytes
+ * @param out where the ring goes, oldest data first
+ * @param info if not NULL, where to print the header
+ * @returns 0 on success, -1 if \c map is not a valid flight recorder, with
+ * the reason printed to stderr
+ */
+int
+flight_rec_decode(const uint8_t *map, size_t file_size, FILE *out, FILE *info)
+{
+	const struct flight_rec_header *header = (const void *) map;
+	const uint8_t *ring;
+	uint32_t append_pos;
+
+	if (file_size < sizeof(*header) ||
+	    memcmp(header->magic, FLIGHT_REC_MAGIC, sizeof(header->magic)) != 0) {
+		fprintf(stderr, "not a flight recorder file\n");
+		return -1;
+	}
+
+	if (header->version != FLIGHT_REC_VERSION) {
+		fprintf(stderr, "unsupported flight recorder version %u\n",
+			header->version);
+		return -1;
+	}
+
+	if (header->header_size < sizeof(*header) ||
+	    header->header_size > file_size ||
+	    header->size > file_size - header->header_size) {
+		fprintf(stderr, "flight recorder file is truncated\n");
+		return -1;
+	}
+
+	ring = map + header->header_size;
+	append_pos = header->append_pos;
+	if (append_pos >= header->size) {
+		fprintf(stderr, "flight recorder position %u out of range\n",
+			append_pos);
+		return -1;
+	}
+
+	if (info)
+		fprintf(info, "pid %u, ring of %u bytes, at byte %u%s\n",
+			header->pid, header->size, append_pos,
+			header->overlap ? ", wrapped around" : "");
+
+	if (header->overlap)
+		fwrite(ring + append_pos, 1, header->size - append_pos, out);
+	fwrite(ring, 1, append_pos, out);
+
+	return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2019 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _FLIGHT_REC_FORMAT_H_
+#define _FLIGHT_REC_FORMAT_H_
+
+#include <stdint.h>
+
+/*
+ * Layout of a file-backed flight recorder, see
+ * weston_log_subscriber_create_flight_rec_file(). The file starts with
+ * this header, followed by the ring itself at header_size bytes.
+ *
+ * The compositor updates append_pos and overlap right after every copy
+ * into the ring, so whatever was written before the compositor died can be
+ * decoded from the file afterwards.
+ */
+
+#define FLIGHT_REC_MAGIC	"WFLTREC"
+#define FLIGHT_REC_VERSION	1
+
+struct flight_rec_header {
+	char magic[8];		/**< FLIGHT_REC_MAGIC, NUL terminated */
+	uint32_t version;	/**< FLIGHT_REC_VERSION */
+	uint32_t header_size;	/**< offset of the ring in the file */
+	uint32_t size;		/**< length of the ring in bytes */
+	uint32_t append_pos;	/**< where the next byte would go */
+	uint32_t overlap;	/**< non-zero once the ring wrapped around */
+	uint32_t pid;		/**< of the compositor that wrote the file */
+};
+
+#endif /* _FLIGHT_REC_FORMAT_H_ */
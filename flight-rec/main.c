@@ -0,0 +1,104 @@
+/*
+ * Copyright © 2019 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "flight-rec-decode.h"
+
+static void
+usage(int exit_code)
+{
+	fprintf(stderr, "usage: flight-rec-decode [--help] [--info] "
+		"<flight recorder file>\n\n"
+		"\t--help\t\tthis help text\n"
+		"\t--info\t\tprint the file header to stderr\n\n"
+		"Prints the contents of a file-backed weston flight recorder\n"
+		"to stdout, oldest data first.\n");
+
+	exit(exit_code);
+}
+
+int main(int argc, char *argv[])
+{
+	struct stat st;
+	void *map;
+	int i, j, fd, ret, info = 0;
+
+	for (i = 1, j = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--help") == 0) {
+			usage(EXIT_SUCCESS);
+		} else if (strcmp(argv[i], "--info") == 0) {
+			info = 1;
+		} else if (strcmp(argv[i], "--") == 0) {
+			break;
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr,
+				"unknown option or invalid argument: %s\n", argv[i]);
+			usage(EXIT_FAILURE);
+		} else {
+			argv[j++] = argv[i];
+		}
+	}
+	argc = j;
+
+	if (argc != 2)
+		usage(EXIT_FAILURE);
+
+	fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "opening %s failed: %s\n",
+			argv[1], strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		fprintf(stderr, "%s is empty or unreadable\n", argv[1]);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "mapping %s failed: %s\n",
+			argv[1], strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	ret = flight_rec_decode(map, st.st_size, stdout, info ? stderr : NULL);
+	munmap(map, st.st_size);
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
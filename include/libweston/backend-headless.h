@@ -37,7 +37,7 @@ extern "C" {
 #include <libweston/backend-drm.h>
 #include <libweston/plugin-registry.h>
 
-#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 2
+#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 4
 
 struct weston_headless_backend_config {
 	struct weston_backend_config base;
@@ -62,6 +62,21 @@ struct weston_headless_backend_config {
 	 */
 	void (*configure_device)(struct weston_compositor *compositor,
 				 struct libinput_device *device);
+
+	/** Refresh rate of the outputs in mHz, 0 for the default of 60 Hz */
+	int refresh;
+
+	/** Whether to present every frame as soon as it was repainted,
+	 * rather than at the refresh rate, e.g. to measure throughput. */
+	bool unthrottled;
+
+	/** Whether to run on a virtual presentation clock, which only
+	 * advances through weston_headless_clock_api. */
+	bool virtual_clock;
+
+	/** Lowest refresh rate in mHz of outputs with variable refresh rate,
+	 * up to the refresh rate, 0 for a fixed one. */
+	int vrr_min_refresh;
 };
 
 #define WESTON_HEADLESS_VIRTUAL_OUTPUT_API_NAME "weston_headless_virtual_output_api_v1"
@@ -76,6 +91,35 @@ weston_headless_virtual_output_get_api(struct weston_compositor *compositor)
 	return (const struct weston_drm_virtual_output_api *)api;
 }
 
+#define WESTON_HEADLESS_CLOCK_API_NAME "weston_headless_clock_api_v1"
+
+/** Control of the virtual presentation clock
+ *
+ * Only available with weston_headless_backend_config::virtual_clock.
+ */
+struct weston_headless_clock_api {
+	/** Advance the virtual presentation clock
+	 *
+	 * Outputs whose vblank was reached present their frame, with the
+	 * vblank time as the presentation time. Then the outputs whose
+	 * repaint became due repaint, before this returns.
+	 *
+	 * \param compositor The compositor instance.
+	 * \param nsec How far to advance the clock, not negative.
+	 */
+	void (*advance)(struct weston_compositor *compositor, int64_t nsec);
+};
+
+static inline const struct weston_headless_clock_api *
+weston_headless_clock_get_api(struct weston_compositor *compositor)
+{
+	const void *api;
+	api = weston_plugin_api_get(compositor,
+				    WESTON_HEADLESS_CLOCK_API_NAME,
+				    sizeof(struct weston_headless_clock_api));
+	return (const struct weston_headless_clock_api *)api;
+}
+
 #ifdef  __cplusplus
 }
 #endif
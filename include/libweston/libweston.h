@@ -224,6 +224,10 @@ struct weston_head {
 	bool connected;			/**< is physically connected */
 	bool non_desktop;		/**< non-desktop display, e.g. HMD */
 
+	/** Variable refresh rate range in mHz, both 0 without VRR */
+	int32_t vrr_min_refresh;
+	int32_t vrr_max_refresh;
+
 	/** Current content protection status */
 	enum weston_hdcp_protection current_protection;
 };
@@ -290,6 +294,16 @@ struct weston_output {
 	int disable_planes;
 	int destroying;
 	struct wl_list feedback_list;
+	struct weston_repaint_stats *repaint_stats;
+	struct weston_repaint_predictor *repaint_predictor;
+
+	/** Variable refresh rate: whether the output may use it, whether
+	 *  the frames currently follow a fullscreen client with it, and
+	 *  whether the repaint scheduled only repeats the last frame */
+	bool vrr_allowed;
+	bool vrr_active;
+	bool vrr_repeat;
+	struct weston_vrr_scheduler *vrr_scheduler;
 
 	uint32_t transform;
 	int32_t native_scale;
@@ -514,6 +528,14 @@ struct weston_pointer {
 	struct wl_listener output_destroy_listener;
 
 	struct wl_list timestamps_list;
+
+	/* Motion held back until the next frame, see
+	 * weston_compositor::coalesce_pointer_motion */
+	bool motion_pending;
+	bool motion_frame_pending;
+	struct weston_pointer_motion_event pending_motion;
+	struct timespec pending_motion_time;
+	struct wl_event_source *motion_flush_timer;
 };
 
 /** libinput style calibration matrix
@@ -797,6 +819,8 @@ struct weston_seat {
 
 	struct input_method *input_method;
 	char *seat_name;
+
+	struct weston_input_latency *input_latency;
 };
 
 enum {
@@ -891,6 +915,17 @@ struct weston_renderer {
 			       uint32_t width, uint32_t height);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage);
+
+	/** Composite an output ahead of its repaint_output(), optional
+	 *
+	 * Called from a worker thread, concurrently for different outputs,
+	 * while the scene graph does not change. It must not touch anything
+	 * but the output's own renderer state. The repaint_output() call
+	 * that follows for the same damage only completes the frame.
+	 */
+	void (*prerender_output)(struct weston_output *output,
+				 pixman_region32_t *output_damage);
+
 	void (*flush_damage)(struct weston_surface *surface);
 	void (*attach)(struct weston_surface *es, struct weston_buffer *buffer);
 	void (*surface_set_color)(struct weston_surface *surface,
@@ -1057,6 +1092,7 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;	/* struct weston_layer::link */
 	struct wl_list view_list;	/* struct weston_view::link */
+	bool view_list_needs_rebuild;
 	struct wl_list plane_list;
 	struct wl_list key_binding_list;
 	struct wl_list modifier_binding_list;
@@ -1070,6 +1106,7 @@ struct weston_compositor {
 	uint32_t idle_inhibit;
 	int idle_time;			/* timeout, s */
 	struct wl_event_source *repaint_timer;
+	int repaint_timer_fd;
 
 	const struct weston_pointer_grab_interface *default_pointer_grab;
 
@@ -1113,6 +1150,38 @@ struct weston_compositor {
 	/* Whether to let the compositor run without any input device. */
 	bool require_input;
 
+	/* Whether to merge pointer motion events and deliver them at most
+	 * once per output frame, or before the next button, axis or key
+	 * event. */
+	bool coalesce_pointer_motion;
+
+	/* Whether the libinput based backends read input devices from a
+	 * thread of their own, so that slow repaints do not make the
+	 * kernel drop input events. */
+	bool input_thread;
+
+	/* The largest selection the clipboard keeps after its client went
+	 * away, in bytes; 0 for no limit. */
+	size_t clipboard_size_limit;
+
+	/* Whether each output starts repainting as late before vblank as
+	 * its recent repaints allow, rather than repaint_msec before. */
+	bool adaptive_repaint_window;
+
+	/* Whether the outputs due at the same time are composited in
+	 * parallel, for renderers that support it. */
+	bool parallel_repaint;
+	struct weston_worker_pool *repaint_pool;
+
+	/* The number of threads the pixman renderer splits the compositing
+	 * of an output across, the compositor's own included. */
+	int renderer_threads;
+
+	/* How many repaints back the GL renderer remembers the damage of
+	 * each output, to repaint buffers up to that old only partially.
+	 * 0 leaves it to the renderer. */
+	int renderer_damage_history;
+
 	/* Signal for a backend to inform a frontend about possible changes
 	 * in head status.
 	 */
@@ -1129,6 +1198,7 @@ struct weston_compositor {
 	struct weston_log_context *weston_log_ctx;
 	struct weston_log_scope *debug_scene;
 	struct weston_log_scope *timeline;
+	struct weston_log_scope *repaint_stats;
 
 	struct content_protection *content_protection;
 };
@@ -2058,6 +2128,9 @@ void
 weston_output_allow_protection(struct weston_output *output,
 			       bool allow_protection);
 
+void
+weston_output_allow_vrr(struct weston_output *output, bool allow_vrr);
+
 int
 weston_compositor_enable_touch_calibrator(struct weston_compositor *compositor,
 				weston_touch_calibration_save_func save);
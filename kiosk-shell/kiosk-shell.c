@@ -412,6 +412,71 @@ kiosk_shell_background_surface_get_label(struct weston_surface *surface,
 	return snprintf(buf, len, "kiosk shell background surface");
 }
 
+static bool
+kiosk_shell_output_is_covered(struct kiosk_shell_output *shoutput)
+{
+	struct weston_output *output = shoutput->output;
+	struct weston_view *view;
+	pixman_region32_t *region;
+
+	wl_list_for_each(view, &shoutput->shell->normal_layer.view_list.link,
+			 layer_link.link) {
+		if (view->alpha < 1.0)
+			continue;
+
+		weston_view_update_transform(view);
+		if (view->output != output)
+			continue;
+
+		if (view->surface->is_opaque)
+			region = &view->transform.boundingbox;
+		else
+			region = &view->transform.opaque;
+
+		if (pixman_region32_contains_rectangle(region,
+						       &output->region.extents) ==
+		    PIXMAN_REGION_IN)
+			return true;
+	}
+
+	return false;
+}
+
+/* While an opaque app covers the whole output, none of the background
+ * shows. Taking it out of the scene leaves the app and whatever pops up
+ * over it as the only views on the output, so that the backend can scan
+ * the app buffer out without compositing anything. */
+static void
+kiosk_shell_output_update_background(struct kiosk_shell_output *shoutput)
+{
+	struct weston_view *background_view = shoutput->background_view;
+	bool covered, shown;
+
+	if (!shoutput->output || !background_view)
+		return;
+
+	covered = kiosk_shell_output_is_covered(shoutput);
+	shown = background_view->layer_link.layer != NULL;
+
+	if (covered && shown) {
+		weston_layer_entry_remove(&background_view->layer_link);
+	} else if (!covered && !shown) {
+		weston_layer_entry_insert(&shoutput->shell->background_layer.view_list,
+					  &background_view->layer_link);
+		weston_view_geometry_dirty(background_view);
+		weston_surface_damage(background_view->surface);
+	}
+}
+
+static void
+kiosk_shell_update_backgrounds(struct kiosk_shell *shell)
+{
+	struct kiosk_shell_output *shoutput;
+
+	wl_list_for_each(shoutput, &shell->output_list, link)
+		kiosk_shell_output_update_background(shoutput);
+}
+
 static void
 kiosk_shell_output_recreate_background(struct kiosk_shell_output *shoutput)
 {
@@ -443,6 +508,8 @@ kiosk_shell_output_recreate_background(struct kiosk_shell_output *shoutput)
 	shoutput->background_view->surface->is_mapped = true;
 	shoutput->background_view->surface->output = output;
 	weston_view_set_output(shoutput->background_view, output);
+
+	kiosk_shell_output_update_background(shoutput);
 }
 
 static void
@@ -619,6 +686,7 @@ desktop_surface_removed(struct weston_desktop_surface *desktop_surface,
 	}
 
 	kiosk_shell_surface_destroy(shsurf);
+	kiosk_shell_update_backgrounds(shell);
 }
 
 static void
@@ -683,6 +751,8 @@ desktop_surface_committed(struct weston_desktop_surface *desktop_surface,
 
 	shsurf->last_width = surface->width;
 	shsurf->last_height = surface->height;
+
+	kiosk_shell_update_backgrounds(shsurf->shell);
 }
 
 static void
@@ -961,12 +1031,13 @@ kiosk_shell_handle_output_moved(struct wl_listener *listener, void *data)
 	struct kiosk_shell *shell =
 		container_of(listener, struct kiosk_shell, output_moved_listener);
 	struct weston_output *output = data;
+	struct kiosk_shell_output *shoutput =
+		kiosk_shell_find_shell_output(shell, output);
 	struct weston_view *view;
 
-	wl_list_for_each(view, &shell->background_layer.view_list.link,
-			 layer_link.link) {
-		if (view->output != output)
-			continue;
+	/* The background may be hidden, so not on its layer */
+	if (shoutput && shoutput->background_view) {
+		view = shoutput->background_view;
 		weston_view_set_position(view,
 					 view->geometry.x + output->move_x,
 					 view->geometry.y + output->move_y);
@@ -46,6 +46,7 @@
 #include "shared/timespec-util.h"
 #include "backend.h"
 #include "libweston-internal.h"
+#include "capture-sink.h"
 #include <lg-remote-server-protocol.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
@@ -58,7 +59,6 @@ struct weston_remoting {
 	const struct weston_drm_virtual_output_api *virtual_output_api;
 
 	struct wl_list resource_list;
-	int fd;
 	struct weston_buffer *buffer;
 };
 
@@ -72,32 +72,15 @@ struct remoted_output {
 	struct weston_head *head;
 
 	struct weston_remoting *remoting;
-	struct wl_event_source *finish_frame_timer;
+	struct weston_capture_sink *sink;
 	struct wl_list link;
-	bool submitted_frame;
-	int fence_sync_fd;
-	struct wl_event_source *fence_sync_event_source;
 
 	int retry_count;
 };
 
-struct mem_free_cb_data {
-	struct remoted_output *output;
-	void *output_buffer;
-};
-
 static int
 remoting_output_disable(struct weston_output *output);
 
-static void
-remoting_output_buffer_release(struct remoted_output *output, void *buffer)
-{
-	const struct weston_drm_virtual_output_api *api
-		= output->remoting->virtual_output_api;
-
-	api->buffer_released(buffer);
-}
-
 static void
 remoting_output_destroy(struct weston_output *output);
 
@@ -131,29 +114,15 @@ weston_remoting_get(struct weston_compositor *compositor)
 	return remoting;
 }
 
-static int
-remoting_output_finish_frame_handler(void *data)
+static void
+remoting_output_frame_finished(void *data)
 {
 	struct remoted_output *output = data;
-	const struct weston_drm_virtual_output_api *api
-		= output->remoting->virtual_output_api;
-	struct timespec now;
-	int64_t msec;
 	struct wl_resource *resource;
 
-	if (output->submitted_frame) {
-		struct weston_compositor *c = output->remoting->compositor;
-		output->submitted_frame = false;
-		weston_compositor_read_presentation_clock(c, &now);
-		api->finish_frame(output->output, &now, 0);
-		wl_resource_for_each(resource, &output->remoting->resource_list) {
-			lg_remote_send_frame_done(resource);
-		}
+	wl_resource_for_each(resource, &output->remoting->resource_list) {
+		lg_remote_send_frame_done(resource);
 	}
-
-	msec = millihz_to_nsec(output->output->current_mode->refresh) / 1000000;
-	wl_event_source_timer_update(output->finish_frame_timer, msec);
-	return 0;
 }
 
 static struct remoted_output *
@@ -178,95 +147,83 @@ lookup_remoted_output(struct weston_output *output)
 
 
 static int
-remoting_output_fence_sync_handler(int fd, uint32_t mask, void *data)
+remoting_output_frame_ready(struct weston_capture_frame *frame, void *data)
 {
-	struct mem_free_cb_data *cb_data = data;
-	struct remoted_output *output = cb_data->output;
+	struct remoted_output *output = data;
 	struct weston_remoting *remoting = output->remoting;
 	struct wl_resource *resource;
-	void *frame;
-	int size = output->output->current_mode->width*output->output->current_mode->height*4;
+	struct wl_shm_buffer *shm_buffer;
+	void *map = MAP_FAILED;
+	size_t size = (size_t)frame->stride * frame->height;
+	size_t row = (size_t)frame->width * 4;
 	struct dma_buf_sync sync;
-	uint8_t *d;
-
-	if(remoting->buffer) {
-		d = wl_shm_buffer_get_data(remoting->buffer->shm_buffer);
-		wl_shm_buffer_begin_access(remoting->buffer->shm_buffer);
-
-		frame = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
-				remoting->fd, 0);
-
-		if(frame) {
+	uint8_t *d, *s;
+	int32_t shm_stride;
+	int y;
+
+	if (remoting->buffer) {
+		shm_buffer = remoting->buffer->shm_buffer;
+		d = wl_shm_buffer_get_data(shm_buffer);
+		shm_stride = wl_shm_buffer_get_stride(shm_buffer);
+		wl_shm_buffer_begin_access(shm_buffer);
+
+		/* The dma-buf stride may be padded past width * 4, so copy
+		 * only the visible part of each row, and only into a buffer
+		 * that can hold it. */
+		if (shm_stride < 0 || (size_t)shm_stride < row ||
+		    wl_shm_buffer_get_height(shm_buffer) < frame->height)
+			weston_log("%s: buffer too small for a %dx%d frame\n",
+				   __func__, frame->width, frame->height);
+		else
+			map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, frame->fd, 0);
+
+		if (map != MAP_FAILED) {
 			sync.flags = DMA_BUF_SYNC_START;
 			sync.flags |= DMA_BUF_SYNC_READ;
-			ioctl(remoting->fd, DMA_BUF_IOCTL_SYNC, &sync);
+			ioctl(frame->fd, DMA_BUF_IOCTL_SYNC, &sync);
 
-			memcpy(d, frame, size);
+			s = map;
+			for (y = 0; y < frame->height; y++) {
+				memcpy(d, s, row);
+				d += shm_stride;
+				s += frame->stride;
+			}
 
 			sync.flags = DMA_BUF_SYNC_END;
-			ioctl(remoting->fd, DMA_BUF_IOCTL_SYNC, &sync);
+			ioctl(frame->fd, DMA_BUF_IOCTL_SYNC, &sync);
 
-			munmap(frame, size);
+			munmap(map, size);
 		}
 		wl_resource_for_each(resource, &remoting->resource_list) {
 			lg_remote_send_done(resource);
 		}
-		wl_shm_buffer_end_access(remoting->buffer->shm_buffer);
+		wl_shm_buffer_end_access(shm_buffer);
 		wl_resource_destroy(remoting->buffer->resource);
 		remoting->buffer = NULL;
 	}
 
-	output->submitted_frame = true;
-	wl_event_source_remove(output->fence_sync_event_source);
-	close(output->fence_sync_fd);
-	close(remoting->fd);
-
-	remoting_output_buffer_release(output, cb_data->output_buffer);
-	free(cb_data);
+	weston_capture_frame_release(frame);
 
 	return 0;
 }
 
+static const struct weston_capture_sink_interface remoting_sink_impl = {
+	remoting_output_frame_ready,
+	remoting_output_frame_finished,
+};
+
 static int
 remoting_output_frame(struct weston_output *output_base, int fd, int stride,
 		      void *output_buffer)
 {
 	struct remoted_output *output = lookup_remoted_output(output_base);
-	struct weston_remoting *remoting;
-	const struct weston_drm_virtual_output_api *api;
-	struct wl_event_loop *loop;
-	struct mem_free_cb_data *cb_data;
 
 	if (!output)
 		return -1;
 
-	remoting = output->remoting;
-	api = remoting->virtual_output_api;
-
-	cb_data = zalloc(sizeof *cb_data);
-	if (!cb_data)
-		return -1;
-
-	cb_data->output = output;
-	cb_data->output_buffer = output_buffer;
-
-	remoting->fd = fd;
-	output->fence_sync_fd = api->get_fence_sync_fd(output->output);
-	if (output->fence_sync_fd == -1) {
-		output->submitted_frame = true;
-		close(fd);
-		free(cb_data);
-		return 0;
-	}
-
-
-	loop = wl_display_get_event_loop(remoting->compositor->wl_display);
-	output->fence_sync_event_source =
-		wl_event_loop_add_fd(loop, output->fence_sync_fd,
-				     WL_EVENT_READABLE,
-				     remoting_output_fence_sync_handler,
-				     cb_data);
-	return 0;
+	return weston_capture_sink_submit_frame(output->sink, fd, stride,
+						output_buffer);
 }
 
 static void
@@ -296,7 +253,6 @@ static int
 remoting_output_start_repaint_loop(struct weston_output *output)
 {
 	struct remoted_output *remoted_output = lookup_remoted_output(output);
-	int64_t msec;
 
 	if(!remoted_output) {
 		return -1;
@@ -304,9 +260,7 @@ remoting_output_start_repaint_loop(struct weston_output *output)
 
 	remoted_output->saved_start_repaint_loop(output);
 
-	msec = millihz_to_nsec(remoted_output->output->current_mode->refresh)
-			/ 1000000;
-	wl_event_source_timer_update(remoted_output->finish_frame_timer, msec);
+	weston_capture_sink_start_repaint_loop(remoted_output->sink);
 
 	return 0;
 }
@@ -315,8 +269,6 @@ static int
 remoting_output_enable(struct weston_output *output)
 {
 	struct remoted_output *remoted_output = lookup_remoted_output(output);
-	struct weston_compositor *c = output->compositor;
-	struct wl_event_loop *loop;
 	int ret;
 
 	if(!remoted_output) {
@@ -325,19 +277,22 @@ remoting_output_enable(struct weston_output *output)
 	const struct weston_drm_virtual_output_api *api = remoted_output->remoting->virtual_output_api;
 	api->set_submit_frame_cb(output, remoting_output_frame);
 
+	remoted_output->sink = weston_capture_sink_create(output, api,
+							  &remoting_sink_impl,
+							  remoted_output);
+	if (!remoted_output->sink)
+		return -1;
+
 	ret = remoted_output->saved_enable(output);
-	if (ret < 0)
+	if (ret < 0) {
+		weston_capture_sink_destroy(remoted_output->sink);
+		remoted_output->sink = NULL;
 		return ret;
+	}
 
 	remoted_output->saved_start_repaint_loop = output->start_repaint_loop;
 	output->start_repaint_loop = remoting_output_start_repaint_loop;
 
-	loop = wl_display_get_event_loop(c->wl_display);
-	remoted_output->finish_frame_timer =
-		wl_event_loop_add_timer(loop,
-					remoting_output_finish_frame_handler,
-					remoted_output);
-
 	return 0;
 }
 
@@ -350,7 +305,8 @@ remoting_output_disable(struct weston_output *output)
 		return -1;
 	}
 
-	wl_event_source_remove(remoted_output->finish_frame_timer);
+	weston_capture_sink_destroy(remoted_output->sink);
+	remoted_output->sink = NULL;
 
 	return remoted_output->saved_disable(output);
 }
@@ -245,6 +245,10 @@ drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 		return -1;
 	}
 
+	memset(output->gbm_surface_fbs, 0, sizeof output->gbm_surface_fbs);
+	output->gbm_emulate_buffer_age = true;
+	output->gbm_repaint_full = false;
+
 	drm_output_init_cursor_egl(output, b);
 
 	return 0;
@@ -266,6 +270,7 @@ drm_output_fini_egl(struct drm_output *output)
 	gl_renderer->output_destroy(&output->base);
 	gbm_surface_destroy(output->gbm_surface);
 	output->gbm_surface = NULL;
+	memset(output->gbm_surface_fbs, 0, sizeof output->gbm_surface_fbs);
 	drm_output_fini_cursor_egl(output);
 }
 
@@ -289,13 +294,104 @@ drm_eotf_to_weston_eotf(uint32_t drm_eotf) {
 	return WESTON_EOTF_TRADITIONAL_GAMMA_SDR;
 }
 
+/* GBM hands out the free buffer of the surface that was rendered to the
+ * longest ago, and never used ones only when all the others are busy.
+ * Returns that buffer if it is one seen before. */
+static struct drm_fb *
+drm_output_predict_gbm_fb(struct drm_output *output)
+{
+	struct drm_fb *oldest = NULL;
+	struct drm_fb *fb;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(output->gbm_surface_fbs); i++) {
+		fb = output->gbm_surface_fbs[i];
+		if (!fb || fb->refcnt > 0)
+			continue;
+		if (!oldest || fb->gbm_render_seq < oldest->gbm_render_seq)
+			oldest = fb;
+	}
+
+	return oldest;
+}
+
+static void
+drm_output_add_gbm_fb(struct drm_output *output, struct drm_fb *fb)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(output->gbm_surface_fbs); i++) {
+		if (output->gbm_surface_fbs[i] == fb)
+			return;
+		if (!output->gbm_surface_fbs[i]) {
+			output->gbm_surface_fbs[i] = fb;
+			return;
+		}
+	}
+}
+
+/* Renders, telling the renderer the age of the buffer it renders to if
+ * EGL cannot. Should GBM not return the buffer expected, the renderer
+ * may have repainted only part of one with other content. That frame is
+ * shown all the same, rather than rendering it twice, and the next one
+ * is repainted in full, see drm_output_update_complete(). */
+static struct drm_fb *
+drm_output_render_gl_aged(struct drm_output *output, pixman_region32_t *damage)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct weston_renderer *renderer = output->base.compositor->renderer;
+	struct drm_fb *predicted = NULL;
+	struct gbm_bo *bo;
+	struct drm_fb *fb;
+	int age = 0;
+
+	if (output->gbm_emulate_buffer_age) {
+		predicted = drm_output_predict_gbm_fb(output);
+		if (predicted)
+			age = output->gbm_render_seq + 1 -
+			      predicted->gbm_render_seq;
+		if (!gl_renderer->output_set_buffer_age(&output->base, age)) {
+			output->gbm_emulate_buffer_age = false;
+			predicted = NULL;
+		}
+	}
+
+	renderer->repaint_output(&output->base, damage);
+
+	bo = gbm_surface_lock_front_buffer(output->gbm_surface);
+	if (!bo) {
+		weston_log("failed to lock front buffer: %s\n",
+			   strerror(errno));
+		return NULL;
+	}
+
+	/* The renderer always produces an opaque image. */
+	fb = drm_fb_get_from_bo(bo, b, true, BUFFER_GBM_SURFACE);
+	if (!fb) {
+		weston_log("failed to get drm_fb for bo\n");
+		gbm_surface_release_buffer(output->gbm_surface, bo);
+		return NULL;
+	}
+	fb->gbm_surface = output->gbm_surface;
+
+	if (predicted && fb != predicted) {
+		weston_log("Output %s: GBM returned buffers out of the "
+			   "expected order, repainting it in full from now "
+			   "on.\n", output->base.name);
+		output->gbm_emulate_buffer_age = false;
+		output->gbm_repaint_full = true;
+	}
+
+	fb->gbm_render_seq = ++output->gbm_render_seq;
+	drm_output_add_gbm_fb(output, fb);
+
+	return fb;
+}
+
 struct drm_fb *
 drm_output_render_gl(struct drm_output_state *state, pixman_region32_t *damage)
 {
 	struct drm_output *output = state->output;
-	struct drm_backend *b = to_drm_backend(output->base.compositor);
-	struct gbm_bo *bo;
-	struct drm_fb *ret;
 	struct weston_head *w_head = weston_output_get_first_head(&output->base);
 	struct drm_head *head = to_drm_head(w_head);
 	struct hdr_metadata_infoframe *dmd = &head->color_state.o_md;
@@ -319,26 +415,7 @@ drm_output_render_gl(struct drm_output_state *state, pixman_region32_t *damage)
 		renderer->set_output_hdr_metadata(&output->base, NULL);
 	}
 
-	output->base.compositor->renderer->repaint_output(&output->base,
-							  damage);
-
-	bo = gbm_surface_lock_front_buffer(output->gbm_surface);
-	if (!bo) {
-		weston_log("failed to lock front buffer: %s\n",
-			   strerror(errno));
-		return NULL;
-	}
-
-	/* The renderer always produces an opaque image. */
-	ret = drm_fb_get_from_bo(bo, b, true, BUFFER_GBM_SURFACE);
-	if (!ret) {
-		weston_log("failed to get drm_fb for bo\n");
-		gbm_surface_release_buffer(output->gbm_surface, bo);
-		return NULL;
-	}
-	ret->gbm_surface = output->gbm_surface;
-
-	return ret;
+	return drm_output_render_gl_aged(output, damage);
 }
 
 static void
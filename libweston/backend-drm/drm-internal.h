@@ -238,6 +238,7 @@ enum wdrm_connector_property {
 	WDRM_CONNECTOR_HDR_METADATA,
 	WDRM_CONNECTOR_PANEL_ORIENTATION,
 	WDRM_CONNECTOR_OUTPUT_COLORSPACE,
+	WDRM_CONNECTOR_VRR_CAPABLE,
 	WDRM_CONNECTOR__COUNT
 };
 
@@ -276,6 +277,7 @@ enum wdrm_panel_orientation {
 enum wdrm_crtc_property {
 	WDRM_CRTC_MODE_ID = 0,
 	WDRM_CRTC_ACTIVE,
+	WDRM_CRTC_VRR_ENABLED,
 	WDRM_CRTC__COUNT
 };
 
@@ -338,6 +340,7 @@ struct drm_backend {
 	bool fb_modifiers;
 
 	struct weston_log_scope *debug;
+	struct weston_log_scope *recorder_debug;
 };
 
 struct drm_mode {
@@ -375,6 +378,8 @@ struct drm_fb {
 	/* Used by gbm fbs */
 	struct gbm_bo *bo;
 	struct gbm_surface *gbm_surface;
+	/* the output repaint that last rendered to a gbm surface fb */
+	uint64_t gbm_render_seq;
 
 	/* Used by dumb fbs */
 	void *map;
@@ -385,6 +390,9 @@ struct drm_edid {
 	char monitor_name[13];
 	char pnp_id[5];
 	char serial_number[13];
+	/* vertical rate range limits in Hz, 0 if not given */
+	int vrr_min_hz;
+	int vrr_max_hz;
 };
 
 /**
@@ -414,6 +422,7 @@ struct drm_output_state {
 	struct wl_list link;
 	enum dpms_enum dpms;
 	enum weston_hdcp_protection protection;
+	bool vrr_enabled;
 	struct wl_list plane_list;
 };
 
@@ -581,6 +590,14 @@ struct drm_output {
 	uint32_t gbm_format;
 	uint32_t gbm_bo_flags;
 
+	/* The buffers of gbm_surface seen so far, for telling the renderer
+	 * their age when EGL does not */
+	struct drm_fb *gbm_surface_fbs[4];
+	uint64_t gbm_render_seq;
+	bool gbm_emulate_buffer_age;
+	/* the last frame went to another buffer than its age was for */
+	bool gbm_repaint_full;
+
 	/* Plane being displayed directly on the CRTC */
 	struct drm_plane *scanout_plane;
 
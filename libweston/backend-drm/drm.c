@@ -61,6 +61,7 @@
 #include "libinput-seat.h"
 #include "launcher-util.h"
 #include "vaapi-recorder.h"
+#include "recorder-queue.h"
 #include "presentation-time-server-protocol.h"
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
@@ -326,6 +327,12 @@ drm_output_update_complete(struct drm_output *output, uint32_t flags,
 	 * repaint needed flag is cleared just after that */
 	if (output->recorder)
 		weston_output_schedule_repaint(&output->base);
+
+	/* Same here, for a frame rendered with the wrong buffer age */
+	if (output->gbm_repaint_full) {
+		output->gbm_repaint_full = false;
+		weston_output_damage(&output->base);
+	}
 }
 
 static struct drm_fb *
@@ -480,6 +487,8 @@ drm_output_repaint(struct weston_output *output_base,
 	else
 		state->protection = WESTON_HDCP_DISABLE;
 
+	state->vrr_enabled = output_base->vrr_active;
+
 	drm_output_render(state, damage);
 	scanout_state = drm_output_state_get_plane(state,
 						   output->scanout_plane);
@@ -2442,6 +2451,8 @@ drm_destroy(struct weston_compositor *ec)
 
 	weston_log_scope_destroy(b->debug);
 	b->debug = NULL;
+	weston_log_scope_destroy(b->recorder_debug);
+	b->recorder_debug = NULL;
 	weston_compositor_shutdown(ec);
 
 	wl_list_for_each_safe(base, next, &ec->head_list, compositor_link)
@@ -2728,9 +2739,62 @@ planes_binding(struct weston_keyboard *keyboard, const struct timespec *time,
 }
 
 #ifdef BUILD_VAAPI_RECORDER
+static void
+recorder_print_stats(struct drm_output *output,
+		     struct weston_log_subscription *sub)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct recorder_queue_stats stats;
+	uint64_t latency_avg = 0, encode_avg = 0;
+	char *str;
+
+	vaapi_recorder_get_stats(output->recorder, &stats);
+
+	if (stats.frames_encoded > 0) {
+		latency_avg = stats.queue_latency_sum_ns / stats.frames_encoded;
+		encode_avg = stats.encode_time_sum_ns / stats.frames_encoded;
+	}
+
+	if (asprintf(&str, "[libva recorder] %s: submitted %"PRIu64", "
+		     "encoded %"PRIu64", dropped %"PRIu64", "
+		     "coalesced %"PRIu64", queue latency avg %"PRIu64" us "
+		     "max %"PRIu64" us, encode avg %"PRIu64" us "
+		     "max %"PRIu64" us\n",
+		     output->base.name, stats.frames_submitted,
+		     stats.frames_encoded, stats.frames_dropped,
+		     stats.frames_coalesced, latency_avg / 1000,
+		     stats.queue_latency_max_ns / 1000, encode_avg / 1000,
+		     stats.encode_time_max_ns / 1000) < 0)
+		return;
+
+	if (sub)
+		weston_log_subscription_printf(sub, "%s", str);
+	else
+		weston_log_scope_printf(b->recorder_debug, "%s", str);
+
+	free(str);
+}
+
+static void
+recorder_debug_subscribe(struct weston_log_subscription *sub, void *data)
+{
+	struct drm_backend *b = data;
+	struct drm_output *output;
+
+	wl_list_for_each(output, &b->compositor->output_list, base.link) {
+		if (output->recorder)
+			recorder_print_stats(output, sub);
+	}
+}
+
 static void
 recorder_destroy(struct drm_output *output)
 {
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+
+	if (weston_log_scope_is_enabled(b->recorder_debug))
+		recorder_print_stats(output, NULL);
+
 	vaapi_recorder_destroy(output->recorder);
 	output->recorder = NULL;
 
@@ -2768,6 +2832,7 @@ recorder_frame_notify(struct wl_listener *listener, void *data)
 	if (ret < 0) {
 		weston_log("[libva recorder] aborted: %s\n", strerror(errno));
 		recorder_destroy(output);
+		return;
 	}
 }
 
@@ -2882,6 +2947,13 @@ drm_backend_create(struct weston_compositor *compositor,
 						   "Debug messages from DRM/KMS backend\n",
 						   NULL, NULL, NULL);
 
+#ifdef BUILD_VAAPI_RECORDER
+	b->recorder_debug =
+		weston_compositor_add_log_scope(compositor, "drm-recorder",
+						"VA-API recorder frame queue statistics\n",
+						recorder_debug_subscribe, NULL, b);
+#endif
+
 	compositor->backend = &b->base;
 	compositor->require_input = !config->continue_without_input;
 
@@ -180,11 +180,13 @@ const struct drm_property_info connector_props[] = {
 		.enum_values = hdmi_clrspace_enums,
 		.num_enum_values = 13,
 	},
+	[WDRM_CONNECTOR_VRR_CAPABLE] = { .name = "vrr_capable", },
 };
 
 const struct drm_property_info crtc_props[] = {
 	[WDRM_CRTC_MODE_ID] = { .name = "MODE_ID", },
 	[WDRM_CRTC_ACTIVE] = { .name = "ACTIVE", },
+	[WDRM_CRTC_VRR_ENABLED] = { .name = "VRR_ENABLED", },
 };
 
 
@@ -1050,6 +1052,9 @@ drm_output_apply_state_atomic(struct drm_output_state *state,
 		ret |= crtc_add_prop(req, output, WDRM_CRTC_MODE_ID,
 				     current_mode->blob_id);
 		ret |= crtc_add_prop(req, output, WDRM_CRTC_ACTIVE, 1);
+		if (output->props_crtc[WDRM_CRTC_VRR_ENABLED].prop_id != 0)
+			ret |= crtc_add_prop(req, output, WDRM_CRTC_VRR_ENABLED,
+					     state->vrr_enabled);
 
 		/* No need for the DPMS property, since it is implicit in
 		 * routing and CRTC activity. */
@@ -129,6 +129,22 @@ check_non_desktop(struct drm_head *head, drmModeObjectPropertiesPtr props)
 	return drm_property_get_value(non_desktop_info, props, 0);
 }
 
+/* The refresh rate range of a display the driver can drive with VRR */
+static void
+update_head_vrr_range(struct drm_head *head, drmModeObjectPropertiesPtr props)
+{
+	struct drm_property_info *vrr_capable =
+		&head->props_conn[WDRM_CONNECTOR_VRR_CAPABLE];
+
+	if (!drm_property_get_value(vrr_capable, props, 0)) {
+		weston_head_set_vrr_range(&head->base, 0, 0);
+		return;
+	}
+
+	weston_head_set_vrr_range(&head->base, head->edid.vrr_min_hz * 1000,
+				  head->edid.vrr_max_hz * 1000);
+}
+
 static uint32_t
 get_panel_orientation(struct drm_head *head, drmModeObjectPropertiesPtr props)
 {
@@ -236,6 +252,7 @@ edid_parse_string(const uint8_t *data, char text[])
 }
 
 #define EDID_DESCRIPTOR_ALPHANUMERIC_DATA_STRING	0xfe
+#define EDID_DESCRIPTOR_DISPLAY_RANGE_LIMITS		0xfd
 #define EDID_DESCRIPTOR_DISPLAY_PRODUCT_NAME		0xfc
 #define EDID_DESCRIPTOR_DISPLAY_PRODUCT_SERIAL_NUMBER	0xff
 #define EDID_OFFSET_DATA_BLOCKS				0x36
@@ -273,6 +290,9 @@ edid_parse(struct drm_edid *edid, const uint8_t *data, size_t length)
 	if (serial_number > 0)
 		sprintf(edid->serial_number, "%lu", (unsigned long) serial_number);
 
+	edid->vrr_min_hz = 0;
+	edid->vrr_max_hz = 0;
+
 	/* parse EDID data */
 	for (i = EDID_OFFSET_DATA_BLOCKS;
 	     i <= EDID_OFFSET_LAST_BLOCK;
@@ -293,6 +313,10 @@ edid_parse(struct drm_edid *edid, const uint8_t *data, size_t length)
 		} else if (data[i+3] == EDID_DESCRIPTOR_ALPHANUMERIC_DATA_STRING) {
 			edid_parse_string(&data[i+5],
 					  edid->eisa_id);
+		} else if (data[i+3] == EDID_DESCRIPTOR_DISPLAY_RANGE_LIMITS) {
+			/* the offset flags add 255 Hz to the rates */
+			edid->vrr_min_hz = data[i+5] + (data[i+4] & 0x1 ? 255 : 0);
+			edid->vrr_max_hz = data[i+6] + (data[i+4] & 0x2 ? 255 : 0);
 		}
 	}
 	return 0;
@@ -525,6 +549,7 @@ update_head_from_connector(struct drm_head *head,
 	weston_head_set_monitor_strings(&head->base, make, model, serial_number);
 	weston_head_set_non_desktop(&head->base,
 				    check_non_desktop(head, props));
+	update_head_vrr_range(head, props);
 	weston_head_set_subpixel(&head->base,
 		drm_subpixel_to_wayland(head->connector->subpixel));
 
@@ -0,0 +1,334 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Single-producer/single-consumer frame queue for the screen recorder.
+ *
+ * The compositor thread is the only producer and the worker thread
+ * created here is the only consumer, so the ring needs no lock: the
+ * producer owns 'tail', the consumer owns 'head', and each publishes its
+ * index with release semantics after touching the slot. The producer
+ * never blocks; when the ring is full the incoming frame is dropped.
+ * The worker sleeps on a semaphore, which sem_post() signals without
+ * taking any lock.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <libweston/zalloc.h>
+#include "shared/timespec-util.h"
+#include "recorder-queue.h"
+
+struct recorder_queue {
+	enum recorder_queue_policy policy;
+	recorder_encode_func_t encode;
+	void *encode_data;
+
+	unsigned int mask;
+	struct recorder_frame *slots;
+
+	/* written by the producer only */
+	uint32_t tail;
+	/* written by the consumer only */
+	uint32_t head;
+
+	int stopping;
+	int error;
+
+	sem_t pending;
+	pthread_t worker_thread;
+
+	struct recorder_queue_stats stats;
+};
+
+static inline uint32_t
+load_index(const uint32_t *index)
+{
+	return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+store_index(uint32_t *index, uint32_t value)
+{
+	__atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+static inline void
+stat_add(uint64_t *stat, uint64_t value)
+{
+	__atomic_fetch_add(stat, value, __ATOMIC_RELAXED);
+}
+
+static inline void
+stat_max(uint64_t *stat, uint64_t value)
+{
+	/* Only the consumer updates the maxima, no CAS loop needed */
+	if (value > __atomic_load_n(stat, __ATOMIC_RELAXED))
+		__atomic_store_n(stat, value, __ATOMIC_RELAXED);
+}
+
+static void
+encode_frame(struct recorder_queue *q, struct recorder_frame *frame)
+{
+	struct timespec start, end;
+	int64_t queue_ns, encode_ns;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	ret = q->encode(q->encode_data, frame);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(frame->prime_fd);
+	frame->prime_fd = -1;
+
+	if (ret < 0) {
+		__atomic_store_n(&q->error, errno ? errno : EIO,
+				 __ATOMIC_RELEASE);
+		return;
+	}
+
+	queue_ns = timespec_sub_to_nsec(&start, &frame->queued);
+	encode_ns = timespec_sub_to_nsec(&end, &start);
+
+	stat_add(&q->stats.frames_encoded, 1);
+	stat_add(&q->stats.queue_latency_sum_ns, queue_ns);
+	stat_max(&q->stats.queue_latency_max_ns, queue_ns);
+	stat_add(&q->stats.encode_time_sum_ns, encode_ns);
+	stat_max(&q->stats.encode_time_max_ns, encode_ns);
+}
+
+static void
+discard_frame(struct recorder_frame *frame)
+{
+	close(frame->prime_fd);
+	frame->prime_fd = -1;
+}
+
+static void *
+worker_thread_function(void *data)
+{
+	struct recorder_queue *q = data;
+	uint32_t head, tail;
+
+	head = q->head;
+
+	for (;;) {
+		while (sem_wait(&q->pending) < 0 && errno == EINTR)
+			;
+
+		if (__atomic_load_n(&q->stopping, __ATOMIC_ACQUIRE))
+			break;
+
+		/* After an encoder failure the producer rejects all frames;
+		 * just wait for recorder_queue_destroy(). */
+		if (__atomic_load_n(&q->error, __ATOMIC_ACQUIRE))
+			continue;
+
+		tail = load_index(&q->tail);
+
+		/* With coalescing there are more semaphore posts than
+		 * frames left in the ring, so it may well be empty. */
+		if (head == tail)
+			continue;
+
+		if (q->policy == RECORDER_QUEUE_POLICY_COALESCE) {
+			while (tail - head > 1) {
+				discard_frame(&q->slots[head & q->mask]);
+				stat_add(&q->stats.frames_coalesced, 1);
+				head++;
+			}
+
+			/* Give the discarded slots back right away, the
+			 * one being encoded stays owned by us. */
+			store_index(&q->head, head);
+		}
+
+		encode_frame(q, &q->slots[head & q->mask]);
+		head++;
+		store_index(&q->head, head);
+	}
+
+	return NULL;
+}
+
+/** Create a frame queue and start its worker thread
+ *
+ * \param capacity Number of frames the queue can hold, including the one
+ * being encoded, rounded up to a power of two.
+ * \param policy How to handle frames arriving faster than they encode.
+ * \param encode Encoder callback, called on the worker thread.
+ * \param data User data passed to \c encode.
+ * \return The new queue, or NULL on failure.
+ */
+struct recorder_queue *
+recorder_queue_create(unsigned int capacity,
+		      enum recorder_queue_policy policy,
+		      recorder_encode_func_t encode, void *data)
+{
+	struct recorder_queue *q;
+	unsigned int size = 1;
+	unsigned int i;
+
+	assert(capacity > 0);
+	assert(encode);
+
+	while (size < capacity)
+		size <<= 1;
+
+	q = zalloc(sizeof *q);
+	if (q == NULL)
+		return NULL;
+
+	q->slots = calloc(size, sizeof *q->slots);
+	if (q->slots == NULL)
+		goto err_free;
+
+	for (i = 0; i < size; i++)
+		q->slots[i].prime_fd = -1;
+
+	q->mask = size - 1;
+	q->policy = policy;
+	q->encode = encode;
+	q->encode_data = data;
+
+	if (sem_init(&q->pending, 0, 0) < 0)
+		goto err_slots;
+
+	if (pthread_create(&q->worker_thread, NULL,
+			   worker_thread_function, q) != 0)
+		goto err_sem;
+
+	return q;
+
+err_sem:
+	sem_destroy(&q->pending);
+err_slots:
+	free(q->slots);
+err_free:
+	free(q);
+
+	return NULL;
+}
+
+/** Stop the worker thread and destroy the queue
+ *
+ * A frame being encoded is allowed to finish; frames still waiting in
+ * the queue are discarded.
+ */
+void
+recorder_queue_destroy(struct recorder_queue *q)
+{
+	uint32_t head, tail;
+
+	__atomic_store_n(&q->stopping, 1, __ATOMIC_RELEASE);
+	sem_post(&q->pending);
+
+	pthread_join(q->worker_thread, NULL);
+
+	head = q->head;
+	tail = q->tail;
+	while (head != tail) {
+		discard_frame(&q->slots[head & q->mask]);
+		head++;
+	}
+
+	sem_destroy(&q->pending);
+	free(q->slots);
+	free(q);
+}
+
+/** Queue a frame for encoding
+ *
+ * Must only be called from one thread. Never blocks. The queue takes
+ * ownership of \c prime_fd in all cases; if the queue is full the frame
+ * is dropped and counted in the statistics.
+ *
+ * \return 0 if the frame was queued or dropped, -1 with errno set if the
+ * encoder has failed.
+ */
+int
+recorder_queue_push(struct recorder_queue *q, int prime_fd, int stride)
+{
+	struct recorder_frame *frame;
+	uint32_t head, tail;
+	int error;
+
+	error = __atomic_load_n(&q->error, __ATOMIC_ACQUIRE);
+	if (error) {
+		close(prime_fd);
+		errno = error;
+		return -1;
+	}
+
+	stat_add(&q->stats.frames_submitted, 1);
+
+	tail = q->tail;
+	head = load_index(&q->head);
+
+	if (tail - head > q->mask) {
+		close(prime_fd);
+		stat_add(&q->stats.frames_dropped, 1);
+		return 0;
+	}
+
+	frame = &q->slots[tail & q->mask];
+	frame->prime_fd = prime_fd;
+	frame->stride = stride;
+	clock_gettime(CLOCK_MONOTONIC, &frame->queued);
+
+	store_index(&q->tail, tail + 1);
+	sem_post(&q->pending);
+
+	return 0;
+}
+
+/** Take a snapshot of the queue statistics
+ *
+ * Safe to call from any thread. Counters are read individually, so the
+ * snapshot is not necessarily consistent across fields.
+ */
+void
+recorder_queue_get_stats(struct recorder_queue *q,
+			 struct recorder_queue_stats *stats)
+{
+	const uint64_t *src = (const uint64_t *) &q->stats;
+	uint64_t *dst = (uint64_t *) stats;
+	size_t i;
+
+	for (i = 0; i < sizeof *stats / sizeof(uint64_t); i++)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
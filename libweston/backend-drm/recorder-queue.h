@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _RECORDER_QUEUE_H_
+#define _RECORDER_QUEUE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/** What to do with frames that arrive faster than they can be encoded */
+enum recorder_queue_policy {
+	/** Encode every queued frame, reject new frames while full */
+	RECORDER_QUEUE_POLICY_DROP = 0,
+	/** Encode only the newest queued frame, discard the older ones */
+	RECORDER_QUEUE_POLICY_COALESCE,
+};
+
+struct recorder_frame {
+	int prime_fd;
+	int stride;
+	struct timespec queued;
+};
+
+/** Encoder callback, run on the queue worker thread
+ *
+ * The frame's prime_fd is owned by the queue and closed after the
+ * callback returns. Returning a negative value stops the queue; the
+ * errno at that point is reported by subsequent recorder_queue_push()
+ * calls.
+ */
+typedef int (*recorder_encode_func_t)(void *data,
+				      const struct recorder_frame *frame);
+
+struct recorder_queue_stats {
+	uint64_t frames_submitted;
+	uint64_t frames_encoded;
+	/** rejected by recorder_queue_push() because the queue was full */
+	uint64_t frames_dropped;
+	/** superseded by a newer frame under RECORDER_QUEUE_POLICY_COALESCE */
+	uint64_t frames_coalesced;
+	/** time between push and the encoder picking the frame up */
+	uint64_t queue_latency_sum_ns;
+	uint64_t queue_latency_max_ns;
+	/** time spent in the encoder callback */
+	uint64_t encode_time_sum_ns;
+	uint64_t encode_time_max_ns;
+};
+
+struct recorder_queue;
+
+struct recorder_queue *
+recorder_queue_create(unsigned int capacity,
+		      enum recorder_queue_policy policy,
+		      recorder_encode_func_t encode, void *data);
+void
+recorder_queue_destroy(struct recorder_queue *q);
+int
+recorder_queue_push(struct recorder_queue *q, int prime_fd, int stride);
+void
+recorder_queue_get_stats(struct recorder_queue *q,
+			 struct recorder_queue_stats *stats);
+
+#endif /* _RECORDER_QUEUE_H_ */
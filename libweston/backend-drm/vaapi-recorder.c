@@ -37,8 +37,6 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
-#include <pthread.h>
-
 #include <va/va.h>
 #include <va/va_drm.h>
 #include <va/va_drmcommon.h>
@@ -47,6 +45,7 @@
 
 #include <libweston/libweston.h>
 #include "vaapi-recorder.h"
+#include "recorder-queue.h"
 
 #define NAL_REF_IDC_NONE        0
 #define NAL_REF_IDC_LOW         1
@@ -70,21 +69,21 @@
 #define PROFILE_IDC_MAIN        77
 #define PROFILE_IDC_HIGH        100
 
+/* Frames waiting for the encoder. The queued prime fds hold no reference
+ * on the scanout buffers, which get reused once newer frames are shown, so
+ * only the newest queued frame is encoded; the extra slots just keep new
+ * frames from being rejected while one is being encoded. */
+#define RECORDER_QUEUE_CAPACITY 4
+
 struct vaapi_recorder {
 	int drm_fd, output_fd;
 	int width, height;
 	int frame_count;
 
+	/* only touched by the queue worker thread */
 	int error;
-	int destroying;
-	pthread_t worker_thread;
-	pthread_mutex_t mutex;
-	pthread_cond_t input_cond;
 
-	struct {
-		int valid;
-		int prime_fd, stride;
-	} input;
+	struct recorder_queue *queue;
 
 	VADisplay va_dpy;
 
@@ -113,8 +112,8 @@ struct vaapi_recorder {
 	} encoder;
 };
 
-static void *
-worker_thread_function(void *);
+static int
+recorder_frame(void *data, const struct recorder_frame *frame);
 
 /* bitstream code used for writing the packed headers */
 
@@ -897,33 +896,6 @@ vpp_destroy(struct vaapi_recorder *r)
 	vaDestroyConfig(r->va_dpy, r->vpp.cfg);
 }
 
-static int
-setup_worker_thread(struct vaapi_recorder *r)
-{
-	pthread_mutex_init(&r->mutex, NULL);
-	pthread_cond_init(&r->input_cond, NULL);
-	pthread_create(&r->worker_thread, NULL, worker_thread_function, r);
-
-	return 1;
-}
-
-static void
-destroy_worker_thread(struct vaapi_recorder *r)
-{
-	pthread_mutex_lock(&r->mutex);
-
-	/* Make sure the worker thread finishes */
-	r->destroying = 1;
-	pthread_cond_signal(&r->input_cond);
-
-	pthread_mutex_unlock(&r->mutex);
-
-	pthread_join(r->worker_thread, NULL);
-
-	pthread_mutex_destroy(&r->mutex);
-	pthread_cond_destroy(&r->input_cond);
-}
-
 struct vaapi_recorder *
 vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
 {
@@ -940,13 +912,10 @@ vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
 	r->height = height;
 	r->drm_fd = drm_fd;
 
-	if (setup_worker_thread(r) < 0)
-		goto err_free;
-
 	flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
 	r->output_fd = open(filename, flags, 0644);
 	if (r->output_fd < 0)
-		goto err_thread;
+		goto err_free;
 
 	r->va_dpy = vaGetDisplayDRM(drm_fd);
 	if (!r->va_dpy) {
@@ -969,16 +938,24 @@ vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
 		goto err_vpp;
 	}
 
+	r->queue = recorder_queue_create(RECORDER_QUEUE_CAPACITY,
+					 RECORDER_QUEUE_POLICY_COALESCE,
+					 recorder_frame, r);
+	if (!r->queue) {
+		weston_log("vaapi: failed to start encoder thread\n");
+		goto err_encoder;
+	}
+
 	return r;
 
+err_encoder:
+	encoder_destroy(r);
 err_vpp:
 	vpp_destroy(r);
 err_va_dpy:
 	vaTerminate(r->va_dpy);
 err_fd:
 	close(r->output_fd);
-err_thread:
-	destroy_worker_thread(r);
 err_free:
 	free(r);
 
@@ -988,7 +965,7 @@ err_free:
 void
 vaapi_recorder_destroy(struct vaapi_recorder *r)
 {
-	destroy_worker_thread(r);
+	recorder_queue_destroy(r->queue);
 
 	encoder_destroy(r);
 	vpp_destroy(r);
@@ -1079,83 +1056,59 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	return status;
 }
 
-static void
-recorder_frame(struct vaapi_recorder *r)
+static int
+recorder_frame(void *data, const struct recorder_frame *frame)
 {
+	struct vaapi_recorder *r = data;
 	VASurfaceID rgb_surface;
 	VAStatus status;
 
-	status = create_surface_from_fd(r, r->input.prime_fd,
-					r->input.stride, &rgb_surface);
+	status = create_surface_from_fd(r, frame->prime_fd,
+					frame->stride, &rgb_surface);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[libva recorder] "
 			   "failed to create surface from bo\n");
-		return;
+		return 0;
 	}
 
-	close(r->input.prime_fd);
-
 	status = convert_rgb_to_yuv(r, rgb_surface);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[libva recorder] "
 			   "color space conversion failed\n");
-		return;
+		vaDestroySurfaces(r->va_dpy, &rgb_surface, 1);
+		return 0;
 	}
 
 	encoder_encode(r, r->vpp.output);
 
 	vaDestroySurfaces(r->va_dpy, &rgb_surface, 1);
-}
-
-static void *
-worker_thread_function(void *data)
-{
-	struct vaapi_recorder *r = data;
-
-	pthread_mutex_lock(&r->mutex);
-
-	while (!r->destroying) {
-		if (!r->input.valid)
-			pthread_cond_wait(&r->input_cond, &r->mutex);
 
-		/* If the thread is awaken by destroy_worker_thread(),
-		 * there might not be valid input */
-		if (!r->input.valid)
-			continue;
-
-		recorder_frame(r);
-		r->input.valid = 0;
+	if (r->error) {
+		errno = r->error;
+		return -1;
 	}
 
-	pthread_mutex_unlock(&r->mutex);
-
-	return NULL;
+	return 0;
 }
 
+/** Hand a frame over to the encoder thread
+ *
+ * Never blocks on the encoder. Takes ownership of \c prime_fd. Frames
+ * that arrive while the encoder is busy are superseded by newer ones, or
+ * dropped if the queue is full; both are accounted for in
+ * vaapi_recorder_get_stats().
+ *
+ * \return 0 on success, -1 with errno set if recording has failed.
+ */
 int
 vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
 {
-	int ret = 0;
-
-	pthread_mutex_lock(&r->mutex);
-
-	if (r->error) {
-		errno = r->error;
-		ret = -1;
-		goto unlock;
-	}
-
-	/* The mutex is never released while encoding, so this point should
-	 * never be reached if input.valid is true. */
-	assert(!r->input.valid);
-
-	r->input.prime_fd = prime_fd;
-	r->input.stride = stride;
-	r->input.valid = 1;
-	pthread_cond_signal(&r->input_cond);
-
-unlock:
-	pthread_mutex_unlock(&r->mutex);
+	return recorder_queue_push(r->queue, prime_fd, stride);
+}
 
-	return ret;
+void
+vaapi_recorder_get_stats(struct vaapi_recorder *r,
+			 struct recorder_queue_stats *stats)
+{
+	recorder_queue_get_stats(r->queue, stats);
 }
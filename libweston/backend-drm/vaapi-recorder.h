@@ -27,6 +27,7 @@
 #define _VAAPI_RECORDER_H_
 
 struct vaapi_recorder;
+struct recorder_queue_stats;
 
 struct vaapi_recorder *
 vaapi_recorder_create(int drm_fd, int width, int height, const char *filename);
@@ -34,5 +35,8 @@ void
 vaapi_recorder_destroy(struct vaapi_recorder *r);
 int
 vaapi_recorder_frame(struct vaapi_recorder *r, int fd, int stride);
+void
+vaapi_recorder_get_stats(struct vaapi_recorder *r,
+			 struct recorder_queue_stats *stats);
 
 #endif /* _VAAPI_RECORDER_H_ */
@@ -56,6 +56,15 @@ struct headless_backend {
 	struct udev *udev;
 	struct udev_input input;
 	struct wl_listener session_listener;
+
+	/* Output refresh rate in mHz, 0 for as fast as possible */
+	int refresh;
+	/* Lowest variable refresh rate in mHz, 0 for none */
+	int vrr_min_refresh;
+
+	/* The virtual presentation clock, only advanced by the clock API */
+	bool virtual_clock;
+	struct timespec clock_now;
 };
 
 struct headless_head {
@@ -77,13 +86,33 @@ struct headless_fb {
 
 	struct gbm_bo *bo;
 	struct gbm_surface *gbm_surface;
+
+	/* Virtual outputs on the pixman renderer render into shared
+	 * memory instead of a gbm_bo */
+	void *shm_data;
+	size_t shm_size;
+	pixman_image_t *image;
 };
 
+/* Buffers per pixman virtual output; one can be held by the capture
+ * consumer while the other is being rendered. */
+#define HEADLESS_VIRTUAL_SHM_BUFFERS 2
+
 struct headless_output {
 	struct weston_output base;
 
 	struct weston_mode mode;
 	struct wl_event_source *finish_frame_timer;
+	struct wl_event_source *finish_frame_idle;
+
+	/* Presentation times stay on a grid of refresh periods, or with
+	 * VRR at least a refresh period apart */
+	struct timespec last_vblank;
+	struct timespec next_vblank;
+	/* Refreshes from last_vblank to next_vblank, for the MSC */
+	int64_t vblanks;
+	/* Repainted, waiting for the virtual clock to reach next_vblank */
+	bool frame_pending;
 	uint32_t *image_buf;
 	pixman_image_t *image;
 
@@ -96,6 +125,8 @@ struct headless_output {
 	bool virtual;
 #ifdef BUILD_HEADLESS_VIRTUAL
 	submit_frame_cb virtual_submit_frame;
+	struct headless_fb *shm_fb[HEADLESS_VIRTUAL_SHM_BUFFERS];
+	pixman_region32_t shm_previous_damage;
 #endif
 };
 
@@ -125,16 +156,16 @@ to_headless_backend(struct weston_compositor *base)
 	return container_of(base->backend, struct headless_backend, base);
 }
 
-#ifdef BUILD_HEADLESS_GBM
-bool
-gbm_create_device_headless(struct headless_backend *b);
-
 struct headless_fb*
 headless_fb_ref(struct headless_fb *fb);
 
 void
 headless_fb_unref(struct headless_fb *fb);
 
+#ifdef BUILD_HEADLESS_GBM
+bool
+gbm_create_device_headless(struct headless_backend *b);
+
 void
 headless_fb_destroy_gbm(struct gbm_bo *bo, void *data);
 
@@ -160,17 +191,6 @@ gbm_create_device_headless(struct headless_backend *b)
 	return false;
 }
 
-inline static struct headless_fb*
-headless_fb_ref(struct headless_fb *fb)
-{
-	return NULL;
-}
-
-inline static void
-headless_fb_unref(struct headless_fb *fb)
-{
-}
-
 inline static void
 headless_fb_destroy_gbm(struct gbm_bo *bo, void *data)
 {
@@ -184,7 +204,7 @@ headless_fb_get_from_bo(struct gbm_bo *bo, struct headless_backend *b)
 
 inline static int
 headless_output_repaint_gbm(struct headless_output *output,
-                            pixman_region32_t *damage);
+                            pixman_region32_t *damage)
 {
 	return 0;
 }
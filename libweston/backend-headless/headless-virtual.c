@@ -6,9 +6,12 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "headless-internal.h"
+#include "pixman-renderer.h"
 #include "renderer-gl/gl-renderer.h"
+#include "shared/os-compatibility.h"
 
 static int
 headless_virtual_output_start_repaint_loop(struct weston_output *output_base)
@@ -21,18 +24,9 @@ headless_virtual_output_start_repaint_loop(struct weston_output *output_base)
 
 static int
 headless_virtual_output_submit_frame(struct headless_output *output,
-				     void *_fb)
+				     int fd, struct headless_fb *fb)
 {
-	struct headless_backend *b = to_headless_backend(output->base.compositor);
-	struct headless_fb* fb = _fb;
-	int fd, ret;
-
-	assert(fb->num_planes == 1);
-	ret = drmPrimeHandleToFD(b->drm_fd, fb->handles[0], DRM_CLOEXEC | DRM_RDWR, &fd);
-	if (ret) {
-		weston_log("drmPrimeHandleFD failed, errno=%d\n", errno);
-		return -1;
-	}
+	int ret;
 
 	headless_fb_ref(fb);
 	ret = output->virtual_submit_frame(&output->base, fd, fb->strides[0],
@@ -45,14 +39,14 @@ headless_virtual_output_submit_frame(struct headless_output *output,
 	return ret;
 }
 
+#ifdef BUILD_HEADLESS_GBM
 static int
-headless_virtual_output_repaint(struct weston_output *output_base,
-			   	pixman_region32_t *damage,
-			   	void *repaint_data)
+headless_virtual_output_repaint_gbm(struct headless_output *output,
+				    pixman_region32_t *damage)
 {
-	struct headless_output *output = to_headless_output(output_base);
-
-	assert(output->virtual);
+	struct headless_backend *b = to_headless_backend(output->base.compositor);
+	struct headless_fb *fb;
+	int fd, ret;
 
 	/* Drop frame if there isn't free buffers */
 	if (!gbm_surface_has_free_buffers(output->gbm_surface)) {
@@ -61,16 +55,170 @@ headless_virtual_output_repaint(struct weston_output *output_base,
 	}
 
 	headless_output_repaint_gbm(output, damage);
-	if (headless_virtual_output_submit_frame(output, output->curr_fb) < 0)
+	fb = output->curr_fb;
+
+	assert(fb->num_planes == 1);
+	ret = drmPrimeHandleToFD(b->drm_fd, fb->handles[0], DRM_CLOEXEC | DRM_RDWR, &fd);
+	if (ret) {
+		weston_log("drmPrimeHandleFD failed, errno=%d\n", errno);
 		return -1;
+	}
+
+	return headless_virtual_output_submit_frame(output, fd, fb);
+}
+#endif
+
+static void
+headless_virtual_output_destroy_shm(struct headless_output *output)
+{
+	struct headless_fb *fb;
+	int i;
+
+	for (i = 0; i < HEADLESS_VIRTUAL_SHM_BUFFERS; i++) {
+		fb = output->shm_fb[i];
+		if (!fb)
+			continue;
+
+		pixman_image_unref(fb->image);
+		munmap(fb->shm_data, fb->shm_size);
+		close(fb->fd);
+		free(fb);
+		output->shm_fb[i] = NULL;
+	}
+
+	pixman_region32_fini(&output->shm_previous_damage);
+}
+
+static int
+headless_virtual_output_create_shm(struct headless_output *output)
+{
+	int width = output->base.current_mode->width;
+	int height = output->base.current_mode->height;
+	struct headless_fb *fb;
+	int i;
+
+	pixman_region32_init(&output->shm_previous_damage);
+
+	for (i = 0; i < HEADLESS_VIRTUAL_SHM_BUFFERS; i++) {
+		fb = zalloc(sizeof *fb);
+		if (!fb)
+			goto err;
+		output->shm_fb[i] = fb;
+
+		fb->width = width;
+		fb->height = height;
+		fb->num_planes = 1;
+		fb->strides[0] = width * 4;
+		fb->format = output->gbm_format;
+		fb->modifier = DRM_FORMAT_MOD_LINEAR;
+		fb->shm_size = fb->strides[0] * height;
+
+		fb->fd = os_create_anonymous_file(fb->shm_size);
+		if (fb->fd < 0)
+			goto err;
+
+		fb->shm_data = mmap(NULL, fb->shm_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED, fb->fd, 0);
+		if (fb->shm_data == MAP_FAILED) {
+			fb->shm_data = NULL;
+			close(fb->fd);
+			goto err;
+		}
+
+		fb->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+						     width, height,
+						     fb->shm_data,
+						     fb->strides[0]);
+		if (!fb->image) {
+			munmap(fb->shm_data, fb->shm_size);
+			close(fb->fd);
+			goto err;
+		}
+	}
 
 	return 0;
+
+err:
+	/* Forget the half-initialized one, it has been cleaned up */
+	free(output->shm_fb[i]);
+	output->shm_fb[i] = NULL;
+	headless_virtual_output_destroy_shm(output);
+	return -1;
+}
+
+static int
+headless_virtual_output_repaint_pixman(struct headless_output *output,
+				       pixman_region32_t *damage)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct headless_fb *fb = NULL;
+	pixman_region32_t repaint;
+	int fd, i;
+
+	for (i = 0; i < HEADLESS_VIRTUAL_SHM_BUFFERS; i++) {
+		if (output->shm_fb[i]->refcnt == 0) {
+			fb = output->shm_fb[i];
+			break;
+		}
+	}
+
+	/* Drop frame if there isn't free buffers */
+	if (!fb) {
+		weston_log("%s: Drop frame!!\n", __func__);
+		return -1;
+	}
+
+	fd = dup(fb->fd);
+	if (fd < 0)
+		return -1;
+
+	/* Buffers are used alternately, so besides this frame's damage the
+	 * buffer also misses whatever the previous frame changed. */
+	pixman_region32_init(&repaint);
+	pixman_region32_union(&repaint, damage, &output->shm_previous_damage);
+	pixman_region32_copy(&output->shm_previous_damage, damage);
+
+	pixman_renderer_output_set_buffer(&output->base, fb->image);
+	ec->renderer->repaint_output(&output->base, &repaint);
+	pixman_region32_fini(&repaint);
+
+	pixman_region32_subtract(&ec->primary_plane.damage,
+				 &ec->primary_plane.damage, damage);
+
+	return headless_virtual_output_submit_frame(output, fd, fb);
+}
+
+static int
+headless_virtual_output_repaint(struct weston_output *output_base,
+			   	pixman_region32_t *damage,
+			   	void *repaint_data)
+{
+	struct headless_output *output = to_headless_output(output_base);
+	struct headless_backend *b = to_headless_backend(output_base->compositor);
+
+	assert(output->virtual);
+
+	if (b->renderer_type == HEADLESS_PIXMAN)
+		return headless_virtual_output_repaint_pixman(output, damage);
+
+#ifdef BUILD_HEADLESS_GBM
+	return headless_virtual_output_repaint_gbm(output, damage);
+#else
+	return -1;
+#endif
 }
 
 static void
 headless_virtual_output_deinit(struct weston_output *base)
 {
 	struct headless_output *output = to_headless_output(base);
+	struct headless_backend *b = to_headless_backend(base->compositor);
+
+	if (b->renderer_type == HEADLESS_PIXMAN) {
+		pixman_renderer_output_destroy(&output->base);
+		headless_virtual_output_destroy_shm(output);
+		return;
+	}
 
 	headless_output_disable_gl_gbm(output);
 }
@@ -90,23 +238,45 @@ headless_virtual_output_destroy(struct weston_output *base)
 	free(output);
 }
 
+static int
+headless_virtual_output_enable_pixman(struct headless_output *output)
+{
+	const struct pixman_renderer_output_options options = {
+		.use_shadow = false,
+	};
+
+	if (headless_virtual_output_create_shm(output) < 0) {
+		weston_log("Failed to allocate virtual output buffers\n");
+		return -1;
+	}
+
+	if (pixman_renderer_output_create(&output->base, &options) < 0) {
+		headless_virtual_output_destroy_shm(output);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
 headless_virtual_output_enable(struct weston_output *output_base)
 {
 	struct headless_output *output = to_headless_output(output_base);
 	struct headless_backend *b = to_headless_backend(output_base->compositor);
 	struct wl_event_loop *loop;
+	int ret;
 
 	assert(output->virtual);
 
-	if (b->renderer_type != HEADLESS_GL_GBM) {
-		weston_log("Cannot enable Virtual outputs without GBM\n");
-		goto err;
+	if (b->renderer_type != HEADLESS_GL_GBM &&
+	    b->renderer_type != HEADLESS_PIXMAN) {
+		weston_log("Cannot enable Virtual outputs without GBM or pixman\n");
+		return -1;
 	}
 
 	if (!output->virtual_submit_frame) {
 		weston_log("The virtual_submit_frame hook is not set\n");
-		goto err;
+		return -1;
 	}
 
 	if (output->finish_frame_timer)
@@ -116,8 +286,13 @@ headless_virtual_output_enable(struct weston_output *output_base)
 	output->finish_frame_timer =
 		wl_event_loop_add_timer(loop, finish_frame_handler, output);
 
-	if (headless_output_enable_gl_gbm(output) < 0) {
-		weston_log("Failed to init output gl state\n");
+	if (b->renderer_type == HEADLESS_PIXMAN)
+		ret = headless_virtual_output_enable_pixman(output);
+	else
+		ret = headless_output_enable_gl_gbm(output);
+
+	if (ret < 0) {
+		weston_log("Failed to init output renderer state\n");
 		goto err;
 	}
 
@@ -132,6 +307,7 @@ headless_virtual_output_enable(struct weston_output *output_base)
 	return 0;
 err:
 	wl_event_source_remove(output->finish_frame_timer);
+	output->finish_frame_timer = NULL;
 	return -1;
 }
 
@@ -158,7 +334,10 @@ headless_virtual_output_create(struct weston_compositor *c, char *name)
 		return NULL;
 
 	output->virtual = true;
+	output->gbm_format = DRM_FORMAT_XRGB8888;
+#ifdef BUILD_HEADLESS_GBM
 	output->gbm_bo_flags = GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING;
+#endif
 
 	weston_output_init(&output->base, c, name);
 
@@ -197,6 +376,10 @@ headless_virtual_output_get_fence_fd(struct weston_output *output_base)
 {
 	struct headless_backend *b = to_headless_backend(output_base->compositor);
 
+	/* The pixman renderer is done by the time the frame is submitted */
+	if (b->renderer_type == HEADLESS_PIXMAN)
+		return -1;
+
 	return b->glri->create_fence_fd(output_base);
 }
 
@@ -231,4 +414,3 @@ int headless_backend_init_virtual_output_api(struct weston_compositor *composito
 					  WESTON_HEADLESS_VIRTUAL_OUTPUT_API_NAME,
 					  &virt_api, sizeof(virt_api));
 }
-
@@ -54,6 +54,7 @@
 #endif
 
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "linux-explicit-synchronization.h"
 #include "pixman-renderer.h"
 #include "renderer-gl/gl-renderer.h"
@@ -65,48 +66,100 @@
 static const char default_seat[] = "seat0";
 
 static int
-headless_output_start_repaint_loop(struct weston_output *output)
+headless_output_start_repaint_loop(struct weston_output *output_base)
 {
+	struct headless_output *output = to_headless_output(output_base);
 	struct timespec ts;
 
-	weston_compositor_read_presentation_clock(output->compositor, &ts);
-	weston_output_finish_frame(output, &ts, WP_PRESENTATION_FEEDBACK_INVALID);
+	/* With VRR, the display waits for the next frame since the last
+	 * one it showed */
+	weston_compositor_read_presentation_clock(output_base->compositor, &ts);
+	if (!output_base->vrr_active)
+		output->last_vblank = ts;
+	weston_output_finish_frame(output_base, &ts,
+				   WP_PRESENTATION_FEEDBACK_INVALID);
 
 	return 0;
 }
 
+static void
+headless_output_present(struct headless_output *output)
+{
+	output->last_vblank = output->next_vblank;
+	output->base.msc += output->vblanks;
+	weston_output_finish_frame(&output->base, &output->next_vblank, 0);
+}
+
 int
 finish_frame_handler(void *data)
 {
 	struct headless_output *output = data;
-	struct timespec ts;
 
-	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
-	weston_output_finish_frame(&output->base, &ts, 0);
+	headless_output_present(output);
 
 	return 1;
 }
 
-#ifdef BUILD_HEADLESS_GBM
-bool
-gbm_create_device_headless(struct headless_backend *b)
+static void
+finish_frame_idle_handler(void *data)
 {
-	const char render_node[] = "/dev/dri/renderD128";
+	struct headless_output *output = data;
 
-	b->drm_fd = open(render_node, O_RDWR);
-	if (b->drm_fd < 0) {
-		fprintf(stderr, "Failed to open drm render node %s\n",
-			render_node);
-		return false;
+	output->finish_frame_idle = NULL;
+	headless_output_present(output);
+}
+
+/* Present the frame just repainted at the next vblank, or right away
+ * without a refresh rate. With VRR, the vblank comes as soon as the last
+ * frame was on for a refresh period. */
+static void
+headless_output_schedule_present(struct headless_output *output)
+{
+	struct weston_compositor *compositor = output->base.compositor;
+	struct headless_backend *b = to_headless_backend(compositor);
+	struct wl_event_loop *loop;
+	struct timespec now;
+	int64_t refresh_nsec, delta, periods;
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+
+	output->vblanks = 1;
+
+	if (output->mode.refresh == 0) {
+		output->next_vblank = now;
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		output->finish_frame_idle =
+			wl_event_loop_add_idle(loop, finish_frame_idle_handler,
+					       output);
+		return;
 	}
 
-	b->gbm = gbm_create_device(b->drm_fd);
-	if (b->gbm == NULL) {
-		fprintf(stderr, "Failed to create gbm device\n");
-		return false;
+	/* The first vblank not before now */
+	refresh_nsec = millihz_to_nsec(output->mode.refresh);
+	delta = timespec_sub_to_nsec(&now, &output->last_vblank);
+	if (output->base.vrr_active) {
+		if (delta >= refresh_nsec)
+			output->next_vblank = now;
+		else
+			timespec_add_nsec(&output->next_vblank,
+					  &output->last_vblank, refresh_nsec);
+	} else {
+		periods = delta > 0 ?
+			  (delta + refresh_nsec - 1) / refresh_nsec : 1;
+		timespec_add_nsec(&output->next_vblank, &output->last_vblank,
+				  periods * refresh_nsec);
+		output->vblanks = periods;
 	}
 
-	return true;
+	if (b->virtual_clock) {
+		output->frame_pending = true;
+		return;
+	}
+
+	/* Rounded up, so that the presentation time is never in the future */
+	delta = timespec_sub_to_nsec(&output->next_vblank, &now);
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     MAX((delta + 999999) / 1000000, 1));
 }
 
 struct headless_fb*
@@ -126,7 +179,34 @@ headless_fb_unref(struct headless_fb *fb)
 	if (--fb->refcnt > 0)
 		return;
 
-	gbm_surface_release_buffer(fb->gbm_surface, fb->bo);
+	/* Shared memory buffers of pixman virtual outputs simply become
+	 * free for rendering again. */
+#ifdef BUILD_HEADLESS_GBM
+	if (fb->bo)
+		gbm_surface_release_buffer(fb->gbm_surface, fb->bo);
+#endif
+}
+
+#ifdef BUILD_HEADLESS_GBM
+bool
+gbm_create_device_headless(struct headless_backend *b)
+{
+	const char render_node[] = "/dev/dri/renderD128";
+
+	b->drm_fd = open(render_node, O_RDWR);
+	if (b->drm_fd < 0) {
+		fprintf(stderr, "Failed to open drm render node %s\n",
+			render_node);
+		return false;
+	}
+
+	b->gbm = gbm_create_device(b->drm_fd);
+	if (b->gbm == NULL) {
+		fprintf(stderr, "Failed to create gbm device\n");
+		return false;
+	}
+
+	return true;
 }
 
 void
@@ -206,7 +286,7 @@ headless_output_repaint_gbm(struct headless_output *output,
 				 &compositor->primary_plane.damage, damage);
 
 	if (!output->virtual)
-		wl_event_source_timer_update(output->finish_frame_timer, 16);
+		headless_output_schedule_present(output);
 
 	return 0;
 }
@@ -240,7 +320,7 @@ headless_output_repaint(struct weston_output *output_base,
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	headless_output_schedule_present(output);
 
 	return 0;
 }
@@ -272,6 +352,11 @@ headless_output_disable(struct weston_output *base)
 		return 0;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	if (output->finish_frame_idle) {
+		wl_event_source_remove(output->finish_frame_idle);
+		output->finish_frame_idle = NULL;
+	}
+	output->frame_pending = false;
 
 	switch (b->renderer_type) {
 	case HEADLESS_GL:
@@ -451,7 +536,7 @@ headless_output_set_size(struct weston_output *base,
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 	output->mode.width = output_width;
 	output->mode.height = output_height;
-	output->mode.refresh = 60000;
+	output->mode.refresh = to_headless_backend(base->compositor)->refresh;
 	wl_list_insert(&output->base.mode_list, &output->mode.link);
 
 	output->base.current_mode = &output->mode;
@@ -497,6 +582,7 @@ static int
 headless_head_create(struct weston_compositor *compositor,
 		     const char *name)
 {
+	struct headless_backend *b = to_headless_backend(compositor);
 	struct headless_head *head;
 
 	/* name can't be NULL. */
@@ -509,6 +595,10 @@ headless_head_create(struct weston_compositor *compositor,
 	weston_head_init(&head->base, name);
 	weston_head_set_connection_status(&head->base, true);
 
+	if (b->vrr_min_refresh > 0)
+		weston_head_set_vrr_range(&head->base, b->vrr_min_refresh,
+					  b->refresh);
+
 	/* Ideally all attributes of the head would be set here, so that the
 	 * user has all the information when deciding to create outputs.
 	 * We do not have those until set_size() time through.
@@ -597,6 +687,44 @@ static const struct weston_windowed_output_api api = {
 	headless_head_create,
 };
 
+static void
+headless_read_presentation_clock(const struct weston_compositor *compositor,
+				 struct timespec *ts)
+{
+	struct headless_backend *b =
+		container_of(compositor->backend, struct headless_backend, base);
+
+	*ts = b->clock_now;
+}
+
+static void
+headless_clock_advance(struct weston_compositor *compositor, int64_t nsec)
+{
+	struct headless_backend *b = to_headless_backend(compositor);
+	struct weston_output *base;
+
+	assert(nsec >= 0);
+	timespec_add_nsec(&b->clock_now, &b->clock_now, nsec);
+
+	wl_list_for_each(base, &compositor->output_list, link) {
+		struct headless_output *output = to_headless_output(base);
+
+		if (output->virtual || !output->frame_pending ||
+		    timespec_sub_to_nsec(&output->next_vblank,
+					 &b->clock_now) > 0)
+			continue;
+
+		output->frame_pending = false;
+		headless_output_present(output);
+	}
+
+	weston_compositor_presentation_clock_advanced(compositor);
+}
+
+static const struct weston_headless_clock_api clock_api = {
+	headless_clock_advance,
+};
+
 static void
 session_notify(struct wl_listener *listener, void *data)
 {
@@ -637,6 +765,36 @@ headless_backend_create(struct weston_compositor *compositor,
 	if (weston_compositor_set_presentation_clock_software(compositor) < 0)
 		goto err_free;
 
+	if (config->refresh < 0) {
+		weston_log("Error: invalid refresh rate %d mHz.\n",
+			   config->refresh);
+		goto err_free;
+	}
+	if (config->unthrottled)
+		b->refresh = 0;
+	else if (config->refresh > 0)
+		b->refresh = config->refresh;
+	else
+		b->refresh = 60000;
+
+	if (config->vrr_min_refresh < 0 ||
+	    (config->vrr_min_refresh > 0 &&
+	     config->vrr_min_refresh >= b->refresh)) {
+		weston_log("Error: invalid variable refresh rate range "
+			   "%d-%d mHz.\n", config->vrr_min_refresh, b->refresh);
+		goto err_free;
+	}
+	b->vrr_min_refresh = config->vrr_min_refresh;
+
+	/* The virtual clock starts from the real one, and stands still */
+	b->virtual_clock = config->virtual_clock;
+	if (b->virtual_clock) {
+		weston_compositor_read_presentation_clock(compositor,
+							  &b->clock_now);
+		b->base.read_presentation_clock =
+			headless_read_presentation_clock;
+	}
+
 	b->udev = udev_new();
 	if (b->udev == NULL) {
 		weston_log("Failed to initialize udev context.\n");
@@ -725,6 +883,16 @@ headless_backend_create(struct weston_compositor *compositor,
 		goto err_input;
 	}
 
+	if (b->virtual_clock) {
+		ret = weston_plugin_api_register(compositor,
+						 WESTON_HEADLESS_CLOCK_API_NAME,
+						 &clock_api, sizeof(clock_api));
+		if (ret < 0) {
+			weston_log("Failed to register clock API.\n");
+			goto err_input;
+		}
+	}
+
 	return b;
 
 err_input:
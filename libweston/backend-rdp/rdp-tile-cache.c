@@ -0,0 +1,269 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Per-peer change detection for the RDP backend.
+ *
+ * Clients often repaint a whole window when only a caret blinked, and the
+ * compositor damage then covers far more than what really changed. The
+ * cache keeps a 64-bit hash of every 64x64 tile of what the peer was last
+ * sent, and trims the damage down to the tiles whose content differs
+ * before anything is handed to the encoder.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libweston/zalloc.h>
+#include "shared/helpers.h"
+#include "rdp-tile-cache.h"
+
+struct rdp_tile_cache {
+	int width;
+	int height;
+	int tiles_x;
+	int tiles_y;
+
+	uint64_t *hashes;
+	uint8_t *valid;
+
+	/* tiles already looked at during the current filter call */
+	uint32_t *seen;
+	uint32_t generation;
+};
+
+#define TILE_HASH_PRIME1 0x9e3779b185ebca87ULL
+#define TILE_HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define TILE_HASH_PRIME3 0x165667b19e3779f9ULL
+
+static inline uint64_t
+rotl64(uint64_t v, int r)
+{
+	return (v << r) | (v >> (64 - r));
+}
+
+static inline uint64_t
+hash_round(uint64_t acc, uint64_t v)
+{
+	acc += v * TILE_HASH_PRIME2;
+	acc = rotl64(acc, 31);
+	return acc * TILE_HASH_PRIME1;
+}
+
+static inline uint64_t
+load64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+/** Hash a block of 32-bit pixels
+ *
+ * A multiply-rotate hash in the spirit of xxHash64, with four
+ * independent lanes so the multiplies of consecutive words overlap.
+ * This is not a cryptographic hash; a collision costs one stale tile
+ * until its content changes again.
+ */
+uint64_t
+rdp_tile_hash(const uint8_t *data, int stride, int width, int height)
+{
+	uint64_t v1 = TILE_HASH_PRIME1 + TILE_HASH_PRIME2;
+	uint64_t v2 = TILE_HASH_PRIME2;
+	uint64_t v3 = 0;
+	uint64_t v4 = -TILE_HASH_PRIME1;
+	uint64_t h;
+	size_t row_bytes = (size_t)width * 4;
+	size_t i;
+	int y;
+
+	for (y = 0; y < height; y++, data += stride) {
+		for (i = 0; i + 32 <= row_bytes; i += 32) {
+			v1 = hash_round(v1, load64(data + i));
+			v2 = hash_round(v2, load64(data + i + 8));
+			v3 = hash_round(v3, load64(data + i + 16));
+			v4 = hash_round(v4, load64(data + i + 24));
+		}
+		for (; i + 8 <= row_bytes; i += 8)
+			v1 = hash_round(v1, load64(data + i));
+		if (i < row_bytes) {
+			uint32_t last;
+
+			memcpy(&last, data + i, sizeof last);
+			v2 = hash_round(v2, last);
+		}
+	}
+
+	h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+	h += (uint64_t)width << 32 | (uint32_t)height;
+
+	h ^= h >> 33;
+	h *= TILE_HASH_PRIME2;
+	h ^= h >> 29;
+	h *= TILE_HASH_PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+struct rdp_tile_cache *
+rdp_tile_cache_create(int width, int height)
+{
+	struct rdp_tile_cache *cache;
+	size_t count;
+
+	cache = zalloc(sizeof *cache);
+	if (!cache)
+		return NULL;
+
+	cache->width = width;
+	cache->height = height;
+	cache->tiles_x = (width + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	cache->tiles_y = (height + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	count = (size_t)cache->tiles_x * cache->tiles_y;
+
+	cache->hashes = calloc(count, sizeof *cache->hashes);
+	cache->valid = calloc(count, sizeof *cache->valid);
+	cache->seen = calloc(count, sizeof *cache->seen);
+	if (!cache->hashes || !cache->valid || !cache->seen) {
+		rdp_tile_cache_destroy(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void
+rdp_tile_cache_destroy(struct rdp_tile_cache *cache)
+{
+	if (!cache)
+		return;
+
+	free(cache->hashes);
+	free(cache->valid);
+	free(cache->seen);
+	free(cache);
+}
+
+/** Whether the cache was created for a surface of this size */
+int
+rdp_tile_cache_matches(struct rdp_tile_cache *cache, int width, int height)
+{
+	return cache->width == width && cache->height == height;
+}
+
+/** Forget all hashes, e.g. after the peer got a full refresh */
+void
+rdp_tile_cache_invalidate(struct rdp_tile_cache *cache)
+{
+	memset(cache->valid, 0,
+	       (size_t)cache->tiles_x * cache->tiles_y * sizeof *cache->valid);
+}
+
+/** Trim damage down to the tiles whose content changed
+ *
+ * Hashes every tile touched by \c damage in \c image, which must be a
+ * 32 bpp image of the size the cache was created for, and records the new
+ * hashes as what the peer will have after this update.
+ *
+ * \param changed Set to the part of \c damage lying in changed tiles.
+ * \param tiles_checked If not NULL, set to the number of tiles hashed.
+ * \return The number of changed tiles.
+ */
+int
+rdp_tile_cache_filter(struct rdp_tile_cache *cache, pixman_image_t *image,
+		      pixman_region32_t *damage, pixman_region32_t *changed,
+		      int *tiles_checked)
+{
+	const uint8_t *data = (const uint8_t *)pixman_image_get_data(image);
+	int stride = pixman_image_get_stride(image);
+	pixman_box32_t *rects;
+	int nrects, i, tx, ty, t;
+	int x1, y1, x2, y2, tx1, ty1, tx2, ty2;
+	int x, y, w, h;
+	int checked = 0, dirty = 0;
+	uint64_t hash;
+
+	pixman_region32_clear(changed);
+
+	/* Zero marks never-seen tiles, skip it on wrap-around */
+	if (++cache->generation == 0) {
+		memset(cache->seen, 0, (size_t)cache->tiles_x *
+		       cache->tiles_y * sizeof *cache->seen);
+		cache->generation = 1;
+	}
+
+	rects = pixman_region32_rectangles(damage, &nrects);
+	for (i = 0; i < nrects; i++) {
+		x1 = MAX(rects[i].x1, 0);
+		y1 = MAX(rects[i].y1, 0);
+		x2 = MIN(rects[i].x2, cache->width);
+		y2 = MIN(rects[i].y2, cache->height);
+		if (x2 <= x1 || y2 <= y1)
+			continue;
+
+		tx1 = x1 / RDP_TILE_SIZE;
+		ty1 = y1 / RDP_TILE_SIZE;
+		tx2 = (x2 - 1) / RDP_TILE_SIZE;
+		ty2 = (y2 - 1) / RDP_TILE_SIZE;
+
+		for (ty = ty1; ty <= ty2; ty++) {
+			for (tx = tx1; tx <= tx2; tx++) {
+				t = ty * cache->tiles_x + tx;
+				if (cache->seen[t] == cache->generation)
+					continue;
+				cache->seen[t] = cache->generation;
+				checked++;
+
+				x = tx * RDP_TILE_SIZE;
+				y = ty * RDP_TILE_SIZE;
+				w = MIN(RDP_TILE_SIZE, cache->width - x);
+				h = MIN(RDP_TILE_SIZE, cache->height - y);
+
+				hash = rdp_tile_hash(data + y * stride + x * 4,
+						     stride, w, h);
+				if (cache->valid[t] && cache->hashes[t] == hash)
+					continue;
+
+				cache->hashes[t] = hash;
+				cache->valid[t] = 1;
+				dirty++;
+				pixman_region32_union_rect(changed, changed,
+							   x, y, w, h);
+			}
+		}
+	}
+
+	pixman_region32_intersect(changed, changed, damage);
+
+	if (tiles_checked)
+		*tiles_checked = checked;
+
+	return dirty;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _RDP_TILE_CACHE_H_
+#define _RDP_TILE_CACHE_H_
+
+#include <stdint.h>
+#include <pixman.h>
+
+#define RDP_TILE_SIZE 64
+
+struct rdp_tile_cache;
+
+struct rdp_tile_cache *
+rdp_tile_cache_create(int width, int height);
+
+void
+rdp_tile_cache_destroy(struct rdp_tile_cache *cache);
+
+int
+rdp_tile_cache_matches(struct rdp_tile_cache *cache, int width, int height);
+
+void
+rdp_tile_cache_invalidate(struct rdp_tile_cache *cache);
+
+int
+rdp_tile_cache_filter(struct rdp_tile_cache *cache, pixman_image_t *image,
+		      pixman_region32_t *damage, pixman_region32_t *changed,
+		      int *tiles_checked);
+
+uint64_t
+rdp_tile_hash(const uint8_t *data, int stride, int width, int height);
+
+#endif /* _RDP_TILE_CACHE_H_ */
@@ -30,6 +30,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <linux/input.h>
 
 #if HAVE_FREERDP_VERSION_H
@@ -100,11 +104,14 @@
 #include "shared/timespec-util.h"
 #include <libweston/libweston.h>
 #include <libweston/backend-rdp.h>
+#include <libweston/weston-log.h>
 #include "pixman-renderer.h"
+#include "rdp-tile-cache.h"
 
 #define MAX_FREERDP_FDS 32
 #define DEFAULT_AXIS_STEP_DISTANCE 10
 #define RDP_MODE_FREQ 60 * 1000
+#define RDP_ENCODER_RETRY_MSEC 16
 
 #if FREERDP_VERSION_MAJOR >= 2 && defined(PIXEL_FORMAT_BGRA32) && !defined(PIXEL_FORMAT_B8G8R8A8)
 	/* The RDP API is truly wonderful: the pixel format definition changed
@@ -132,6 +139,9 @@ struct rdp_backend {
 	int tls_enabled;
 	int no_clients_resize;
 	int force_no_compression;
+
+	struct wl_list encoder_list;
+	struct weston_log_scope *debug;
 };
 
 enum peer_item_flags {
@@ -159,15 +169,95 @@ struct rdp_output {
 	struct wl_list peers;
 };
 
+enum rdp_peer_codec {
+	RDP_CODEC_RAW,
+	RDP_CODEC_NSC,
+	RDP_CODEC_RFX,
+};
+
+struct rdp_encoder_stats {
+	uint64_t frames;
+	uint64_t frames_idle;
+	uint64_t tiles_checked;
+	uint64_t tiles_changed;
+	uint64_t bytes;
+	uint64_t bytes_sent;
+	uint64_t encode_sum_ns;
+	uint64_t encode_max_ns;
+};
+
+/* One encoder per codec, shared by all the peers which negotiated it: a
+ * frame is compressed once and goes to each of them. NSCodec messages
+ * stand alone, so the bitstream itself is shared. The RemoteFX one
+ * carries state, see rdp_peer_write_rfx(), so only the encoded tiles
+ * are.
+ *
+ * Damage goes through the tile cache, then the changed part of the
+ * shadow is copied to the staging image and encoded by the worker
+ * thread while the compositor carries on. Damage arriving meanwhile
+ * accumulates in pending_damage. */
+struct rdp_encoder {
+	struct rdp_backend *b;
+	enum rdp_peer_codec codec;
+	int peer_count;
+	struct wl_list link; /* rdp_backend::encoder_list */
+
+	RFX_CONTEXT *rfx_context;
+	RFX_MESSAGE *rfx_message;
+	NSC_CONTEXT *nsc_context;
+	wStream *encode_stream;
+	RFX_RECT *rfx_rects;
+
+	struct rdp_tile_cache *tile_cache;
+	pixman_image_t *staging;
+	pixman_region32_t pending_damage;
+	pixman_region32_t encode_region;
+	int encode_tiles_checked;
+	int encode_tiles_changed;
+	int encode_skipped;
+	bool encoding;
+
+	bool encode_thread_running;
+	pthread_t encode_thread;
+	pthread_mutex_t encode_mutex;
+	pthread_cond_t encode_cond;
+	bool encode_requested;
+	bool encode_stopping;
+	int64_t encode_time_ns;
+	int encode_readfd;
+	int encode_writefd;
+	struct wl_event_source *encode_source;
+
+	/* Comes back for peers which were skipped while backed up */
+	struct wl_event_source *retry_timer;
+
+	struct rdp_encoder_stats stats;
+};
+
+struct rdp_peer_stats {
+	uint64_t frames;
+	uint64_t frames_skipped;
+	uint64_t bytes;
+};
+
 struct rdp_peer_context {
 	rdpContext _p;
 
 	struct rdp_backend *rdpBackend;
 	struct wl_event_source *events[MAX_FREERDP_FDS];
+
+	struct rdp_encoder *encoder;
+	/* Writes the RemoteFX bitstream of this peer */
 	RFX_CONTEXT *rfx_context;
-	wStream *encode_stream;
-	RFX_RECT *rfx_rects;
-	NSC_CONTEXT *nsc_context;
+	wStream *rfx_stream;
+	/* What changed while this peer was skipped, either because its
+	 * socket was backed up or because it suppressed output. Folded
+	 * into the next frame it takes. */
+	pixman_region32_t missed_damage;
+	/* Gets the frame the encoder has in flight */
+	bool encode_target;
+
+	struct rdp_peer_stats stats;
 
 	struct rdp_peers_item item;
 };
@@ -191,49 +281,28 @@ to_rdp_backend(struct weston_compositor *base)
 	return container_of(base->backend, struct rdp_backend, base);
 }
 
+/* Called on the encoder thread */
 static void
-rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encoder_encode_rfx(struct rdp_encoder *enc, pixman_region32_t *damage,
+		       pixman_image_t *image)
 {
 	int width, height, nrects, i;
 	pixman_box32_t *region, *rects;
 	uint32_t *ptr;
 	RFX_RECT *rfxRect;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND cmd;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
-
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
 
 	width = (damage->extents.x2 - damage->extents.x1);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-#ifdef HAVE_SKIP_COMPRESSION
-	cmd.skipCompression = TRUE;
-#else
-	memset(&cmd, 0, sizeof(*cmd));
-#endif
-#ifdef HAVE_SURFCMD_CMDTYPE
-	cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
-#endif
-	cmd.destLeft = damage->extents.x1;
-	cmd.destTop = damage->extents.y1;
-	cmd.destRight = damage->extents.x2;
-	cmd.destBottom = damage->extents.y2;
-	SURFACE_BPP(cmd) = 32;
-	SURFACE_CODECID(cmd) = peer->settings->RemoteFxCodecId;
-	SURFACE_WIDTH(cmd) = width;
-	SURFACE_HEIGHT(cmd) = height;
-
 	ptr = pixman_image_get_data(image) + damage->extents.x1 +
 				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
 
 	rects = pixman_region32_rectangles(damage, &nrects);
-	context->rfx_rects = realloc(context->rfx_rects, nrects * sizeof *rfxRect);
+	enc->rfx_rects = realloc(enc->rfx_rects, nrects * sizeof *rfxRect);
 
 	for (i = 0; i < nrects; i++) {
 		region = &rects[i];
-		rfxRect = &context->rfx_rects[i];
+		rfxRect = &enc->rfx_rects[i];
 
 		rfxRect->x = (region->x1 - damage->extents.x1);
 		rfxRect->y = (region->y1 - damage->extents.y1);
@@ -241,61 +310,105 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 		rfxRect->height = (region->y2 - region->y1);
 	}
 
-	rfx_compose_message(context->rfx_context, context->encode_stream, context->rfx_rects, nrects,
-			(BYTE *)ptr, width, height,
-			pixman_image_get_stride(image)
-	);
-
-	SURFACE_BITMAP_DATA_LEN(cmd) = Stream_GetPosition(context->encode_stream);
-	SURFACE_BITMAP_DATA(cmd) = Stream_Buffer(context->encode_stream);
-
-	update->SurfaceBits(update->context, &cmd);
+	enc->rfx_message = rfx_encode_message(enc->rfx_context, enc->rfx_rects,
+					      nrects, (BYTE *)ptr, width, height,
+					      pixman_image_get_stride(image));
 }
 
-
+/* Called on the encoder thread */
 static void
-rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encoder_encode_nsc(struct rdp_encoder *enc, pixman_region32_t *damage,
+		       pixman_image_t *image)
 {
 	int width, height;
 	uint32_t *ptr;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND cmd;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+	Stream_Clear(enc->encode_stream);
+	Stream_SetPosition(enc->encode_stream, 0);
 
 	width = (damage->extents.x2 - damage->extents.x1);
 	height = (damage->extents.y2 - damage->extents.y1);
 
+	ptr = pixman_image_get_data(image) + damage->extents.x1 +
+				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+
+	nsc_compose_message(enc->nsc_context, enc->encode_stream, (BYTE *)ptr,
+			width, height,
+			pixman_image_get_stride(image));
+}
+
+/* The RemoteFX bitstream starts with the codec headers after each reset of
+ * the context writing it, rfx_write_message() sends them while the context
+ * is in RFX_STATE_SEND_HEADERS. Writing the shared tiles with a context of
+ * the peer's own keeps that to the peer: resetting it for a peer which
+ * (re)activates does not disturb the others. The frame numbers come from
+ * the shared encoder, a peer which skipped frames sees a gap in them;
+ * RemoteFX frames are coded on their own, they only order the frames. */
+static size_t
+rdp_peer_write_rfx(RdpPeerContext *context, RFX_MESSAGE *message)
+{
+	Stream_SetPosition(context->rfx_stream, 0);
+
+	if (!rfx_write_message(context->rfx_context, context->rfx_stream,
+			       message))
+		return 0;
+
+	return Stream_GetPosition(context->rfx_stream);
+}
+
+static size_t
+rdp_peer_send_encoded(RdpPeerContext *context, struct rdp_encoder *enc)
+{
+	freerdp_peer *peer = context->item.peer;
+	pixman_region32_t *damage = &enc->encode_region;
+	rdpUpdate *update = peer->update;
+	SURFACE_BITS_COMMAND cmd;
+	wStream *stream;
+	size_t len;
+
+	if (enc->codec == RDP_CODEC_RFX) {
+		if (!enc->rfx_message)
+			return 0;
+
+		stream = context->rfx_stream;
+		len = rdp_peer_write_rfx(context, enc->rfx_message);
+	} else {
+		stream = enc->encode_stream;
+		len = Stream_GetPosition(stream);
+	}
+
+	if (len == 0)
+		return 0;
+
+	memset(&cmd, 0, sizeof(cmd));
 #ifdef HAVE_SKIP_COMPRESSION
 	cmd.skipCompression = TRUE;
-#else
-	memset(cmd, 0, sizeof(*cmd));
 #endif
 #ifdef HAVE_SURFCMD_CMDTYPE
-	cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
+	if (enc->codec == RDP_CODEC_RFX)
+		cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
+	else
+		cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
 #endif
 	cmd.destLeft = damage->extents.x1;
 	cmd.destTop = damage->extents.y1;
 	cmd.destRight = damage->extents.x2;
 	cmd.destBottom = damage->extents.y2;
 	SURFACE_BPP(cmd) = 32;
-	SURFACE_CODECID(cmd) = peer->settings->NSCodecId;
-	SURFACE_WIDTH(cmd) = width;
-	SURFACE_HEIGHT(cmd) = height;
-
-	ptr = pixman_image_get_data(image) + damage->extents.x1 +
-				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
-
-	nsc_compose_message(context->nsc_context, context->encode_stream, (BYTE *)ptr,
-			width, height,
-			pixman_image_get_stride(image));
+	/* The codec ids are negotiated per peer */
+	if (enc->codec == RDP_CODEC_RFX)
+		SURFACE_CODECID(cmd) = peer->settings->RemoteFxCodecId;
+	else
+		SURFACE_CODECID(cmd) = peer->settings->NSCodecId;
+	SURFACE_WIDTH(cmd) = damage->extents.x2 - damage->extents.x1;
+	SURFACE_HEIGHT(cmd) = damage->extents.y2 - damage->extents.y1;
 
-	SURFACE_BITMAP_DATA_LEN(cmd) = Stream_GetPosition(context->encode_stream);
-	SURFACE_BITMAP_DATA(cmd) = Stream_Buffer(context->encode_stream);
+	SURFACE_BITMAP_DATA_LEN(cmd) = len;
+	SURFACE_BITMAP_DATA(cmd) = Stream_Buffer(stream);
 
 	update->SurfaceBits(update->context, &cmd);
+
+	return len;
 }
 
 static void
@@ -375,19 +488,783 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	update->SurfaceFrameMarker(peer->context, &marker);
 }
 
+static const char *
+rdp_peer_name(freerdp_peer *peer)
+{
+	if (peer->settings->ClientHostname)
+		return peer->settings->ClientHostname;
+
+	return peer->settings->ClientAddress;
+}
+
+static const char *
+rdp_codec_name(enum rdp_peer_codec codec)
+{
+	switch (codec) {
+	case RDP_CODEC_RFX:
+		return "rfx";
+	case RDP_CODEC_NSC:
+		return "nsc";
+	case RDP_CODEC_RAW:
+		break;
+	}
+
+	return "raw";
+}
+
+static enum rdp_peer_codec
+rdp_peer_codec(rdpSettings *settings)
+{
+	if (settings->RemoteFxCodec)
+		return RDP_CODEC_RFX;
+	if (settings->NSCodec)
+		return RDP_CODEC_NSC;
+
+	return RDP_CODEC_RAW;
+}
+
+static uint64_t
+rdp_region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint64_t area = 0;
+	int n, i;
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+static bool
+rdp_peer_wants_frames(RdpPeerContext *context)
+{
+	int flags = context->item.flags;
+
+	return (flags & RDP_PEER_ACTIVATED) &&
+	       (flags & RDP_PEER_OUTPUT_ENABLED);
+}
+
+/* Whether the peer's socket still has not taken the previous updates. A
+ * slow peer is skipped rather than letting FreeRDP block the compositor
+ * on the write. */
+static bool
+rdp_peer_is_backed_up(freerdp_peer *peer)
+{
+#if FREERDP_VERSION_MAJOR >= 2
+	if (!peer->IsWriteBlocked || !peer->IsWriteBlocked(peer))
+		return false;
+
+	if (peer->DrainOutputBuffer)
+		peer->DrainOutputBuffer(peer);
+
+	return peer->IsWriteBlocked(peer);
+#else
+	return false;
+#endif
+}
+
+static void
+rdp_encoder_free_message(struct rdp_encoder *enc)
+{
+	if (!enc->rfx_message)
+		return;
+
+	rfx_message_free(enc->rfx_context, enc->rfx_message);
+	enc->rfx_message = NULL;
+}
+
+static void *
+rdp_encoder_thread(void *data)
+{
+	struct rdp_encoder *enc = data;
+	struct timespec start, end;
+	char done = 1;
+
+	pthread_mutex_lock(&enc->encode_mutex);
+	for (;;) {
+		while (!enc->encode_requested && !enc->encode_stopping)
+			pthread_cond_wait(&enc->encode_cond,
+					  &enc->encode_mutex);
+
+		if (enc->encode_stopping)
+			break;
+
+		enc->encode_requested = false;
+		pthread_mutex_unlock(&enc->encode_mutex);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (enc->codec == RDP_CODEC_RFX)
+			rdp_encoder_encode_rfx(enc, &enc->encode_region,
+					       enc->staging);
+		else
+			rdp_encoder_encode_nsc(enc, &enc->encode_region,
+					       enc->staging);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		pthread_mutex_lock(&enc->encode_mutex);
+		enc->encode_time_ns = timespec_sub_to_nsec(&end, &start);
+
+		if (write(enc->encode_writefd, &done, 1) != 1)
+			weston_log("rdp: failed to signal encoded frame\n");
+	}
+	pthread_mutex_unlock(&enc->encode_mutex);
+
+	return NULL;
+}
+
+/* Wait for the frame in flight, if any, and throw it away */
+static void
+rdp_encoder_cancel(struct rdp_encoder *enc)
+{
+	struct rdp_peers_item *item;
+	RdpPeerContext *context;
+	char done;
+
+	if (!enc->encoding)
+		return;
+
+	while (read(enc->encode_readfd, &done, 1) < 0 && errno == EINTR)
+		;
+
+	enc->encoding = false;
+	rdp_encoder_free_message(enc);
+
+	/* Its targets never get it, so they have to catch up */
+	wl_list_for_each(item, &enc->b->output->peers, link) {
+		context = container_of(item, RdpPeerContext, item);
+		if (context->encoder != enc || !context->encode_target)
+			continue;
+
+		context->encode_target = false;
+		pixman_region32_union(&context->missed_damage,
+				      &context->missed_damage,
+				      &enc->encode_region);
+	}
+}
+
+static bool
+rdp_encoder_ensure_buffers(struct rdp_encoder *enc, int width, int height)
+{
+	if (enc->tile_cache &&
+	    rdp_tile_cache_matches(enc->tile_cache, width, height))
+		return true;
+
+	rdp_tile_cache_destroy(enc->tile_cache);
+	if (enc->staging)
+		pixman_image_unref(enc->staging);
+
+	enc->tile_cache = rdp_tile_cache_create(width, height);
+	enc->staging = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+						width, height, NULL,
+						width * 4);
+
+	if (!enc->tile_cache || !enc->staging) {
+		rdp_tile_cache_destroy(enc->tile_cache);
+		enc->tile_cache = NULL;
+		if (enc->staging)
+			pixman_image_unref(enc->staging);
+		enc->staging = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static void
+rdp_encoder_debug_frame(struct rdp_encoder *enc, int sent, size_t bytes,
+			int64_t encode_ns)
+{
+	struct weston_log_scope *debug = enc->b->debug;
+
+	if (!weston_log_scope_is_enabled(debug))
+		return;
+
+	weston_log_scope_printf(debug,
+		"[rdp] %s: frame %"PRIu64": tiles %d/%d changed, "
+		"%"PRIu64" px, %zu bytes, encode %"PRId64" us, "
+		"sent to %d peers, %d skipped\n",
+		rdp_codec_name(enc->codec), enc->stats.frames,
+		enc->encode_tiles_changed, enc->encode_tiles_checked,
+		rdp_region_area(&enc->encode_region), bytes,
+		encode_ns / 1000, sent, enc->encode_skipped);
+}
+
+static void
+rdp_encoder_kick(struct rdp_encoder *enc)
+{
+	struct rdp_output *output = enc->b->output;
+	pixman_image_t *shadow = output->shadow_surface;
+	int width = pixman_image_get_width(shadow);
+	int height = pixman_image_get_height(shadow);
+	struct rdp_peers_item *item;
+	RdpPeerContext *context;
+	pixman_box32_t *extents;
+	int checked, changed;
+	int targets = 0, skipped = 0;
+	bool up_to_date = false;
+	bool deferred = false;
+	size_t bytes;
+
+	if (!rdp_encoder_ensure_buffers(enc, width, height)) {
+		weston_log("rdp: failed to allocate encoding buffers\n");
+		pixman_region32_clear(&enc->pending_damage);
+		return;
+	}
+
+	changed = rdp_tile_cache_filter(enc->tile_cache, shadow,
+					&enc->pending_damage,
+					&enc->encode_region, &checked);
+	pixman_region32_clear(&enc->pending_damage);
+
+	enc->stats.tiles_checked += checked;
+	enc->stats.tiles_changed += changed;
+	enc->encode_tiles_checked = checked;
+	enc->encode_tiles_changed = changed;
+
+	/* Peers which cannot take this frame remember what changed... */
+	wl_list_for_each(item, &output->peers, link) {
+		context = container_of(item, RdpPeerContext, item);
+		if (context->encoder != enc)
+			continue;
+
+		context->encode_target = rdp_peer_wants_frames(context) &&
+			!rdp_peer_is_backed_up(item->peer);
+		if (context->encode_target)
+			continue;
+
+		pixman_region32_union(&context->missed_damage,
+				      &context->missed_damage,
+				      &enc->encode_region);
+
+		if (rdp_peer_wants_frames(context) &&
+		    pixman_region32_not_empty(&context->missed_damage)) {
+			context->stats.frames_skipped++;
+			skipped++;
+		}
+	}
+
+	/* The peers which are up to date get the new changes alone. Those
+	 * catching up, like one which just joined and needs the whole
+	 * screen, get what they missed in a frame of their own right after,
+	 * rather than making everybody take it. */
+	if (pixman_region32_not_empty(&enc->encode_region)) {
+		wl_list_for_each(item, &output->peers, link) {
+			context = container_of(item, RdpPeerContext, item);
+			if (context->encoder == enc && context->encode_target &&
+			    !pixman_region32_not_empty(&context->missed_damage))
+				up_to_date = true;
+		}
+	}
+
+	/* Either way, the peers in a frame get the union of what each of
+	 * them missed, which is what lets them share one encode. */
+	wl_list_for_each(item, &output->peers, link) {
+		context = container_of(item, RdpPeerContext, item);
+		if (context->encoder != enc || !context->encode_target)
+			continue;
+
+		/* Without new changes, only the ones catching up get a frame */
+		if (!up_to_date &&
+		    !pixman_region32_not_empty(&context->missed_damage)) {
+			context->encode_target = false;
+			continue;
+		}
+
+		if (up_to_date &&
+		    pixman_region32_not_empty(&context->missed_damage)) {
+			context->encode_target = false;
+			pixman_region32_union(&context->missed_damage,
+					      &context->missed_damage,
+					      &enc->encode_region);
+			deferred = true;
+			continue;
+		}
+
+		pixman_region32_union(&enc->encode_region,
+				      &enc->encode_region,
+				      &context->missed_damage);
+		pixman_region32_clear(&context->missed_damage);
+		targets++;
+	}
+
+	/* What was missed before a resize may lie outside the surface */
+	pixman_region32_intersect_rect(&enc->encode_region,
+				       &enc->encode_region,
+				       0, 0, width, height);
+
+	enc->encode_skipped = skipped;
+	if (skipped)
+		wl_event_source_timer_update(enc->retry_timer,
+					     RDP_ENCODER_RETRY_MSEC);
+
+	if (!targets || !pixman_region32_not_empty(&enc->encode_region)) {
+		wl_list_for_each(item, &output->peers, link) {
+			context = container_of(item, RdpPeerContext, item);
+			if (context->encoder == enc)
+				context->encode_target = false;
+		}
+
+		if (!pixman_region32_not_empty(&enc->encode_region))
+			enc->stats.frames_idle++;
+		rdp_encoder_debug_frame(enc, 0, 0, 0);
+		return;
+	}
+
+	enc->stats.frames++;
+
+	if (enc->codec == RDP_CODEC_RAW) {
+		/* Nothing to compress, send straight from the shadow */
+		bytes = rdp_region_area(&enc->encode_region) * 4;
+		wl_list_for_each(item, &output->peers, link) {
+			context = container_of(item, RdpPeerContext, item);
+			if (context->encoder != enc || !context->encode_target)
+				continue;
+
+			context->encode_target = false;
+			rdp_peer_refresh_raw(&enc->encode_region, shadow,
+					     item->peer);
+			context->stats.frames++;
+			context->stats.bytes += bytes;
+			enc->stats.bytes_sent += bytes;
+		}
+		enc->stats.bytes += bytes;
+		rdp_encoder_debug_frame(enc, targets, bytes, 0);
+
+		/* No encode to wait for, the peers catching up go next */
+		if (deferred)
+			rdp_encoder_kick(enc);
+		return;
+	}
+
+	/* The codecs read whole blocks around the rectangles, so give the
+	 * encoder the full extents. */
+	extents = pixman_region32_extents(&enc->encode_region);
+	pixman_image_composite32(PIXMAN_OP_SRC, shadow, NULL, enc->staging,
+				 extents->x1, extents->y1, 0, 0,
+				 extents->x1, extents->y1,
+				 extents->x2 - extents->x1,
+				 extents->y2 - extents->y1);
+
+	enc->encoding = true;
+
+	pthread_mutex_lock(&enc->encode_mutex);
+	enc->encode_requested = true;
+	pthread_cond_signal(&enc->encode_cond);
+	pthread_mutex_unlock(&enc->encode_mutex);
+}
+
+static bool
+rdp_encoder_has_work(struct rdp_encoder *enc)
+{
+	struct rdp_peers_item *item;
+	RdpPeerContext *context;
+
+	if (pixman_region32_not_empty(&enc->pending_damage))
+		return true;
+
+	wl_list_for_each(item, &enc->b->output->peers, link) {
+		context = container_of(item, RdpPeerContext, item);
+		if (context->encoder == enc &&
+		    rdp_peer_wants_frames(context) &&
+		    pixman_region32_not_empty(&context->missed_damage))
+			return true;
+	}
+
+	return false;
+}
+
+static int
+rdp_encoder_done(int fd, uint32_t mask, void *data)
+{
+	struct rdp_encoder *enc = data;
+	struct rdp_peers_item *item;
+	RdpPeerContext *context;
+	int64_t encode_ns;
+	size_t bytes = 0, len;
+	int sent = 0;
+	char done;
+
+	if (read(fd, &done, 1) != 1)
+		return 0;
+
+	pthread_mutex_lock(&enc->encode_mutex);
+	encode_ns = enc->encode_time_ns;
+	pthread_mutex_unlock(&enc->encode_mutex);
+
+	enc->encoding = false;
+
+	wl_list_for_each(item, &enc->b->output->peers, link) {
+		context = container_of(item, RdpPeerContext, item);
+		if (context->encoder != enc || !context->encode_target)
+			continue;
+
+		context->encode_target = false;
+		if (!rdp_peer_wants_frames(context)) {
+			/* Suppressed its output meanwhile */
+			pixman_region32_union(&context->missed_damage,
+					      &context->missed_damage,
+					      &enc->encode_region);
+			continue;
+		}
+
+		len = rdp_peer_send_encoded(context, enc);
+		if (len == 0) {
+			weston_log("rdp: failed to write an encoded frame "
+				   "for %s\n", rdp_peer_name(item->peer));
+			continue;
+		}
+
+		/* With RemoteFX, each peer's bitstream has its own size */
+		bytes = MAX(bytes, len);
+		context->stats.frames++;
+		context->stats.bytes += len;
+		enc->stats.bytes_sent += len;
+		sent++;
+	}
+
+	rdp_encoder_free_message(enc);
+
+	enc->stats.bytes += bytes;
+	enc->stats.encode_sum_ns += encode_ns;
+	enc->stats.encode_max_ns = MAX(enc->stats.encode_max_ns,
+				       (uint64_t)encode_ns);
+	rdp_encoder_debug_frame(enc, sent, bytes, encode_ns);
+
+	if (rdp_encoder_has_work(enc))
+		rdp_encoder_kick(enc);
+
+	return 0;
+}
+
+static int
+rdp_encoder_retry(void *data)
+{
+	struct rdp_encoder *enc = data;
+
+	/* Otherwise picked up when the frame in flight is done */
+	if (!enc->encoding && rdp_encoder_has_work(enc))
+		rdp_encoder_kick(enc);
+
+	return 0;
+}
+
+static int
+rdp_encoder_start_thread(struct rdp_encoder *enc, struct wl_event_loop *loop)
+{
+	int fd[2];
+
+	if (pipe2(fd, O_CLOEXEC) == -1)
+		return -1;
+
+	enc->encode_readfd = fd[0];
+	enc->encode_writefd = fd[1];
+	enc->encode_source =
+		wl_event_loop_add_fd(loop, enc->encode_readfd,
+				     WL_EVENT_READABLE,
+				     rdp_encoder_done, enc);
+	if (!enc->encode_source)
+		goto err_pipe;
+
+	pthread_mutex_init(&enc->encode_mutex, NULL);
+	pthread_cond_init(&enc->encode_cond, NULL);
+
+	if (pthread_create(&enc->encode_thread, NULL,
+			   rdp_encoder_thread, enc) != 0)
+		goto err_source;
+
+	enc->encode_thread_running = true;
+
+	return 0;
+
+err_source:
+	pthread_cond_destroy(&enc->encode_cond);
+	pthread_mutex_destroy(&enc->encode_mutex);
+	wl_event_source_remove(enc->encode_source);
+	enc->encode_source = NULL;
+err_pipe:
+	close(enc->encode_readfd);
+	close(enc->encode_writefd);
+	return -1;
+}
+
+static RFX_CONTEXT *
+rdp_rfx_context_create(void)
+{
+#if FREERDP_VERSION_MAJOR == 1 && FREERDP_VERSION_MINOR == 1
+	return rfx_context_new();
+#else
+	return rfx_context_new(TRUE);
+#endif
+}
+
+/* The encoder's context and the peers' ones must agree on the mode and
+ * the pixel format, which the tiles and the headers reflect */
+static void
+rdp_rfx_context_setup(RFX_CONTEXT *rfx_context, struct rdp_output *output)
+{
+	rfx_context->mode = RLGR3;
+	rfx_context->width = output->base.width;
+	rfx_context->height = output->base.height;
+	rfx_context_set_pixel_format(rfx_context, DEFAULT_PIXEL_FORMAT);
+}
+
 static void
-rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+rdp_encoder_destroy(struct rdp_encoder *enc)
+{
+	if (enc->encode_thread_running) {
+		pthread_mutex_lock(&enc->encode_mutex);
+		enc->encode_stopping = true;
+		pthread_cond_signal(&enc->encode_cond);
+		pthread_mutex_unlock(&enc->encode_mutex);
+
+		pthread_join(enc->encode_thread, NULL);
+
+		pthread_cond_destroy(&enc->encode_cond);
+		pthread_mutex_destroy(&enc->encode_mutex);
+		wl_event_source_remove(enc->encode_source);
+		close(enc->encode_readfd);
+		close(enc->encode_writefd);
+	}
+
+	if (enc->retry_timer)
+		wl_event_source_remove(enc->retry_timer);
+
+	rdp_tile_cache_destroy(enc->tile_cache);
+	if (enc->staging)
+		pixman_image_unref(enc->staging);
+	pixman_region32_fini(&enc->pending_damage);
+	pixman_region32_fini(&enc->encode_region);
+
+	rdp_encoder_free_message(enc);
+	if (enc->encode_stream)
+		Stream_Free(enc->encode_stream, TRUE);
+	if (enc->nsc_context)
+		nsc_context_free(enc->nsc_context);
+	if (enc->rfx_context)
+		rfx_context_free(enc->rfx_context);
+	free(enc->rfx_rects);
+
+	wl_list_remove(&enc->link);
+	free(enc);
+}
+
+static struct rdp_encoder *
+rdp_encoder_create(struct rdp_backend *b, enum rdp_peer_codec codec)
+{
+	struct wl_event_loop *loop;
+	struct rdp_encoder *enc;
+
+	enc = zalloc(sizeof *enc);
+	if (!enc)
+		return NULL;
+
+	enc->b = b;
+	enc->codec = codec;
+	pixman_region32_init(&enc->pending_damage);
+	pixman_region32_init(&enc->encode_region);
+	wl_list_insert(&b->encoder_list, &enc->link);
+
+	loop = wl_display_get_event_loop(b->compositor->wl_display);
+	enc->retry_timer = wl_event_loop_add_timer(loop, rdp_encoder_retry,
+						   enc);
+	if (!enc->retry_timer)
+		goto err;
+
+	switch (codec) {
+	case RDP_CODEC_RAW:
+		return enc;
+	case RDP_CODEC_RFX:
+		enc->rfx_context = rdp_rfx_context_create();
+		if (!enc->rfx_context)
+			goto err;
+
+		rdp_rfx_context_setup(enc->rfx_context, b->output);
+		break;
+	case RDP_CODEC_NSC:
+		enc->nsc_context = nsc_context_new();
+		if (!enc->nsc_context)
+			goto err;
+
+#ifdef HAVE_NSC_CONTEXT_SET_PARAMETERS
+		nsc_context_set_parameters(enc->nsc_context, NSC_COLOR_FORMAT, DEFAULT_PIXEL_FORMAT);
+#else
+		nsc_context_set_pixel_format(enc->nsc_context, DEFAULT_PIXEL_FORMAT);
+#endif
+
+		enc->encode_stream = Stream_New(NULL, 65536);
+		if (!enc->encode_stream)
+			goto err;
+		break;
+	}
+
+	if (rdp_encoder_start_thread(enc, loop) < 0)
+		goto err;
+
+	return enc;
+
+err:
+	rdp_encoder_destroy(enc);
+	return NULL;
+}
+
+static void
+rdp_encoder_refresh(struct rdp_encoder *enc, pixman_region32_t *region)
+{
+	pixman_region32_union(&enc->pending_damage,
+			      &enc->pending_damage, region);
+
+	/* Otherwise picked up when the frame in flight is done */
+	if (!enc->encoding)
+		rdp_encoder_kick(enc);
+}
+
+/* After a mode switch: the frame in flight has the old size, and the
+ * shared contexts encode at the output size */
+static void
+rdp_encoder_resize(struct rdp_encoder *enc, int width, int height)
+{
+	rdp_encoder_cancel(enc);
+
+	if (enc->rfx_context)
+		RFX_RESET(enc->rfx_context, width, height);
+	if (enc->nsc_context)
+		NSC_RESET(enc->nsc_context, width, height);
+}
+
+static void
+rdp_peer_release_encoder(RdpPeerContext *context)
+{
+	struct rdp_encoder *enc = context->encoder;
+
+	if (context->rfx_stream)
+		Stream_Free(context->rfx_stream, TRUE);
+	context->rfx_stream = NULL;
+	if (context->rfx_context)
+		rfx_context_free(context->rfx_context);
+	context->rfx_context = NULL;
+
+	if (!enc)
+		return;
+
+	context->encoder = NULL;
+	context->encode_target = false;
+	if (--enc->peer_count == 0)
+		rdp_encoder_destroy(enc);
+}
+
+static int
+rdp_peer_init_rfx(RdpPeerContext *context)
+{
+	context->rfx_context = rdp_rfx_context_create();
+	if (!context->rfx_context)
+		return -1;
+
+	rdp_rfx_context_setup(context->rfx_context,
+			      context->rdpBackend->output);
+
+	context->rfx_stream = Stream_New(NULL, 65536);
+	if (!context->rfx_stream)
+		return -1;
+
+	return 0;
+}
+
+/* Attach the peer to the encoder shared by the peers using its codec */
+static int
+rdp_peer_set_encoder(RdpPeerContext *context, enum rdp_peer_codec codec)
+{
+	struct rdp_backend *b = context->rdpBackend;
+	struct rdp_encoder *enc;
+
+	if (context->encoder && context->encoder->codec == codec)
+		return 0;
+
+	rdp_peer_release_encoder(context);
+
+	if (codec == RDP_CODEC_RFX && rdp_peer_init_rfx(context) < 0)
+		goto err;
+
+	wl_list_for_each(enc, &b->encoder_list, link) {
+		if (enc->codec == codec) {
+			context->encoder = enc;
+			enc->peer_count++;
+			return 0;
+		}
+	}
+
+	enc = rdp_encoder_create(b, codec);
+	if (!enc)
+		goto err;
+
+	context->encoder = enc;
+	enc->peer_count++;
+
+	return 0;
+
+err:
+	rdp_peer_release_encoder(context);
+	return -1;
+}
+
+/* The whole screen goes out with the next frame of the shared encoder */
+static void
+rdp_peer_refresh_full(RdpPeerContext *context)
 {
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 	struct rdp_output *output = context->rdpBackend->output;
-	rdpSettings *settings = peer->settings;
 
-	if (settings->RemoteFxCodec)
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
-	else if (settings->NSCodec)
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
-	else
-		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+	pixman_region32_union_rect(&context->missed_damage,
+				   &context->missed_damage, 0, 0,
+				   output->base.width, output->base.height);
+
+	if (context->encoder && !context->encoder->encoding)
+		rdp_encoder_kick(context->encoder);
+}
+
+static void
+rdp_debug_subscribe(struct weston_log_subscription *sub, void *data)
+{
+	struct rdp_backend *b = data;
+	struct rdp_encoder *enc;
+	struct rdp_encoder_stats *st;
+	struct rdp_peers_item *item;
+	RdpPeerContext *context;
+
+	if (!b->output)
+		return;
+
+	wl_list_for_each(enc, &b->encoder_list, link) {
+		st = &enc->stats;
+
+		weston_log_subscription_printf(sub,
+			"%s encoder: %d peers, %"PRIu64" frames, "
+			"%"PRIu64" idle, tiles %"PRIu64"/%"PRIu64" changed, "
+			"%"PRIu64" bytes encoded, %"PRIu64" sent, "
+			"encode avg %"PRIu64" us max %"PRIu64" us\n",
+			rdp_codec_name(enc->codec), enc->peer_count,
+			st->frames, st->frames_idle, st->tiles_changed,
+			st->tiles_checked, st->bytes, st->bytes_sent,
+			st->frames ? st->encode_sum_ns / st->frames / 1000 : 0,
+			st->encode_max_ns / 1000);
+	}
+
+	wl_list_for_each(item, &b->output->peers, link) {
+		context = container_of(item, RdpPeerContext, item);
+
+		if (!(item->flags & RDP_PEER_ACTIVATED) || !context->encoder)
+			continue;
+
+		weston_log_subscription_printf(sub,
+			"%s (%s): %"PRIu64" frames, %"PRIu64" skipped, "
+			"%"PRIu64" bytes, %"PRIu64" px behind\n",
+			rdp_peer_name(item->peer),
+			rdp_codec_name(context->encoder->codec),
+			context->stats.frames, context->stats.frames_skipped,
+			context->stats.bytes,
+			rdp_region_area(&context->missed_damage));
+	}
 }
 
 static int
@@ -407,19 +1284,15 @@ rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage,
 {
 	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
 	struct weston_compositor *ec = output->base.compositor;
-	struct rdp_peers_item *outputPeer;
+	struct rdp_backend *b = to_rdp_backend(ec);
+	struct rdp_encoder *enc;
 
 	pixman_renderer_output_set_buffer(output_base, output->shadow_surface);
 	ec->renderer->repaint_output(&output->base, damage);
 
 	if (pixman_region32_not_empty(damage)) {
-		wl_list_for_each(outputPeer, &output->peers, link) {
-			if ((outputPeer->flags & RDP_PEER_ACTIVATED) &&
-					(outputPeer->flags & RDP_PEER_OUTPUT_ENABLED))
-			{
-				rdp_peer_refresh_region(damage, outputPeer->peer);
-			}
-		}
+		wl_list_for_each(enc, &b->encoder_list, link)
+			rdp_encoder_refresh(enc, damage);
 	}
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
@@ -472,6 +1345,8 @@ static int
 rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 {
 	struct rdp_output *rdpOutput = container_of(output, struct rdp_output, base);
+	struct rdp_backend *b = to_rdp_backend(output->compositor);
+	struct rdp_encoder *enc;
 	struct rdp_peers_item *rdpPeer;
 	rdpSettings *settings;
 	pixman_image_t *new_shadow_buffer;
@@ -502,6 +1377,9 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 	pixman_image_unref(rdpOutput->shadow_surface);
 	rdpOutput->shadow_surface = new_shadow_buffer;
 
+	wl_list_for_each(enc, &b->encoder_list, link)
+		rdp_encoder_resize(enc, target_mode->width, target_mode->height);
+
 	wl_list_for_each(rdpPeer, &rdpOutput->peers, link) {
 		settings = rdpPeer->peer->settings;
 		if (settings->DesktopWidth == (UINT32)target_mode->width &&
@@ -696,6 +1574,7 @@ rdp_destroy(struct weston_compositor *ec)
 
 	freerdp_listener_free(b->listener);
 
+	weston_log_scope_destroy(b->debug);
 	free(b->server_cert);
 	free(b->server_key);
 	free(b->rdp_key);
@@ -748,40 +1627,9 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 	context->item.peer = client;
 	context->item.flags = RDP_PEER_OUTPUT_ENABLED;
 
-#if FREERDP_VERSION_MAJOR == 1 && FREERDP_VERSION_MINOR == 1
-	context->rfx_context = rfx_context_new();
-#else
-	context->rfx_context = rfx_context_new(TRUE);
-#endif
-	if (!context->rfx_context) {
-		FREERDP_CB_RETURN(FALSE);
-	}
-
-	context->rfx_context->mode = RLGR3;
-	context->rfx_context->width = client->settings->DesktopWidth;
-	context->rfx_context->height = client->settings->DesktopHeight;
-	rfx_context_set_pixel_format(context->rfx_context, DEFAULT_PIXEL_FORMAT);
-
-	context->nsc_context = nsc_context_new();
-	if (!context->nsc_context)
-		goto out_error_nsc;
-
-#ifdef HAVE_NSC_CONTEXT_SET_PARAMETERS
-	nsc_context_set_parameters(context->nsc_context, NSC_COLOR_FORMAT, DEFAULT_PIXEL_FORMAT);
-#else
-	nsc_context_set_pixel_format(context->nsc_context, DEFAULT_PIXEL_FORMAT);
-#endif
-	context->encode_stream = Stream_New(NULL, 65536);
-	if (!context->encode_stream)
-		goto out_error_stream;
+	pixman_region32_init(&context->missed_damage);
 
 	FREERDP_CB_RETURN(TRUE);
-
-out_error_nsc:
-	rfx_context_free(context->rfx_context);
-out_error_stream:
-	nsc_context_free(context->nsc_context);
-	FREERDP_CB_RETURN(FALSE);
 }
 
 static void
@@ -804,10 +1652,8 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 		 * but it would crash on reconnect */
 	}
 
-	Stream_Free(context->encode_stream, TRUE);
-	nsc_context_free(context->nsc_context);
-	rfx_context_free(context->rfx_context);
-	free(context->rfx_rects);
+	rdp_peer_release_encoder(context);
+	pixman_region32_fini(&context->missed_damage);
 }
 
 
@@ -980,9 +1826,8 @@ xf_peer_activate(freerdp_peer* client)
 	struct xkb_rule_names xkbRuleNames;
 	struct xkb_keymap *keymap;
 	struct weston_output *weston_output;
+	struct rdp_encoder *encoder;
 	int i;
-	pixman_box32_t box;
-	pixman_region32_t damage;
 	char seat_name[50];
 	POINTER_SYSTEM_UPDATE pointer_system;
 
@@ -1033,9 +1878,22 @@ xf_peer_activate(freerdp_peer* client)
 		}
 	}
 
+	if (rdp_peer_set_encoder(peerCtx, rdp_peer_codec(settings)) < 0) {
+		weston_log("unable to create the peer encoder\n");
+		return FALSE;
+	}
+	encoder = peerCtx->encoder;
+
+	/* Only this peer's RemoteFX bitstream starts over, with the codec
+	 * headers. NSCodec messages do not depend on each other, resetting
+	 * the shared context only has to wait for the frame in flight. */
 	weston_output = &output->base;
-	RFX_RESET(peerCtx->rfx_context, weston_output->width, weston_output->height);
-	NSC_RESET(peerCtx->nsc_context, weston_output->width, weston_output->height);
+	if (peerCtx->rfx_context)
+		RFX_RESET(peerCtx->rfx_context, weston_output->width, weston_output->height);
+	if (encoder->nsc_context) {
+		rdp_encoder_cancel(encoder);
+		NSC_RESET(encoder->nsc_context, weston_output->width, weston_output->height);
+	}
 
 	if (peersItem->flags & RDP_PEER_ACTIVATED)
 		return TRUE;
@@ -1089,15 +1947,7 @@ xf_peer_activate(freerdp_peer* client)
 	pointer->PointerSystem(client->context, &pointer_system);
 
 	/* sends a full refresh */
-	box.x1 = 0;
-	box.y1 = 0;
-	box.x2 = output->base.width;
-	box.y2 = output->base.height;
-	pixman_region32_init_with_extents(&damage, &box);
-
-	rdp_peer_refresh_region(&damage, client);
-
-	pixman_region32_fini(&damage);
+	rdp_peer_refresh_full(peerCtx);
 
 	return TRUE;
 }
@@ -1193,22 +2043,10 @@ xf_extendedMouseEvent(rdpInput *input, UINT16 flags, UINT16 x, UINT16 y)
 static FREERDP_CB_RET_TYPE
 xf_input_synchronize_event(rdpInput *input, UINT32 flags)
 {
-	freerdp_peer *client = input->context->peer;
 	RdpPeerContext *peerCtx = (RdpPeerContext *)input->context;
-	struct rdp_output *output = peerCtx->rdpBackend->output;
-	pixman_box32_t box;
-	pixman_region32_t damage;
 
 	/* sends a full refresh */
-	box.x1 = 0;
-	box.y1 = 0;
-	box.x2 = output->base.width;
-	box.y2 = output->base.height;
-	pixman_region32_init_with_extents(&damage, &box);
-
-	rdp_peer_refresh_region(&damage, client);
-
-	pixman_region32_fini(&damage);
+	rdp_peer_refresh_full(peerCtx);
 	FREERDP_CB_RETURN(TRUE);
 }
 
@@ -1272,6 +2110,11 @@ xf_suppress_output(rdpContext *context, BYTE allow, const RECTANGLE_16 *area)
 	else
 		peerContext->item.flags &= (~RDP_PEER_OUTPUT_ENABLED);
 
+	/* Catch up on what was missed while suppressed */
+	if (allow && peerContext->encoder && !peerContext->encoder->encoding &&
+	    pixman_region32_not_empty(&peerContext->missed_damage))
+		rdp_encoder_kick(peerContext->encoder);
+
 	FREERDP_CB_RETURN(TRUE);
 }
 
@@ -1392,9 +2235,15 @@ rdp_backend_create(struct weston_compositor *compositor,
 	b->rdp_key = config->rdp_key ? strdup(config->rdp_key) : NULL;
 	b->no_clients_resize = config->no_clients_resize;
 	b->force_no_compression = config->force_no_compression;
+	wl_list_init(&b->encoder_list);
 
 	compositor->backend = &b->base;
 
+	b->debug = weston_compositor_add_log_scope(compositor, "rdp-encode",
+						   "RDP peer encoding statistics\n",
+						   rdp_debug_subscribe, NULL,
+						   b);
+
 	/* activate TLS only if certificate/key are available */
 	if (config->server_cert && config->server_key) {
 		weston_log("TLS support activated\n");
@@ -1458,6 +2307,7 @@ err_output:
 err_compositor:
 	weston_compositor_shutdown(compositor);
 err_free_strings:
+	weston_log_scope_destroy(b->debug);
 	free(b->rdp_key);
 	free(b->server_cert);
 	free(b->server_key);
@@ -107,8 +107,25 @@ struct weston_backend {
 	 */
 	bool (*can_scanout_dmabuf)(struct weston_compositor *compositor,
 				   struct linux_dmabuf_buffer *buffer);
+
+	/** Read the presentation clock of the backend
+	 *
+	 * @param compositor The compositor.
+	 * @param ts Set to the current time.
+	 *
+	 * Optional, for backends that keep a presentation clock of their
+	 * own rather than reading the clock set with
+	 * weston_compositor_set_presentation_clock().
+	 */
+	void (*read_presentation_clock)(const struct weston_compositor *compositor,
+					struct timespec *ts);
 };
 
+/* weston_compositor */
+
+void
+weston_compositor_presentation_clock_advanced(struct weston_compositor *compositor);
+
 /* weston_head */
 
 void
@@ -131,6 +148,10 @@ weston_head_set_monitor_strings(struct weston_head *head,
 void
 weston_head_set_non_desktop(struct weston_head *head, bool non_desktop);
 
+void
+weston_head_set_vrr_range(struct weston_head *head,
+			  int32_t min_refresh, int32_t max_refresh);
+
 void
 weston_head_set_physical_size(struct weston_head *head,
 			      int32_t mm_width, int32_t mm_height);
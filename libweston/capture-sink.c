@@ -0,0 +1,482 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Common plumbing for plugins that consume the frames of virtual outputs
+ * created through weston_drm_virtual_output_api (remoting, pipewire,
+ * lg-remoting): waiting for the render fence, handing the buffer back to
+ * the backend, pacing finish_frame with a timer while there is no real
+ * vblank, and keeping statistics about all of it.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "capture-sink.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+
+/* Finish-frame pace while the consumer is not pulling frames */
+#define CAPTURE_SINK_IDLE_REFRESH_MHZ 1000
+
+struct weston_capture_sink {
+	struct weston_output *output;
+	const struct weston_drm_virtual_output_api *api;
+	const struct weston_capture_sink_interface *impl;
+	void *data;
+
+	struct wl_event_source *finish_frame_timer;
+	bool frame_delivered;
+	bool idle;
+	enum dpms_enum dpms;
+
+	/* damage reported by the renderer for the next submitted frame */
+	pixman_region32_t pending_damage;
+	struct wl_listener frame_listener;
+
+	/* weston_capture_frame::link */
+	struct wl_list free_list;
+	struct wl_list busy_list;
+
+	uint64_t seq;
+	struct weston_capture_sink_stats stats;
+
+	struct weston_log_scope *debug;
+};
+
+static void
+capture_sink_print_stats(struct weston_capture_sink *sink,
+			 struct weston_log_subscription *sub)
+{
+	struct weston_capture_sink_stats *s = &sink->stats;
+	uint64_t fence_avg = 0, hold_avg = 0;
+
+	if (s->frames_delivered > 0) {
+		fence_avg = s->fence_wait_sum_ns / s->frames_delivered;
+		hold_avg = s->hold_sum_ns / s->frames_delivered;
+	}
+
+	weston_log_subscription_printf(sub,
+		"%s: submitted %"PRIu64", delivered %"PRIu64", "
+		"rejected %"PRIu64", finished %"PRIu64", "
+		"damage %"PRIu64" px, fence wait avg %"PRIu64" us "
+		"max %"PRIu64" us, hold avg %"PRIu64" us max %"PRIu64" us\n",
+		sink->output->name, s->frames_submitted, s->frames_delivered,
+		s->frames_rejected, s->frames_finished, s->damage_pixels,
+		fence_avg / 1000, s->fence_wait_max_ns / 1000,
+		hold_avg / 1000, s->hold_max_ns / 1000);
+}
+
+static void
+capture_sink_debug_subscribe(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_capture_sink *sink = data;
+
+	capture_sink_print_stats(sink, sub);
+}
+
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint64_t area = 0;
+	int n, i;
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+static void
+capture_sink_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_capture_sink *sink =
+		container_of(listener, struct weston_capture_sink,
+			     frame_listener);
+	pixman_region32_t *damage = data;
+
+	/* The renderer signals the frame before the backend submits it,
+	 * so this is the damage of the upcoming submit_frame. */
+	pixman_region32_union(&sink->pending_damage,
+			      &sink->pending_damage, damage);
+}
+
+static int
+capture_sink_finish_frame_handler(void *data)
+{
+	struct weston_capture_sink *sink = data;
+	struct weston_compositor *c = sink->output->compositor;
+	struct timespec now;
+	uint32_t refresh;
+	int64_t msec;
+
+	if (sink->frame_delivered) {
+		sink->frame_delivered = false;
+		weston_compositor_read_presentation_clock(c, &now);
+		sink->api->finish_frame(sink->output, &now, 0);
+		sink->stats.frames_finished++;
+		if (sink->impl->frame_finished)
+			sink->impl->frame_finished(sink->data);
+	}
+
+	if (sink->dpms != WESTON_DPMS_ON) {
+		wl_event_source_timer_update(sink->finish_frame_timer, 0);
+		return 0;
+	}
+
+	if (sink->idle)
+		refresh = CAPTURE_SINK_IDLE_REFRESH_MHZ;
+	else
+		refresh = sink->output->current_mode->refresh;
+
+	msec = millihz_to_nsec(refresh) / 1000000;
+	wl_event_source_timer_update(sink->finish_frame_timer, msec);
+
+	return 0;
+}
+
+/** Create a capture sink for a virtual output
+ *
+ * Installs the sink as the output's frame consumer. The caller still has
+ * to call weston_capture_sink_submit_frame() from its submit_frame_cb,
+ * since that callback carries no user data.
+ *
+ * \param output The virtual output, created with \c api.
+ * \param api The virtual output API of the backend.
+ * \param impl Callbacks of the frame consumer.
+ * \param data User data passed to the callbacks.
+ * \return The sink, or NULL on failure.
+ */
+WL_EXPORT struct weston_capture_sink *
+weston_capture_sink_create(struct weston_output *output,
+			   const struct weston_drm_virtual_output_api *api,
+			   const struct weston_capture_sink_interface *impl,
+			   void *data)
+{
+	struct weston_capture_sink *sink;
+	struct wl_event_loop *loop;
+	char *scope_name;
+
+	sink = zalloc(sizeof *sink);
+	if (!sink)
+		return NULL;
+
+	sink->output = output;
+	sink->api = api;
+	sink->impl = impl;
+	sink->data = data;
+	sink->dpms = WESTON_DPMS_ON;
+	wl_list_init(&sink->free_list);
+	wl_list_init(&sink->busy_list);
+	pixman_region32_init(&sink->pending_damage);
+
+	loop = wl_display_get_event_loop(output->compositor->wl_display);
+	sink->finish_frame_timer =
+		wl_event_loop_add_timer(loop, capture_sink_finish_frame_handler,
+					sink);
+	if (!sink->finish_frame_timer) {
+		pixman_region32_fini(&sink->pending_damage);
+		free(sink);
+		return NULL;
+	}
+
+	sink->frame_listener.notify = capture_sink_frame_notify;
+	wl_signal_add(&output->frame_signal, &sink->frame_listener);
+
+	if (asprintf(&scope_name, "capture-%s", output->name) >= 0) {
+		sink->debug =
+			weston_compositor_add_log_scope(output->compositor,
+							scope_name,
+							"Capture sink statistics\n",
+							capture_sink_debug_subscribe,
+							NULL, sink);
+		free(scope_name);
+	}
+
+	return sink;
+}
+
+static void
+capture_frame_destroy(struct weston_capture_frame *frame)
+{
+	wl_list_remove(&frame->link);
+	pixman_region32_fini(&frame->damage);
+	free(frame);
+}
+
+static void
+capture_frame_put_back(struct weston_capture_frame *frame)
+{
+	struct weston_capture_sink *sink = frame->sink;
+
+	if (frame->fence_source) {
+		wl_event_source_remove(frame->fence_source);
+		frame->fence_source = NULL;
+	}
+	if (frame->fence_fd >= 0) {
+		close(frame->fence_fd);
+		frame->fence_fd = -1;
+	}
+	if (frame->fd >= 0) {
+		close(frame->fd);
+		frame->fd = -1;
+	}
+
+	sink->api->buffer_released(frame->buffer);
+	frame->buffer = NULL;
+	frame->user_data = NULL;
+
+	pixman_region32_clear(&frame->damage);
+	wl_list_remove(&frame->link);
+	wl_list_insert(&sink->free_list, &frame->link);
+}
+
+/** Destroy a capture sink
+ *
+ * Frames still held by the consumer are released. The consumer must not
+ * touch any frame after this.
+ */
+WL_EXPORT void
+weston_capture_sink_destroy(struct weston_capture_sink *sink)
+{
+	struct weston_capture_frame *frame, *next;
+
+	wl_list_for_each_safe(frame, next, &sink->busy_list, link)
+		capture_frame_put_back(frame);
+
+	wl_list_for_each_safe(frame, next, &sink->free_list, link)
+		capture_frame_destroy(frame);
+
+	weston_log_scope_destroy(sink->debug);
+	wl_list_remove(&sink->frame_listener.link);
+	wl_event_source_remove(sink->finish_frame_timer);
+	pixman_region32_fini(&sink->pending_damage);
+	free(sink);
+}
+
+static struct weston_capture_frame *
+capture_sink_get_frame(struct weston_capture_sink *sink)
+{
+	struct weston_capture_frame *frame;
+
+	if (!wl_list_empty(&sink->free_list)) {
+		frame = container_of(sink->free_list.next,
+				     struct weston_capture_frame, link);
+		wl_list_remove(&frame->link);
+	} else {
+		frame = zalloc(sizeof *frame);
+		if (!frame)
+			return NULL;
+		frame->sink = sink;
+		frame->fd = -1;
+		frame->fence_fd = -1;
+		pixman_region32_init(&frame->damage);
+	}
+
+	wl_list_insert(&sink->busy_list, &frame->link);
+
+	return frame;
+}
+
+static void
+capture_sink_deliver(struct weston_capture_sink *sink,
+		     struct weston_capture_frame *frame)
+{
+	uint64_t wait;
+
+	weston_compositor_read_presentation_clock(sink->output->compositor,
+						  &frame->ready_time);
+	wait = timespec_sub_to_nsec(&frame->ready_time, &frame->submit_time);
+	sink->stats.fence_wait_sum_ns += wait;
+	sink->stats.fence_wait_max_ns = MAX(sink->stats.fence_wait_max_ns,
+					    wait);
+	sink->stats.frames_delivered++;
+
+	/* Advance the repaint loop whatever the consumer makes of it */
+	sink->frame_delivered = true;
+
+	if (sink->impl->frame_ready(frame, sink->data) < 0) {
+		sink->stats.frames_rejected++;
+		weston_capture_frame_release(frame);
+	}
+}
+
+static int
+capture_sink_fence_handler(int fd, uint32_t mask, void *data)
+{
+	struct weston_capture_frame *frame = data;
+
+	wl_event_source_remove(frame->fence_source);
+	frame->fence_source = NULL;
+	close(frame->fence_fd);
+	frame->fence_fd = -1;
+
+	capture_sink_deliver(frame->sink, frame);
+
+	return 0;
+}
+
+/** Accept a frame from the virtual output's submit_frame_cb
+ *
+ * Takes ownership of \c fd and \c buffer; both are given back when the
+ * consumer releases the frame. Forward the return value of this from
+ * the submit_frame_cb.
+ */
+WL_EXPORT int
+weston_capture_sink_submit_frame(struct weston_capture_sink *sink,
+				 int fd, int stride, void *buffer)
+{
+	struct weston_output *output = sink->output;
+	struct weston_capture_frame *frame;
+	struct wl_event_loop *loop;
+
+	frame = capture_sink_get_frame(sink);
+	if (!frame)
+		return -1;
+
+	frame->fd = fd;
+	frame->stride = stride;
+	frame->buffer = buffer;
+	frame->width = output->current_mode->width;
+	frame->height = output->current_mode->height;
+	frame->seq = sink->seq++;
+	weston_compositor_read_presentation_clock(output->compositor,
+						  &frame->submit_time);
+
+	pixman_region32_copy(&frame->damage, &sink->pending_damage);
+	pixman_region32_clear(&sink->pending_damage);
+
+	sink->stats.frames_submitted++;
+	sink->stats.damage_pixels += region_area(&frame->damage);
+
+	frame->fence_fd = sink->api->get_fence_sync_fd(output);
+	if (frame->fence_fd < 0) {
+		capture_sink_deliver(sink, frame);
+		return 0;
+	}
+
+	loop = wl_display_get_event_loop(output->compositor->wl_display);
+	frame->fence_source =
+		wl_event_loop_add_fd(loop, frame->fence_fd, WL_EVENT_READABLE,
+				     capture_sink_fence_handler, frame);
+	if (!frame->fence_source) {
+		close(frame->fence_fd);
+		frame->fence_fd = -1;
+		capture_sink_deliver(sink, frame);
+	}
+
+	return 0;
+}
+
+/** Start pacing finish_frame, call from the output's start_repaint_loop */
+WL_EXPORT void
+weston_capture_sink_start_repaint_loop(struct weston_capture_sink *sink)
+{
+	int64_t msec;
+
+	if (sink->idle)
+		msec = millihz_to_nsec(CAPTURE_SINK_IDLE_REFRESH_MHZ) / 1000000;
+	else
+		msec = millihz_to_nsec(sink->output->current_mode->refresh) /
+		       1000000;
+
+	wl_event_source_timer_update(sink->finish_frame_timer, msec);
+}
+
+/** Stop or resume the finish_frame pacing along with the output's DPMS */
+WL_EXPORT void
+weston_capture_sink_set_dpms(struct weston_capture_sink *sink,
+			     enum dpms_enum level)
+{
+	if (sink->dpms == level)
+		return;
+
+	sink->dpms = level;
+	capture_sink_finish_frame_handler(sink);
+}
+
+/** Slow the pacing down while nobody consumes the frames */
+WL_EXPORT void
+weston_capture_sink_set_idle(struct weston_capture_sink *sink, bool idle)
+{
+	sink->idle = idle;
+}
+
+WL_EXPORT void
+weston_capture_sink_get_stats(struct weston_capture_sink *sink,
+			      struct weston_capture_sink_stats *stats)
+{
+	*stats = sink->stats;
+}
+
+/** Take over the frame's dma-buf fd
+ *
+ * For consumers that hand the fd on to something that closes it.
+ */
+WL_EXPORT int
+weston_capture_frame_take_fd(struct weston_capture_frame *frame)
+{
+	int fd = frame->fd;
+
+	frame->fd = -1;
+
+	return fd;
+}
+
+/** Give a frame back to the sink and its buffer back to the backend */
+WL_EXPORT void
+weston_capture_frame_release(struct weston_capture_frame *frame)
+{
+	struct weston_capture_sink *sink = frame->sink;
+	struct timespec now;
+	uint64_t hold;
+
+	weston_compositor_read_presentation_clock(sink->output->compositor,
+						  &now);
+	hold = timespec_sub_to_nsec(&now, &frame->ready_time);
+	sink->stats.hold_sum_ns += hold;
+	sink->stats.hold_max_ns = MAX(sink->stats.hold_max_ns, hold);
+
+	if (weston_log_scope_is_enabled(sink->debug)) {
+		weston_log_scope_printf(sink->debug,
+			"[%s] frame %"PRIu64": fence wait %"PRId64" us, "
+			"held %"PRIu64" us\n", sink->output->name, frame->seq,
+			timespec_sub_to_nsec(&frame->ready_time,
+					     &frame->submit_time) / 1000,
+			hold / 1000);
+	}
+
+	capture_frame_put_back(frame);
+}
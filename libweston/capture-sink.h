@@ -0,0 +1,141 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_CAPTURE_SINK_H
+#define WESTON_CAPTURE_SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <pixman.h>
+#include <wayland-util.h>
+
+#include <libweston/libweston.h>
+#include <libweston/backend-drm.h>
+
+struct weston_capture_sink;
+
+/** A frame rendered by a virtual output
+ *
+ * Frames are handed to the sink owner through
+ * weston_capture_sink_interface::frame_ready once the renderer fence has
+ * signalled, and must be given back with weston_capture_frame_release().
+ * Frame records are pooled by the sink, do not keep pointers to them
+ * after releasing.
+ */
+struct weston_capture_frame {
+	struct weston_capture_sink *sink;
+
+	/** dma-buf of the frame, closed on release unless taken with
+	 * weston_capture_frame_take_fd() */
+	int fd;
+	int stride;
+	int width;
+	int height;
+
+	/** Damage since the previously submitted frame, in output
+	 * coordinates */
+	pixman_region32_t damage;
+
+	/** Sequence number, counting submitted frames */
+	uint64_t seq;
+
+	struct timespec submit_time;
+	struct timespec ready_time;
+
+	/** Free for the consumer to use while it holds the frame */
+	void *user_data;
+
+	/* private */
+	void *buffer;
+	int fence_fd;
+	struct wl_event_source *fence_source;
+	struct wl_list link;
+};
+
+struct weston_capture_sink_interface {
+	/** Called when a frame is fully rendered
+	 *
+	 * \param frame The frame, owned by the callee until it calls
+	 * weston_capture_frame_release(), which it may also do before
+	 * returning.
+	 * \param data The data given to weston_capture_sink_create().
+	 * \return 0 if the frame was consumed, -1 if it was not; the sink
+	 * then releases it right away.
+	 */
+	int (*frame_ready)(struct weston_capture_frame *frame, void *data);
+
+	/** Optional, called after finish_frame has been sent to the
+	 * output for a delivered frame */
+	void (*frame_finished)(void *data);
+};
+
+struct weston_capture_sink_stats {
+	uint64_t frames_submitted;
+	uint64_t frames_delivered;
+	uint64_t frames_rejected;
+	uint64_t frames_finished;
+	uint64_t damage_pixels;
+	uint64_t fence_wait_sum_ns;
+	uint64_t fence_wait_max_ns;
+	uint64_t hold_sum_ns;
+	uint64_t hold_max_ns;
+};
+
+struct weston_capture_sink *
+weston_capture_sink_create(struct weston_output *output,
+			   const struct weston_drm_virtual_output_api *api,
+			   const struct weston_capture_sink_interface *impl,
+			   void *data);
+
+void
+weston_capture_sink_destroy(struct weston_capture_sink *sink);
+
+int
+weston_capture_sink_submit_frame(struct weston_capture_sink *sink,
+				 int fd, int stride, void *buffer);
+
+void
+weston_capture_sink_start_repaint_loop(struct weston_capture_sink *sink);
+
+void
+weston_capture_sink_set_dpms(struct weston_capture_sink *sink,
+			     enum dpms_enum level);
+
+void
+weston_capture_sink_set_idle(struct weston_capture_sink *sink, bool idle);
+
+void
+weston_capture_sink_get_stats(struct weston_capture_sink *sink,
+			      struct weston_capture_sink_stats *stats);
+
+int
+weston_capture_frame_take_fd(struct weston_capture_frame *frame);
+
+void
+weston_capture_frame_release(struct weston_capture_frame *frame);
+
+#endif /* WESTON_CAPTURE_SINK_H */
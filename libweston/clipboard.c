@@ -25,21 +25,35 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/sendfile.h>
 #include <sys/uio.h>
 
 #include <libweston/libweston.h>
 #include "libweston-internal.h"
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+
+/*
+ * The selection is kept in an anonymous file, a sealed memfd where
+ * available, so that it survives its client. It is spliced in from the
+ * source pipe and sent to the pasting clients with sendfile(), neither
+ * of which copies it through the compositor's memory.
+ */
+
+/* As much as a pipe holds by default */
+#define CLIPBOARD_CHUNK_SIZE (64 * 1024)
 
 struct clipboard_source {
 	struct weston_data_source base;
-	struct wl_array contents;
+	int data_fd;
+	size_t size;
 	struct clipboard *clipboard;
 	struct wl_event_source *event_source;
 	uint32_t serial;
@@ -74,35 +88,80 @@ clipboard_source_unref(struct clipboard_source *source)
 	s = source->base.mime_types.data;
 	free(*s);
 	wl_array_release(&source->base.mime_types);
-	wl_array_release(&source->contents);
+	close(source->data_fd);
 	free(source);
 }
 
+/* For files splice() cannot write to */
+static ssize_t
+clipboard_source_copy(struct clipboard_source *source, int fd, size_t len)
+{
+	char buf[4096];
+	ssize_t n;
+
+	n = read(fd, buf, MIN(len, sizeof buf));
+	if (n <= 0)
+		return n;
+
+	if (pwrite(source->data_fd, buf, n, source->size) != n)
+		return -1;
+
+	return n;
+}
+
+/* Stop reading the selection and give up the clipboard's reference. Paste
+ * clients may still hold the source, so the fd watch must go first. */
+static void
+clipboard_source_drop(struct clipboard_source *source)
+{
+	struct clipboard *clipboard = source->clipboard;
+
+	wl_event_source_remove(source->event_source);
+	close(source->fd);
+	source->event_source = NULL;
+	clipboard_source_unref(source);
+	clipboard->source = NULL;
+}
+
 static int
 clipboard_source_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_source *source = data;
 	struct clipboard *clipboard = source->clipboard;
-	char *p;
-	int len, size;
+	size_t limit = clipboard->seat->compositor->clipboard_size_limit;
+	size_t len = CLIPBOARD_CHUNK_SIZE;
+	loff_t offset = source->size;
+	ssize_t n;
 
-	if (source->contents.alloc - source->contents.size < 1024) {
-		wl_array_add(&source->contents, 1024);
-		source->contents.size -= 1024;
-	}
+	/* one byte more than the limit, to tell when it is exceeded */
+	if (limit)
+		len = MIN(len, limit + 1 - source->size);
+
+	n = splice(fd, NULL, source->data_fd, &offset, len,
+		   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n < 0 && errno == EINVAL)
+		n = clipboard_source_copy(source, fd, len);
 
-	p = source->contents.data + source->contents.size;
-	size = source->contents.alloc - source->contents.size;
-	len = read(fd, p, size);
-	if (len == 0) {
+	if (n == 0) {
 		wl_event_source_remove(source->event_source);
 		close(fd);
 		source->event_source = NULL;
-	} else if (len < 0) {
-		clipboard_source_unref(source);
-		clipboard->source = NULL;
+#ifdef HAVE_MEMFD_CREATE
+		/* complete, make it read-only */
+		fcntl(source->data_fd, F_ADD_SEALS, F_SEAL_SHRINK |
+		      F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+	} else if (n < 0 && errno == EAGAIN) {
+		return 1;
+	} else if (n < 0) {
+		clipboard_source_drop(source);
 	} else {
-		source->contents.size += len;
+		source->size += n;
+		if (limit && source->size > limit) {
+			weston_log("clipboard: selection larger than %zu "
+				   "bytes, not keeping it\n", limit);
+			clipboard_source_drop(source);
+		}
 	}
 
 	return 1;
@@ -147,7 +206,11 @@ clipboard_source_create(struct clipboard *clipboard,
 	if (source == NULL)
 		return NULL;
 
-	wl_array_init(&source->contents);
+	/* room for the first chunk; the file grows as needed */
+	source->data_fd = os_create_anonymous_file(CLIPBOARD_CHUNK_SIZE);
+	if (source->data_fd < 0)
+		goto err_file;
+
 	wl_array_init(&source->base.mime_types);
 	source->base.resource = NULL;
 	source->base.accept = clipboard_source_accept;
@@ -178,6 +241,8 @@ clipboard_source_create(struct clipboard *clipboard,
  err_strdup:
 	wl_array_release(&source->base.mime_types);
  err_add:
+	close(source->data_fd);
+ err_file:
 	free(source);
 
 	return NULL;
@@ -185,25 +250,47 @@ clipboard_source_create(struct clipboard *clipboard,
 
 struct clipboard_client {
 	struct wl_event_source *event_source;
-	size_t offset;
+	off_t offset;
 	struct clipboard_source *source;
 };
 
+/* For when sendfile() cannot read the file */
+static ssize_t
+clipboard_client_copy(struct clipboard_client *client, int fd, size_t len)
+{
+	char buf[4096];
+	ssize_t n;
+
+	n = pread(client->source->data_fd, buf, MIN(len, sizeof buf),
+		  client->offset);
+	if (n <= 0)
+		return n;
+
+	n = write(fd, buf, n);
+	if (n > 0)
+		client->offset += n;
+
+	return n;
+}
+
 static int
 clipboard_client_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_client *client = data;
-	char *p;
-	size_t size;
-	int len;
-
-	size = client->source->contents.size;
-	p = client->source->contents.data;
-	len = write(fd, p + client->offset, size - client->offset);
-	if (len > 0)
-		client->offset += len;
+	size_t size = client->source->size;
+	size_t len;
+	ssize_t n = 0;
+
+	len = MIN(size - client->offset, CLIPBOARD_CHUNK_SIZE);
+	if (len > 0) {
+		n = sendfile(fd, client->source->data_fd, &client->offset, len);
+		if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+			n = clipboard_client_copy(client, fd, len);
+		if (n < 0 && errno == EAGAIN)
+			return 1;
+	}
 
-	if (client->offset == size || len <= 0) {
+	if ((size_t)client->offset == size || n <= 0) {
 		close(fd);
 		wl_event_source_remove(client->event_source);
 		clipboard_source_unref(client->source);
@@ -225,6 +312,9 @@ clipboard_client_create(struct clipboard_source *source, int fd)
 	if (client == NULL)
 		return;
 
+	/* never block the compositor on a slow reader */
+	fcntl(fd, F_SETFL, O_WRONLY | O_NONBLOCK);
+
 	client->source = source;
 	source->refcount++;
 	client->event_source =
@@ -42,6 +42,7 @@
 #include <sys/socket.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <math.h>
 #include <linux/input.h>
@@ -54,6 +55,9 @@
 #include <inttypes.h>
 
 #include "timeline.h"
+#include "repaint-stats.h"
+#include "repaint-scheduler.h"
+#include "worker-pool.h"
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
@@ -84,6 +88,8 @@
  */
 
 #define DEFAULT_REPAINT_WINDOW 7 /* milliseconds */
+/* Outputs due within this much of each other repaint together */
+#define REPAINT_TIMER_SLACK_NSEC 250000
 
 static void
 weston_output_update_matrix(struct weston_output *output);
@@ -93,7 +99,7 @@ weston_output_transform_scale_init(struct weston_output *output,
 				   uint32_t transform, uint32_t scale);
 
 static void
-weston_compositor_build_view_list(struct weston_compositor *compositor);
+weston_compositor_view_list_dirty(struct weston_compositor *compositor);
 
 static char *
 weston_output_create_heads_string(struct weston_output *output);
@@ -2134,6 +2140,7 @@ weston_view_unmap(struct weston_view *view)
 	weston_layer_entry_remove(&view->layer_link);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
+	weston_compositor_view_list_dirty(view->surface->compositor);
 	view->output_mask = 0;
 	weston_surface_assign_output(view->surface);
 
@@ -2164,6 +2171,7 @@ weston_surface_unmap(struct weston_surface *surface)
 	wl_list_for_each(view, &surface->views, surface_link)
 		weston_view_unmap(view);
 	surface->output = NULL;
+	weston_compositor_view_list_dirty(surface->compositor);
 }
 
 static void
@@ -2655,12 +2663,34 @@ view_list_add(struct weston_compositor *compositor,
 	}
 }
 
+/* Anything that changes which views are in the view list or their order
+ * has to call this: layers, layer entries, sub-surface stacking and
+ * sub-surface mapping. */
 static void
+weston_compositor_view_list_dirty(struct weston_compositor *compositor)
+{
+	compositor->view_list_needs_rebuild = true;
+}
+
+/** Bring compositor::view_list up to date with the layers
+ *
+ * Only rebuilds the list when something marked it dirty, otherwise just
+ * updates the view transforms. Exported for the test suite.
+ */
+WL_EXPORT void
 weston_compositor_build_view_list(struct weston_compositor *compositor)
 {
 	struct weston_view *view, *tmp;
 	struct weston_layer *layer;
 
+	/* Typically a fullscreen client only flips buffers, so the scene
+	 * stays the same from one repaint to the next. */
+	if (!compositor->view_list_needs_rebuild) {
+		wl_list_for_each(view, &compositor->view_list, link)
+			weston_view_update_transform(view);
+		return;
+	}
+
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_stash_subsurface_views(view->surface);
@@ -2678,6 +2708,8 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_free_unused_subsurface_views(view->surface);
+
+	compositor->view_list_needs_rebuild = false;
 }
 
 static void
@@ -2705,26 +2737,87 @@ weston_output_take_feedback_list(struct weston_output *output,
 	wl_list_init(&surface->feedback_list);
 }
 
-static int
-weston_output_repaint(struct weston_output *output, void *repaint_data)
+/* An output repaint, split around the renderer compositing the output
+ * so that outputs can be composited in parallel */
+struct weston_output_repaint {
+	struct weston_output *output;
+	void *repaint_data;
+	struct wl_list frame_callback_list;
+	pixman_region32_t output_damage;
+	/* time spent in prerender_output */
+	int64_t prerender_nsec;
+};
+
+/* VRR follows a client showing fullscreen on the output: the topmost view
+ * on it, the cursor aside, has to cover it entirely. The refresh rate
+ * range is the one all the heads support, up to that of the mode. */
+static void
+weston_output_update_vrr(struct weston_output *output)
 {
 	struct weston_compositor *ec = output->compositor;
+	struct weston_head *head;
 	struct weston_view *ev;
-	struct weston_animation *animation, *next;
-	struct weston_frame_callback *cb, *cnext;
-	struct wl_list frame_callback_list;
-	pixman_region32_t output_damage;
-	int r;
-	uint32_t frame_time_msec;
-	enum weston_hdcp_protection highest_requested = WESTON_HDCP_DISABLE;
+	int32_t min_refresh = 0;
+	int32_t max_refresh = output->current_mode->refresh;
+	bool active = false;
 
-	if (output->destroying)
-		return 0;
+	if (!output->vrr_allowed || !output->vrr_scheduler ||
+	    wl_list_empty(&output->head_list))
+		goto out;
+
+	wl_list_for_each(head, &output->head_list, output_link) {
+		if (head->vrr_min_refresh <= 0)
+			goto out;
+		min_refresh = MAX(min_refresh, head->vrr_min_refresh);
+		max_refresh = MIN(max_refresh, head->vrr_max_refresh);
+	}
+	if (min_refresh >= max_refresh)
+		goto out;
+
+	wl_list_for_each(ev, &ec->view_list, link) {
+		if (!(ev->output_mask & (1u << output->id)) ||
+		    get_view_layer(ev) == &ec->cursor_layer)
+			continue;
+
+		active = ev->surface->resource &&
+			 pixman_region32_contains_rectangle(&ev->transform.boundingbox,
+							    &output->region.extents) ==
+			 PIXMAN_REGION_IN;
+		break;
+	}
+
+	if (active && !output->vrr_active)
+		weston_vrr_scheduler_init(output->vrr_scheduler,
+					  millihz_to_nsec(max_refresh),
+					  millihz_to_nsec(min_refresh));
+
+out:
+	output->vrr_active = active;
+}
+
+/* Everything that changes the scene graph before compositing */
+static void
+weston_output_repaint_prepare(struct weston_output_repaint *repaint)
+{
+	struct weston_output *output = repaint->output;
+	struct weston_compositor *ec = output->compositor;
+	struct weston_view *ev;
+	enum weston_hdcp_protection highest_requested = WESTON_HDCP_DISABLE;
+	struct timespec stage_begin, stage_end;
 
 	TL_POINT(ec, "core_repaint_begin", TLP_OUTPUT(output), TLP_END);
 
 	/* Rebuild the surface list and update surface transforms up front. */
+	clock_gettime(CLOCK_MONOTONIC, &stage_begin);
+	if (output->repaint_predictor)
+		weston_repaint_predictor_frame_begin(output->repaint_predictor,
+						     timespec_to_nsec(&stage_begin));
 	weston_compositor_build_view_list(ec);
+	clock_gettime(CLOCK_MONOTONIC, &stage_end);
+	weston_repaint_stats_record(output, WESTON_REPAINT_STAGE_VIEW_LIST,
+				    &stage_begin, &stage_end);
+
+	weston_output_update_vrr(output);
 
 	/* Find the highest protection desired for an output */
 	wl_list_for_each(ev, &ec->view_list, link) {
@@ -2744,7 +2837,12 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 	output->desired_protection = highest_requested;
 
 	if (output->assign_planes && !output->disable_planes) {
-		output->assign_planes(output, repaint_data);
+		clock_gettime(CLOCK_MONOTONIC, &stage_begin);
+		output->assign_planes(output, repaint->repaint_data);
+		clock_gettime(CLOCK_MONOTONIC, &stage_end);
+		weston_repaint_stats_record(output,
+					    WESTON_REPAINT_STAGE_ASSIGN_PLANES,
+					    &stage_begin, &stage_end);
 	} else {
 		wl_list_for_each(ev, &ec->view_list, link) {
 			weston_view_move_to_plane(ev, &ec->primary_plane);
@@ -2752,13 +2850,13 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 		}
 	}
 
-	wl_list_init(&frame_callback_list);
+	wl_list_init(&repaint->frame_callback_list);
 	wl_list_for_each(ev, &ec->view_list, link) {
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
 		if (ev->surface->output == output) {
-			wl_list_insert_list(&frame_callback_list,
+			wl_list_insert_list(&repaint->frame_callback_list,
 					    &ev->surface->frame_callback_list);
 			wl_list_init(&ev->surface->frame_callback_list);
 
@@ -2766,30 +2864,63 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 		}
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &stage_begin);
 	output_accumulate_damage(output);
 
-	pixman_region32_init(&output_damage);
-	pixman_region32_intersect(&output_damage,
+	pixman_region32_init(&repaint->output_damage);
+	pixman_region32_intersect(&repaint->output_damage,
 				  &ec->primary_plane.damage, &output->region);
-	pixman_region32_subtract(&output_damage,
-				 &output_damage, &ec->primary_plane.clip);
+	pixman_region32_subtract(&repaint->output_damage,
+				 &repaint->output_damage,
+				 &ec->primary_plane.clip);
+	clock_gettime(CLOCK_MONOTONIC, &stage_end);
+	weston_repaint_stats_record(output, WESTON_REPAINT_STAGE_DAMAGE,
+				    &stage_begin, &stage_end);
 
 	if (output->dirty)
 		weston_output_update_matrix(output);
 
-	r = output->repaint(output, &output_damage, repaint_data);
+	repaint->prerender_nsec = 0;
+}
+
+/* Hands the frame to the backend and lets the clients know */
+static int
+weston_output_repaint_finish(struct weston_output_repaint *repaint)
+{
+	struct weston_output *output = repaint->output;
+	struct weston_compositor *ec = output->compositor;
+	struct weston_animation *animation, *next;
+	struct weston_frame_callback *cb, *cnext;
+	uint32_t frame_time_msec;
+	struct timespec stage_begin, stage_end;
+	int r;
+
+	clock_gettime(CLOCK_MONOTONIC, &stage_begin);
+	r = output->repaint(output, &repaint->output_damage,
+			    repaint->repaint_data);
+	clock_gettime(CLOCK_MONOTONIC, &stage_end);
+
+	/* Compositing ahead of time counts as rendering all the same */
+	timespec_add_nsec(&stage_begin, &stage_begin, -repaint->prerender_nsec);
+	weston_repaint_stats_record(output, WESTON_REPAINT_STAGE_RENDER,
+				    &stage_begin, &stage_end);
 
-	pixman_region32_fini(&output_damage);
+	pixman_region32_fini(&repaint->output_damage);
 
 	output->repaint_needed = false;
-	if (r == 0)
+	if (r == 0) {
 		output->repaint_status = REPAINT_AWAITING_COMPLETION;
+		weston_repaint_stats_repaint_posted(output);
+		if (output->repaint_predictor)
+			weston_repaint_predictor_frame_done(output->repaint_predictor,
+							    timespec_to_nsec(&stage_end));
+	}
 
 	weston_compositor_repick(ec);
 
 	frame_time_msec = timespec_to_msec(&output->frame_time);
 
-	wl_list_for_each_safe(cb, cnext, &frame_callback_list, link) {
+	wl_list_for_each_safe(cb, cnext, &repaint->frame_callback_list, link) {
 		wl_callback_send_done(cb->resource, frame_time_msec);
 		wl_resource_destroy(cb->resource);
 	}
@@ -2804,6 +2935,22 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 	return r;
 }
 
+static int
+weston_output_repaint(struct weston_output *output, void *repaint_data)
+{
+	struct weston_output_repaint repaint = {
+		.output = output,
+		.repaint_data = repaint_data,
+	};
+
+	if (output->destroying)
+		return 0;
+
+	weston_output_repaint_prepare(&repaint);
+
+	return weston_output_repaint_finish(&repaint);
+}
+
 static void
 weston_output_schedule_repaint_reset(struct weston_output *output)
 {
@@ -2812,32 +2959,50 @@ weston_output_schedule_repaint_reset(struct weston_output *output)
 		 TLP_OUTPUT(output), TLP_END);
 }
 
-static int
-weston_output_maybe_repaint(struct weston_output *output, struct timespec *now,
-			    void *repaint_data)
+/* Whether the output is to be repainted now, dropping it from the
+ * repaint loop if it turns out to have nothing to do */
+static bool
+weston_output_repaint_due(struct weston_output *output, struct timespec *now)
 {
 	struct weston_compositor *compositor = output->compositor;
-	int ret = 0;
-	int64_t msec_to_repaint;
+	int64_t nsec_to_repaint;
 
 	/* We're not ready yet; come back to make a decision later. */
 	if (output->repaint_status != REPAINT_SCHEDULED)
-		return ret;
+		return false;
 
-	msec_to_repaint = timespec_sub_to_msec(&output->next_repaint, now);
-	if (msec_to_repaint > 1)
-		return ret;
+	nsec_to_repaint = timespec_sub_to_nsec(&output->next_repaint, now);
+	if (nsec_to_repaint > REPAINT_TIMER_SLACK_NSEC)
+		return false;
 
 	/* If we're sleeping, drop the repaint machinery entirely; we will
 	 * explicitly repaint all outputs when we come back. */
 	if (compositor->state == WESTON_COMPOSITOR_SLEEPING ||
 	    compositor->state == WESTON_COMPOSITOR_OFFSCREEN)
-		goto err;
+		goto drop;
 
 	/* We don't actually need to repaint this output; drop it from
-	 * repaint until something causes damage. */
-	if (!output->repaint_needed)
-		goto err;
+	 * repaint until something causes damage. A repeated VRR frame
+	 * repaints without any. */
+	if (!output->repaint_needed && !output->vrr_repeat)
+		goto drop;
+
+	return true;
+
+drop:
+	weston_output_schedule_repaint_reset(output);
+	return false;
+}
+
+static int
+weston_output_maybe_repaint(struct weston_output *output, struct timespec *now,
+			    void *repaint_data)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int ret = 0;
+
+	if (!weston_output_repaint_due(output, now))
+		return ret;
 
 	/* If repaint fails, we aren't going to get weston_output_finish_frame
 	 * to trigger a new repaint, so drop it from repaint and hope
@@ -2857,26 +3022,136 @@ err:
 	return ret;
 }
 
+static void
+output_prerender_job(void *data, unsigned int index)
+{
+	struct weston_output_repaint *repaint =
+		&((struct weston_output_repaint *)data)[index];
+	struct weston_output *output = repaint->output;
+	struct timespec begin, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	output->compositor->renderer->prerender_output(output,
+						       &repaint->output_damage);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	repaint->prerender_nsec = timespec_sub_to_nsec(&end, &begin);
+}
+
+/** Repaint the due outputs, compositing them in parallel
+ *
+ * All outputs are prepared first, then the renderer composites them on
+ * the repaint pool while nothing else runs, and only then are the frames
+ * handed to the backend one by one and the clients told. Animations and
+ * frame callbacks of one output thus cannot change what another one
+ * shows in the same repaint.
+ */
+static int
+output_repaint_parallel(struct weston_compositor *compositor,
+			struct timespec *now, void *repaint_data)
+{
+	/* output ids are bits in a 32-bit mask */
+	struct weston_output_repaint repaints[32];
+	struct weston_output *output;
+	unsigned int count = 0;
+	unsigned int i;
+	int ret = 0;
+	int r;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (!weston_output_repaint_due(output, now))
+			continue;
+
+		/* Like weston_output_repaint(), pretend it went fine */
+		if (output->destroying) {
+			output->repainted = true;
+			continue;
+		}
+
+		assert(count < ARRAY_LENGTH(repaints));
+		repaints[count].output = output;
+		repaints[count].repaint_data = repaint_data;
+		weston_output_repaint_prepare(&repaints[count]);
+		count++;
+	}
+
+	weston_worker_pool_run(compositor->repaint_pool, count,
+			       output_prerender_job, repaints);
+
+	/* Every prepared output has to finish, its frame callbacks are
+	 * in the repaint */
+	for (i = 0; i < count; i++) {
+		output = repaints[i].output;
+		r = weston_output_repaint_finish(&repaints[i]);
+		if (r != 0) {
+			weston_output_schedule_repaint_reset(output);
+			if (ret == 0)
+				ret = r;
+			continue;
+		}
+
+		output->repainted = true;
+	}
+
+	if (count > 0)
+		weston_compositor_read_presentation_clock(compositor, now);
+
+	return ret;
+}
+
+/* Whether to use output_repaint_parallel(), starting the pool on first use */
+static bool
+weston_compositor_repaint_in_parallel(struct weston_compositor *compositor)
+{
+	long cpus;
+
+	if (!compositor->parallel_repaint ||
+	    !compositor->renderer->prerender_output)
+		return false;
+
+	if (compositor->repaint_pool)
+		return true;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+
+	/* One output per thread at most, the caller being one of them */
+	compositor->repaint_pool =
+		weston_worker_pool_create(MIN(cpus, 32) - 1);
+	if (!compositor->repaint_pool) {
+		weston_log("Error: could not start the repaint threads, "
+			   "repainting outputs one by one.\n");
+		compositor->parallel_repaint = false;
+		return false;
+	}
+
+	weston_log("Compositing outputs on %u threads.\n",
+		   weston_worker_pool_get_size(compositor->repaint_pool));
+
+	return true;
+}
+
 static void
 output_repaint_timer_arm(struct weston_compositor *compositor)
 {
 	struct weston_output *output;
 	bool any_should_repaint = false;
 	struct timespec now;
-	int64_t msec_to_next = INT64_MAX;
+	struct itimerspec its = {};
+	int64_t nsec_to_next = INT64_MAX;
 
 	weston_compositor_read_presentation_clock(compositor, &now);
 
 	wl_list_for_each(output, &compositor->output_list, link) {
-		int64_t msec_to_this;
+		int64_t nsec_to_this;
 
 		if (output->repaint_status != REPAINT_SCHEDULED)
 			continue;
 
-		msec_to_this = timespec_sub_to_msec(&output->next_repaint,
+		nsec_to_this = timespec_sub_to_nsec(&output->next_repaint,
 						    &now);
-		if (!any_should_repaint || msec_to_this < msec_to_next)
-			msec_to_next = msec_to_this;
+		if (!any_should_repaint || nsec_to_this < nsec_to_next)
+			nsec_to_next = nsec_to_this;
 
 		any_should_repaint = true;
 	}
@@ -2884,16 +3159,20 @@ output_repaint_timer_arm(struct weston_compositor *compositor)
 	if (!any_should_repaint)
 		return;
 
-	/* Even if we should repaint immediately, add the minimum 1 ms delay.
+	/* Even if we should repaint immediately, add a minimum delay.
 	 * This is a workaround to allow coalescing multiple output repaints
 	 * particularly from weston_output_finish_frame()
 	 * into the same call, which would not happen if we called
 	 * output_repaint_timer_handler() directly.
+	 *
+	 * The timer runs on CLOCK_MONOTONIC, which the presentation clock
+	 * may not be, but only the delay matters here.
 	 */
-	if (msec_to_next < 1)
-		msec_to_next = 1;
+	if (nsec_to_next < REPAINT_TIMER_SLACK_NSEC)
+		nsec_to_next = REPAINT_TIMER_SLACK_NSEC;
 
-	wl_event_source_timer_update(compositor->repaint_timer, msec_to_next);
+	timespec_from_nsec(&its.it_value, nsec_to_next);
+	timerfd_settime(compositor->repaint_timer_fd, 0, &its, NULL);
 }
 
 static int
@@ -2905,15 +3184,23 @@ output_repaint_timer_handler(void *data)
 	void *repaint_data = NULL;
 	int ret = 0;
 
+	/* Coalesced pointer motion goes into this frame */
+	weston_compositor_flush_pointer_motion(compositor);
+
 	weston_compositor_read_presentation_clock(compositor, &now);
 
 	if (compositor->backend->repaint_begin)
 		repaint_data = compositor->backend->repaint_begin(compositor);
 
-	wl_list_for_each(output, &compositor->output_list, link) {
-		ret = weston_output_maybe_repaint(output, &now, repaint_data);
-		if (ret)
-			break;
+	if (weston_compositor_repaint_in_parallel(compositor)) {
+		ret = output_repaint_parallel(compositor, &now, repaint_data);
+	} else {
+		wl_list_for_each(output, &compositor->output_list, link) {
+			ret = weston_output_maybe_repaint(output, &now,
+							  repaint_data);
+			if (ret)
+				break;
+		}
 	}
 
 	if (ret == 0) {
@@ -2941,6 +3228,33 @@ output_repaint_timer_handler(void *data)
 	return 0;
 }
 
+/** The backend advanced its own presentation clock
+ *
+ * For a backend whose presentation clock does not run by itself: repaints
+ * the outputs whose repaint became due right away, rather than whenever
+ * the repaint timer happens to fire next.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_compositor_presentation_clock_advanced(struct weston_compositor *compositor)
+{
+	output_repaint_timer_handler(compositor);
+}
+
+static int
+output_repaint_timer_fd_handler(int fd, uint32_t mask, void *data)
+{
+	uint64_t expirations;
+
+	/* The timer is one-shot, only clear its readiness */
+	if (read(fd, &expirations, sizeof expirations) < 0 &&
+	    errno == EAGAIN)
+		return 0;
+
+	return output_repaint_timer_handler(data);
+}
+
 /** Convert a presentation timestamp to another clock domain
  *
  * \param compositor The compositor defines the presentation clock domain.
@@ -2974,6 +3288,77 @@ convert_presentation_time_now(struct weston_compositor *compositor,
 	return target_stamp;
 }
 
+/* How long before vblank the next repaint of the output starts */
+static int64_t
+weston_output_get_repaint_window(struct weston_output *output,
+				 int32_t refresh_nsec)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t fixed_nsec = (int64_t)compositor->repaint_msec * 1000000;
+
+	if (!compositor->adaptive_repaint_window || !output->repaint_predictor)
+		return fixed_nsec;
+
+	return weston_repaint_predictor_get_window(output->repaint_predictor,
+						   refresh_nsec, fixed_nsec);
+}
+
+/* The earliest VRR repaint for new content: early enough to present it at
+ * the highest refresh rate, and right away if the display is ready */
+static void
+weston_output_set_vrr_next_repaint(struct weston_output *output,
+				   const struct timespec *now)
+{
+	struct weston_vrr_scheduler *vrr = output->vrr_scheduler;
+	int64_t window_nsec, earliest;
+
+	window_nsec = weston_output_get_repaint_window(output,
+						       vrr->min_period_ns);
+	earliest = weston_vrr_scheduler_get_earliest(vrr);
+
+	timespec_from_nsec(&output->next_repaint, earliest - window_nsec);
+	if (timespec_sub_to_nsec(&output->next_repaint, now) < 0)
+		output->next_repaint = *now;
+
+	if (output->repaint_predictor)
+		weston_repaint_predictor_set_target(output->repaint_predictor,
+			MAX(timespec_to_nsec(&output->next_repaint) + window_nsec,
+			    earliest));
+}
+
+/* Schedules the repaint after a VRR frame: for new content as early as
+ * the display allows, otherwise for low framerate compensation, which
+ * repeats the last frame as it is, right when due. */
+static void
+weston_output_schedule_vrr_repaint(struct weston_output *output,
+				   const struct timespec *stamp,
+				   uint32_t presented_flags, bool repeat,
+				   const struct timespec *now)
+{
+	struct weston_vrr_scheduler *vrr = output->vrr_scheduler;
+	int64_t repeat_ns;
+
+	/* A restarted repaint loop presented nothing */
+	if (presented_flags != WP_PRESENTATION_FEEDBACK_INVALID)
+		weston_vrr_scheduler_presented(vrr, timespec_to_nsec(stamp),
+					       !repeat);
+
+	repeat_ns = weston_vrr_scheduler_get_repeat(vrr);
+	if (output->repaint_needed || repeat_ns == 0) {
+		weston_output_set_vrr_next_repaint(output, now);
+		return;
+	}
+
+	timespec_from_nsec(&output->next_repaint, repeat_ns);
+	if (timespec_sub_to_nsec(&output->next_repaint, now) < 0)
+		output->next_repaint = *now;
+	output->vrr_repeat = true;
+
+	if (output->repaint_predictor)
+		weston_repaint_predictor_set_target(output->repaint_predictor,
+						    repeat_ns);
+}
+
 /**
  * \ingroup output
  */
@@ -2983,13 +3368,18 @@ weston_output_finish_frame(struct weston_output *output,
 			   uint32_t presented_flags)
 {
 	struct weston_compositor *compositor = output->compositor;
+	struct weston_repaint_predictor *predictor = output->repaint_predictor;
 	int32_t refresh_nsec;
 	struct timespec now;
 	struct timespec vblank_monotonic;
+	int64_t window_nsec;
 	int64_t msec_rel;
+	bool repeat = output->vrr_repeat;
 
 	assert(output->repaint_status == REPAINT_AWAITING_COMPLETION);
 
+	output->vrr_repeat = false;
+
 	weston_compositor_read_presentation_clock(compositor, &now);
 
 	/* If we haven't been supplied any timestamp at all, we don't have a
@@ -2997,6 +3387,8 @@ weston_output_finish_frame(struct weston_output *output,
 	 * repaint as soon as possible so we can get on with it. */
 	if (!stamp) {
 		output->next_repaint = now;
+		if (predictor)
+			weston_repaint_predictor_set_target(predictor, 0);
 		goto out;
 	}
 
@@ -3005,18 +3397,48 @@ weston_output_finish_frame(struct weston_output *output,
 							 CLOCK_MONOTONIC);
 	TL_POINT(compositor, "core_repaint_finished", TLP_OUTPUT(output),
 		 TLP_VBLANK(&vblank_monotonic), TLP_END);
+	weston_repaint_stats_presented(output, stamp);
+	weston_repaint_stats_input_presented(output, &vblank_monotonic);
 
-	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	/* A mode without a refresh rate presents as fast as it can */
+	if (output->current_mode->refresh > 0)
+		refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	else
+		refresh_nsec = 0;
+	/* No constant refresh rate to tell the clients about with VRR */
 	weston_presentation_feedback_present_list(&output->feedback_list,
-						  output, refresh_nsec, stamp,
-						  output->msc,
+						  output,
+						  output->vrr_active ?
+							0 : refresh_nsec,
+						  stamp, output->msc,
 						  presented_flags);
 
+	if (predictor &&
+	    weston_repaint_predictor_frame_presented(predictor,
+						     timespec_to_nsec(stamp),
+						     refresh_nsec))
+		TL_POINT(compositor, "core_repaint_deadline_missed",
+			 TLP_OUTPUT(output), TLP_END);
+
 	output->frame_time = *stamp;
 
-	timespec_add_nsec(&output->next_repaint, stamp, refresh_nsec);
-	timespec_add_msec(&output->next_repaint, &output->next_repaint,
-			  -compositor->repaint_msec);
+	if (output->vrr_active) {
+		weston_output_schedule_vrr_repaint(output, stamp,
+						   presented_flags, repeat,
+						   &now);
+		goto out;
+	}
+
+	if (refresh_nsec == 0) {
+		output->next_repaint = now;
+		if (predictor)
+			weston_repaint_predictor_set_target(predictor, 0);
+		goto out;
+	}
+
+	window_nsec = weston_output_get_repaint_window(output, refresh_nsec);
+	timespec_add_nsec(&output->next_repaint, stamp,
+			  refresh_nsec - window_nsec);
 	msec_rel = timespec_sub_to_msec(&output->next_repaint, &now);
 
 	if (msec_rel < -1000 || msec_rel > 1000) {
@@ -3043,6 +3465,10 @@ weston_output_finish_frame(struct weston_output *output,
 		}
 	}
 
+	if (predictor)
+		weston_repaint_predictor_set_target(predictor,
+			timespec_to_nsec(&output->next_repaint) + window_nsec);
+
 out:
 	output->repaint_status = REPAINT_SCHEDULED;
 	output_repaint_timer_arm(compositor);
@@ -3068,11 +3494,17 @@ weston_layer_entry_insert(struct weston_layer_entry *list,
 {
 	wl_list_insert(&list->link, &entry->link);
 	entry->layer = list->layer;
+
+	if (entry->layer)
+		weston_compositor_view_list_dirty(entry->layer->compositor);
 }
 
 WL_EXPORT void
 weston_layer_entry_remove(struct weston_layer_entry *entry)
 {
+	if (entry->layer)
+		weston_compositor_view_list_dirty(entry->layer->compositor);
+
 	wl_list_remove(&entry->link);
 	wl_list_init(&entry->link);
 	entry->layer = NULL;
@@ -3110,6 +3542,7 @@ weston_layer_set_position(struct weston_layer *layer,
 	struct weston_layer *below;
 
 	wl_list_remove(&layer->link);
+	weston_compositor_view_list_dirty(layer->compositor);
 
 	/* layer_list is ordered from top to bottom, the last layer being the
 	 * background with the smallest position value */
@@ -3134,6 +3567,7 @@ weston_layer_unset_position(struct weston_layer *layer)
 {
 	wl_list_remove(&layer->link);
 	wl_list_init(&layer->link);
+	weston_compositor_view_list_dirty(layer->compositor);
 }
 
 WL_EXPORT void
@@ -3199,6 +3633,18 @@ weston_output_schedule_repaint(struct weston_output *output)
 	 * no need to set it again. If the repaint has been called but
 	 * not finished, then weston_output_finish_frame() will notice
 	 * that a repaint is needed and schedule one. */
+	if (output->repaint_status == REPAINT_SCHEDULED &&
+	    output->vrr_repeat) {
+		/* New content instead of the repeat, and maybe sooner */
+		struct timespec now;
+
+		output->vrr_repeat = false;
+		weston_compositor_read_presentation_clock(compositor, &now);
+		weston_output_set_vrr_next_repaint(output, &now);
+		output_repaint_timer_arm(compositor);
+		return;
+	}
+
 	if (output->repaint_status != REPAINT_NOT_SCHEDULED)
 		return;
 
@@ -3381,8 +3827,10 @@ weston_surface_commit_subsurface_order(struct weston_surface *surface)
 		wl_list_remove(&sub->parent_link);
 		wl_list_insert(&surface->subsurface_list, &sub->parent_link);
 
-		if (sub->reordered)
+		if (sub->reordered) {
+			weston_compositor_view_list_dirty(surface->compositor);
 			weston_surface_damage_subsurfaces(sub);
+		}
 	}
 }
 
@@ -3654,8 +4102,10 @@ weston_surface_commit_state(struct weston_surface *surface,
 
 	/* wl_surface.damage and wl_surface.damage_buffer */
 	if (pixman_region32_not_empty(&state->damage_surface) ||
-	     pixman_region32_not_empty(&state->damage_buffer))
+	     pixman_region32_not_empty(&state->damage_buffer)) {
 		TL_POINT(surface->compositor, "core_commit_damage", TLP_SURFACE(surface), TLP_END);
+		weston_repaint_stats_surface_committed(surface);
+	}
 
 	pixman_region32_union(&surface->damage, &surface->damage,
 			      &state->damage_surface);
@@ -4157,6 +4607,7 @@ subsurface_committed(struct weston_surface *surface, int32_t dx, int32_t dy)
 
 	if (!weston_surface_is_mapped(surface)) {
 		surface->is_mapped = true;
+		weston_compositor_view_list_dirty(surface->compositor);
 
 		/* Cannot call weston_view_update_transform(),
 		 * because that would call it also for the parent surface,
@@ -4495,6 +4946,7 @@ subsurface_set_desync(struct wl_client *client, struct wl_resource *resource)
 static void
 weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 {
+	weston_compositor_view_list_dirty(sub->surface->compositor);
 	wl_list_remove(&sub->parent_link);
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
@@ -4561,6 +5013,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	weston_compositor_view_list_dirty(parent->compositor);
 }
 
 static void
@@ -4605,6 +5058,7 @@ weston_subsurface_destroy(struct weston_subsurface *sub)
 		assert(sub->parent_destroy_listener.notify == NULL);
 		wl_list_remove(&sub->parent_link);
 		wl_list_remove(&sub->parent_link_pending);
+		weston_compositor_view_list_dirty(sub->surface->compositor);
 	}
 
 	wl_list_remove(&sub->surface_destroy_listener.link);
@@ -4669,6 +5123,7 @@ weston_subsurface_create_for_parent(struct weston_surface *parent)
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	weston_compositor_view_list_dirty(parent->compositor);
 
 	return sub;
 }
@@ -5476,6 +5931,26 @@ weston_head_set_non_desktop(struct weston_head *head, bool non_desktop)
 	weston_head_set_device_changed(head);
 }
 
+/** Store the variable refresh rate range of the display
+ *
+ * \param head The head to modify.
+ * \param min_refresh The lowest refresh rate in mHz, 0 without VRR.
+ * \param max_refresh The highest refresh rate in mHz, 0 without VRR.
+ *
+ * \ingroup head
+ * \internal
+ */
+WL_EXPORT void
+weston_head_set_vrr_range(struct weston_head *head,
+			  int32_t min_refresh, int32_t max_refresh)
+{
+	if (min_refresh <= 0 || max_refresh <= min_refresh)
+		min_refresh = max_refresh = 0;
+
+	head->vrr_min_refresh = min_refresh;
+	head->vrr_max_refresh = max_refresh;
+}
+
 /** Store display transformation
  *
  * \param head The head to modify.
@@ -6267,6 +6742,10 @@ weston_output_init(struct weston_output *output,
 
 	pixman_region32_init(&output->region);
 	wl_list_init(&output->mode_list);
+
+	output->repaint_stats = weston_repaint_stats_create();
+	output->repaint_predictor = zalloc(sizeof *output->repaint_predictor);
+	output->vrr_scheduler = zalloc(sizeof *output->vrr_scheduler);
 }
 
 /** Adds weston_output object to pending output list.
@@ -6581,6 +7060,12 @@ weston_output_release(struct weston_output *output)
 	wl_list_for_each_safe(head, tmp, &output->head_list, output_link)
 		weston_head_detach(head);
 
+	weston_repaint_stats_destroy(output);
+	free(output->repaint_predictor);
+	output->repaint_predictor = NULL;
+	free(output->vrr_scheduler);
+	output->vrr_scheduler = NULL;
+
 	free(output->name);
 }
 
@@ -6724,6 +7209,21 @@ weston_output_allow_protection(struct weston_output *output,
 	output->allow_protection = allow_protection;
 }
 
+/** Allow/Disallow variable refresh rate for an output
+ *
+ * With VRR allowed, and when all its heads support it, the output follows
+ * a fullscreen client: its frames are presented as soon as the client
+ * commits them, within the refresh rate range of the display.
+ *
+ * \param output The weston_output to allow VRR on.
+ * \param allow_vrr The bool value which is to be set.
+ */
+WL_EXPORT void
+weston_output_allow_vrr(struct weston_output *output, bool allow_vrr)
+{
+	output->vrr_allowed = allow_vrr;
+}
+
 static void
 xdg_output_unlist(struct wl_resource *resource)
 {
@@ -7412,6 +7912,7 @@ weston_compositor_create(struct wl_display *display,
 		goto fail;
 
 	wl_list_init(&ec->view_list);
+	ec->view_list_needs_rebuild = true;
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
@@ -7436,9 +7937,14 @@ weston_compositor_create(struct wl_display *display,
 
 	loop = wl_display_get_event_loop(ec->wl_display);
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
+	ec->repaint_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					      TFD_CLOEXEC | TFD_NONBLOCK);
+	if (ec->repaint_timer_fd < 0)
+		goto fail;
 	ec->repaint_timer =
-		wl_event_loop_add_timer(loop, output_repaint_timer_handler,
-					ec);
+		wl_event_loop_add_fd(loop, ec->repaint_timer_fd,
+				     WL_EVENT_READABLE,
+				     output_repaint_timer_fd_handler, ec);
 
 	weston_layer_init(&ec->fade_layer, ec);
 	weston_layer_init(&ec->cursor_layer, ec);
@@ -7453,12 +7959,9 @@ weston_compositor_create(struct wl_display *display,
 						debug_scene_graph_cb, NULL,
 						ec);
 
-	ec->timeline =
-		weston_compositor_add_log_scope(ec, "timeline",
-						"Timeline event points\n",
-						weston_timeline_create_subscription,
-						weston_timeline_destroy_subscription,
-						ec);
+	ec->timeline = weston_timeline_create_scope(ec);
+
+	ec->repaint_stats = weston_repaint_stats_create_scope(ec);
 	return ec;
 
 fail:
@@ -7487,6 +7990,14 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	if (ec->renderer)
 		ec->renderer->destroy(ec);
 
+	wl_event_source_remove(ec->repaint_timer);
+	ec->repaint_timer = NULL;
+	close(ec->repaint_timer_fd);
+	ec->repaint_timer_fd = -1;
+
+	weston_worker_pool_destroy(ec->repaint_pool);
+	ec->repaint_pool = NULL;
+
 	weston_binding_list_destroy_all(&ec->key_binding_list);
 	weston_binding_list_destroy_all(&ec->modifier_binding_list);
 	weston_binding_list_destroy_all(&ec->button_binding_list);
@@ -7596,6 +8107,12 @@ weston_compositor_read_presentation_clock(
 	static bool warned;
 	int ret;
 
+	if (compositor->backend &&
+	    compositor->backend->read_presentation_clock) {
+		compositor->backend->read_presentation_clock(compositor, ts);
+		return;
+	}
+
 	ret = clock_gettime(compositor->presentation_clock, ts);
 	if (ret < 0) {
 		ts->tv_sec = 0;
@@ -7826,9 +8343,12 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	weston_log_scope_destroy(compositor->debug_scene);
 	compositor->debug_scene = NULL;
 
-	weston_log_scope_destroy(compositor->timeline);
+	weston_timeline_destroy_scope(compositor->timeline);
 	compositor->timeline = NULL;
 
+	weston_log_scope_destroy(compositor->repaint_stats);
+	compositor->repaint_stats = NULL;
+
 	free(compositor);
 }
 
@@ -7963,6 +8483,22 @@ weston_buffer_send_server_error(struct weston_buffer *buffer,
 			       "wl_buffer@%u: %s", id, msg);
 }
 
+/** The GPU finished rendering the repaint in flight
+ *
+ * \param end When the GPU finished, in CLOCK_MONOTONIC.
+ *
+ * For renderers which can tell, so that the adaptive repaint window
+ * covers the GPU time as well.
+ */
+WL_EXPORT void
+weston_output_repaint_gpu_done(struct weston_output *output,
+			       const struct timespec *end)
+{
+	if (output->repaint_predictor)
+		weston_repaint_predictor_frame_done(output->repaint_predictor,
+						    timespec_to_nsec(end));
+}
+
 WL_EXPORT void
 weston_output_disable_planes_incr(struct weston_output *output)
 {
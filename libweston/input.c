@@ -45,6 +45,7 @@
 #include <libweston/libweston.h>
 #include "backend.h"
 #include "libweston-internal.h"
+#include "repaint-stats.h"
 #include "relative-pointer-unstable-v1-server-protocol.h"
 #include "pointer-constraints-unstable-v1-server-protocol.h"
 #include "input-timestamps-unstable-v1-server-protocol.h"
@@ -1267,6 +1268,8 @@ weston_pointer_destroy(struct weston_pointer *pointer)
 	wl_list_remove(&pointer->focus_view_listener.link);
 	wl_list_remove(&pointer->output_destroy_listener.link);
 	wl_list_remove(&pointer->timestamps_list);
+	if (pointer->motion_flush_timer)
+		wl_event_source_remove(pointer->motion_flush_timer);
 	free(pointer);
 }
 
@@ -1779,6 +1782,216 @@ weston_pointer_handle_output_destroy(struct wl_listener *listener, void *data)
 	weston_pointer_move_to(pointer, fx, fy);
 }
 
+/** Deliver the motion held back by motion coalescing, if any
+ *
+ * The pointer frame that followed the motion, if it was held back as
+ * well, is delivered right after it.
+ */
+static void
+weston_pointer_flush_motion(struct weston_pointer *pointer)
+{
+	struct weston_pointer_motion_event event;
+	struct timespec time;
+	bool frame;
+
+	if (!pointer->motion_pending)
+		return;
+
+	event = pointer->pending_motion;
+	time = pointer->pending_motion_time;
+	frame = pointer->motion_frame_pending;
+	pointer->motion_pending = false;
+	pointer->motion_frame_pending = false;
+	wl_event_source_timer_update(pointer->motion_flush_timer, 0);
+
+	pointer->grab->interface->motion(pointer->grab, &time, &event);
+	if (frame)
+		pointer->grab->interface->frame(pointer->grab);
+}
+
+static void
+weston_seat_flush_pointer_motion(struct weston_seat *seat)
+{
+	if (seat->pointer_state)
+		weston_pointer_flush_motion(seat->pointer_state);
+}
+
+/** Deliver the held back motion of all seats
+ *
+ * Called at the start of every repaint, so that pointer motion reaches
+ * the clients and the cursor plane once per output frame.
+ */
+void
+weston_compositor_flush_pointer_motion(struct weston_compositor *compositor)
+{
+	struct weston_seat *seat;
+
+	wl_list_for_each(seat, &compositor->seat_list, link)
+		weston_seat_flush_pointer_motion(seat);
+}
+
+static int
+pointer_motion_flush_timer_handler(void *data)
+{
+	struct weston_pointer *pointer = data;
+
+	weston_pointer_flush_motion(pointer);
+
+	return 0;
+}
+
+/** Add motion to the held back one, if they are of the same kind
+ *
+ * Absolute positions replace each other while relative deltas add up, so
+ * that relative pointer clients still see the whole distance travelled.
+ */
+static bool
+weston_pointer_motion_merge(struct weston_pointer_motion_event *pending,
+			    const struct weston_pointer_motion_event *event)
+{
+	if (pending->mask != event->mask)
+		return false;
+
+	if (event->mask & WESTON_POINTER_MOTION_ABS) {
+		pending->x = event->x;
+		pending->y = event->y;
+	}
+	if (event->mask & WESTON_POINTER_MOTION_REL) {
+		pending->dx += event->dx;
+		pending->dy += event->dy;
+	}
+	if (event->mask & WESTON_POINTER_MOTION_REL_UNACCEL) {
+		pending->dx_unaccel += event->dx_unaccel;
+		pending->dy_unaccel += event->dy_unaccel;
+	}
+	pending->time = event->time;
+
+	return true;
+}
+
+/** Where the pointer is, or will be once the held back motion is delivered
+ *
+ * pointer->x and pointer->y only move when the motion reaches the grab,
+ * so while motion is held back they lag behind the device.
+ */
+static void
+weston_pointer_get_target_position(struct weston_pointer *pointer,
+				   int *x, int *y)
+{
+	wl_fixed_t fx = pointer->x;
+	wl_fixed_t fy = pointer->y;
+
+	if (pointer->motion_pending) {
+		weston_pointer_motion_to_abs(pointer, &pointer->pending_motion,
+					     &fx, &fy);
+		weston_pointer_clamp(pointer, &fx, &fy);
+	}
+
+	*x = wl_fixed_to_int(fx);
+	*y = wl_fixed_to_int(fy);
+}
+
+static uint32_t
+weston_pointer_frame_msec(struct weston_pointer *pointer)
+{
+	struct weston_compositor *ec = pointer->seat->compositor;
+	struct weston_output *output;
+	int x, y;
+
+	weston_pointer_get_target_position(pointer, &x, &y);
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (!pixman_region32_contains_point(&output->region,
+						    x, y, NULL))
+			continue;
+		if (!output->current_mode || output->current_mode->refresh <= 0)
+			break;
+		return MAX(millihz_to_nsec(output->current_mode->refresh) /
+			   1000000, 1);
+	}
+
+	return 16;
+}
+
+/** Hold motion back until the next frame
+ *
+ * Motion is normally delivered at the start of the next repaint. The
+ * timer only covers the case where nothing is being repainted, e.g.
+ * with the cursor hidden, so that motion is never held for more than
+ * about a frame.
+ */
+static void
+weston_pointer_queue_motion(struct weston_pointer *pointer,
+			    const struct timespec *time,
+			    const struct weston_pointer_motion_event *event)
+{
+	struct wl_event_loop *loop;
+
+	if (pointer->motion_pending &&
+	    weston_pointer_motion_merge(&pointer->pending_motion, event)) {
+		pointer->pending_motion_time = *time;
+		return;
+	}
+
+	weston_pointer_flush_motion(pointer);
+
+	if (!pointer->motion_flush_timer) {
+		loop = wl_display_get_event_loop(pointer->seat->compositor->wl_display);
+		pointer->motion_flush_timer =
+			wl_event_loop_add_timer(loop,
+						pointer_motion_flush_timer_handler,
+						pointer);
+		if (!pointer->motion_flush_timer) {
+			pointer->grab->interface->motion(pointer->grab,
+							 time, event);
+			return;
+		}
+	}
+
+	pointer->pending_motion = *event;
+	pointer->pending_motion_time = *time;
+	pointer->motion_pending = true;
+
+	wl_event_source_timer_update(pointer->motion_flush_timer,
+				     weston_pointer_frame_msec(pointer));
+	if (pointer->sprite)
+		weston_view_schedule_repaint(pointer->sprite);
+}
+
+/* The outputs pointer input may show on: the one under the cursor and
+ * those of the focus surface; for the input-to-present latency. */
+static uint32_t
+pointer_output_mask(struct weston_pointer *pointer)
+{
+	struct weston_compositor *ec = pointer->seat->compositor;
+	struct weston_output *output;
+	uint32_t mask = 0;
+	int x, y;
+
+	weston_pointer_get_target_position(pointer, &x, &y);
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (pixman_region32_contains_point(&output->region, x, y, NULL))
+			mask |= 1u << output->id;
+	}
+
+	if (pointer->focus)
+		mask |= pointer->focus->surface->output_mask;
+
+	return mask;
+}
+
+static void
+pointer_notify_motion(struct weston_pointer *pointer,
+		      const struct timespec *time,
+		      struct weston_pointer_motion_event *event)
+{
+	if (pointer->seat->compositor->coalesce_pointer_motion)
+		weston_pointer_queue_motion(pointer, time, event);
+	else
+		pointer->grab->interface->motion(pointer->grab, time, event);
+}
+
 WL_EXPORT void
 notify_motion(struct weston_seat *seat,
 	      const struct timespec *time,
@@ -1788,7 +2001,8 @@ notify_motion(struct weston_seat *seat,
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
 	weston_compositor_wake(ec);
-	pointer->grab->interface->motion(pointer->grab, time, event);
+	pointer_notify_motion(pointer, time, event);
+	weston_input_latency_record(seat, time, pointer_output_mask(pointer));
 }
 
 static void
@@ -1843,7 +2057,8 @@ notify_motion_absolute(struct weston_seat *seat, const struct timespec *time,
 		.y = y,
 	};
 
-	pointer->grab->interface->motion(pointer->grab, time, &event);
+	pointer_notify_motion(pointer, time, &event);
+	weston_input_latency_record(seat, time, pointer_output_mask(pointer));
 }
 
 static unsigned int
@@ -1882,6 +2097,9 @@ notify_button(struct weston_seat *seat, const struct timespec *time,
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	weston_pointer_flush_motion(pointer);
+	weston_input_latency_record(seat, time, pointer_output_mask(pointer));
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		if (pointer->button_count == 0) {
@@ -1914,6 +2132,7 @@ notify_axis(struct weston_seat *seat, const struct timespec *time,
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
 	weston_compositor_wake(compositor);
+	weston_pointer_flush_motion(pointer);
 
 	if (weston_compositor_run_axis_binding(compositor, pointer,
 					       time, event))
@@ -1929,6 +2148,7 @@ notify_axis_source(struct weston_seat *seat, uint32_t source)
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
 	weston_compositor_wake(compositor);
+	weston_pointer_flush_motion(pointer);
 
 	pointer->grab->interface->axis_source(pointer->grab, source);
 }
@@ -1941,6 +2161,12 @@ notify_pointer_frame(struct weston_seat *seat)
 
 	weston_compositor_wake(compositor);
 
+	/* Keep the frame with the motion it terminates */
+	if (pointer->motion_pending) {
+		pointer->motion_frame_pending = true;
+		return;
+	}
+
 	pointer->grab->interface->frame(pointer->grab);
 }
 
@@ -2194,6 +2420,10 @@ notify_key(struct weston_seat *seat, const struct timespec *time, uint32_t key,
 	struct weston_keyboard_grab *grab = keyboard->grab;
 	uint32_t *k, *end;
 
+	weston_seat_flush_pointer_motion(seat);
+	weston_input_latency_record(seat, time, keyboard->focus ?
+				    keyboard->focus->output_mask : 0);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 	} else {
@@ -3361,6 +3591,7 @@ weston_seat_release_pointer(struct weston_seat *seat)
 
 	seat->pointer_device_count--;
 	if (seat->pointer_device_count == 0) {
+		weston_pointer_flush_motion(pointer);
 		weston_pointer_clear_focus(pointer);
 		weston_pointer_cancel_grab(pointer);
 
@@ -3432,6 +3663,7 @@ weston_seat_init(struct weston_seat *seat, struct weston_compositor *ec,
 	seat->compositor = ec;
 	seat->modifier_state = 0;
 	seat->seat_name = strdup(seat_name);
+	seat->input_latency = weston_input_latency_create();
 
 	wl_list_insert(ec->seat_list.prev, &seat->link);
 
@@ -3469,6 +3701,7 @@ weston_seat_release(struct weston_seat *seat)
 		weston_touch_destroy(seat->touch_state);
 
 	free (seat->seat_name);
+	weston_input_latency_destroy(seat->input_latency);
 
 	wl_global_destroy(seat->global);
 
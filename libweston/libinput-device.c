@@ -42,6 +42,7 @@
 #include "backend.h"
 #include "libweston-internal.h"
 #include "libinput-device.h"
+#include "libinput-seat.h"
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 
@@ -332,21 +333,35 @@ touch_get_calibration_head_name(struct weston_touch_device *device)
 	return NULL;
 }
 
+static struct udev_input *
+evdev_device_get_input(struct evdev_device *device)
+{
+	struct libinput *libinput = libinput_device_get_context(device->device);
+
+	return libinput_get_user_data(libinput);
+}
+
 static void
 touch_get_calibration(struct weston_touch_device *device,
 		      struct weston_touch_device_matrix *cal)
 {
 	struct evdev_device *evdev_device = device->backend_data;
+	struct udev_input *input = evdev_device_get_input(evdev_device);
+	bool locked;
 
+	locked = udev_input_lock(input);
 	libinput_device_config_calibration_get_matrix(evdev_device->device,
 						      cal->m);
+	udev_input_unlock(input, locked);
 }
 
 static void
 do_set_calibration(struct evdev_device *evdev_device,
 		   const struct weston_touch_device_matrix *cal)
 {
+	struct udev_input *input = evdev_device_get_input(evdev_device);
 	enum libinput_config_status status;
+	bool locked;
 
 	weston_log("input device %s: applying calibration:\n",
 		   libinput_device_get_sysname(evdev_device->device));
@@ -355,8 +370,10 @@ do_set_calibration(struct evdev_device *evdev_device,
 	weston_log_continue(STAMP_SPACE "  %f %f %f\n",
 			    cal->m[3], cal->m[4], cal->m[5]);
 
+	locked = udev_input_lock(input);
 	status = libinput_device_config_calibration_set_matrix(evdev_device->device,
 							       cal->m);
+	udev_input_unlock(input, locked);
 	if (status != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		weston_log("Error: Failed to apply calibration.\n");
 }
@@ -567,8 +584,8 @@ notify_output_destroy(struct wl_listener *listener, void *data)
  * can't do that, so we need to convert the calibration to the normalized
  * format libinput expects.
  */
-void
-evdev_device_set_calibration(struct evdev_device *device)
+static void
+evdev_device_load_calibration(struct evdev_device *device)
 {
 	struct udev *udev;
 	struct udev_device *udev_device = NULL;
@@ -656,6 +673,17 @@ out:
 	udev_unref(udev);
 }
 
+void
+evdev_device_set_calibration(struct evdev_device *device)
+{
+	struct udev_input *input = evdev_device_get_input(device);
+	bool locked;
+
+	locked = udev_input_lock(input);
+	evdev_device_load_calibration(device);
+	udev_input_unlock(input, locked);
+}
+
 void
 evdev_device_set_output(struct evdev_device *device,
 			struct weston_output *output)
@@ -0,0 +1,189 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Single-producer/single-consumer ring between the libinput thread and
+ * the compositor thread. The producer owns 'tail' and the consumer owns
+ * 'head'; each publishes its index with release semantics after touching
+ * the slot, so neither side ever waits for the other. A full ring
+ * rejects the item, it is up to the producer to keep it.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#include "libinput-queue.h"
+
+int
+udev_input_queue_init(struct udev_input_queue *queue, unsigned int order)
+{
+	memset(queue, 0, sizeof *queue);
+
+	queue->items = calloc(1u << order, sizeof *queue->items);
+	if (!queue->items)
+		return -1;
+
+	queue->mask = (1u << order) - 1;
+
+	return 0;
+}
+
+void
+udev_input_queue_release(struct udev_input_queue *queue)
+{
+	free(queue->items);
+	queue->items = NULL;
+}
+
+/** Whether the next push would fail, only meaningful to the producer */
+bool
+udev_input_queue_is_full(struct udev_input_queue *queue)
+{
+	uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+	return queue->tail - head > queue->mask;
+}
+
+bool
+udev_input_queue_push(struct udev_input_queue *queue,
+		      const struct udev_input_item *item)
+{
+	uint32_t tail = queue->tail;
+
+	if (udev_input_queue_is_full(queue))
+		return false;
+
+	queue->items[tail & queue->mask] = *item;
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+bool
+udev_input_queue_pop(struct udev_input_queue *queue,
+		     struct udev_input_item *item)
+{
+	uint32_t head = queue->head;
+	uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return false;
+
+	*item = queue->items[head & queue->mask];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/*
+ * The input thread calls into libinput with the lock held, and libinput
+ * may ask for a device to be opened or closed from there. Only the
+ * compositor thread may talk to the launcher, so the request is handed
+ * over and the input thread waits for it with the lock dropped. The
+ * compositor thread has to keep serving requests until the input thread
+ * is gone before joining it, or both would wait on each other.
+ */
+
+void
+udev_input_handoff_init(struct udev_input_handoff *handoff,
+			pthread_mutex_t *lock, pthread_cond_t *cond,
+			int wake_fd)
+{
+	memset(handoff, 0, sizeof *handoff);
+
+	handoff->lock = lock;
+	handoff->cond = cond;
+	handoff->wake_fd = wake_fd;
+}
+
+/** Have the compositor thread serve a request, from the input thread
+ *
+ * Called with the lock held, which is dropped while waiting.
+ *
+ * \return The result the compositor thread set.
+ */
+int
+udev_input_handoff_request(struct udev_input_handoff *handoff,
+			   const struct udev_input_request *request)
+{
+	handoff->request = *request;
+	handoff->request.pending = true;
+	pthread_cond_broadcast(handoff->cond);
+	eventfd_write(handoff->wake_fd, 1);
+
+	while (handoff->request.pending)
+		pthread_cond_wait(handoff->cond, handoff->lock);
+
+	return handoff->request.result;
+}
+
+/** Serve the pending request if any, from the compositor thread
+ *
+ * Called with the lock held.
+ */
+void
+udev_input_handoff_serve(struct udev_input_handoff *handoff,
+			 udev_input_serve_func_t serve, void *data)
+{
+	if (!handoff->request.pending)
+		return;
+
+	serve(&handoff->request, data);
+
+	handoff->request.pending = false;
+	pthread_cond_broadcast(handoff->cond);
+}
+
+/** Tell the compositor thread the input thread makes no more requests */
+void
+udev_input_handoff_thread_exit(struct udev_input_handoff *handoff)
+{
+	pthread_mutex_lock(handoff->lock);
+	handoff->thread_exited = true;
+	pthread_cond_broadcast(handoff->cond);
+	pthread_mutex_unlock(handoff->lock);
+}
+
+/** Serve requests until the input thread is on its way out
+ *
+ * For the compositor thread, after asking the input thread to stop and
+ * before joining it: the input thread may be waiting for a request in the
+ * middle of a dispatch, or make more on its way out.
+ */
+void
+udev_input_handoff_wait_exit(struct udev_input_handoff *handoff,
+			     udev_input_serve_func_t serve, void *data)
+{
+	pthread_mutex_lock(handoff->lock);
+	while (!handoff->thread_exited) {
+		udev_input_handoff_serve(handoff, serve, data);
+		if (!handoff->thread_exited && !handoff->request.pending)
+			pthread_cond_wait(handoff->cond, handoff->lock);
+	}
+	pthread_mutex_unlock(handoff->lock);
+}
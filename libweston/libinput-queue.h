@@ -0,0 +1,125 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _LIBINPUT_QUEUE_H_
+#define _LIBINPUT_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+struct libinput_event;
+
+enum udev_input_item_type {
+	UDEV_INPUT_ITEM_EVENT,
+	/** a libinput log message, logged from the input thread */
+	UDEV_INPUT_ITEM_LOG,
+};
+
+struct udev_input_item {
+	enum udev_input_item_type type;
+	union {
+		struct libinput_event *event;
+		char *message;
+	};
+};
+
+/** Hands items from the input thread over to the compositor thread */
+struct udev_input_queue {
+	struct udev_input_item *items;
+	uint32_t mask;
+	uint32_t head;	/**< next item to pop, owned by the consumer */
+	uint32_t tail;	/**< next free slot, owned by the producer */
+};
+
+int
+udev_input_queue_init(struct udev_input_queue *queue, unsigned int order);
+
+void
+udev_input_queue_release(struct udev_input_queue *queue);
+
+bool
+udev_input_queue_is_full(struct udev_input_queue *queue);
+
+bool
+udev_input_queue_push(struct udev_input_queue *queue,
+		      const struct udev_input_item *item);
+
+bool
+udev_input_queue_pop(struct udev_input_queue *queue,
+		     struct udev_input_item *item);
+
+enum udev_input_request_type {
+	UDEV_INPUT_REQUEST_OPEN,
+	UDEV_INPUT_REQUEST_CLOSE,
+};
+
+/** A device the input thread needs the compositor thread to open or close */
+struct udev_input_request {
+	bool pending;
+	enum udev_input_request_type type;
+	const char *path;
+	int flags;
+	int fd;
+	int result;
+};
+
+typedef void (*udev_input_serve_func_t)(struct udev_input_request *request,
+					void *data);
+
+/** Hands requests from the input thread over to the compositor thread
+ *
+ * Everything in here is protected by the lock, which the input thread
+ * holds while dispatching and only drops to wait for its request.
+ */
+struct udev_input_handoff {
+	pthread_mutex_t *lock;
+	pthread_cond_t *cond;
+	int wake_fd;
+	struct udev_input_request request;
+	bool thread_exited;
+};
+
+void
+udev_input_handoff_init(struct udev_input_handoff *handoff,
+			pthread_mutex_t *lock, pthread_cond_t *cond,
+			int wake_fd);
+
+int
+udev_input_handoff_request(struct udev_input_handoff *handoff,
+			   const struct udev_input_request *request);
+
+void
+udev_input_handoff_serve(struct udev_input_handoff *handoff,
+			 udev_input_serve_func_t serve, void *data);
+
+void
+udev_input_handoff_thread_exit(struct udev_input_handoff *handoff);
+
+void
+udev_input_handoff_wait_exit(struct udev_input_handoff *handoff,
+			     udev_input_serve_func_t serve, void *data);
+
+#endif /* _LIBINPUT_QUEUE_H_ */
@@ -28,9 +28,14 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <libinput.h>
 #include <libudev.h>
 
@@ -45,11 +50,18 @@
 
 static void
 process_events(struct udev_input *input);
+static void
+udev_input_stop_thread(struct udev_input *input);
 static struct udev_seat *
 udev_seat_create(struct udev_input *input, const char *seat_name);
 static void
 udev_seat_destroy(struct udev_seat *seat);
 
+#define UDEV_INPUT_QUEUE_ORDER 12
+
+/* Set on the input thread, to route its libinput calls back */
+static __thread bool in_input_thread;
+
 static struct udev_seat *
 get_udev_seat(struct udev_input *input, struct libinput_device *device)
 {
@@ -164,8 +176,12 @@ udev_input_disable(struct udev_input *input)
 	if (input->suspended)
 		return;
 
-	wl_event_source_remove(input->libinput_source);
-	input->libinput_source = NULL;
+	if (input->thread_running) {
+		udev_input_stop_thread(input);
+	} else {
+		wl_event_source_remove(input->libinput_source);
+		input->libinput_source = NULL;
+	}
 	libinput_suspend(input->libinput);
 	process_events(input);
 	input->suspended = 1;
@@ -233,12 +249,272 @@ libinput_source_dispatch(int fd, uint32_t mask, void *data)
 	return udev_input_dispatch(input) != 0;
 }
 
+/** Have the compositor thread open or close a device for the input thread
+ *
+ * Called with the lock held, from inside libinput_dispatch(). The
+ * launcher is not thread-safe, so the request is handed over and the lock
+ * dropped until udev_input_serve_request() ran.
+ */
+static int
+udev_input_thread_request(struct udev_input *input,
+			  enum udev_input_request_type type,
+			  const char *path, int flags, int fd)
+{
+	struct udev_input_request request = {
+		.type = type,
+		.path = path,
+		.flags = flags,
+		.fd = fd,
+	};
+
+	return udev_input_handoff_request(&input->handoff, &request);
+}
+
+static void
+udev_input_serve_request(struct udev_input_request *request, void *data)
+{
+	struct udev_input *input = data;
+	struct weston_launcher *launcher = input->compositor->launcher;
+
+	switch (request->type) {
+	case UDEV_INPUT_REQUEST_OPEN:
+		request->result = weston_launcher_open(launcher, request->path,
+						       request->flags);
+		break;
+	case UDEV_INPUT_REQUEST_CLOSE:
+		weston_launcher_close(launcher, request->fd);
+		request->result = 0;
+		break;
+	}
+}
+
+/** Take the libinput lock from the compositor thread
+ *
+ * Needed around any call into libinput while the input thread runs. It
+ * is fine to nest, e.g. for a LED update while processing a key event.
+ *
+ * \return Whether the lock was taken, to be passed to udev_input_unlock().
+ */
+bool
+udev_input_lock(struct udev_input *input)
+{
+	if (!input->thread_running || input->main_locked)
+		return false;
+
+	pthread_mutex_lock(&input->lock);
+
+	/* The input thread only lets go of the lock in the middle of a
+	 * dispatch to wait for a device to be opened or closed. */
+	while (input->thread_dispatching) {
+		udev_input_handoff_serve(&input->handoff,
+					 udev_input_serve_request, input);
+		if (input->thread_dispatching)
+			pthread_cond_wait(&input->cond, &input->lock);
+	}
+
+	input->main_locked = true;
+
+	return true;
+}
+
+void
+udev_input_unlock(struct udev_input *input, bool locked)
+{
+	if (!locked)
+		return;
+
+	input->main_locked = false;
+	pthread_mutex_unlock(&input->lock);
+}
+
+static void
+udev_input_process_queue(struct udev_input *input)
+{
+	struct udev_input_item item;
+
+	while (udev_input_queue_pop(&input->queue, &item)) {
+		switch (item.type) {
+		case UDEV_INPUT_ITEM_EVENT:
+			process_event(item.event);
+			libinput_event_destroy(item.event);
+			break;
+		case UDEV_INPUT_ITEM_LOG:
+			weston_log("%s", item.message);
+			free(item.message);
+			break;
+		}
+	}
+}
+
+static int
+udev_input_wake(int fd, uint32_t mask, void *data)
+{
+	struct udev_input *input = data;
+	eventfd_t count;
+	bool locked;
+
+	eventfd_read(fd, &count);
+
+	locked = udev_input_lock(input);
+	udev_input_process_queue(input);
+	/* whatever did not fit in the queue */
+	process_events(input);
+	udev_input_unlock(input, locked);
+
+	return 0;
+}
+
+static void
+udev_input_thread_log(struct udev_input *input, const char *fmt, va_list ap)
+{
+	struct udev_input_item item = { .type = UDEV_INPUT_ITEM_LOG };
+
+	if (vasprintf(&item.message, fmt, ap) < 0)
+		return;
+
+	if (!udev_input_queue_push(&input->queue, &item))
+		free(item.message);
+}
+
+static void WL_PRINTF(2, 3)
+udev_input_thread_printf(struct udev_input *input, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	udev_input_thread_log(input, fmt, ap);
+	va_end(ap);
+}
+
+static void *
+udev_input_thread(void *data)
+{
+	struct udev_input *input = data;
+	struct udev_input_item item = { .type = UDEV_INPUT_ITEM_EVENT };
+	struct pollfd fds[2] = {
+		{ .fd = libinput_get_fd(input->libinput), .events = POLLIN },
+		{ .fd = input->stop_fd, .events = POLLIN },
+	};
+	bool queued;
+
+	in_input_thread = true;
+
+	for (;;) {
+		if (poll(fds, ARRAY_LENGTH(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[1].revents)
+			break;
+
+		pthread_mutex_lock(&input->lock);
+		input->thread_dispatching = true;
+
+		if (libinput_dispatch(input->libinput) != 0)
+			udev_input_thread_printf(input, "libinput: Failed to "
+						 "dispatch libinput\n");
+
+		queued = false;
+		while (!udev_input_queue_is_full(&input->queue) &&
+		       (item.event = libinput_get_event(input->libinput))) {
+			udev_input_queue_push(&input->queue, &item);
+			queued = true;
+		}
+
+		input->thread_dispatching = false;
+		pthread_cond_broadcast(&input->cond);
+		pthread_mutex_unlock(&input->lock);
+
+		if (queued)
+			eventfd_write(input->wake_fd, 1);
+	}
+
+	udev_input_handoff_thread_exit(&input->handoff);
+
+	return NULL;
+}
+
+static int
+udev_input_start_thread(struct udev_input *input)
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(input->compositor->wl_display);
+	input->wake_source = wl_event_loop_add_fd(loop, input->wake_fd,
+						  WL_EVENT_READABLE,
+						  udev_input_wake, input);
+	if (!input->wake_source)
+		return -1;
+
+	udev_input_handoff_init(&input->handoff, &input->lock, &input->cond,
+				input->wake_fd);
+
+	input->thread_running = true;
+	if (pthread_create(&input->thread, NULL,
+			   udev_input_thread, input) != 0) {
+		input->thread_running = false;
+		wl_event_source_remove(input->wake_source);
+		input->wake_source = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Free what the input thread needs, once it is stopped */
+static void
+udev_input_release_thread(struct udev_input *input)
+{
+	if (input->wake_fd < 0 && input->stop_fd < 0)
+		return;
+
+	if (input->wake_fd >= 0)
+		close(input->wake_fd);
+	if (input->stop_fd >= 0)
+		close(input->stop_fd);
+	input->wake_fd = -1;
+	input->stop_fd = -1;
+
+	udev_input_queue_release(&input->queue);
+	pthread_cond_destroy(&input->cond);
+	pthread_mutex_destroy(&input->lock);
+}
+
+/** Stop the input thread, processing what it already queued
+ *
+ * The thread may be in the middle of a dispatch, waiting for a device to
+ * be opened or closed, so its requests are served until it is out.
+ */
+static void
+udev_input_stop_thread(struct udev_input *input)
+{
+	eventfd_t count;
+
+	eventfd_write(input->stop_fd, 1);
+	udev_input_handoff_wait_exit(&input->handoff,
+				     udev_input_serve_request, input);
+	pthread_join(input->thread, NULL);
+	eventfd_read(input->stop_fd, &count);
+	input->thread_running = false;
+
+	wl_event_source_remove(input->wake_source);
+	input->wake_source = NULL;
+
+	udev_input_process_queue(input);
+}
+
 static int
 open_restricted(const char *path, int flags, void *user_data)
 {
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
 
+	if (in_input_thread)
+		return udev_input_thread_request(input, UDEV_INPUT_REQUEST_OPEN,
+						 path, flags, -1);
+
 	return weston_launcher_open(launcher, path, flags);
 }
 
@@ -248,6 +524,12 @@ close_restricted(int fd, void *user_data)
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
 
+	if (in_input_thread) {
+		udev_input_thread_request(input, UDEV_INPUT_REQUEST_CLOSE,
+					  NULL, 0, fd);
+		return;
+	}
+
 	weston_launcher_close(launcher, fd);
 }
 
@@ -265,25 +547,26 @@ udev_input_enable(struct udev_input *input)
 	struct udev_seat *seat;
 	int devices_found = 0;
 
-	loop = wl_display_get_event_loop(c->wl_display);
-	fd = libinput_get_fd(input->libinput);
-	input->libinput_source =
-		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
-				     libinput_source_dispatch, input);
-	if (!input->libinput_source) {
-		return -1;
-	}
-
 	if (input->suspended) {
-		if (libinput_resume(input->libinput) != 0) {
-			wl_event_source_remove(input->libinput_source);
-			input->libinput_source = NULL;
+		if (libinput_resume(input->libinput) != 0)
 			return -1;
-		}
 		input->suspended = 0;
 		process_events(input);
 	}
 
+	if (c->input_thread && input->wake_fd >= 0 &&
+	    udev_input_start_thread(input) == 0) {
+		weston_log("libinput: reading input devices from a thread\n");
+	} else {
+		loop = wl_display_get_event_loop(c->wl_display);
+		fd = libinput_get_fd(input->libinput);
+		input->libinput_source =
+			wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+					     libinput_source_dispatch, input);
+		if (!input->libinput_source)
+			return -1;
+	}
+
 	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
 		evdev_notify_keyboard_focus(&seat->base, &seat->devices_list);
 
@@ -316,7 +599,12 @@ libinput_log_func(struct libinput *libinput,
 		  enum libinput_log_priority priority,
 		  const char *format, va_list args)
 {
-	weston_vlog(format, args);
+	struct udev_input *input = libinput_get_user_data(libinput);
+
+	if (in_input_thread)
+		udev_input_thread_log(input, format, args);
+	else
+		weston_vlog(format, args);
 }
 
 int
@@ -331,6 +619,23 @@ udev_input_init(struct udev_input *input, struct weston_compositor *c,
 
 	input->compositor = c;
 	input->configure_device = configure_device;
+	input->wake_fd = -1;
+	input->stop_fd = -1;
+
+	if (c->input_thread) {
+		pthread_mutex_init(&input->lock, NULL);
+		pthread_cond_init(&input->cond, NULL);
+		input->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		input->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (input->wake_fd < 0 || input->stop_fd < 0 ||
+		    udev_input_queue_init(&input->queue,
+					  UDEV_INPUT_QUEUE_ORDER) < 0) {
+			weston_log("libinput: failed to set up the input "
+				   "thread, reading input devices in the "
+				   "main loop\n");
+			udev_input_release_thread(input);
+		}
+	}
 
 	log_priority = getenv("WESTON_LIBINPUT_LOG_PRIORITY");
 
@@ -356,6 +661,7 @@ udev_input_init(struct udev_input *input, struct weston_compositor *c,
 
 	if (libinput_udev_assign_seat(input->libinput, seat_id) != 0) {
 		libinput_unref(input->libinput);
+		udev_input_release_thread(input);
 		return -1;
 	}
 
@@ -369,11 +675,14 @@ udev_input_destroy(struct udev_input *input)
 {
 	struct udev_seat *seat, *next;
 
+	if (input->thread_running)
+		udev_input_stop_thread(input);
 	if (input->libinput_source)
 		wl_event_source_remove(input->libinput_source);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
 	libinput_unref(input->libinput);
+	udev_input_release_thread(input);
 }
 
 static void
@@ -381,9 +690,20 @@ udev_seat_led_update(struct weston_seat *seat_base, enum weston_led leds)
 {
 	struct udev_seat *seat = (struct udev_seat *) seat_base;
 	struct evdev_device *device;
+	struct udev_input *input;
+	bool locked;
+
+	if (wl_list_empty(&seat->devices_list))
+		return;
+
+	device = container_of(seat->devices_list.next,
+			      struct evdev_device, link);
+	input = libinput_get_user_data(libinput_device_get_context(device->device));
 
+	locked = udev_input_lock(input);
 	wl_list_for_each(device, &seat->devices_list, link)
 		evdev_led_update(device, leds);
+	udev_input_unlock(input, locked);
 }
 
 static void
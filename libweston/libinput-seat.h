@@ -29,9 +29,12 @@
 
 #include "config.h"
 
+#include <stdbool.h>
+#include <pthread.h>
 #include <libudev.h>
 
 #include <libweston/libweston.h>
+#include "libinput-queue.h"
 
 struct libinput_device;
 
@@ -51,6 +54,21 @@ struct udev_input {
 	struct weston_compositor *compositor;
 	int suspended;
 	udev_configure_device_t configure_device;
+
+	/* Input thread, with weston_compositor::input_thread. It dispatches
+	 * libinput and queues the events, the compositor thread processes
+	 * them. The lock serializes all calls into libinput. */
+	bool thread_running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool thread_dispatching;
+	bool main_locked;
+	struct udev_input_handoff handoff;
+	struct udev_input_queue queue;
+	int wake_fd;
+	int stop_fd;
+	struct wl_event_source *wake_source;
 };
 
 int
@@ -66,6 +84,11 @@ udev_input_init(struct udev_input *input,
 void
 udev_input_destroy(struct udev_input *input);
 
+bool
+udev_input_lock(struct udev_input *input);
+void
+udev_input_unlock(struct udev_input *input, bool locked);
+
 struct udev_seat *
 udev_seat_get_named(struct udev_input *u,
 		    const char *seat_name);
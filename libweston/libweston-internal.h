@@ -76,6 +76,8 @@ weston_compositor_add_head(struct weston_compositor *compositor,
 void
 weston_compositor_add_pending_output(struct weston_output *output,
 				     struct weston_compositor *compositor);
+void
+weston_compositor_build_view_list(struct weston_compositor *compositor);
 bool
 weston_compositor_import_dmabuf(struct weston_compositor *compositor,
 				struct linux_dmabuf_buffer *buffer);
@@ -151,6 +153,9 @@ weston_compositor_xkb_destroy(struct weston_compositor *ec);
 int
 weston_input_init(struct weston_compositor *compositor);
 
+void
+weston_compositor_flush_pointer_motion(struct weston_compositor *compositor);
+
 /* weston_output */
 
 void
@@ -159,6 +164,10 @@ weston_output_disable_planes_incr(struct weston_output *output);
 void
 weston_output_disable_planes_decr(struct weston_output *output);
 
+void
+weston_output_repaint_gpu_done(struct weston_output *output,
+			       const struct timespec *end);
+
 /* weston_plane */
 
 void
@@ -33,6 +33,8 @@
 #include <assert.h>
 
 #include "pixman-renderer.h"
+#include "repaint-stats.h"
+#include "worker-pool.h"
 #include "shared/helpers.h"
 
 #include <linux/input.h>
@@ -42,6 +44,13 @@ struct pixman_output_state {
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
 	pixman_region32_t *hw_extra_damage;
+
+	/* composited by prerender_output, not yet copied to hw_buffer */
+	bool prerendered;
+	pixman_region32_t prerender_damage;
+
+	/* struct weston_view *, bottom first, see cull_views() */
+	struct wl_array draw_views;
 };
 
 struct pixman_surface_state {
@@ -51,6 +60,10 @@ struct pixman_surface_state {
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_release_reference buffer_release_ref;
 
+	/* image is a solid fill of this color, from surface_set_color */
+	bool solid;
+	pixman_color_t solid_color;
+
 	struct wl_listener buffer_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
@@ -63,9 +76,23 @@ struct pixman_renderer {
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	/* compositing threads, the compositor's included */
+	int band_threads;
+	struct weston_worker_pool *band_pool;
+
+	/* overdraw seen by the compositing threads, weston_log() is only
+	 * called from the compositor thread */
+	int overdraw;
+	bool overdraw_warned;
+
 	struct wl_signal destroy_signal;
 };
 
+/* Damage smaller than this is composited on the calling thread */
+#define BAND_MIN_PIXELS (256 * 256)
+/* Rows per band at least */
+#define BAND_MIN_HEIGHT 16
+
 static inline struct pixman_output_state *
 get_output_state(struct weston_output *output)
 {
@@ -223,26 +250,52 @@ composite_whole(pixman_op_t op,
 	int32_t dest_width;
 	int32_t dest_height;
 
+	pixman_image_t *image;
+	void *src_data;
+
 	dest_width = pixman_image_get_width(dest);
 	dest_height = pixman_image_get_height(dest);
 
-	pixman_image_set_transform(src, transform);
-	pixman_image_set_filter(src, filter, NULL, 0);
+	/* A solid fill looks the same under any transform. Otherwise use
+	 * an image of our own on the same pixels, as outputs repainted in
+	 * parallel may composite the same surface with different
+	 * transformations. */
+	src_data = pixman_image_get_data(src);
+	if (!src_data) {
+		pixman_image_composite32(op, src, mask, dest,
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 0, 0, /* dest_x, dest_y */
+					 dest_width, dest_height);
+		return;
+	}
+
+	image = pixman_image_create_bits_no_clear(pixman_image_get_format(src),
+						  pixman_image_get_width(src),
+						  pixman_image_get_height(src),
+						  src_data,
+						  pixman_image_get_stride(src));
+
+	pixman_image_set_transform(image, transform);
+	pixman_image_set_filter(image, filter, NULL, 0);
 
 	/* bilinear filtering needs the equivalent of OpenGL CLAMP_TO_EDGE */
 	if (filter == PIXMAN_FILTER_NEAREST)
-		pixman_image_set_repeat(src, PIXMAN_REPEAT_NONE);
+		pixman_image_set_repeat(image, PIXMAN_REPEAT_NONE);
 	else
-		pixman_image_set_repeat(src, PIXMAN_REPEAT_PAD);
+		pixman_image_set_repeat(image, PIXMAN_REPEAT_PAD);
 
-	pixman_image_composite32(op, src, mask, dest,
+	pixman_image_composite32(op, image, mask, dest,
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
 				 dest_width, dest_height);
+
+	pixman_image_unref(image);
 }
 
-static void
+/* Returns the number of times the destination is drawn */
+static int
 composite_clipped(pixman_image_t *src,
 		  pixman_image_t *mask,
 		  pixman_image_t *dest,
@@ -311,20 +364,14 @@ composite_clipped(pixman_image_t *src,
 		pixman_image_unref(boximg);
 	}
 
-	if (n_box > 1) {
-		static bool warned = false;
-
-		if (!warned)
-			weston_log("Pixman-renderer warning: %dx overdraw\n",
-				   n_box);
-		warned = true;
-	}
+	return n_box;
 }
 
 /** Paint an intersected region
  *
  * \param ev The view to be painted.
  * \param output The output being painted.
+ * \param target_image The image to paint into.
  * \param repaint_output The region to be painted in output coordinates.
  * \param source_clip The region of the source image to use, in source image
  *                    coordinates. If NULL, use the whole source image.
@@ -332,6 +379,7 @@ composite_clipped(pixman_image_t *src,
  */
 static void
 repaint_region(struct weston_view *ev, struct weston_output *output,
+	       pixman_image_t *target_image,
 	       pixman_region32_t *repaint_output,
 	       pixman_region32_t *source_clip,
 	       pixman_op_t pixman_op)
@@ -339,18 +387,12 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	struct pixman_renderer *pr =
 		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
 	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
-	pixman_image_t *target_image;
 	pixman_transform_t transform;
 	pixman_filter_t filter;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
-
-	if (po->shadow_image)
-		target_image = po->shadow_image;
-	else
-		target_image = po->hw_buffer;
+	int overdraw;
 
  	/* Clip rendering to the damaged output region */
 	pixman_image_set_clip_region32(target_image, repaint_output);
@@ -372,12 +414,17 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		mask_image = NULL;
 	}
 
-	if (source_clip)
-		composite_clipped(ps->image, mask_image, target_image,
-				  &transform, filter, source_clip);
-	else
+	if (source_clip) {
+		overdraw = composite_clipped(ps->image, mask_image,
+					     target_image, &transform,
+					     filter, source_clip);
+		if (overdraw > 1)
+			__atomic_store_n(&pr->overdraw, overdraw,
+					 __ATOMIC_RELAXED);
+	} else {
 		composite_whole(pixman_op, ps->image, mask_image,
 				target_image, &transform, filter);
+	}
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
@@ -401,6 +448,7 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 
 static void
 draw_view_translated(struct weston_view *view, struct weston_output *output,
+		     pixman_image_t *target_image,
 		     pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = view->surface;
@@ -428,8 +476,8 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 							  view);
 			region_global_to_output(output, &repaint_output);
 
-			repaint_region(view, output, &repaint_output, NULL,
-				       PIXMAN_OP_SRC);
+			repaint_region(view, output, target_image,
+				       &repaint_output, NULL, PIXMAN_OP_SRC);
 		}
 	}
 
@@ -439,8 +487,8 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 						  &surface_blend, view);
 		region_global_to_output(output, &repaint_output);
 
-		repaint_region(view, output, &repaint_output, NULL,
-			       PIXMAN_OP_OVER);
+		repaint_region(view, output, target_image,
+			       &repaint_output, NULL, PIXMAN_OP_OVER);
 	}
 
 	pixman_region32_fini(&surface_blend);
@@ -450,6 +498,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 static void
 draw_view_source_clipped(struct weston_view *view,
 			 struct weston_output *output,
+			 pixman_image_t *target_image,
 			 pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = view->surface;
@@ -475,26 +524,62 @@ draw_view_source_clipped(struct weston_view *view,
 	pixman_region32_copy(&repaint_output, repaint_global);
 	region_global_to_output(output, &repaint_output);
 
-	repaint_region(view, output, &repaint_output, &buffer_region,
-		       PIXMAN_OP_OVER);
+	repaint_region(view, output, target_image, &repaint_output,
+		       &buffer_region, PIXMAN_OP_OVER);
 
 	pixman_region32_fini(&repaint_output);
 	pixman_region32_fini(&buffer_region);
 	pixman_region32_fini(&surf_region);
 }
 
+/* Opaque solid color views need no compositing, filling will do */
+static bool
+view_is_opaque_solid(struct weston_view *view, struct pixman_renderer *pr)
+{
+	/* Not get_surface_state(), this may run on a worker thread */
+	struct pixman_surface_state *ps = view->surface->renderer_state;
+
+	return ps->solid && ps->solid_color.alpha == 0xffff &&
+	       !(view->alpha < 1.0) && !view->geometry.scissor_enabled &&
+	       view_transformation_is_translation(view) && !pr->repaint_debug;
+}
+
+static void
+draw_view_solid(struct weston_view *view, struct weston_output *output,
+		pixman_image_t *target_image,
+		pixman_region32_t *repaint_global)
+{
+	struct pixman_surface_state *ps = view->surface->renderer_state;
+	pixman_region32_t surf_region;
+	/* region to be filled in output coordinates: */
+	pixman_region32_t repaint_output;
+	pixman_box32_t *boxes;
+	int n_boxes;
+
+	pixman_region32_init_rect(&surf_region, 0, 0,
+				  view->surface->width, view->surface->height);
+	pixman_region32_init(&repaint_output);
+	region_intersect_only_translation(&repaint_output, repaint_global,
+					  &surf_region, view);
+	region_global_to_output(output, &repaint_output);
+
+	boxes = pixman_region32_rectangles(&repaint_output, &n_boxes);
+	pixman_image_fill_boxes(PIXMAN_OP_SRC, target_image,
+				&ps->solid_color, n_boxes, boxes);
+
+	pixman_region32_fini(&repaint_output);
+	pixman_region32_fini(&surf_region);
+}
+
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
+	  pixman_image_t *target_image,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
-	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	struct pixman_renderer *pr = get_renderer(output->compositor);
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
 
-	/* No buffer attached */
-	if (!ps->image)
-		return;
-
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
 				  &ev->transform.boundingbox, damage);
@@ -503,7 +588,9 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
-	if (view_transformation_is_translation(ev)) {
+	if (view_is_opaque_solid(ev, pr)) {
+		draw_view_solid(ev, output, target_image, &repaint);
+	} else if (view_transformation_is_translation(ev)) {
 		/* The simple case: The surface regions opaque, non-opaque,
 		 * etc. are convertible to global coordinate space.
 		 * There is no need to use a source clip region.
@@ -511,7 +598,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_view_translated(ev, output, &repaint);
+		draw_view_translated(ev, output, target_image, &repaint);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -520,27 +607,83 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_view_source_clipped(ev, output, &repaint);
+		draw_view_source_clipped(ev, output, target_image, &repaint);
 	}
 
 out:
 	pixman_region32_fini(&repaint);
 }
+
+/** Pick the views to draw into the damage, bottom first
+ *
+ * Views with nothing in the damage that is not covered by the opaque
+ * views above them, ev->clip, are culled before any compositing setup.
+ * The damage already leaves out what the planes above the primary one
+ * cover. The bands then go through the views left only.
+ */
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+cull_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct pixman_renderer *pr = get_renderer(compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_surface_state *ps;
+	struct weston_view *view, **v;
+	pixman_region32_t repaint;
+	unsigned int drawn = 0, culled = 0, cleared = 0;
+
+	po->draw_views.size = 0;
+	pixman_region32_init(&repaint);
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	wl_list_for_each_reverse(view, &compositor->view_list, link) {
+		if (view->plane != &compositor->primary_plane)
+			continue;
+
+		/* No buffer attached */
+		ps = view->surface->renderer_state;
+		if (!ps || !ps->image)
+			continue;
+
+		pixman_region32_intersect(&repaint,
+					  &view->transform.boundingbox, damage);
+		pixman_region32_subtract(&repaint, &repaint, &view->clip);
+		if (!pixman_region32_not_empty(&repaint)) {
+			culled++;
+			continue;
+		}
+
+		v = wl_array_add(&po->draw_views, sizeof *v);
+		if (!v)
+			continue;
+		*v = view;
+
+		if (view_is_opaque_solid(view, pr))
+			cleared++;
+		else
+			drawn++;
+	}
+
+	pixman_region32_fini(&repaint);
+
+	weston_repaint_stats_count_views(output, drawn, culled, cleared);
 }
 
+/* Draws the views cull_views() picked */
 static void
-copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
+repaint_surfaces(struct weston_output *output, pixman_image_t *target_image,
+		 pixman_region32_t *damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	struct weston_view **view;
+
+	wl_array_for_each(view, &po->draw_views)
+		draw_view(*view, output, target_image, damage);
+}
+
+static void
+copy_to_hw_buffer(struct weston_output *output, pixman_image_t *shadow_image,
+		  pixman_image_t *hw_buffer, pixman_region32_t *region)
+{
 	pixman_region32_t output_region;
 
 	pixman_region32_init(&output_region);
@@ -548,28 +691,203 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 
 	region_global_to_output(output, &output_region);
 
-	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
+	pixman_image_set_clip_region32 (hw_buffer, &output_region);
 	pixman_region32_fini(&output_region);
 
 	pixman_image_composite32(PIXMAN_OP_SRC,
-				 po->shadow_image, /* src */
+				 shadow_image, /* src */
 				 NULL /* mask */,
-				 po->hw_buffer, /* dest */
+				 hw_buffer, /* dest */
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->hw_buffer), /* width */
-				 pixman_image_get_height (po->hw_buffer) /* height */);
+				 pixman_image_get_width (hw_buffer), /* width */
+				 pixman_image_get_height (hw_buffer) /* height */);
+
+	pixman_image_set_clip_region32 (hw_buffer, NULL);
+}
+
+/* Another image on the same pixels, to set a clip of its own on */
+static pixman_image_t *
+image_alias(pixman_image_t *image)
+{
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+						 pixman_image_get_width(image),
+						 pixman_image_get_height(image),
+						 pixman_image_get_data(image),
+						 pixman_image_get_stride(image));
+}
+
+/* What to composite into an output, and copy to its hardware buffer */
+struct composite_job {
+	struct weston_output *output;
+	pixman_image_t *target_image;
+	/* in global coordinates, either may be NULL */
+	pixman_region32_t *damage;
+	pixman_region32_t *copy_damage;
+
+	/* the bands split these, in global coordinates */
+	pixman_box32_t extents;
+	unsigned int bands;
+};
+
+static void
+composite_band(void *data, unsigned int index)
+{
+	struct composite_job *job = data;
+	struct pixman_output_state *po = get_output_state(job->output);
+	pixman_box32_t *e = &job->extents;
+	pixman_region32_t band, damage;
+	pixman_image_t *target, *shadow_image, *hw_buffer;
+	int y1, y2;
+
+	y1 = e->y1 + (int64_t)(e->y2 - e->y1) * index / job->bands;
+	y2 = e->y1 + (int64_t)(e->y2 - e->y1) * (index + 1) / job->bands;
+	pixman_region32_init_rect(&band, e->x1, y1, e->x2 - e->x1, y2 - y1);
+	pixman_region32_init(&damage);
+
+	/* Images of our own, as every band sets its clip */
+	if (job->damage) {
+		pixman_region32_intersect(&damage, job->damage, &band);
+		if (pixman_region32_not_empty(&damage)) {
+			target = image_alias(job->target_image);
+			repaint_surfaces(job->output, target, &damage);
+			pixman_image_unref(target);
+		}
+	}
+
+	if (job->copy_damage) {
+		pixman_region32_intersect(&damage, job->copy_damage, &band);
+		if (pixman_region32_not_empty(&damage)) {
+			shadow_image = image_alias(po->shadow_image);
+			hw_buffer = image_alias(po->hw_buffer);
+			copy_to_hw_buffer(job->output, shadow_image,
+					  hw_buffer, &damage);
+			pixman_image_unref(hw_buffer);
+			pixman_image_unref(shadow_image);
+		}
+	}
+
+	pixman_region32_fini(&damage);
+	pixman_region32_fini(&band);
+}
+
+/** Composite damage into an output and copy damage to the hardware buffer
+ *
+ * With more than one compositing thread, large damage is split into
+ * horizontal bands, in global coordinates, which are composited and
+ * copied concurrently. The bands cover disjoint parts of the target, and
+ * each one copies what it composited itself.
+ */
+static void
+composite_output(struct weston_output *output, pixman_image_t *target_image,
+		 pixman_region32_t *damage, pixman_region32_t *copy_damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct composite_job job = {
+		.output = output,
+		.target_image = target_image,
+		.damage = damage,
+		.copy_damage = copy_damage,
+	};
+	pixman_region32_t all;
+	unsigned int max_bands;
+	int64_t area;
+
+	if (damage)
+		cull_views(output, damage);
+
+	pixman_region32_init(&all);
+	if (damage)
+		pixman_region32_union(&all, &all, damage);
+	if (copy_damage)
+		pixman_region32_union(&all, &all, copy_damage);
+	job.extents = *pixman_region32_extents(&all);
+	pixman_region32_fini(&all);
+
+	area = (int64_t)(job.extents.x2 - job.extents.x1) *
+	       (job.extents.y2 - job.extents.y1);
+
+	if (!pr->band_pool || area < BAND_MIN_PIXELS) {
+		if (damage)
+			repaint_surfaces(output, target_image, damage);
+		if (copy_damage)
+			copy_to_hw_buffer(output, po->shadow_image,
+					  po->hw_buffer, copy_damage);
+		return;
+	}
+
+	/* Twice as many bands as threads, as views make some bands cost
+	 * more than others */
+	job.bands = weston_worker_pool_get_size(pr->band_pool) * 2;
+	max_bands = MAX((job.extents.y2 - job.extents.y1) / BAND_MIN_HEIGHT, 1);
+	job.bands = MIN(job.bands, max_bands);
 
-	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	weston_worker_pool_run(pr->band_pool, job.bands, composite_band, &job);
+}
+
+/* Follow compositor->renderer_threads, on the compositor thread only */
+static void
+pixman_renderer_update_band_pool(struct pixman_renderer *pr,
+				 struct weston_compositor *ec)
+{
+	int threads = MAX(ec->renderer_threads, 1);
+
+	if (threads == pr->band_threads)
+		return;
+
+	weston_worker_pool_destroy(pr->band_pool);
+	pr->band_pool = NULL;
+	pr->band_threads = threads;
+
+	if (threads == 1)
+		return;
+
+	pr->band_pool = weston_worker_pool_create(threads - 1);
+	if (!pr->band_pool) {
+		weston_log("Error: could not start the pixman renderer "
+			   "threads, compositing on one.\n");
+		return;
+	}
+
+	weston_log("Pixman renderer compositing on %u threads.\n",
+		   weston_worker_pool_get_size(pr->band_pool));
+}
+
+/** Composite into the shadow image, leaving the copy to repaint_output
+ *
+ * Outputs without a shadow image are left to repaint_output, which
+ * composites straight into the buffer the backend picks for the frame.
+ */
+static void
+pixman_renderer_prerender_output(struct weston_output *output,
+				 pixman_region32_t *output_damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	if (!po->shadow_image)
+		return;
+
+	composite_output(output, po->shadow_image, output_damage, NULL);
+
+	/* If the backend ends up not calling repaint_output, say for
+	 * direct scanout, the next frame copies this as well. */
+	pixman_region32_union(&po->prerender_damage,
+			      &po->prerender_damage, output_damage);
+	po->prerendered = true;
 }
 
 static void
 pixman_renderer_repaint_output(struct weston_output *output,
 			       pixman_region32_t *output_damage)
 {
+	struct pixman_renderer *pr = get_renderer(output->compositor);
 	struct pixman_output_state *po = get_output_state(output);
 	pixman_region32_t hw_damage;
+	int overdraw;
+
+	pixman_renderer_update_band_pool(pr, output->compositor);
 
 	if (!po->hw_buffer) {
 		po->hw_extra_damage = NULL;
@@ -585,14 +903,28 @@ pixman_renderer_repaint_output(struct weston_output *output,
 		pixman_region32_copy(&hw_damage, output_damage);
 	}
 
-	if (po->shadow_image) {
-		repaint_surfaces(output, output_damage);
-		copy_to_hw_buffer(output, &hw_damage);
+	if (po->prerendered) {
+		pixman_region32_union(&hw_damage, &hw_damage,
+				      &po->prerender_damage);
+		pixman_region32_clear(&po->prerender_damage);
+		po->prerendered = false;
+		composite_output(output, po->shadow_image, NULL, &hw_damage);
+	} else if (po->shadow_image) {
+		composite_output(output, po->shadow_image, output_damage,
+				 &hw_damage);
 	} else {
-		repaint_surfaces(output, &hw_damage);
+		composite_output(output, po->hw_buffer, &hw_damage, NULL);
 	}
 	pixman_region32_fini(&hw_damage);
 
+	/* Also covers what prerender_output composited */
+	overdraw = __atomic_load_n(&pr->overdraw, __ATOMIC_RELAXED);
+	if (overdraw > 1 && !pr->overdraw_warned) {
+		weston_log("Pixman-renderer warning: %dx overdraw\n",
+			   overdraw);
+		pr->overdraw_warned = true;
+	}
+
 	wl_signal_emit(&output->frame_signal, output_damage);
 
 	/* Actual flip should be done by caller */
@@ -640,6 +972,7 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->solid = false;
 
 	if (!buffer)
 		return;
@@ -780,6 +1113,8 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	}
 
 	ps->image = pixman_image_create_solid_fill(&color);
+	ps->solid = true;
+	ps->solid_color = color;
 }
 
 static void
@@ -789,6 +1124,7 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+	weston_worker_pool_destroy(pr->band_pool);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -875,6 +1211,7 @@ pixman_renderer_init(struct weston_compositor *ec)
 	renderer->debug_color = NULL;
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
 	renderer->base.repaint_output = pixman_renderer_repaint_output;
+	renderer->base.prerender_output = pixman_renderer_prerender_output;
 	renderer->base.flush_damage = pixman_renderer_flush_damage;
 	renderer->base.attach = pixman_renderer_attach;
 	renderer->base.surface_set_color = pixman_renderer_surface_set_color;
@@ -959,6 +1296,9 @@ pixman_renderer_output_create(struct weston_output *output,
 		}
 	}
 
+	pixman_region32_init(&po->prerender_damage);
+	wl_array_init(&po->draw_views);
+
 	output->renderer_state = po;
 
 	return 0;
@@ -976,6 +1316,8 @@ pixman_renderer_output_destroy(struct weston_output *output)
 		pixman_image_unref(po->hw_buffer);
 
 	free(po->shadow_buffer);
+	pixman_region32_fini(&po->prerender_damage);
+	wl_array_release(&po->draw_views);
 
 	po->shadow_buffer = NULL;
 	po->shadow_image = NULL;
@@ -81,6 +81,18 @@ struct gl_renderer {
 	struct wl_list dmabuf_images;
 	struct wl_list dmabuf_formats;
 
+	/** struct dmabuf_cache_entry::link, most recently used first */
+	struct wl_list dmabuf_cache;
+	int dmabuf_cache_count;
+	uint64_t dmabuf_cache_bytes;
+	uint64_t dmabuf_cache_hits;
+	uint64_t dmabuf_cache_misses;
+	uint64_t dmabuf_cache_uncacheable;
+	struct weston_log_scope *dmabuf_cache_scope;
+	/** evicts entries no wl_buffer has used for a while */
+	struct wl_event_source *dmabuf_cache_timer;
+	bool dmabuf_cache_purge_pending;
+
 	bool has_gl_texture_rg;
 
 	struct gl_shader *current_shader;
@@ -39,10 +39,15 @@
 #include <assert.h>
 #include <linux/input.h>
 #include <drm_fourcc.h>
+#include <inttypes.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
 
 #include "linux-sync-file.h"
 #include "timeline.h"
+#include "repaint-stats.h"
 
 #include "gl-renderer.h"
 #include "gl-renderer-internal.h"
@@ -66,7 +71,8 @@
 #define GR_GL_VERSION_INVALID \
 	GR_GL_VERSION(0, 0)
 
-#define BUFFER_DAMAGE_COUNT 2
+/* Frames of damage kept per output unless the compositor says otherwise */
+#define DAMAGE_HISTORY_DEFAULT 4
 
 enum gl_border_status {
 	BORDER_STATUS_CLEAN = 0,
@@ -85,11 +91,26 @@ struct gl_border_image {
 	void *data;
 };
 
+/* What a repaint changed in the buffer it went to */
+struct gl_frame_damage {
+	pixman_region32_t region;
+	enum gl_border_status border_status;
+};
+
 struct gl_output_state {
 	EGLSurface egl_surface;
-	pixman_region32_t buffer_damage[BUFFER_DAMAGE_COUNT];
-	int buffer_damage_index;
-	enum gl_border_status border_damage[BUFFER_DAMAGE_COUNT];
+	/* single-buffered, so the content of the last frame stays */
+	bool egl_surface_is_pbuffer;
+
+	/* A ring of the damage of the last repaints, the newest at
+	 * damage_index, of which damage_history_count are valid. */
+	struct gl_frame_damage *damage_history;
+	int damage_history_length;
+	int damage_history_count;
+	int damage_index;
+	/* buffer age the backend told for the next repaint, 0 if none */
+	int emulated_buffer_age;
+
 	struct gl_border_image borders[4];
 	enum gl_border_status border_status;
 
@@ -99,6 +120,10 @@ struct gl_output_state {
 
 	/* struct timeline_render_point::link */
 	struct wl_list timeline_render_point_list;
+	/* GPU begin and end stamps, and the repaint they belong to */
+	uint64_t render_seq;
+	uint64_t gpu_stamp_seq[2];
+	struct timespec gpu_stamp[2];
 	GLuint shadow_fbo;
 	GLuint shadow_tex;
 	enum weston_colorspace_enums target_colorspace;
@@ -133,6 +158,52 @@ struct dmabuf_image {
 	struct egl_image *images[3];
 	struct wl_list link;
 
+	/* the cache entry shared with other wl_buffers, if any */
+	struct dmabuf_cache_entry *cache_entry;
+
+	enum import_type import_type;
+	GLenum target;
+	enum gl_shader_texture_variant shader_variant;
+};
+
+/* Imports of recycled dma-bufs kept around at most */
+#define DMABUF_CACHE_MAX_ENTRIES 64
+#define DMABUF_CACHE_MAX_BYTES (256 * 1024 * 1024)
+
+/* How long an import outlives the last wl_buffer using it. Long enough for
+ * a client to wrap the dma-buf in a new wl_buffer, short enough not to keep
+ * the memory of clients that are done with it, or gone. */
+#define DMABUF_CACHE_IDLE_MS 1000
+
+#ifndef DMA_BUF_MAGIC
+#define DMA_BUF_MAGIC 0x444d4142
+#endif
+
+/* Identifies the memory a dma-buf import refers to, regardless of the fds
+ * and the wl_buffer it came with */
+struct dmabuf_cache_key {
+	dev_t dev[MAX_DMABUF_PLANES];
+	ino_t ino[MAX_DMABUF_PLANES];
+	uint32_t offset[MAX_DMABUF_PLANES];
+	uint32_t stride[MAX_DMABUF_PLANES];
+	uint64_t modifier;
+	uint32_t format;
+	int32_t width;
+	int32_t height;
+	int n_planes;
+};
+
+struct dmabuf_cache_entry {
+	struct wl_list link; /* gl_renderer::dmabuf_cache */
+	struct dmabuf_cache_key key;
+	uint64_t size;
+
+	/* dmabuf_images using the entry, and since when there are none */
+	int users;
+	struct timespec idle_since;
+
+	int num_images;
+	struct egl_image *images[3];
 	enum import_type import_type;
 	GLenum target;
 	enum gl_shader_texture_variant shader_variant;
@@ -220,6 +291,7 @@ struct timeline_render_point {
 	struct wl_list link; /* gl_output_state::timeline_render_point_list */
 
 	enum timeline_render_point_type type;
+	uint64_t seq;
 	int fd;
 	struct weston_output *output;
 	struct wl_event_source *event_source;
@@ -266,6 +338,29 @@ timeline_render_point_destroy(struct timeline_render_point *trp)
 	free(trp);
 }
 
+/* Feeds the GPU time of a repaint to the repaint stats and the repaint
+ * window prediction once both of its sync fds have signalled, in whatever
+ * order they are dispatched. */
+static void
+timeline_render_point_record(struct timeline_render_point *trp,
+			     const struct timespec *stamp)
+{
+	struct gl_output_state *go = get_output_state(trp->output);
+
+	go->gpu_stamp[trp->type] = *stamp;
+	go->gpu_stamp_seq[trp->type] = trp->seq;
+
+	if (go->gpu_stamp_seq[TIMELINE_RENDER_POINT_TYPE_BEGIN] ==
+	    go->gpu_stamp_seq[TIMELINE_RENDER_POINT_TYPE_END]) {
+		weston_repaint_stats_record(trp->output,
+			WESTON_REPAINT_STAGE_GPU,
+			&go->gpu_stamp[TIMELINE_RENDER_POINT_TYPE_BEGIN],
+			&go->gpu_stamp[TIMELINE_RENDER_POINT_TYPE_END]);
+		weston_output_repaint_gpu_done(trp->output,
+			&go->gpu_stamp[TIMELINE_RENDER_POINT_TYPE_END]);
+	}
+}
+
 static int
 timeline_render_point_handler(int fd, uint32_t mask, void *data)
 {
@@ -280,6 +375,7 @@ timeline_render_point_handler(int fd, uint32_t mask, void *data)
 							  &tspec) == 0) {
 			TL_POINT(trp->output->compositor, tp_name, TLP_GPU(&tspec),
 				 TLP_OUTPUT(trp->output), TLP_END);
+			timeline_render_point_record(trp, &tspec);
 		}
 	}
 
@@ -300,6 +396,17 @@ create_render_sync(struct gl_renderer *gr)
 			       attribs);
 }
 
+/* A sync fd and an event source per repaint: only for the timeline, the
+ * repaint-stats scope and the adaptive repaint window, while they want
+ * the GPU times. */
+static bool
+gl_renderer_wants_gpu_times(struct weston_compositor *ec)
+{
+	return weston_timeline_is_enabled(ec->timeline) ||
+	       weston_log_scope_is_enabled(ec->repaint_stats) ||
+	       ec->adaptive_repaint_window;
+}
+
 static void
 timeline_submit_render_sync(struct gl_renderer *gr,
 			    struct weston_compositor *ec,
@@ -312,7 +419,7 @@ timeline_submit_render_sync(struct gl_renderer *gr,
 	int fd;
 	struct timeline_render_point *trp;
 
-	if (!weston_log_scope_is_enabled(ec->timeline) ||
+	if (!gl_renderer_wants_gpu_times(ec) ||
 	    !gr->has_native_fence_sync ||
 	    sync == EGL_NO_SYNC_KHR)
 		return;
@@ -331,6 +438,7 @@ timeline_submit_render_sync(struct gl_renderer *gr,
 	}
 
 	trp->type = type;
+	trp->seq = go->render_seq;
 	trp->fd = fd;
 	trp->output = output;
 	trp->event_source = wl_event_loop_add_fd(loop, fd,
@@ -1032,7 +1140,86 @@ compute_hdr_requirements_from_view(struct weston_view *ev,
 	gs->shader_requirements.gamma = gamma;
 }
 
+/* What draw_view() did with a view */
+enum draw_view_result {
+	DRAW_VIEW_SKIPPED = 0,	/* nothing to draw it with */
+	DRAW_VIEW_CULLED,	/* covered or outside of the damage */
+	DRAW_VIEW_CLEARED,	/* opaque solid color, scissored clears */
+	DRAW_VIEW_DRAWN,
+};
+
+/* Opaque solid color views, axis aligned on whole pixels, need no shader:
+ * clearing what is visible of them to their color does the same. */
+static bool
+view_is_opaque_solid(struct weston_view *ev, struct weston_output *output)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+
+	if (gs->buffer_type != BUFFER_TYPE_SOLID || gs->direct_display ||
+	    gs->shader_requirements.variant != SHADER_VARIANT_SOLID)
+		return false;
+
+	if (ev->surface->protection_mode ==
+	    WESTON_SURFACE_PROTECTION_MODE_ENFORCED)
+		return false;
+
+	/* The shader would convert colors */
+	if (gs->shader_requirements.csc_matrix ||
+	    gs->shader_requirements.tone_mapping != SHADER_TONE_MAP_NONE)
+		return false;
+
+	if (ev->alpha < 1.0 || gs->color[3] < 1.0)
+		return false;
+
+	if (gr->fan_debug || output->zoom.active)
+		return false;
+
+	return !ev->transform.enabled && !ev->geometry.scissor_enabled &&
+	       ev->geometry.x == (int)ev->geometry.x &&
+	       ev->geometry.y == (int)ev->geometry.y;
+}
+
+/* Fill a region, in global coordinates, with a color by scissored clears */
 static void
+clear_region(struct weston_output *output, pixman_region32_t *region,
+	     const GLfloat *color)
+{
+	struct gl_output_state *go = get_output_state(output);
+	pixman_region32_t transformed;
+	pixman_box32_t *box;
+	int n_boxes, i;
+
+	/* Translate from global to output co-ordinate space. */
+	pixman_region32_init(&transformed);
+	pixman_region32_copy(&transformed, region);
+	pixman_region32_translate(&transformed, -output->x, -output->y);
+	weston_transformed_region(output->width, output->height,
+				  output->transform,
+				  output->current_scale,
+				  &transformed, &transformed);
+
+	glEnable(GL_SCISSOR_TEST);
+	glClearColor(color[0], color[1], color[2], 1.0);
+
+	/* Within the viewport, which starts past the left and bottom
+	 * borders, and GL's y axis goes up. */
+	box = pixman_region32_rectangles(&transformed, &n_boxes);
+	for (i = 0; i < n_boxes; i++) {
+		glScissor(go->borders[GL_RENDERER_BORDER_LEFT].width +
+			  box[i].x1,
+			  go->borders[GL_RENDERER_BORDER_BOTTOM].height +
+			  output->current_mode->height - box[i].y2,
+			  box[i].x2 - box[i].x1,
+			  box[i].y2 - box[i].y1);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+
+	glDisable(GL_SCISSOR_TEST);
+	pixman_region32_fini(&transformed);
+}
+
+static enum draw_view_result
 draw_view(struct weston_view *ev, struct weston_output *output,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
@@ -1049,26 +1236,39 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	int i;
 	struct gl_shader_requirements shader_requirements;
 	enum gl_shader_texture_variant replaced_variant = SHADER_VARIANT_NONE;
+	enum draw_view_result result = DRAW_VIEW_SKIPPED;
 
 	/* In case of a runtime switch of renderers, we may not have received
 	 * an attach for this surface since the switch. In that case we don't
 	 * have a valid buffer or a proper shader set up so skip rendering. */
 	if (!gs->shader_requirements.variant && !gs->direct_display)
-		return;
-
-	compute_hdr_requirements_from_view(ev, output);
+		return DRAW_VIEW_SKIPPED;
 
+	/* Cull before any setup: the damage already leaves out what the
+	 * planes above cover, ev->clip what the opaque views above do. */
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
 				  &ev->transform.boundingbox, damage);
 	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
 
-	if (!pixman_region32_not_empty(&repaint))
+	if (!pixman_region32_not_empty(&repaint)) {
+		result = DRAW_VIEW_CULLED;
+		goto out;
+	}
+
+	compute_hdr_requirements_from_view(ev, output);
+
+	if (view_is_opaque_solid(ev, output)) {
+		clear_region(output, &repaint, gs->color);
+		result = DRAW_VIEW_CLEARED;
 		goto out;
+	}
 
 	if (ensure_surface_buffer_is_ready(gr, gs) < 0)
 		goto out;
 
+	result = DRAW_VIEW_DRAWN;
+
 	replaced_variant = setup_censor_overrides(output, ev);
 
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -1156,6 +1356,8 @@ out:
 
 	if (replaced_variant)
 		gs->shader_requirements.variant = replaced_variant;
+
+	return result;
 }
 
 static void
@@ -1163,10 +1365,15 @@ repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_view *view;
+	unsigned int count[DRAW_VIEW_DRAWN + 1] = { 0 };
 
 	wl_list_for_each_reverse(view, &compositor->view_list, link)
 		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+			count[draw_view(view, output, damage)]++;
+
+	weston_repaint_stats_count_views(output, count[DRAW_VIEW_DRAWN],
+					 count[DRAW_VIEW_CULLED],
+					 count[DRAW_VIEW_CLEARED]);
 }
 
 static int
@@ -1439,43 +1646,72 @@ output_get_border_damage(struct weston_output *output,
 					   full_width, bottom->height);
 }
 
-static void
-output_get_damage(struct weston_output *output,
-		  pixman_region32_t *buffer_damage, uint32_t *border_damage)
+/* The number of repaints ago the buffer to repaint was last repainted,
+ * 0 if unknown */
+static int
+output_get_buffer_age(struct weston_output *output)
 {
 	struct gl_output_state *go = get_output_state(output);
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	EGLint buffer_age = 0;
 	EGLBoolean ret;
-	int i;
 
-	if (gr->has_egl_buffer_age) {
-		ret = eglQuerySurface(gr->egl_display, go->egl_surface,
-				      EGL_BUFFER_AGE_EXT, &buffer_age);
-		if (ret == EGL_FALSE) {
-			weston_log("buffer age query failed.\n");
-			gl_renderer_print_egl_error_state();
-		}
+	if (go->egl_surface_is_pbuffer)
+		return go->damage_history_count > 0 ? 1 : 0;
+
+	if (!gr->has_egl_buffer_age) {
+		buffer_age = go->emulated_buffer_age;
+		go->emulated_buffer_age = 0;
+		return buffer_age;
+	}
+
+	ret = eglQuerySurface(gr->egl_display, go->egl_surface,
+			      EGL_BUFFER_AGE_EXT, &buffer_age);
+	if (ret == EGL_FALSE) {
+		weston_log("buffer age query failed.\n");
+		gl_renderer_print_egl_error_state();
+		return 0;
 	}
 
-	if (buffer_age == 0 || buffer_age - 1 > BUFFER_DAMAGE_COUNT) {
+	return buffer_age;
+}
+
+static void
+output_get_damage(struct weston_output *output,
+		  pixman_region32_t *buffer_damage, uint32_t *border_damage)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_frame_damage *frame;
+	int buffer_age;
+	int i;
+
+	buffer_age = output_get_buffer_age(output);
+
+	if (buffer_age == 0 || buffer_age - 1 > go->damage_history_count) {
 		pixman_region32_copy(buffer_damage, &output->region);
 		*border_damage = BORDER_ALL_DIRTY;
-	} else {
-		for (i = 0; i < buffer_age - 1; i++)
-			*border_damage |= go->border_damage[(go->buffer_damage_index + i) % BUFFER_DAMAGE_COUNT];
-
-		if (*border_damage & BORDER_SIZE_CHANGED) {
-			/* If we've had a resize, we have to do a full
-			 * repaint. */
-			*border_damage |= BORDER_ALL_DIRTY;
-			pixman_region32_copy(buffer_damage, &output->region);
-		} else {
-			for (i = 0; i < buffer_age - 1; i++)
-				pixman_region32_union(buffer_damage,
-						      buffer_damage,
-						      &go->buffer_damage[(go->buffer_damage_index + i) % BUFFER_DAMAGE_COUNT]);
-		}
+		return;
+	}
+
+	for (i = 0; i < buffer_age - 1; i++) {
+		frame = &go->damage_history[(go->damage_index + i) %
+					    go->damage_history_length];
+		*border_damage |= frame->border_status;
+	}
+
+	if (*border_damage & BORDER_SIZE_CHANGED) {
+		/* If we've had a resize, we have to do a full
+		 * repaint. */
+		*border_damage |= BORDER_ALL_DIRTY;
+		pixman_region32_copy(buffer_damage, &output->region);
+		return;
+	}
+
+	for (i = 0; i < buffer_age - 1; i++) {
+		frame = &go->damage_history[(go->damage_index + i) %
+					    go->damage_history_length];
+		pixman_region32_union(buffer_damage, buffer_damage,
+				      &frame->region);
 	}
 }
 
@@ -1485,16 +1721,17 @@ output_rotate_damage(struct weston_output *output,
 		     enum gl_border_status border_status)
 {
 	struct gl_output_state *go = get_output_state(output);
-	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_frame_damage *frame;
 
-	if (!gr->has_egl_buffer_age)
-		return;
+	go->damage_index += go->damage_history_length - 1;
+	go->damage_index %= go->damage_history_length;
 
-	go->buffer_damage_index += BUFFER_DAMAGE_COUNT - 1;
-	go->buffer_damage_index %= BUFFER_DAMAGE_COUNT;
+	frame = &go->damage_history[go->damage_index];
+	pixman_region32_copy(&frame->region, output_damage);
+	frame->border_status = border_status;
 
-	pixman_region32_copy(&go->buffer_damage[go->buffer_damage_index], output_damage);
-	go->border_damage[go->buffer_damage_index] = border_status;
+	if (go->damage_history_count < go->damage_history_length)
+		go->damage_history_count++;
 }
 
 /**
@@ -1652,7 +1889,9 @@ gl_renderer_repaint_output(struct weston_output *output,
 	pixman_region32_init(&total_damage); /* total area to redraw */
 
 	/* Update previous_damage using buffer_age (if available), and store
-	 * current damaged region for future use. */
+	 * current damaged region for future use. A change of HDR state
+	 * repaints everything, which the buffers that are older than this
+	 * repaint have to catch up on as well. */
 	output_get_damage(output, &previous_damage, &border_status);
 
 	if (go->hdr_state_changed) {
@@ -1727,6 +1966,7 @@ gl_renderer_repaint_output(struct weston_output *output,
 	/* We have to submit the render sync objects after swap buffers, since
 	 * the objects get assigned a valid sync file fd only after a gl flush.
 	 */
+	go->render_seq++;
 	timeline_submit_render_sync(gr, compositor, output,
 				    go->begin_render_sync,
 				    TIMELINE_RENDER_POINT_TYPE_BEGIN);
@@ -2136,14 +2376,6 @@ gl_renderer_attach_egl(struct weston_surface *es, struct weston_buffer *buffer,
 	gs->y_inverted = buffer->y_inverted;
 }
 
-static void
-gl_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
-{
-	struct dmabuf_image *image = linux_dmabuf_buffer_get_user_data(dmabuf);
-
-	dmabuf_image_destroy(image);
-}
-
 static struct egl_image *
 import_simple_dmabuf(struct gl_renderer *gr,
                      struct dmabuf_attributes *attributes)
@@ -2668,43 +2900,259 @@ gl_renderer_query_dmabuf_modifiers(struct weston_compositor *wc, int format,
 			num_modifiers);
 }
 
+/* Only dma-bufs of kernels giving each buffer its own inode can be told
+ * apart, older ones share a single anonymous inode. The EGLImage keeps the
+ * buffer alive, so its inode is not reused for another while cached. */
 static bool
-gl_renderer_import_dmabuf(struct weston_compositor *ec,
-			  struct linux_dmabuf_buffer *dmabuf)
+dmabuf_cache_key_init(struct dmabuf_cache_key *key,
+		      const struct dmabuf_attributes *attributes)
 {
-	struct gl_renderer *gr = get_renderer(ec);
-	struct dmabuf_image *image;
+	struct statfs fs;
+	struct stat st;
 	int i;
 
-	assert(gr->has_dmabuf_import);
-
-	for (i = 0; i < dmabuf->attributes.n_planes; i++) {
-		/* return if EGL doesn't support import modifiers */
-		if (dmabuf->attributes.modifier[i] != DRM_FORMAT_MOD_INVALID)
-			if (!gr->has_dmabuf_import_modifiers)
-				return false;
+	memset(key, 0, sizeof *key);
 
-		/* return if modifiers passed are unequal */
-		if (dmabuf->attributes.modifier[i] !=
-		    dmabuf->attributes.modifier[0])
+	for (i = 0; i < attributes->n_planes; i++) {
+		if (fstatfs(attributes->fd[i], &fs) < 0 ||
+		    fs.f_type != DMA_BUF_MAGIC)
+			return false;
+		if (fstat(attributes->fd[i], &st) < 0)
 			return false;
+
+		key->dev[i] = st.st_dev;
+		key->ino[i] = st.st_ino;
+		key->offset[i] = attributes->offset[i];
+		key->stride[i] = attributes->stride[i];
 	}
 
-	/* reject all flags we do not recognize or handle */
-	if (dmabuf->attributes.flags & ~ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT)
-		return false;
+	key->modifier = attributes->modifier[0];
+	key->format = attributes->format;
+	key->width = attributes->width;
+	key->height = attributes->height;
+	key->n_planes = attributes->n_planes;
 
-	image = import_dmabuf(gr, dmabuf);
-	if (!image)
+	return true;
+}
+
+static bool
+dmabuf_cache_key_equal(const struct dmabuf_cache_key *a,
+		       const struct dmabuf_cache_key *b)
+{
+	int i;
+
+	if (a->n_planes != b->n_planes || a->format != b->format ||
+	    a->modifier != b->modifier ||
+	    a->width != b->width || a->height != b->height)
 		return false;
 
-	wl_list_insert(&gr->dmabuf_images, &image->link);
-	linux_dmabuf_buffer_set_user_data(dmabuf, image,
-		gl_renderer_destroy_dmabuf);
+	for (i = 0; i < a->n_planes; i++) {
+		if (a->dev[i] != b->dev[i] || a->ino[i] != b->ino[i] ||
+		    a->offset[i] != b->offset[i] ||
+		    a->stride[i] != b->stride[i])
+			return false;
+	}
 
 	return true;
 }
 
+static uint64_t
+dmabuf_cache_key_size(const struct dmabuf_cache_key *key)
+{
+	const struct pixel_format_info *info;
+	uint64_t size = 0;
+	int i;
+
+	info = pixel_format_get_info(key->format & ~DRM_FORMAT_BIG_ENDIAN);
+
+	for (i = 0; i < key->n_planes; i++) {
+		if (info)
+			size += (uint64_t)key->stride[i] *
+				pixel_format_height_for_plane(info, i,
+							      key->height);
+		else
+			size += (uint64_t)key->stride[i] * key->height;
+	}
+
+	return size;
+}
+
+static void
+dmabuf_cache_entry_destroy(struct gl_renderer *gr,
+			   struct dmabuf_cache_entry *entry)
+{
+	struct dmabuf_image *image;
+	int i;
+
+	/* the images stay alive for as long as a wl_buffer still uses them */
+	if (entry->users > 0) {
+		wl_list_for_each(image, &gr->dmabuf_images, link) {
+			if (image->cache_entry == entry)
+				image->cache_entry = NULL;
+		}
+	}
+
+	for (i = 0; i < entry->num_images; i++)
+		egl_image_unref(entry->images[i]);
+
+	gr->dmabuf_cache_count--;
+	gr->dmabuf_cache_bytes -= entry->size;
+	wl_list_remove(&entry->link);
+	free(entry);
+}
+
+static int
+dmabuf_cache_purge(void *data)
+{
+	struct gl_renderer *gr = data;
+	struct dmabuf_cache_entry *entry, *next;
+	struct timespec now;
+	int64_t idle_ms, next_ms = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	wl_list_for_each_safe(entry, next, &gr->dmabuf_cache, link) {
+		if (entry->users > 0)
+			continue;
+
+		idle_ms = timespec_sub_to_msec(&now, &entry->idle_since);
+		if (idle_ms >= DMABUF_CACHE_IDLE_MS) {
+			dmabuf_cache_entry_destroy(gr, entry);
+			continue;
+		}
+
+		if (next_ms == 0 || DMABUF_CACHE_IDLE_MS - idle_ms < next_ms)
+			next_ms = DMABUF_CACHE_IDLE_MS - idle_ms;
+	}
+
+	wl_event_source_timer_update(gr->dmabuf_cache_timer, next_ms);
+	gr->dmabuf_cache_purge_pending = next_ms > 0;
+
+	return 0;
+}
+
+static void
+dmabuf_cache_entry_use(struct dmabuf_cache_entry *entry,
+		       struct dmabuf_image *image)
+{
+	image->cache_entry = entry;
+	entry->users++;
+}
+
+static void
+dmabuf_cache_entry_release(struct gl_renderer *gr,
+			   struct dmabuf_cache_entry *entry)
+{
+	assert(entry->users > 0);
+
+	entry->users--;
+	if (entry->users > 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &entry->idle_since);
+
+	if (!gr->dmabuf_cache_purge_pending) {
+		wl_event_source_timer_update(gr->dmabuf_cache_timer,
+					     DMABUF_CACHE_IDLE_MS);
+		gr->dmabuf_cache_purge_pending = true;
+	}
+}
+
+/* Replace the cached images with the ones just imported for \c image */
+static void
+dmabuf_cache_entry_update(struct dmabuf_cache_entry *entry,
+			  struct dmabuf_image *image)
+{
+	int i;
+
+	for (i = 0; i < entry->num_images; i++)
+		egl_image_unref(entry->images[i]);
+
+	entry->num_images = image->num_images;
+	for (i = 0; i < image->num_images; i++)
+		entry->images[i] = egl_image_ref(image->images[i]);
+}
+
+/* A linear search, the cache is small */
+static struct dmabuf_cache_entry *
+dmabuf_cache_lookup(struct gl_renderer *gr, const struct dmabuf_cache_key *key)
+{
+	struct dmabuf_cache_entry *entry;
+
+	wl_list_for_each(entry, &gr->dmabuf_cache, link) {
+		if (!dmabuf_cache_key_equal(&entry->key, key))
+			continue;
+
+		wl_list_remove(&entry->link);
+		wl_list_insert(&gr->dmabuf_cache, &entry->link);
+		return entry;
+	}
+
+	return NULL;
+}
+
+static void
+dmabuf_cache_insert(struct gl_renderer *gr, const struct dmabuf_cache_key *key,
+		    struct dmabuf_image *image)
+{
+	struct dmabuf_cache_entry *entry;
+	uint64_t size;
+	int i;
+
+	size = dmabuf_cache_key_size(key);
+	if (size > DMABUF_CACHE_MAX_BYTES)
+		return;
+
+	entry = zalloc(sizeof *entry);
+	if (!entry)
+		return;
+
+	entry->key = *key;
+	entry->size = size;
+	entry->num_images = image->num_images;
+	for (i = 0; i < image->num_images; i++)
+		entry->images[i] = egl_image_ref(image->images[i]);
+	entry->import_type = image->import_type;
+	entry->target = image->target;
+	entry->shader_variant = image->shader_variant;
+	dmabuf_cache_entry_use(entry, image);
+
+	wl_list_insert(&gr->dmabuf_cache, &entry->link);
+	gr->dmabuf_cache_count++;
+	gr->dmabuf_cache_bytes += size;
+
+	/* Evict the least recently used ones */
+	while (gr->dmabuf_cache_count > DMABUF_CACHE_MAX_ENTRIES ||
+	       gr->dmabuf_cache_bytes > DMABUF_CACHE_MAX_BYTES) {
+		entry = container_of(gr->dmabuf_cache.prev,
+				     struct dmabuf_cache_entry, link);
+		dmabuf_cache_entry_destroy(gr, entry);
+	}
+}
+
+static struct dmabuf_image *
+dmabuf_image_create_from_cache(struct linux_dmabuf_buffer *dmabuf,
+			       struct dmabuf_cache_entry *entry)
+{
+	struct dmabuf_image *image;
+	int i;
+
+	image = dmabuf_image_create();
+	if (!image)
+		return NULL;
+
+	image->dmabuf = dmabuf;
+	image->num_images = entry->num_images;
+	for (i = 0; i < entry->num_images; i++)
+		image->images[i] = egl_image_ref(entry->images[i]);
+	image->import_type = entry->import_type;
+	image->target = entry->target;
+	image->shader_variant = entry->shader_variant;
+	dmabuf_cache_entry_use(entry, image);
+
+	return image;
+}
+
 static bool
 import_known_dmabuf(struct gl_renderer *gr,
                     struct dmabuf_image *image)
@@ -2730,6 +3178,114 @@ import_known_dmabuf(struct gl_renderer *gr,
 	return true;
 }
 
+static void
+gl_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
+{
+	struct gl_renderer *gr = get_renderer(dmabuf->compositor);
+	struct dmabuf_image *image = linux_dmabuf_buffer_get_user_data(dmabuf);
+
+	if (image->cache_entry)
+		dmabuf_cache_entry_release(gr, image->cache_entry);
+
+	dmabuf_image_destroy(image);
+}
+
+static void
+dmabuf_cache_subscribe(struct weston_log_subscription *sub, void *data)
+{
+	struct gl_renderer *gr = data;
+	struct dmabuf_cache_entry *entry;
+	uint64_t lookups = gr->dmabuf_cache_hits + gr->dmabuf_cache_misses;
+	char fmt[4];
+
+	weston_log_subscription_printf(sub,
+		"%d of %d entries, %" PRIu64 " of %d KiB\n",
+		gr->dmabuf_cache_count, DMABUF_CACHE_MAX_ENTRIES,
+		gr->dmabuf_cache_bytes / 1024, DMABUF_CACHE_MAX_BYTES / 1024);
+	weston_log_subscription_printf(sub,
+		"%" PRIu64 " hits, %" PRIu64 " misses, hit rate %.1f %%, "
+		"%" PRIu64 " imports not cacheable\n",
+		gr->dmabuf_cache_hits, gr->dmabuf_cache_misses,
+		lookups ? 100.0 * gr->dmabuf_cache_hits / lookups : 0.0,
+		gr->dmabuf_cache_uncacheable);
+
+	/* Most recently used first */
+	wl_list_for_each(entry, &gr->dmabuf_cache, link) {
+		weston_log_subscription_printf(sub,
+			"\t%.4s %dx%d, %d plane%s, %" PRIu64 " KiB%s\n",
+			dump_format(entry->key.format, fmt),
+			entry->key.width, entry->key.height,
+			entry->key.n_planes,
+			entry->key.n_planes > 1 ? "s" : "",
+			entry->size / 1024,
+			entry->users > 0 ? ", in use" : "");
+	}
+
+	weston_log_subscription_complete(sub);
+}
+
+static bool
+gl_renderer_import_dmabuf(struct weston_compositor *ec,
+			  struct linux_dmabuf_buffer *dmabuf)
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	struct dmabuf_cache_key key;
+	struct dmabuf_cache_entry *entry = NULL;
+	struct dmabuf_image *image;
+	bool cacheable;
+	int i;
+
+	assert(gr->has_dmabuf_import);
+
+	for (i = 0; i < dmabuf->attributes.n_planes; i++) {
+		/* return if EGL doesn't support import modifiers */
+		if (dmabuf->attributes.modifier[i] != DRM_FORMAT_MOD_INVALID)
+			if (!gr->has_dmabuf_import_modifiers)
+				return false;
+
+		/* return if modifiers passed are unequal */
+		if (dmabuf->attributes.modifier[i] !=
+		    dmabuf->attributes.modifier[0])
+			return false;
+	}
+
+	/* reject all flags we do not recognize or handle */
+	if (dmabuf->attributes.flags & ~ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT)
+		return false;
+
+	/* Clients recycling a pool of buffers often wrap the same dma-bufs in
+	 * new wl_buffers, re-use the EGLImages imported for them before */
+	cacheable = gr->dmabuf_cache_timer &&
+		    dmabuf_cache_key_init(&key, &dmabuf->attributes);
+	if (cacheable)
+		entry = dmabuf_cache_lookup(gr, &key);
+
+	if (entry) {
+		gr->dmabuf_cache_hits++;
+		image = dmabuf_image_create_from_cache(dmabuf, entry);
+		if (!image)
+			return false;
+	} else {
+		if (cacheable)
+			gr->dmabuf_cache_misses++;
+		else
+			gr->dmabuf_cache_uncacheable++;
+
+		image = import_dmabuf(gr, dmabuf);
+		if (!image)
+			return false;
+
+		if (cacheable)
+			dmabuf_cache_insert(gr, &key, image);
+	}
+
+	wl_list_insert(&gr->dmabuf_images, &image->link);
+	linux_dmabuf_buffer_set_user_data(dmabuf, image,
+		gl_renderer_destroy_dmabuf);
+
+	return true;
+}
+
 static bool
 dmabuf_is_opaque(struct linux_dmabuf_buffer *dmabuf)
 {
@@ -2799,12 +3355,18 @@ gl_renderer_attach_dmabuf(struct weston_surface *surface,
 
 	for (i = 0; i < image->num_images; ++i)
 		egl_image_unref(image->images[i]);
+	image->num_images = 0;
 
 	if (!import_known_dmabuf(gr, image)) {
 		linux_dmabuf_buffer_send_server_error(dmabuf, "EGL dmabuf import failed");
 		return;
 	}
 
+	/* Other wl_buffers of the same dma-buf get the fresh import too. The
+	 * cache saves the import when a wl_buffer is created, not this one. */
+	if (image->cache_entry)
+		dmabuf_cache_entry_update(image->cache_entry, image);
+
 	gs->num_images = image->num_images;
 	for (i = 0; i < gs->num_images; ++i)
 		gs->images[i] = egl_image_ref(image->images[i]);
@@ -3256,8 +3818,9 @@ gl_renderer_create_window_surface(struct gl_renderer *gr,
 
 static int
 gl_renderer_output_create(struct weston_output *output,
-			  EGLSurface surface)
+			  EGLSurface surface, bool is_pbuffer)
 {
+	struct weston_compositor *ec = output->compositor;
 	struct gl_output_state *go;
 	int i;
 
@@ -3266,9 +3829,20 @@ gl_renderer_output_create(struct weston_output *output,
 		return -1;
 
 	go->egl_surface = surface;
+	go->egl_surface_is_pbuffer = is_pbuffer;
+
+	go->damage_history_length = ec->renderer_damage_history > 0 ?
+				    ec->renderer_damage_history :
+				    DAMAGE_HISTORY_DEFAULT;
+	go->damage_history = calloc(go->damage_history_length,
+				    sizeof *go->damage_history);
+	if (go->damage_history == NULL) {
+		free(go);
+		return -1;
+	}
 
-	for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
-		pixman_region32_init(&go->buffer_damage[i]);
+	for (i = 0; i < go->damage_history_length; i++)
+		pixman_region32_init(&go->damage_history[i].region);
 
 	wl_list_init(&go->timeline_render_point_list);
 
@@ -3305,7 +3879,7 @@ gl_renderer_output_window_create(struct weston_output *output,
 		return -1;
 	}
 
-	ret = gl_renderer_output_create(output, egl_surface);
+	ret = gl_renderer_output_create(output, egl_surface, false);
 	if (ret < 0)
 		weston_platform_destroy_egl_surface(gr->egl_display, egl_surface);
 
@@ -3344,7 +3918,7 @@ gl_renderer_output_pbuffer_create(struct weston_output *output,
 		return -1;
 	}
 
-	ret = gl_renderer_output_create(output, egl_surface);
+	ret = gl_renderer_output_create(output, egl_surface, true);
 	if (ret < 0)
 		eglDestroySurface(gr->egl_display, egl_surface);
 
@@ -3359,8 +3933,9 @@ gl_renderer_output_destroy(struct weston_output *output)
 	struct timeline_render_point *trp, *tmp;
 	int i;
 
-	for (i = 0; i < 2; i++)
-		pixman_region32_fini(&go->buffer_damage[i]);
+	for (i = 0; i < go->damage_history_length; i++)
+		pixman_region32_fini(&go->damage_history[i].region);
+	free(go->damage_history);
 
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -3383,6 +3958,20 @@ gl_renderer_output_destroy(struct weston_output *output)
 	free(go);
 }
 
+static bool
+gl_renderer_output_set_buffer_age(struct weston_output *output, int age)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+
+	if (gr->has_egl_buffer_age || go->egl_surface_is_pbuffer)
+		return false;
+
+	go->emulated_buffer_age = age;
+
+	return true;
+}
+
 static int
 gl_renderer_create_fence_fd(struct weston_output *output)
 {
@@ -3405,11 +3994,14 @@ gl_renderer_destroy(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
 	struct dmabuf_image *image, *next;
+	struct dmabuf_cache_entry *entry, *next_entry;
 	struct dmabuf_format *format, *next_format;
 	struct gl_shader *shader, *next_shader;
 
 	wl_signal_emit(&gr->destroy_signal, gr);
 
+	weston_log_scope_destroy(gr->dmabuf_cache_scope);
+
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
@@ -3423,6 +4015,11 @@ gl_renderer_destroy(struct weston_compositor *ec)
 		       EGL_NO_CONTEXT);
 
 
+	wl_list_for_each_safe(entry, next_entry, &gr->dmabuf_cache, link)
+		dmabuf_cache_entry_destroy(gr, entry);
+	if (gr->dmabuf_cache_timer)
+		wl_event_source_remove(gr->dmabuf_cache_timer);
+
 	wl_list_for_each_safe(image, next, &gr->dmabuf_images, link)
 		dmabuf_image_destroy(image);
 
@@ -3589,6 +4186,7 @@ gl_renderer_display_create(struct weston_compositor *ec,
 		ec->capabilities |= WESTON_CAP_EXPLICIT_SYNC;
 
 	wl_list_init(&gr->dmabuf_images);
+	wl_list_init(&gr->dmabuf_cache);
 	if (gr->has_dmabuf_import) {
 		gr->base.import_dmabuf = gl_renderer_import_dmabuf;
 		gr->base.query_dmabuf_formats =
@@ -3625,6 +4223,18 @@ gl_renderer_display_create(struct weston_compositor *ec,
 
 	gr->sg = gl_shader_generator_create(ec);
 
+	if (gr->has_dmabuf_import) {
+		/* without it imports are not cached */
+		gr->dmabuf_cache_timer =
+			wl_event_loop_add_timer(wl_display_get_event_loop(ec->wl_display),
+						dmabuf_cache_purge, gr);
+		gr->dmabuf_cache_scope =
+			weston_compositor_add_log_scope(ec, "gl-dmabuf-cache",
+				"GL renderer cache of dma-buf imports, "
+				"printed on subscription\n",
+				dmabuf_cache_subscribe, NULL, gr);
+	}
+
 	return 0;
 
 fail_with_error:
@@ -3836,5 +4446,6 @@ WL_EXPORT struct gl_renderer_interface gl_renderer_interface = {
 	.output_pbuffer_create = gl_renderer_output_pbuffer_create,
 	.output_destroy = gl_renderer_output_destroy,
 	.output_set_border = gl_renderer_output_set_border,
+	.output_set_buffer_age = gl_renderer_output_set_buffer_age,
 	.create_fence_fd = gl_renderer_create_fence_fd,
 };
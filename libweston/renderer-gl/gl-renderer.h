@@ -212,6 +212,22 @@ struct gl_renderer_interface {
 				  int32_t width, int32_t height,
 				  int32_t tex_width, unsigned char *data);
 
+	/**
+	 * Tell the age of the buffer the next repaint renders to
+	 *
+	 * \param output The output about to be repainted.
+	 * \param age How many repaints ago the buffer was last rendered to,
+	 * as EGL_EXT_buffer_age counts, or 0 if unknown.
+	 * \return true if the renderer uses the age, false if it knows the
+	 * age of its buffers by itself.
+	 *
+	 * For native windows of EGL platforms without EGL_EXT_buffer_age,
+	 * where the backend can tell which buffer the rendering will end up
+	 * in. The age only applies to the next repaint: without it, the
+	 * renderer repaints the whole output.
+	 */
+	bool (*output_set_buffer_age)(struct weston_output *output, int age);
+
 	/* Create fence sync FD to wait for GPU rendering.
 	 *
 	 * Return FD on success, -1 on failure or unsupported
@@ -0,0 +1,261 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "repaint-scheduler.h"
+#include "shared/helpers.h"
+
+void
+weston_repaint_predictor_init(struct weston_repaint_predictor *predictor)
+{
+	memset(predictor, 0, sizeof *predictor);
+}
+
+/** Feed how long a repaint took, from its start to rendering complete */
+void
+weston_repaint_predictor_add_sample(struct weston_repaint_predictor *predictor,
+				    int64_t duration_ns)
+{
+	int64_t err;
+
+	if (duration_ns < 0)
+		return;
+
+	if (predictor->samples++ == 0) {
+		predictor->mean_ns = duration_ns;
+		predictor->dev_ns = duration_ns / 2;
+		return;
+	}
+
+	/* Rise fast, decay slowly */
+	err = duration_ns - predictor->mean_ns;
+	if (err > 0)
+		predictor->mean_ns += err / 2;
+	else
+		predictor->mean_ns += err / 16;
+
+	predictor->dev_ns += (llabs(err) - predictor->dev_ns) / 4;
+}
+
+/** How long before vblank the next repaint should start
+ *
+ * \param refresh_ns The refresh period of the output.
+ * \param fallback_ns The window to use until enough samples came in.
+ * \return The predicted repaint duration plus four deviations and a
+ * safety margin, at most one refresh period.
+ */
+int64_t
+weston_repaint_predictor_get_window(struct weston_repaint_predictor *predictor,
+				    int64_t refresh_ns, int64_t fallback_ns)
+{
+	int64_t window;
+
+	if (predictor->samples < WESTON_REPAINT_WARMUP_FRAMES)
+		return fallback_ns;
+
+	window = predictor->mean_ns + 4 * predictor->dev_ns +
+		 WESTON_REPAINT_MARGIN_NSEC;
+
+	if (refresh_ns > 0)
+		window = MIN(window, refresh_ns);
+
+	return window;
+}
+
+/** Set the vblank the next repaint aims for
+ *
+ * \param target_ns The vblank time, in the presentation clock, or 0 if
+ * unknown.
+ */
+void
+weston_repaint_predictor_set_target(struct weston_repaint_predictor *predictor,
+				    int64_t target_ns)
+{
+	predictor->frame_target_ns = target_ns;
+}
+
+/** A repaint starts
+ *
+ * \param begin_ns Now, in CLOCK_MONOTONIC.
+ */
+void
+weston_repaint_predictor_frame_begin(struct weston_repaint_predictor *predictor,
+				     int64_t begin_ns)
+{
+	predictor->frame_begin_ns = begin_ns;
+	predictor->frame_done_ns = 0;
+}
+
+/** Part of the repaint completed, its CPU or its GPU side
+ *
+ * The repaint is done with the last of these.
+ *
+ * \param done_ns The completion time, in CLOCK_MONOTONIC.
+ */
+void
+weston_repaint_predictor_frame_done(struct weston_repaint_predictor *predictor,
+				    int64_t done_ns)
+{
+	if (predictor->frame_begin_ns == 0 ||
+	    done_ns < predictor->frame_begin_ns)
+		return;
+
+	predictor->frame_done_ns = MAX(predictor->frame_done_ns, done_ns);
+}
+
+/** The repaint in flight was presented
+ *
+ * Takes the repaint duration as a sample, and counts a deadline miss if
+ * the frame was presented closer to a later vblank than to the one it
+ * aimed for. A miss also widens the deviation, as the estimate was
+ * evidently too short.
+ *
+ * \param presented_ns The presentation time, in the presentation clock.
+ * \return Whether the repaint missed its vblank.
+ */
+bool
+weston_repaint_predictor_frame_presented(struct weston_repaint_predictor *predictor,
+					 int64_t presented_ns,
+					 int64_t refresh_ns)
+{
+	bool missed = false;
+
+	if (predictor->frame_done_ns)
+		weston_repaint_predictor_add_sample(predictor,
+			predictor->frame_done_ns - predictor->frame_begin_ns);
+
+	if (predictor->frame_begin_ns && predictor->frame_target_ns &&
+	    refresh_ns > 0) {
+		predictor->frames++;
+		if (presented_ns - predictor->frame_target_ns >
+		    refresh_ns / 2) {
+			missed = true;
+			predictor->misses++;
+			predictor->dev_ns += refresh_ns / 8;
+		}
+	}
+
+	predictor->frame_begin_ns = 0;
+	predictor->frame_done_ns = 0;
+	predictor->frame_target_ns = 0;
+
+	return missed;
+}
+
+/** Start following content on an output
+ *
+ * \param min_period_ns The frame period at the highest refresh rate.
+ * \param max_period_ns The frame period at the lowest refresh rate.
+ */
+void
+weston_vrr_scheduler_init(struct weston_vrr_scheduler *vrr,
+			  int64_t min_period_ns, int64_t max_period_ns)
+{
+	memset(vrr, 0, sizeof *vrr);
+	vrr->min_period_ns = min_period_ns;
+	vrr->max_period_ns = max_period_ns;
+}
+
+/** A frame was presented
+ *
+ * \param presented_ns The presentation time.
+ * \param content Whether the frame had new content, rather than repeating
+ * the previous one.
+ */
+void
+weston_vrr_scheduler_presented(struct weston_vrr_scheduler *vrr,
+			       int64_t presented_ns, bool content)
+{
+	int64_t period;
+
+	vrr->last_present_ns = presented_ns;
+	if (!content)
+		return;
+
+	if (vrr->last_content_ns) {
+		period = presented_ns - vrr->last_content_ns;
+		if (period <= 0 || period > WESTON_VRR_CONTENT_PAUSE_NSEC)
+			vrr->content_period_ns = 0;
+		else if (vrr->content_period_ns == 0)
+			vrr->content_period_ns = period;
+		else
+			vrr->content_period_ns +=
+				(period - vrr->content_period_ns) / 4;
+	}
+
+	vrr->last_content_ns = presented_ns;
+}
+
+/** The earliest the next frame may be presented, 0 for any time */
+int64_t
+weston_vrr_scheduler_get_earliest(struct weston_vrr_scheduler *vrr)
+{
+	if (!vrr->last_present_ns)
+		return 0;
+
+	return vrr->last_present_ns + vrr->min_period_ns;
+}
+
+/** When to present the last content again, if no new content comes first
+ *
+ * The content period is split into as few equal parts as keep within the
+ * lowest refresh rate. Nothing repeats while the content is fast enough,
+ * when the parts would be shorter than the highest refresh rate allows,
+ * or once the content seems to have stopped, twice its period after its
+ * last frame.
+ *
+ * A repeat never lands just before the next content frame is due, which
+ * would then have to wait for the highest refresh rate period.
+ *
+ * \return The time to present the repeat at, or 0 for none.
+ */
+int64_t
+weston_vrr_scheduler_get_repeat(struct weston_vrr_scheduler *vrr)
+{
+	int64_t period = vrr->content_period_ns;
+	int64_t parts, interval, due, repeat;
+
+	if (!vrr->last_content_ns || period <= vrr->max_period_ns)
+		return 0;
+
+	parts = (period + vrr->max_period_ns - 1) / vrr->max_period_ns;
+	interval = period / parts;
+	if (interval < vrr->min_period_ns)
+		return 0;
+
+	repeat = vrr->last_present_ns + interval;
+	if (repeat - vrr->last_content_ns > 2 * period)
+		return 0;
+
+	due = vrr->last_content_ns + period;
+	if (repeat < due && repeat + vrr->min_period_ns > due)
+		repeat = due;
+
+	return repeat;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_REPAINT_SCHEDULER_H
+#define WESTON_REPAINT_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Added to the predicted repaint duration */
+#define WESTON_REPAINT_MARGIN_NSEC 1000000
+/* Samples needed before the prediction is used */
+#define WESTON_REPAINT_WARMUP_FRAMES 4
+
+/** Predicts how long before vblank an output repaint has to start
+ *
+ * Keeps a moving estimate of the time from the start of a repaint until
+ * its rendering completed, GPU included, and of its deviation. The
+ * estimate follows longer repaints within a couple of frames and decays
+ * slowly, so that one short frame after a run of expensive ones does not
+ * cause a miss.
+ *
+ * The policy only deals in nanoseconds and does not read any clock, so
+ * that it can be tested with a simulated one.
+ */
+struct weston_repaint_predictor {
+	int64_t mean_ns;
+	int64_t dev_ns;
+	unsigned int samples;
+
+	uint64_t frames;
+	uint64_t misses;
+
+	/* The repaint in flight: when it began and when its rendering
+	 * completed, in CLOCK_MONOTONIC, and the vblank it aims for, in the
+	 * presentation clock; 0 when unknown. */
+	int64_t frame_begin_ns;
+	int64_t frame_done_ns;
+	int64_t frame_target_ns;
+};
+
+/* Content frames further apart than this paused rather than slowed down */
+#define WESTON_VRR_CONTENT_PAUSE_NSEC 1000000000
+
+/** Schedules the frames of an output with variable refresh rate
+ *
+ * With VRR, the panel shows a frame as soon as it arrives, as long as the
+ * previous one was on for at least the frame period of the highest
+ * refresh rate, and at most that of the lowest. Repaints then follow the
+ * content rather than a fixed vblank grid.
+ *
+ * Content slower than the lowest refresh rate would have the panel refresh
+ * by itself in between, showing frames for uneven times. Low framerate
+ * compensation repeats every content frame instead, evenly spaced, as many
+ * times as it takes to stay within the range.
+ *
+ * Like the predictor, this only deals in nanoseconds of the presentation
+ * clock and does not read any clock.
+ */
+struct weston_vrr_scheduler {
+	/* frame periods at the highest and the lowest refresh rate */
+	int64_t min_period_ns;
+	int64_t max_period_ns;
+
+	/* moving estimate of the content frame period, 0 until known */
+	int64_t content_period_ns;
+
+	/* when the last frame was presented, and the last one with new
+	 * content; 0 before any */
+	int64_t last_present_ns;
+	int64_t last_content_ns;
+};
+
+void
+weston_repaint_predictor_init(struct weston_repaint_predictor *predictor);
+
+void
+weston_repaint_predictor_add_sample(struct weston_repaint_predictor *predictor,
+				    int64_t duration_ns);
+
+int64_t
+weston_repaint_predictor_get_window(struct weston_repaint_predictor *predictor,
+				    int64_t refresh_ns, int64_t fallback_ns);
+
+void
+weston_repaint_predictor_set_target(struct weston_repaint_predictor *predictor,
+				    int64_t target_ns);
+
+void
+weston_repaint_predictor_frame_begin(struct weston_repaint_predictor *predictor,
+				     int64_t begin_ns);
+
+void
+weston_repaint_predictor_frame_done(struct weston_repaint_predictor *predictor,
+				    int64_t done_ns);
+
+bool
+weston_repaint_predictor_frame_presented(struct weston_repaint_predictor *predictor,
+					 int64_t presented_ns,
+					 int64_t refresh_ns);
+
+void
+weston_vrr_scheduler_init(struct weston_vrr_scheduler *vrr,
+			  int64_t min_period_ns, int64_t max_period_ns);
+
+void
+weston_vrr_scheduler_presented(struct weston_vrr_scheduler *vrr,
+			       int64_t presented_ns, bool content);
+
+int64_t
+weston_vrr_scheduler_get_earliest(struct weston_vrr_scheduler *vrr);
+
+int64_t
+weston_vrr_scheduler_get_repeat(struct weston_vrr_scheduler *vrr);
+
+#endif /* WESTON_REPAINT_SCHEDULER_H */
@@ -0,0 +1,523 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Always-on repaint latency statistics.
+ *
+ * Every output keeps one histogram per repaint stage. Recording a sample is
+ * a couple of additions and one bucket increment, cheap enough to leave on
+ * in production; the 'repaint-stats' log scope prints percentiles of all
+ * of them whenever somebody subscribes, e.g. with weston-debug.
+ *
+ * Every seat likewise keeps a histogram of the input-to-present latency:
+ * from the kernel timestamp of an input event to the presentation of the
+ * first frame repainted after it on an output the event concerns, i.e.
+ * the output under the pointer or the one showing the focus.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include <libweston/zalloc.h>
+#include "repaint-stats.h"
+#include "repaint-scheduler.h"
+#include "timeline.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+
+struct weston_repaint_stats {
+	struct weston_latency_histogram stage[WESTON_REPAINT_STAGE_COUNT];
+
+	/* Earliest damaging commit not yet repainted, and the one the
+	 * repaint in flight picked up; tv_sec == 0 when unset. */
+	struct timespec commit_pending;
+	struct timespec commit_in_flight;
+
+	/* What the renderer did with the views of the primary plane */
+	uint64_t views_drawn;
+	uint64_t views_culled;
+	uint64_t views_cleared;
+};
+
+struct weston_input_latency {
+	struct weston_latency_histogram hist;
+
+	/* Earliest input not yet picked up by a repaint, in CLOCK_MONOTONIC
+	 * like the evdev timestamps, and the outputs it may show on, 0 for
+	 * any; then the one the repaint in flight on in_flight_output
+	 * picked up. tv_sec == 0 when unset. */
+	struct timespec pending;
+	uint32_t pending_mask;
+	struct timespec in_flight;
+	struct weston_output *in_flight_output;
+};
+
+static const char * const stage_names[] = {
+	[WESTON_REPAINT_STAGE_VIEW_LIST] = "view-list",
+	[WESTON_REPAINT_STAGE_ASSIGN_PLANES] = "assign-planes",
+	[WESTON_REPAINT_STAGE_DAMAGE] = "damage",
+	[WESTON_REPAINT_STAGE_RENDER] = "render",
+	[WESTON_REPAINT_STAGE_GPU] = "gpu",
+	[WESTON_REPAINT_STAGE_COMMIT_TO_PRESENT] = "commit-to-present",
+};
+
+static unsigned int
+histogram_bucket(uint64_t v)
+{
+	const unsigned int sub_bits = WESTON_LATENCY_HISTOGRAM_SUB_BITS;
+	unsigned int msb;
+
+	if (v < (1u << sub_bits))
+		return v;
+
+	msb = 63 - __builtin_clzll(v);
+	if (msb >= WESTON_LATENCY_HISTOGRAM_MAX_BITS)
+		return WESTON_LATENCY_HISTOGRAM_BUCKETS - 1;
+
+	return ((msb - sub_bits + 1) << sub_bits) +
+	       ((v >> (msb - sub_bits)) & ((1u << sub_bits) - 1));
+}
+
+/* The value in the middle of a bucket */
+static uint64_t
+histogram_bucket_value(unsigned int bucket)
+{
+	const unsigned int sub_bits = WESTON_LATENCY_HISTOGRAM_SUB_BITS;
+	unsigned int group = bucket >> sub_bits;
+	unsigned int shift;
+	uint64_t sub;
+
+	if (group == 0)
+		return bucket;
+
+	shift = group - 1;
+	sub = bucket & ((1u << sub_bits) - 1);
+
+	return (((1u << sub_bits) + sub) << shift) + ((1ull << shift) >> 1);
+}
+
+void
+weston_latency_histogram_add(struct weston_latency_histogram *hist,
+			     uint64_t value_ns)
+{
+	if (hist->count == 0 || value_ns < hist->min_ns)
+		hist->min_ns = value_ns;
+	if (value_ns > hist->max_ns)
+		hist->max_ns = value_ns;
+
+	hist->count++;
+	hist->sum_ns += value_ns;
+	hist->buckets[histogram_bucket(value_ns)]++;
+}
+
+/** Estimate a percentile of the recorded values
+ *
+ * \param percentile Between 0 and 100.
+ * \return The value below which \c percentile percent of the samples lie,
+ * accurate to the bucket width, or 0 if nothing was recorded.
+ */
+uint64_t
+weston_latency_histogram_percentile(const struct weston_latency_histogram *hist,
+				    double percentile)
+{
+	uint64_t rank, seen = 0;
+	unsigned int i;
+
+	if (hist->count == 0)
+		return 0;
+
+	rank = (uint64_t)(percentile / 100.0 * hist->count + 0.5);
+	rank = MAX(rank, 1);
+
+	for (i = 0; i < WESTON_LATENCY_HISTOGRAM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == WESTON_LATENCY_HISTOGRAM_BUCKETS)
+		return hist->max_ns;
+
+	return MIN(MAX(histogram_bucket_value(i), hist->min_ns), hist->max_ns);
+}
+
+struct weston_repaint_stats *
+weston_repaint_stats_create(void)
+{
+	return zalloc(sizeof(struct weston_repaint_stats));
+}
+
+void
+weston_repaint_stats_destroy(struct weston_output *output)
+{
+	struct weston_seat *seat;
+
+	wl_list_for_each(seat, &output->compositor->seat_list, link) {
+		struct weston_input_latency *latency = seat->input_latency;
+
+		if (latency && latency->in_flight_output == output) {
+			latency->in_flight_output = NULL;
+			latency->in_flight.tv_sec = 0;
+			latency->in_flight.tv_nsec = 0;
+		}
+	}
+
+	free(output->repaint_stats);
+	output->repaint_stats = NULL;
+}
+
+/** Record how long a repaint stage took on an output
+ *
+ * Negative durations, e.g. from clock adjustments, are dropped.
+ */
+WL_EXPORT void
+weston_repaint_stats_record_ns(struct weston_output *output,
+			       enum weston_repaint_stage stage,
+			       int64_t duration_ns)
+{
+	struct weston_repaint_stats *stats = output->repaint_stats;
+
+	if (!stats || duration_ns < 0)
+		return;
+
+	weston_latency_histogram_add(&stats->stage[stage], duration_ns);
+}
+
+WL_EXPORT void
+weston_repaint_stats_record(struct weston_output *output,
+			    enum weston_repaint_stage stage,
+			    const struct timespec *begin,
+			    const struct timespec *end)
+{
+	weston_repaint_stats_record_ns(output, stage,
+				       timespec_sub_to_nsec(end, begin));
+}
+
+/** Count what a renderer did with the views of a repaint
+ *
+ * \param drawn Views composited into the damage.
+ * \param culled Views skipped as what the damage shows of them is covered
+ * by opaque views, or as they lie outside of it.
+ * \param cleared Opaque solid color views filled instead of composited.
+ */
+WL_EXPORT void
+weston_repaint_stats_count_views(struct weston_output *output,
+				 unsigned int drawn, unsigned int culled,
+				 unsigned int cleared)
+{
+	struct weston_repaint_stats *stats = output->repaint_stats;
+
+	if (!stats)
+		return;
+
+	stats->views_drawn += drawn;
+	stats->views_culled += culled;
+	stats->views_cleared += cleared;
+}
+
+/** Note a damaging commit for the commit-to-present latency
+ *
+ * Only the first commit since the previous repaint of each output the
+ * surface is on counts, as that is the one that waited the longest.
+ */
+void
+weston_repaint_stats_surface_committed(struct weston_surface *surface)
+{
+	struct weston_compositor *compositor = surface->compositor;
+	struct weston_output *output;
+	struct timespec now = { 0 };
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		struct weston_repaint_stats *stats = output->repaint_stats;
+
+		if (!stats || stats->commit_pending.tv_sec != 0 ||
+		    !(surface->output_mask & (1u << output->id)))
+			continue;
+
+		if (now.tv_sec == 0)
+			weston_compositor_read_presentation_clock(compositor,
+								  &now);
+		stats->commit_pending = now;
+	}
+}
+
+/** The output repaint picked up the pending commits and input */
+void
+weston_repaint_stats_repaint_posted(struct weston_output *output)
+{
+	struct weston_repaint_stats *stats = output->repaint_stats;
+	struct weston_seat *seat;
+
+	if (!stats)
+		return;
+
+	wl_list_for_each(seat, &output->compositor->seat_list, link) {
+		struct weston_input_latency *latency = seat->input_latency;
+
+		if (!latency || latency->pending.tv_sec == 0 ||
+		    latency->in_flight_output)
+			continue;
+
+		if (latency->pending_mask &&
+		    !(latency->pending_mask & (1u << output->id)))
+			continue;
+
+		latency->in_flight = latency->pending;
+		latency->in_flight_output = output;
+		latency->pending.tv_sec = 0;
+		latency->pending.tv_nsec = 0;
+		latency->pending_mask = 0;
+	}
+
+	stats->commit_in_flight = stats->commit_pending;
+	stats->commit_pending.tv_sec = 0;
+	stats->commit_pending.tv_nsec = 0;
+}
+
+/** The repaint in flight hit the screen at \c stamp
+ *
+ * \param stamp The presentation timestamp, in the presentation clock.
+ */
+void
+weston_repaint_stats_presented(struct weston_output *output,
+			       const struct timespec *stamp)
+{
+	struct weston_repaint_stats *stats = output->repaint_stats;
+
+	if (!stats || stats->commit_in_flight.tv_sec == 0)
+		return;
+
+	weston_repaint_stats_record(output,
+				    WESTON_REPAINT_STAGE_COMMIT_TO_PRESENT,
+				    &stats->commit_in_flight, stamp);
+	stats->commit_in_flight.tv_sec = 0;
+	stats->commit_in_flight.tv_nsec = 0;
+}
+
+/** The repaint in flight hit the screen, for the input latency
+ *
+ * \param stamp_monotonic The presentation timestamp, converted to
+ * CLOCK_MONOTONIC like the input timestamps.
+ */
+void
+weston_repaint_stats_input_presented(struct weston_output *output,
+				     const struct timespec *stamp_monotonic)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_seat *seat;
+
+	wl_list_for_each(seat, &compositor->seat_list, link) {
+		struct weston_input_latency *latency = seat->input_latency;
+		int64_t ns;
+
+		if (!latency || latency->in_flight_output != output)
+			continue;
+
+		ns = timespec_sub_to_nsec(stamp_monotonic,
+					  &latency->in_flight);
+		if (ns >= 0)
+			weston_latency_histogram_add(&latency->hist, ns);
+
+		TL_POINT(compositor, "core_input_presented",
+			 TLP_OUTPUT(output), TLP_VBLANK(stamp_monotonic),
+			 TLP_INPUT(&latency->in_flight), TLP_END);
+
+		latency->in_flight_output = NULL;
+		latency->in_flight.tv_sec = 0;
+		latency->in_flight.tv_nsec = 0;
+	}
+}
+
+static void
+histogram_get_summary(const struct weston_latency_histogram *hist,
+		      struct weston_latency_summary *summary)
+{
+	memset(summary, 0, sizeof *summary);
+	if (hist->count == 0)
+		return;
+
+	summary->count = hist->count;
+	summary->min_ns = hist->min_ns;
+	summary->p50_ns = weston_latency_histogram_percentile(hist, 50.0);
+	summary->p90_ns = weston_latency_histogram_percentile(hist, 90.0);
+	summary->p99_ns = weston_latency_histogram_percentile(hist, 99.0);
+	summary->max_ns = hist->max_ns;
+	summary->mean_ns = hist->sum_ns / hist->count;
+}
+
+WL_EXPORT void
+weston_repaint_stats_get_summary(struct weston_output *output,
+				 enum weston_repaint_stage stage,
+				 struct weston_latency_summary *summary)
+{
+	memset(summary, 0, sizeof *summary);
+	if (!output->repaint_stats)
+		return;
+
+	histogram_get_summary(&output->repaint_stats->stage[stage], summary);
+}
+
+struct weston_input_latency *
+weston_input_latency_create(void)
+{
+	return zalloc(sizeof(struct weston_input_latency));
+}
+
+void
+weston_input_latency_destroy(struct weston_input_latency *latency)
+{
+	free(latency);
+}
+
+/** Note an input event for the input-to-present latency
+ *
+ * Only the earliest event since the previous repaint counts, as that is
+ * the one that waited the longest.
+ *
+ * \param time The event timestamp, in CLOCK_MONOTONIC.
+ * \param output_mask The outputs the event may show on, 0 for any.
+ */
+void
+weston_input_latency_record(struct weston_seat *seat,
+			    const struct timespec *time,
+			    uint32_t output_mask)
+{
+	struct weston_input_latency *latency = seat->input_latency;
+
+	if (!latency || !time || (time->tv_sec == 0 && time->tv_nsec == 0))
+		return;
+
+	if (latency->pending.tv_sec == 0) {
+		latency->pending = *time;
+		latency->pending_mask = output_mask;
+	} else if (latency->pending_mask) {
+		latency->pending_mask = output_mask ?
+			latency->pending_mask | output_mask : 0;
+	}
+}
+
+WL_EXPORT void
+weston_input_latency_get_summary(struct weston_seat *seat,
+				 struct weston_latency_summary *summary)
+{
+	memset(summary, 0, sizeof *summary);
+	if (!seat->input_latency)
+		return;
+
+	histogram_get_summary(&seat->input_latency->hist, summary);
+}
+
+static void
+print_summary(struct weston_log_subscription *sub, const char *name,
+	      const struct weston_latency_summary *s)
+{
+	weston_log_subscription_printf(sub,
+		"  %-18s %10" PRIu64 " %9.1f %9.1f %9.1f "
+		"%9.1f %9.1f %9.1f\n", name,
+		s->count, s->min_ns / 1000.0, s->p50_ns / 1000.0,
+		s->p90_ns / 1000.0, s->p99_ns / 1000.0,
+		s->max_ns / 1000.0, s->mean_ns / 1000.0);
+}
+
+static void
+print_header(struct weston_log_subscription *sub, const char *name)
+{
+	weston_log_subscription_printf(sub,
+		"  %-18s %10s %9s %9s %9s %9s %9s %9s\n", name,
+		"count", "min", "p50", "p90", "p99", "max", "mean");
+}
+
+static void
+print_deadlines(struct weston_log_subscription *sub,
+		const struct weston_repaint_predictor *p)
+{
+	weston_log_subscription_printf(sub,
+		"  deadline misses: %" PRIu64 " of %" PRIu64 " frames, "
+		"predicted repaint %.1f +- %.1f\n",
+		p->misses, p->frames, p->mean_ns / 1000.0, p->dev_ns / 1000.0);
+}
+
+static void
+print_views(struct weston_log_subscription *sub,
+	    const struct weston_repaint_stats *stats)
+{
+	weston_log_subscription_printf(sub,
+		"  views: %" PRIu64 " drawn, %" PRIu64 " culled, "
+		"%" PRIu64 " solid clears\n",
+		stats->views_drawn, stats->views_culled, stats->views_cleared);
+}
+
+static void
+repaint_stats_subscribe(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_latency_summary s;
+	struct weston_output *output;
+	struct weston_seat *seat;
+	unsigned int i;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		weston_log_subscription_printf(sub, "output %s, "
+					       "times in microseconds:\n",
+					       output->name);
+		print_header(sub, "stage");
+
+		for (i = 0; i < WESTON_REPAINT_STAGE_COUNT; i++) {
+			weston_repaint_stats_get_summary(output, i, &s);
+			print_summary(sub, stage_names[i], &s);
+		}
+
+		if (output->repaint_predictor)
+			print_deadlines(sub, output->repaint_predictor);
+		if (output->repaint_stats)
+			print_views(sub, output->repaint_stats);
+	}
+
+	wl_list_for_each(seat, &compositor->seat_list, link) {
+		weston_log_subscription_printf(sub, "seat %s, "
+					       "times in microseconds:\n",
+					       seat->seat_name);
+		print_header(sub, "latency");
+
+		weston_input_latency_get_summary(seat, &s);
+		print_summary(sub, "input-to-present", &s);
+	}
+
+	weston_log_subscription_complete(sub);
+}
+
+struct weston_log_scope *
+weston_repaint_stats_create_scope(struct weston_compositor *compositor)
+{
+	return weston_compositor_add_log_scope(compositor, "repaint-stats",
+			"Per-output repaint and per-seat input latency "
+			"percentiles, printed on subscription\n",
+			repaint_stats_subscribe, NULL, compositor);
+}
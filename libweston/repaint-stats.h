@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_REPAINT_STATS_H
+#define WESTON_REPAINT_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+
+enum weston_repaint_stage {
+	WESTON_REPAINT_STAGE_VIEW_LIST = 0,
+	WESTON_REPAINT_STAGE_ASSIGN_PLANES,
+	WESTON_REPAINT_STAGE_DAMAGE,
+	WESTON_REPAINT_STAGE_RENDER,
+	WESTON_REPAINT_STAGE_GPU,
+	WESTON_REPAINT_STAGE_COMMIT_TO_PRESENT,
+	WESTON_REPAINT_STAGE_COUNT,
+};
+
+/* Log-linear buckets: exact below 16 ns, then 16 buckets per power of
+ * two, so any value is off by at most 1/16. Values above 2^40 ns (about
+ * 18 minutes) land in the last bucket. */
+#define WESTON_LATENCY_HISTOGRAM_SUB_BITS 4
+#define WESTON_LATENCY_HISTOGRAM_MAX_BITS 40
+#define WESTON_LATENCY_HISTOGRAM_BUCKETS \
+	((WESTON_LATENCY_HISTOGRAM_MAX_BITS - \
+	  WESTON_LATENCY_HISTOGRAM_SUB_BITS + 1) << \
+	 WESTON_LATENCY_HISTOGRAM_SUB_BITS)
+
+struct weston_latency_histogram {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint32_t buckets[WESTON_LATENCY_HISTOGRAM_BUCKETS];
+};
+
+struct weston_latency_summary {
+	uint64_t count;
+	uint64_t min_ns;
+	uint64_t p50_ns;
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t max_ns;
+	uint64_t mean_ns;
+};
+
+/* The GL renderer is a module of its own and the test plugins read the
+ * statistics back, so these are WL_EXPORT */
+
+void
+weston_repaint_stats_record(struct weston_output *output,
+			    enum weston_repaint_stage stage,
+			    const struct timespec *begin,
+			    const struct timespec *end);
+
+void
+weston_repaint_stats_record_ns(struct weston_output *output,
+			       enum weston_repaint_stage stage,
+			       int64_t duration_ns);
+
+void
+weston_repaint_stats_count_views(struct weston_output *output,
+				 unsigned int drawn, unsigned int culled,
+				 unsigned int cleared);
+
+void
+weston_repaint_stats_get_summary(struct weston_output *output,
+				 enum weston_repaint_stage stage,
+				 struct weston_latency_summary *summary);
+
+void
+weston_input_latency_get_summary(struct weston_seat *seat,
+				 struct weston_latency_summary *summary);
+
+/* Internal to libweston */
+
+void
+weston_latency_histogram_add(struct weston_latency_histogram *hist,
+			     uint64_t value_ns);
+
+uint64_t
+weston_latency_histogram_percentile(const struct weston_latency_histogram *hist,
+				    double percentile);
+
+struct weston_repaint_stats *
+weston_repaint_stats_create(void);
+
+void
+weston_repaint_stats_destroy(struct weston_output *output);
+
+void
+weston_repaint_stats_surface_committed(struct weston_surface *surface);
+
+void
+weston_repaint_stats_repaint_posted(struct weston_output *output);
+
+void
+weston_repaint_stats_presented(struct weston_output *output,
+			       const struct timespec *stamp);
+
+void
+weston_repaint_stats_input_presented(struct weston_output *output,
+				     const struct timespec *stamp_monotonic);
+
+struct weston_input_latency *
+weston_input_latency_create(void);
+
+void
+weston_input_latency_destroy(struct weston_input_latency *latency);
+
+void
+weston_input_latency_record(struct weston_seat *seat,
+			    const struct timespec *time,
+			    uint32_t output_mask);
+
+struct weston_log_scope *
+weston_repaint_stats_create_scope(struct weston_compositor *compositor);
+
+#endif /* WESTON_REPAINT_STATS_H */
@@ -26,14 +26,20 @@
 
 #include "config.h"
 
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <inttypes.h>
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
+#include <libweston/zalloc.h>
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "timeline.h"
 #include "weston-log-internal.h"
 
@@ -52,306 +58,951 @@
  * Do note that only weston_timeline_refresh_subscription_objects()
  * is exported in libweston.
  *
- * Destruction of the objects assigned to each underlying objects happens in
- * two places: one in the logging framework callback of the log scope
- * ('destroy_subscription'), and secondly, when the object itself gets
- * destroyed.
+ * Timeline points are hot: some are hit for every surface commit. Rather
+ * than formatting JSON once per point and subscription, a point is appended
+ * to a preallocated ring as a fixed-size weston_timeline_record, with the
+ * point name and the objects interned to small ids. The ring is converted to
+ * the wesgr JSON and written to the subscriptions from a timer a little
+ * later, or right away when it fills up. The producer and the flush both run
+ * on the compositor thread; head and tail are only ever advanced by one side
+ * each, so no lock is needed.
  *
- * timeline_emit_context - For each subscription this object will be created to
- * store a buffer when the object itself will be written and a subscription,
- * which will be used to force the object ID if there is a need to do so (the
- * underlying object has been refreshed, or better said has suffered some
- * modification). Data written to a subscription will be flushed before the
- * data written to the FILE *.
+ * Object ids and names are shared by all subscriptions. An object is
+ * described (a description record is queued) the first time it is seen and
+ * again whenever it is refreshed, and every new subscription refreshes all
+ * objects so it learns about those seen before it came.
  *
- * @param cur a FILE *
- * @param subscription a pointer to an already created subscription
+ * The same ring also feeds the 'timeline-trace' scope, which writes the
+ * Chrome Trace Event format that Perfetto and chrome://tracing load
+ * directly: one track per output, per surface and per output GPU, with
+ * flow arrows following a damaging commit through the repaint that posted
+ * it to its presentation.
  *
  * @ingroup internal-log
  * @sa weston_timeline_point
  */
-struct timeline_emit_context {
-	FILE *cur;
-	struct weston_log_subscription *subscription;
+struct weston_timeline {
+	struct weston_compositor *compositor;
+	struct weston_log_scope *scope;
+	struct weston_log_scope *trace_scope;
+	unsigned int subscription_count;	/**< of both scopes */
+	unsigned int trace_subscription_count;
+
+	struct weston_timeline_record *ring;
+	uint32_t ring_mask;
+	uint64_t head;			/**< next record to write */
+	uint64_t tail;			/**< next record to flush */
+	struct wl_event_source *flush_timer;
+
+	char **names;
+	const char **name_keys;		/**< caller's pointers, for a fast hit */
+	unsigned int name_count;
+	unsigned int name_alloc;
+
+	unsigned int next_id;
+	struct wl_list objects;		/**< weston_timeline_object::link */
+
+	/* Flows of the trace being written */
+	uint64_t trace_next_flow;
+	struct wl_array trace_commits;	/**< struct timeline_trace_commit */
+	struct wl_array trace_outputs;	/**< struct timeline_trace_output */
 };
 
-/** Create a timeline subscription and hang it off the subscription
- *
- * Called when the subscription is created.
- *
- * @ingroup internal-log
- */
-void
-weston_timeline_create_subscription(struct weston_log_subscription *sub,
-		void *user_data)
+/* Points the trace format gives a meaning to; interned first, in this
+ * order, so that their name ids are the enum values. */
+enum timeline_known_point {
+	TLK_COMMIT_DAMAGE = 0,
+	TLK_FLUSH_DAMAGE,
+	TLK_REPAINT_BEGIN,
+	TLK_REPAINT_POSTED,
+	TLK_REPAINT_FINISHED,
+	TLK_GPU_BEGIN,
+	TLK_GPU_END,
+	TLK_INPUT_PRESENTED,
+	TLK_COUNT,
+};
+
+static const char * const known_points[] = {
+	[TLK_COMMIT_DAMAGE] = "core_commit_damage",
+	[TLK_FLUSH_DAMAGE] = "core_flush_damage",
+	[TLK_REPAINT_BEGIN] = "core_repaint_begin",
+	[TLK_REPAINT_POSTED] = "core_repaint_posted",
+	[TLK_REPAINT_FINISHED] = "core_repaint_finished",
+	[TLK_GPU_BEGIN] = "renderer_gpu_begin",
+	[TLK_GPU_END] = "renderer_gpu_end",
+	[TLK_INPUT_PRESENTED] = "core_input_presented",
+};
+
+#define TRACE_PID_OUTPUTS 1
+#define TRACE_PID_SURFACES 2
+#define TRACE_PID_GPU 3
+
+/* Commits waiting for a repaint, at most one per surface */
+struct timeline_trace_commit {
+	uint32_t surface;
+	uint64_t flow;
+};
+
+/* Commits flushed into a repaint, and those of the repaint in flight */
+#define TIMELINE_TRACE_MAX_FLOWS 16
+struct timeline_trace_output {
+	uint32_t output;
+	unsigned int n_pending;
+	unsigned int n_in_flight;
+	uint64_t pending[TIMELINE_TRACE_MAX_FLOWS];
+	uint64_t in_flight[TIMELINE_TRACE_MAX_FLOWS];
+};
+
+/* 4096 records of 56 bytes; about 4 frames worth of a busy desktop */
+#define TIMELINE_RING_ORDER 12
+/* How long records may sit in the ring before they are written out */
+#define TIMELINE_FLUSH_MSEC 10
+
+static void WL_PRINTF(4, 5)
+buf_append(char *buf, size_t size, size_t *len, const char *fmt, ...)
 {
-	struct weston_timeline_subscription *tl_sub = zalloc(sizeof(*tl_sub));
-	if (!tl_sub)
-		return;
+	va_list ap;
+	int n;
 
-	wl_list_init(&tl_sub->objects);
+	va_start(ap, fmt);
+	n = vsnprintf(buf + *len, size - *len, fmt, ap);
+	va_end(ap);
 
-	/* attach this timeline_subscription to it */
-	weston_log_subscription_set_data(sub, tl_sub);
+	if (n > 0)
+		*len = MIN(*len + n, size - 1);
 }
 
 static void
-weston_timeline_destroy_subscription_object(struct weston_timeline_subscription_object *sub_obj)
+buf_append_timestamp(char *buf, size_t size, size_t *len,
+		     const char *key, uint64_t ns)
 {
-	/* remove the notify listener */
-	wl_list_remove(&sub_obj->destroy_listener.link);
-	sub_obj->destroy_listener.notify = NULL;
+	buf_append(buf, size, len, ", \"%s\":[%" PRId64 ", %ld]", key,
+		   (int64_t)(ns / 1000000000), (long)(ns % 1000000000));
+}
 
-	wl_list_remove(&sub_obj->subscription_link);
-	free(sub_obj);
+static void
+buf_append_quoted_string(char *buf, size_t size, size_t *len, const char *str)
+{
+	if (!str)
+		buf_append(buf, size, len, "null");
+	else
+		buf_append(buf, size, len, "\"%s\"", str);
 }
 
-/** Destroy the timeline subscription and all timeline subscription objects
- * associated with it.
+/** Turn one record into its wesgr JSON line
  *
- * Called when (before) the subscription is destroyed.
- *
- * @ingroup internal-log
+ * @return the length of the line in \c buf, truncated to fit
  */
-void
-weston_timeline_destroy_subscription(struct weston_log_subscription *sub,
-				     void *user_data)
+static size_t
+timeline_format_record(struct weston_timeline *tl,
+		       const struct weston_timeline_record *rec,
+		       char *buf, size_t size)
 {
-	struct weston_timeline_subscription *tl_sub =
-		weston_log_subscription_get_data(sub);
-	struct weston_timeline_subscription_object *sub_obj, *tmp_sub_obj;
-
-	if (!tl_sub)
-		return;
+	size_t len = 0;
+
+	switch (rec->type) {
+	case TLR_OUTPUT_DESC:
+		buf_append(buf, size, &len, "{ \"id\":%u, "
+			   "\"type\":\"weston_output\", \"name\":",
+			   rec->output);
+		buf_append_quoted_string(buf, size, &len, rec->desc);
+		break;
+	case TLR_SURFACE_DESC:
+		buf_append(buf, size, &len, "{ \"id\":%u, "
+			   "\"type\":\"weston_surface\", \"desc\":",
+			   rec->output);
+		buf_append_quoted_string(buf, size, &len, rec->desc);
+		if (rec->surface)
+			buf_append(buf, size, &len, ", \"main_surface\":%u",
+				   rec->surface);
+		break;
+	case TLR_POINT:
+		buf_append(buf, size, &len, "{ \"T\":[%" PRId64 ", %ld], "
+			   "\"N\":\"%s\"",
+			   (int64_t)(rec->ts_ns / 1000000000),
+			   (long)(rec->ts_ns % 1000000000),
+			   tl->names[rec->name]);
+		if (rec->output)
+			buf_append(buf, size, &len, ", \"wo\":%u", rec->output);
+		if (rec->surface)
+			buf_append(buf, size, &len, ", \"ws\":%u", rec->surface);
+		if (rec->flags & TLR_HAS_VBLANK)
+			buf_append_timestamp(buf, size, &len,
+					     "vblank_monotonic", rec->vblank_ns);
+		if (rec->flags & TLR_HAS_GPU)
+			buf_append_timestamp(buf, size, &len,
+					     "gpu", rec->gpu_ns);
+		if (rec->flags & TLR_HAS_INPUT)
+			buf_append_timestamp(buf, size, &len,
+					     "input", rec->input_ns);
+		break;
+	}
+	buf_append(buf, size, &len, " }\n");
 
-	wl_list_for_each_safe(sub_obj, tmp_sub_obj,
-			      &tl_sub->objects, subscription_link)
-		weston_timeline_destroy_subscription_object(sub_obj);
+	/* keep one record per line even when truncated */
+	if (len == size - 1)
+		buf[len - 1] = '\n';
 
-	free(tl_sub);
+	return len;
 }
 
-static bool
-weston_timeline_check_object_refresh(struct weston_timeline_subscription_object *obj)
+static void
+buf_append_json_escaped(char *buf, size_t size, size_t *len, const char *str)
 {
-	if (obj->force_refresh == true) {
-		obj->force_refresh = false;
-		return true;
+	unsigned char c;
+
+	for (; *str && *len < size - 1; str++) {
+		c = *str;
+		if (c == '"' || c == '\\') {
+			buf_append(buf, size, len, "\\%c", c);
+		} else if (c < 0x20) {
+			buf_append(buf, size, len, "\\u%04x", c);
+		} else {
+			buf[(*len)++] = c;
+			buf[*len] = '\0';
+		}
 	}
-	return false;
 }
 
-static struct weston_timeline_subscription_object *
-weston_timeline_subscription_search(struct weston_timeline_subscription *tl_sub,
-				    void *object)
+/* Opens a trace event; the caller adds its own fields and closes it. */
+static void
+trace_append_event(char *buf, size_t size, size_t *len, const char *ph,
+		   const char *name, int pid, uint32_t tid, uint64_t ts_ns)
 {
-	struct weston_timeline_subscription_object *sub_obj;
+	buf_append(buf, size, len, "{\"ph\":\"%s\",\"name\":\"%s\","
+		   "\"pid\":%d,\"tid\":%u,\"ts\":%" PRIu64 ".%03u",
+		   ph, name, pid, tid, ts_ns / 1000,
+		   (unsigned int)(ts_ns % 1000));
+}
 
-	wl_list_for_each(sub_obj, &tl_sub->objects, subscription_link)
-		if (sub_obj->object == object)
-			return sub_obj;
+static void
+trace_append_simple(char *buf, size_t size, size_t *len, const char *ph,
+		    const char *name, int pid, uint32_t tid, uint64_t ts_ns)
+{
+	trace_append_event(buf, size, len, ph, name, pid, tid, ts_ns);
+	buf_append(buf, size, len, "},\n");
+}
 
-	return NULL;
+/* Timeline points become zero-length slices, so flows can bind to them */
+static void
+trace_append_slice(char *buf, size_t size, size_t *len, const char *name,
+		   int pid, uint32_t tid, uint64_t ts_ns)
+{
+	trace_append_event(buf, size, len, "X", name, pid, tid, ts_ns);
+	buf_append(buf, size, len, ",\"dur\":0},\n");
+}
+
+static void
+trace_append_flow(char *buf, size_t size, size_t *len, const char *ph,
+		  int pid, uint32_t tid, uint64_t ts_ns, uint64_t flow)
+{
+	trace_append_event(buf, size, len, ph, "frame", pid, tid, ts_ns);
+	buf_append(buf, size, len, ",\"cat\":\"frame\",\"id\":%" PRIu64
+		   ",\"bp\":\"e\"},\n", flow);
 }
 
-static struct weston_timeline_subscription_object *
-weston_timeline_subscription_object_create(void *object,
-					   struct weston_timeline_subscription *tm_sub)
+static void
+trace_append_thread_name(char *buf, size_t size, size_t *len, int pid,
+			 uint32_t tid, const char *kind, const char *name)
 {
-	struct weston_timeline_subscription_object *sub_obj;
+	buf_append(buf, size, len, "{\"ph\":\"M\",\"name\":\"thread_name\","
+		   "\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s ",
+		   pid, tid, kind);
+	if (name)
+		buf_append_json_escaped(buf, size, len, name);
+	else
+		buf_append(buf, size, len, "%u", tid);
+	buf_append(buf, size, len, "\"}},\n");
+}
 
-	sub_obj = zalloc(sizeof(*sub_obj));
-	sub_obj->id = ++tm_sub->next_id;
-	sub_obj->object = object;
+static struct timeline_trace_output *
+timeline_trace_output_get(struct weston_timeline *tl, uint32_t output)
+{
+	struct timeline_trace_output *to;
 
-	/* when the object is created so that it has the chance to display the
-	 * object ID, we set the refresh status; it will only be re-freshed by
-	 * the backend (or part parts) when the underlying objects has suffered
-	 * modifications */
-	sub_obj->force_refresh = true;
+	wl_array_for_each(to, &tl->trace_outputs)
+		if (to->output == output)
+			return to;
 
-	wl_list_insert(&tm_sub->objects, &sub_obj->subscription_link);
+	to = wl_array_add(&tl->trace_outputs, sizeof *to);
+	if (!to)
+		return NULL;
+
+	memset(to, 0, sizeof *to);
+	to->output = output;
 
-	return sub_obj;
+	return to;
 }
 
-static void
-weston_timeline_destroy_subscription_object_notify(struct wl_listener *listener, void *data)
+/** Start a flow for a commit, unless one is already waiting
+ *
+ * @return the new flow id, or 0
+ */
+static uint64_t
+timeline_trace_commit_start(struct weston_timeline *tl, uint32_t surface)
 {
-	struct weston_timeline_subscription_object *sub_obj;
+	struct timeline_trace_commit *tc;
+
+	wl_array_for_each(tc, &tl->trace_commits)
+		if (tc->surface == surface)
+			return 0;
+
+	tc = wl_array_add(&tl->trace_commits, sizeof *tc);
+	if (!tc)
+		return 0;
+
+	tc->surface = surface;
+	tc->flow = ++tl->trace_next_flow;
 
-	sub_obj = wl_container_of(listener, sub_obj, destroy_listener);
-	weston_timeline_destroy_subscription_object(sub_obj);
+	return tc->flow;
 }
 
-static struct weston_timeline_subscription_object *
-weston_timeline_subscription_output_ensure(struct weston_timeline_subscription *tl_sub,
-		struct weston_output *output)
+/** Take the waiting commit flow of a surface, 0 if none */
+static uint64_t
+timeline_trace_commit_take(struct weston_timeline *tl, uint32_t surface)
 {
-	struct weston_timeline_subscription_object *sub_obj;
+	struct timeline_trace_commit *tc, *last;
+	uint64_t flow;
 
-	sub_obj = weston_timeline_subscription_search(tl_sub, output);
-	if (!sub_obj) {
-		sub_obj = weston_timeline_subscription_object_create(output, tl_sub);
+	wl_array_for_each(tc, &tl->trace_commits) {
+		if (tc->surface != surface)
+			continue;
 
-		sub_obj->destroy_listener.notify =
-			weston_timeline_destroy_subscription_object_notify;
-		wl_signal_add(&output->destroy_signal,
-			      &sub_obj->destroy_listener);
+		flow = tc->flow;
+		last = (struct timeline_trace_commit *)
+			((char *)tl->trace_commits.data +
+			 tl->trace_commits.size) - 1;
+		*tc = *last;
+		tl->trace_commits.size -= sizeof *tc;
+
+		return flow;
 	}
-	return sub_obj;
+
+	return 0;
 }
 
-static struct weston_timeline_subscription_object *
-weston_timeline_subscription_surface_ensure(struct weston_timeline_subscription *tl_sub,
-		struct weston_surface *surface)
+static void
+timeline_trace_point(struct weston_timeline *tl,
+		     const struct weston_timeline_record *rec,
+		     char *buf, size_t size, size_t *len)
 {
-	struct weston_timeline_subscription_object *sub_obj;
+	const char *name = tl->names[rec->name];
+	struct timeline_trace_output *to = NULL;
+	uint64_t flow, ts;
+	unsigned int i;
+
+	if (rec->output)
+		to = timeline_trace_output_get(tl, rec->output);
+
+	switch (rec->name) {
+	case TLK_COMMIT_DAMAGE:
+		if (!rec->surface)
+			break;
+		trace_append_slice(buf, size, len, name, TRACE_PID_SURFACES,
+				   rec->surface, rec->ts_ns);
+		flow = timeline_trace_commit_start(tl, rec->surface);
+		if (flow)
+			trace_append_flow(buf, size, len, "s",
+					  TRACE_PID_SURFACES, rec->surface,
+					  rec->ts_ns, flow);
+		return;
+	case TLK_FLUSH_DAMAGE:
+		if (!to || !rec->surface)
+			break;
+		trace_append_slice(buf, size, len, name, TRACE_PID_OUTPUTS,
+				   rec->output, rec->ts_ns);
+		flow = timeline_trace_commit_take(tl, rec->surface);
+		if (flow && to->n_pending < TIMELINE_TRACE_MAX_FLOWS) {
+			to->pending[to->n_pending++] = flow;
+			trace_append_flow(buf, size, len, "t",
+					  TRACE_PID_OUTPUTS, rec->output,
+					  rec->ts_ns, flow);
+		}
+		return;
+	case TLK_REPAINT_BEGIN:
+		if (!to)
+			break;
+		trace_append_simple(buf, size, len, "B", "repaint",
+				    TRACE_PID_OUTPUTS, rec->output, rec->ts_ns);
+		return;
+	case TLK_REPAINT_POSTED:
+		if (!to)
+			break;
+		for (i = 0; i < to->n_pending; i++)
+			trace_append_flow(buf, size, len, "t",
+					  TRACE_PID_OUTPUTS, rec->output,
+					  rec->ts_ns, to->pending[i]);
+		memcpy(to->in_flight, to->pending,
+		       to->n_pending * sizeof to->pending[0]);
+		to->n_in_flight = to->n_pending;
+		to->n_pending = 0;
+		trace_append_simple(buf, size, len, "E", "repaint",
+				    TRACE_PID_OUTPUTS, rec->output, rec->ts_ns);
+		return;
+	case TLK_REPAINT_FINISHED:
+		if (!to)
+			break;
+		ts = (rec->flags & TLR_HAS_VBLANK) ? rec->vblank_ns : rec->ts_ns;
+		trace_append_slice(buf, size, len, "present",
+				   TRACE_PID_OUTPUTS, rec->output, ts);
+		for (i = 0; i < to->n_in_flight; i++)
+			trace_append_flow(buf, size, len, "f",
+					  TRACE_PID_OUTPUTS, rec->output,
+					  ts, to->in_flight[i]);
+		to->n_in_flight = 0;
+		return;
+	case TLK_GPU_BEGIN:
+	case TLK_GPU_END:
+		if (!rec->output || !(rec->flags & TLR_HAS_GPU))
+			break;
+		trace_append_simple(buf, size, len,
+				    rec->name == TLK_GPU_BEGIN ? "B" : "E",
+				    "gpu", TRACE_PID_GPU, rec->output,
+				    rec->gpu_ns);
+		return;
+	case TLK_INPUT_PRESENTED:
+		if (!rec->output || !(rec->flags & TLR_HAS_INPUT))
+			break;
+		/* a slice from the input event to its presentation */
+		ts = (rec->flags & TLR_HAS_VBLANK) ? rec->vblank_ns : rec->ts_ns;
+		ts -= MIN(ts, rec->input_ns);
+		trace_append_event(buf, size, len, "X", "input",
+				   TRACE_PID_OUTPUTS, rec->output,
+				   rec->input_ns);
+		buf_append(buf, size, len, ",\"dur\":%" PRIu64 ".%03u},\n",
+			   ts / 1000, (unsigned int)(ts % 1000));
+		return;
+	}
 
-	sub_obj = weston_timeline_subscription_search(tl_sub, surface);
-	if (!sub_obj) {
-		sub_obj = weston_timeline_subscription_object_create(surface, tl_sub);
+	if (rec->surface)
+		trace_append_slice(buf, size, len, name, TRACE_PID_SURFACES,
+				   rec->surface, rec->ts_ns);
+	else
+		trace_append_slice(buf, size, len, name, TRACE_PID_OUTPUTS,
+				   rec->output, rec->ts_ns);
+}
 
-		sub_obj->destroy_listener.notify =
-			weston_timeline_destroy_subscription_object_notify;
-		wl_signal_add(&surface->destroy_signal,
-			      &sub_obj->destroy_listener);
+/** Turn one record into Chrome Trace Event JSON
+ *
+ * @return the length of the events in \c buf
+ */
+static size_t
+timeline_format_trace(struct weston_timeline *tl,
+		      const struct weston_timeline_record *rec,
+		      char *buf, size_t size)
+{
+	size_t len = 0;
+
+	buf[0] = '\0';
+
+	switch (rec->type) {
+	case TLR_OUTPUT_DESC:
+		trace_append_thread_name(buf, size, &len, TRACE_PID_OUTPUTS,
+					 rec->output, "output", rec->desc);
+		trace_append_thread_name(buf, size, &len, TRACE_PID_GPU,
+					 rec->output, "gpu", rec->desc);
+		break;
+	case TLR_SURFACE_DESC:
+		trace_append_thread_name(buf, size, &len, TRACE_PID_SURFACES,
+					 rec->output, "surface", rec->desc);
+		break;
+	case TLR_POINT:
+		timeline_trace_point(tl, rec, buf, size, &len);
+		break;
 	}
 
-	return sub_obj;
+	return len;
 }
 
 static void
-fprint_quoted_string(struct weston_log_subscription *sub, const char *str)
+timeline_write_record(struct weston_log_scope *scope, uint64_t seq,
+		      const char *buf, size_t len)
 {
-	if (!str) {
-		weston_log_subscription_printf(sub, "null");
-		return;
-	}
+	struct weston_timeline_subscription *tl_sub;
+	struct weston_log_subscription *sub = NULL;
+
+	while ((sub = weston_log_subscription_iterate(scope, sub))) {
+		tl_sub = weston_log_subscription_get_data(sub);
+		if (!tl_sub || seq < tl_sub->first_seq)
+			continue;
 
-	weston_log_subscription_printf(sub, "\"%s\"", str);
+		weston_log_subscription_write(sub, buf, len);
+	}
 }
 
+/** Write all queued records out to the subscriptions
+ *
+ * A subscription only gets the records queued after it was created.
+ */
 static void
-emit_weston_output_print_id(struct weston_log_subscription *sub,
-			    struct weston_timeline_subscription_object *sub_obj,
-			    const char *name)
+timeline_flush(struct weston_timeline *tl)
 {
-	if (!weston_timeline_check_object_refresh(sub_obj))
-		return;
+	struct weston_timeline_record *rec;
+	uint64_t head, seq;
+	char buf[8192];
+	size_t len;
+
+	head = __atomic_load_n(&tl->head, __ATOMIC_ACQUIRE);
+
+	for (seq = tl->tail; seq != head; seq++) {
+		rec = &tl->ring[seq & tl->ring_mask];
 
-	weston_log_subscription_printf(sub, "{ \"id\":%u, "
-			"\"type\":\"weston_output\", \"name\":", sub_obj->id);
-	fprint_quoted_string(sub, name);
-	weston_log_subscription_printf(sub, " }\n");
+		if (tl->subscription_count > tl->trace_subscription_count) {
+			len = timeline_format_record(tl, rec, buf, sizeof buf);
+			timeline_write_record(tl->scope, seq, buf, len);
+		}
+
+		if (tl->trace_subscription_count > 0) {
+			len = timeline_format_trace(tl, rec, buf, sizeof buf);
+			if (len > 0)
+				timeline_write_record(tl->trace_scope, seq,
+						      buf, len);
+		}
+
+		free(rec->desc);
+		rec->desc = NULL;
+	}
+
+	__atomic_store_n(&tl->tail, head, __ATOMIC_RELEASE);
 }
 
 static int
-emit_weston_output(struct timeline_emit_context *ctx, void *obj)
+timeline_flush_timer_handler(void *data)
 {
-	struct weston_log_subscription *sub = ctx->subscription;
-	struct weston_output *output = obj;
-	struct weston_timeline_subscription_object *sub_obj;
-	struct weston_timeline_subscription *tl_sub;
+	struct weston_timeline *tl = data;
 
-	tl_sub = weston_log_subscription_get_data(sub);
-	sub_obj = weston_timeline_subscription_output_ensure(tl_sub, output);
-	emit_weston_output_print_id(sub, sub_obj, output->name);
+	timeline_flush(tl);
 
-	assert(sub_obj->id != 0);
-	fprintf(ctx->cur, "\"wo\":%u", sub_obj->id);
+	return 0;
+}
 
-	return 1;
+/** Get the next free ring record, making room if needed
+ *
+ * The record is published with timeline_commit().
+ */
+static struct weston_timeline_record *
+timeline_reserve(struct weston_timeline *tl)
+{
+	uint64_t tail = __atomic_load_n(&tl->tail, __ATOMIC_ACQUIRE);
+
+	if (tl->head - tail > tl->ring_mask)
+		timeline_flush(tl);
+	else if (tl->head == tail)
+		wl_event_source_timer_update(tl->flush_timer,
+					     TIMELINE_FLUSH_MSEC);
+
+	return &tl->ring[tl->head & tl->ring_mask];
+}
+
+static void
+timeline_commit(struct weston_timeline *tl)
+{
+	__atomic_store_n(&tl->head, tl->head + 1, __ATOMIC_RELEASE);
+}
+
+/** Look up the id of a point name, interning it on first use
+ *
+ * Point names are nearly always string literals, so the pointer seen last
+ * time is tried first. The names are copied, as the caller may live in a
+ * module.
+ */
+static int
+timeline_intern_name(struct weston_timeline *tl, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < tl->name_count; i++)
+		if (tl->name_keys[i] == name && strcmp(tl->names[i], name) == 0)
+			return i;
+
+	for (i = 0; i < tl->name_count; i++) {
+		if (strcmp(tl->names[i], name) == 0) {
+			tl->name_keys[i] = name;
+			return i;
+		}
+	}
+
+	if (tl->name_count == UINT16_MAX)
+		return -1;
+
+	if (tl->name_count == tl->name_alloc) {
+		unsigned int alloc = tl->name_alloc ? tl->name_alloc * 2 : 32;
+		char **names;
+		const char **keys;
+
+		names = realloc(tl->names, alloc * sizeof *names);
+		if (!names)
+			return -1;
+		tl->names = names;
+
+		keys = realloc(tl->name_keys, alloc * sizeof *keys);
+		if (!keys)
+			return -1;
+		tl->name_keys = keys;
+
+		tl->name_alloc = alloc;
+	}
+
+	tl->names[i] = strdup(name);
+	if (!tl->names[i])
+		return -1;
+	tl->name_keys[i] = name;
+
+	return tl->name_count++;
 }
 
+static void
+weston_timeline_object_destroy(struct weston_timeline_object *tl_obj)
+{
+	wl_list_remove(&tl_obj->destroy_listener.link);
+	wl_list_remove(&tl_obj->link);
+	free(tl_obj);
+}
 
 static void
-check_weston_surface_description(struct weston_log_subscription *sub,
-				 struct weston_surface *s,
-				 struct weston_timeline_subscription *tm_sub,
-				 struct weston_timeline_subscription_object *sub_obj)
+weston_timeline_object_destroy_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_timeline_object *tl_obj;
+
+	tl_obj = wl_container_of(listener, tl_obj, destroy_listener);
+	weston_timeline_object_destroy(tl_obj);
+}
+
+static struct weston_timeline_object *
+weston_timeline_object_search(struct weston_timeline *tl, void *object)
 {
+	struct weston_timeline_object *tl_obj;
+
+	wl_list_for_each(tl_obj, &tl->objects, link)
+		if (tl_obj->object == object)
+			return tl_obj;
+
+	return NULL;
+}
+
+static struct weston_timeline_object *
+weston_timeline_object_ensure(struct weston_timeline *tl, void *object,
+			      struct wl_signal *destroy_signal)
+{
+	struct weston_timeline_object *tl_obj;
+
+	tl_obj = weston_timeline_object_search(tl, object);
+	if (tl_obj)
+		return tl_obj;
+
+	tl_obj = zalloc(sizeof(*tl_obj));
+	if (!tl_obj)
+		return NULL;
+
+	tl_obj->id = ++tl->next_id;
+	tl_obj->object = object;
+
+	/* when the object is created so that it has the chance to display the
+	 * object ID, we set the refresh status; it will only be re-freshed by
+	 * the backend (or part parts) when the underlying objects has suffered
+	 * modifications */
+	tl_obj->force_refresh = true;
+
+	tl_obj->destroy_listener.notify = weston_timeline_object_destroy_notify;
+	wl_signal_add(destroy_signal, &tl_obj->destroy_listener);
+	wl_list_insert(&tl->objects, &tl_obj->link);
+
+	return tl_obj;
+}
+
+static unsigned int
+timeline_output_id(struct weston_timeline *tl, struct weston_output *output)
+{
+	struct weston_timeline_object *tl_obj;
+	struct weston_timeline_record *rec;
+
+	tl_obj = weston_timeline_object_ensure(tl, output,
+					       &output->destroy_signal);
+	if (!tl_obj)
+		return 0;
+
+	if (tl_obj->force_refresh) {
+		tl_obj->force_refresh = false;
+
+		rec = timeline_reserve(tl);
+		rec->type = TLR_OUTPUT_DESC;
+		rec->output = tl_obj->id;
+		rec->surface = 0;
+		rec->desc = output->name ? strdup(output->name) : NULL;
+		timeline_commit(tl);
+	}
+
+	return tl_obj->id;
+}
+
+static unsigned int
+timeline_surface_id(struct weston_timeline *tl, struct weston_surface *surface)
+{
+	struct weston_timeline_object *tl_obj;
+	struct weston_timeline_record *rec;
 	struct weston_surface *mains;
+	unsigned int main_id = 0;
 	char d[512];
-	char mainstr[32];
 
-	if (!weston_timeline_check_object_refresh(sub_obj))
-		return;
+	tl_obj = weston_timeline_object_ensure(tl, surface,
+					       &surface->destroy_signal);
+	if (!tl_obj)
+		return 0;
+
+	if (tl_obj->force_refresh) {
+		tl_obj->force_refresh = false;
 
-	mains = weston_surface_get_main_surface(s);
-	if (mains != s) {
-		struct weston_timeline_subscription_object *new_sub_obj;
-
-		new_sub_obj = weston_timeline_subscription_surface_ensure(tm_sub, mains);
-		check_weston_surface_description(sub, mains, tm_sub, new_sub_obj);
-		if (snprintf(mainstr, sizeof(mainstr), ", \"main_surface\":%u",
-			     new_sub_obj->id) < 0)
-			mainstr[0] = '\0';
-	} else {
-		mainstr[0] = '\0';
+		mains = weston_surface_get_main_surface(surface);
+		if (mains != surface)
+			main_id = timeline_surface_id(tl, mains);
+
+		if (!surface->get_label ||
+		    surface->get_label(surface, d, sizeof(d)) < 0)
+			d[0] = '\0';
+
+		rec = timeline_reserve(tl);
+		rec->type = TLR_SURFACE_DESC;
+		rec->output = tl_obj->id;
+		rec->surface = main_id;
+		rec->desc = d[0] ? strdup(d) : NULL;
+		timeline_commit(tl);
 	}
 
-	if (!s->get_label || s->get_label(s, d, sizeof(d)) < 0)
-		d[0] = '\0';
+	return tl_obj->id;
+}
+
+static bool
+timeline_ensure_ring(struct weston_timeline *tl)
+{
+	struct wl_event_loop *loop;
+
+	if (tl->ring)
+		return true;
 
-	weston_log_subscription_printf(sub, "{ \"id\":%u, "
-				       "\"type\":\"weston_surface\", \"desc\":",
-				       sub_obj->id);
-	fprint_quoted_string(sub, d[0] ? d : NULL);
-	weston_log_subscription_printf(sub, "%s }\n", mainstr);
+	loop = wl_display_get_event_loop(tl->compositor->wl_display);
+	tl->flush_timer = wl_event_loop_add_timer(loop,
+						  timeline_flush_timer_handler,
+						  tl);
+	if (!tl->flush_timer)
+		return false;
+
+	tl->ring = calloc(1u << TIMELINE_RING_ORDER, sizeof *tl->ring);
+	if (!tl->ring) {
+		wl_event_source_remove(tl->flush_timer);
+		tl->flush_timer = NULL;
+		return false;
+	}
+	tl->ring_mask = (1u << TIMELINE_RING_ORDER) - 1;
+
+	return true;
 }
 
-static int
-emit_weston_surface(struct timeline_emit_context *ctx, void *obj)
+/** Create a timeline subscription and hang it off the subscription
+ *
+ * Called when the subscription is created.
+ *
+ * @ingroup internal-log
+ */
+static struct weston_timeline_subscription *
+timeline_subscription_create(struct weston_timeline *tl,
+			     struct weston_log_subscription *sub)
 {
-	struct weston_log_subscription *sub = ctx->subscription;
-	struct weston_surface *surface = obj;
-	struct weston_timeline_subscription_object *sub_obj;
 	struct weston_timeline_subscription *tl_sub;
+	struct weston_timeline_object *tl_obj;
 
-	tl_sub = weston_log_subscription_get_data(sub);
-	sub_obj = weston_timeline_subscription_surface_ensure(tl_sub, surface);
-	check_weston_surface_description(sub, surface, tl_sub, sub_obj);
+	if (!timeline_ensure_ring(tl))
+		return NULL;
+
+	tl_sub = zalloc(sizeof(*tl_sub));
+	if (!tl_sub)
+		return NULL;
 
-	assert(sub_obj->id != 0);
-	fprintf(ctx->cur, "\"ws\":%u", sub_obj->id);
+	tl_sub->first_seq = tl->head;
+	tl->subscription_count++;
+
+	/* the new subscription needs to learn about all objects again */
+	wl_list_for_each(tl_obj, &tl->objects, link)
+		tl_obj->force_refresh = true;
+
+	/* attach this timeline_subscription to it */
+	weston_log_subscription_set_data(sub, tl_sub);
 
-	return 1;
+	return tl_sub;
 }
 
-static int
-emit_vblank_timestamp(struct timeline_emit_context *ctx, void *obj)
+/** Destroy the timeline subscription
+ *
+ * Called when (before) the subscription is destroyed. What is still in the
+ * ring is written out first, for subscribers that can still take it.
+ *
+ * @return true if there was a timeline subscription
+ *
+ * @ingroup internal-log
+ */
+static bool
+timeline_subscription_destroy(struct weston_timeline *tl,
+			      struct weston_log_subscription *sub)
 {
-	struct timespec *ts = obj;
+	struct weston_timeline_subscription *tl_sub =
+		weston_log_subscription_get_data(sub);
 
-	fprintf(ctx->cur, "\"vblank_monotonic\":[%" PRId64 ", %ld]",
-		(int64_t)ts->tv_sec, ts->tv_nsec);
+	if (!tl_sub)
+		return false;
+
+	timeline_flush(tl);
+	tl->subscription_count--;
+
+	free(tl_sub);
 
-	return 1;
+	return true;
 }
 
-static int
-emit_gpu_timestamp(struct timeline_emit_context *ctx, void *obj)
+static void
+weston_timeline_create_subscription(struct weston_log_subscription *sub,
+				    void *user_data)
 {
-	struct timespec *ts = obj;
+	timeline_subscription_create(user_data, sub);
+}
 
-	fprintf(ctx->cur, "\"gpu\":[%" PRId64 ", %ld]",
-		(int64_t)ts->tv_sec, ts->tv_nsec);
+static void
+weston_timeline_destroy_subscription(struct weston_log_subscription *sub,
+				     void *user_data)
+{
+	timeline_subscription_destroy(user_data, sub);
+}
 
-	return 1;
+static void
+weston_timeline_trace_create_subscription(struct weston_log_subscription *sub,
+					  void *user_data)
+{
+	struct weston_timeline *tl = user_data;
+
+	if (!timeline_subscription_create(tl, sub))
+		return;
+
+	tl->trace_subscription_count++;
+
+	/* The closing bracket is optional in the JSON Array Format, so a
+	 * trace cut short at any point still loads. */
+	weston_log_subscription_printf(sub, "[\n"
+		"{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+		"\"args\":{\"name\":\"outputs\"}},\n"
+		"{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+		"\"args\":{\"name\":\"surfaces\"}},\n"
+		"{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+		"\"args\":{\"name\":\"gpu\"}},\n",
+		TRACE_PID_OUTPUTS, TRACE_PID_SURFACES, TRACE_PID_GPU);
 }
 
-static struct weston_timeline_subscription_object *
-weston_timeline_get_subscription_object(struct weston_log_subscription *sub,
-		void *object)
+static void
+weston_timeline_trace_destroy_subscription(struct weston_log_subscription *sub,
+					   void *user_data)
 {
-	struct weston_timeline_subscription *tl_sub;
+	struct weston_timeline *tl = user_data;
 
-	tl_sub = weston_log_subscription_get_data(sub);
-	if (!tl_sub)
+	if (!timeline_subscription_destroy(tl, sub))
+		return;
+
+	/* Forget flows no one will see the end of */
+	if (--tl->trace_subscription_count == 0) {
+		tl->trace_commits.size = 0;
+		tl->trace_outputs.size = 0;
+	}
+}
+
+/** Create the 'timeline' and 'timeline-trace' log scopes
+ *
+ * @param compositor the compositor whose event loop flushes the timeline
+ * @return the 'timeline' scope, to be destroyed with
+ * weston_timeline_destroy_scope()
+ *
+ * @ingroup internal-log
+ */
+struct weston_log_scope *
+weston_timeline_create_scope(struct weston_compositor *compositor)
+{
+	struct weston_timeline *tl;
+	unsigned int i;
+
+	tl = zalloc(sizeof(*tl));
+	if (!tl)
 		return NULL;
 
-	return weston_timeline_subscription_search(tl_sub, object);
+	tl->compositor = compositor;
+	wl_list_init(&tl->objects);
+	wl_array_init(&tl->trace_commits);
+	wl_array_init(&tl->trace_outputs);
+
+	for (i = 0; i < TLK_COUNT; i++)
+		if (timeline_intern_name(tl, known_points[i]) != (int)i)
+			goto err;
+
+	tl->scope = weston_compositor_add_log_scope(compositor, "timeline",
+						    "Timeline event points\n",
+						    weston_timeline_create_subscription,
+						    weston_timeline_destroy_subscription,
+						    tl);
+	if (!tl->scope)
+		goto err;
+
+	tl->trace_scope =
+		weston_compositor_add_log_scope(compositor, "timeline-trace",
+						"Timeline event points in the "
+						"Chrome Trace Event format, "
+						"for Perfetto\n",
+						weston_timeline_trace_create_subscription,
+						weston_timeline_trace_destroy_subscription,
+						tl);
+
+	return tl->scope;
+
+err:
+	for (i = 0; i < tl->name_count; i++)
+		free(tl->names[i]);
+	free(tl->names);
+	free(tl->name_keys);
+	free(tl);
+	return NULL;
+}
+
+/** Flush and destroy the 'timeline' and 'timeline-trace' log scopes
+ *
+ * @param timeline_scope the scope from weston_timeline_create_scope(), may
+ * be NULL
+ *
+ * @ingroup internal-log
+ */
+void
+weston_timeline_destroy_scope(struct weston_log_scope *timeline_scope)
+{
+	struct weston_timeline *tl;
+	struct weston_timeline_object *tl_obj, *tmp;
+	unsigned int i;
+
+	if (!timeline_scope)
+		return;
+
+	tl = weston_log_scope_get_user_data(timeline_scope);
+	if (tl->ring)
+		timeline_flush(tl);
+
+	weston_log_scope_destroy(tl->trace_scope);
+	weston_log_scope_destroy(timeline_scope);
+	wl_array_release(&tl->trace_commits);
+	wl_array_release(&tl->trace_outputs);
+
+	wl_list_for_each_safe(tl_obj, tmp, &tl->objects, link)
+		weston_timeline_object_destroy(tl_obj);
+
+	for (i = 0; i < tl->name_count; i++)
+		free(tl->names[i]);
+	free(tl->names);
+	free(tl->name_keys);
+
+	if (tl->flush_timer)
+		wl_event_source_remove(tl->flush_timer);
+	free(tl->ring);
+	free(tl);
 }
 
 /** Sets (on) the timeline subscription object refresh status.
@@ -370,32 +1021,27 @@ WL_EXPORT void
 weston_timeline_refresh_subscription_objects(struct weston_compositor *wc,
 					     void *object)
 {
-	struct weston_log_subscription *sub = NULL;
+	struct weston_timeline *tl;
+	struct weston_timeline_object *tl_obj;
 
-	while ((sub = weston_log_subscription_iterate(wc->timeline, sub))) {
-		struct weston_timeline_subscription_object *sub_obj;
+	if (!wc->timeline)
+		return;
 
-		sub_obj = weston_timeline_get_subscription_object(sub, object);
-		if (sub_obj)
-			sub_obj->force_refresh = true;
-	}
+	tl = weston_log_scope_get_user_data(wc->timeline);
+	tl_obj = weston_timeline_object_search(tl, object);
+	if (tl_obj)
+		tl_obj->force_refresh = true;
 }
 
-typedef int (*type_func)(struct timeline_emit_context *ctx, void *obj);
-
-static const type_func type_dispatch[] = {
-	[TLT_OUTPUT] = emit_weston_output,
-	[TLT_SURFACE] = emit_weston_surface,
-	[TLT_VBLANK] = emit_vblank_timestamp,
-	[TLT_GPU] = emit_gpu_timestamp,
-};
-
-/** Disseminates the message to all subscriptions of the scope \c
+/** Records a timeline point for all subscriptions of the scope \c
  * timeline_scope
  *
  * The TL_POINT() is a wrapper over this function, but it  uses the weston_compositor
  * instance to pass the timeline scope.
  *
+ * Nothing is formatted here: the point goes into the timeline ring and is
+ * written out as JSON when the ring is flushed.
+ *
  * @param timeline_scope the timeline scope
  * @param name the name of the timeline point. Interpretable by the tool reading
  * the output (wesgr).
@@ -406,56 +1052,93 @@ WL_EXPORT void
 weston_timeline_point(struct weston_log_scope *timeline_scope,
 		      const char *name, ...)
 {
+	struct weston_timeline *tl;
+	struct weston_timeline_record point = { .type = TLR_POINT };
+	struct weston_timeline_record *rec;
 	struct timespec ts;
 	enum timeline_type otype;
 	void *obj;
-	char buf[512];
-	struct weston_log_subscription *sub = NULL;
+	va_list argp;
+	int name_id;
 
-	if (!weston_log_scope_is_enabled(timeline_scope))
+	if (!timeline_scope)
 		return;
 
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-
-	while ((sub = weston_log_subscription_iterate(timeline_scope, sub))) {
-		va_list argp;
-		struct timeline_emit_context ctx = {};
+	/* subscriptions are only counted once the ring is there */
+	tl = weston_log_scope_get_user_data(timeline_scope);
+	if (tl->subscription_count == 0)
+		return;
 
-		memset(buf, 0, sizeof(buf));
-		ctx.cur = fmemopen(buf, sizeof(buf), "w");
-		ctx.subscription = sub;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	point.ts_ns = timespec_to_nsec(&ts);
 
-		if (!ctx.cur) {
-			weston_log("Timeline error in fmemopen, closing.\n");
-			return;
+	name_id = timeline_intern_name(tl, name);
+	if (name_id < 0) {
+		weston_log("Timeline error interning '%s', dropping.\n", name);
+		return;
+	}
+	point.name = name_id;
+
+	/* Object descriptions are queued ahead of the point using them */
+	va_start(argp, name);
+	while (1) {
+		otype = va_arg(argp, enum timeline_type);
+		if (otype == TLT_END)
+			break;
+
+		obj = va_arg(argp, void *);
+		if (!obj)
+			continue;
+
+		switch (otype) {
+		case TLT_OUTPUT:
+			point.output = timeline_output_id(tl, obj);
+			break;
+		case TLT_SURFACE:
+			point.surface = timeline_surface_id(tl, obj);
+			break;
+		case TLT_VBLANK:
+			point.flags |= TLR_HAS_VBLANK;
+			point.vblank_ns = timespec_to_nsec(obj);
+			break;
+		case TLT_GPU:
+			point.flags |= TLR_HAS_GPU;
+			point.gpu_ns = timespec_to_nsec(obj);
+			break;
+		case TLT_INPUT:
+			point.flags |= TLR_HAS_INPUT;
+			point.input_ns = timespec_to_nsec(obj);
+			break;
+		case TLT_END:
+			break;
 		}
+	}
+	va_end(argp);
 
-		fprintf(ctx.cur, "{ \"T\":[%" PRId64 ", %ld], \"N\":\"%s\"",
-				(int64_t)ts.tv_sec, ts.tv_nsec, name);
-
-		va_start(argp, name);
-		while (1) {
-			otype = va_arg(argp, enum timeline_type);
-			if (otype == TLT_END)
-				break;
+	rec = timeline_reserve(tl);
+	*rec = point;
+	timeline_commit(tl);
+}
 
-			obj = va_arg(argp, void *);
-			if (type_dispatch[otype]) {
-				fprintf(ctx.cur, ", ");
-				type_dispatch[otype](&ctx, obj);
-			}
-		}
-		va_end(argp);
+/** Whether the timeline points go anywhere
+ *
+ * @param timeline_scope the timeline scope
+ *
+ * True while either the 'timeline' or the 'timeline-trace' scope has a
+ * subscriber. For points which cost something to gather before
+ * weston_timeline_point() gets to drop them.
+ *
+ * @ingroup log
+ */
+WL_EXPORT bool
+weston_timeline_is_enabled(struct weston_log_scope *timeline_scope)
+{
+	struct weston_timeline *tl;
 
-		fprintf(ctx.cur, " }\n");
-		fflush(ctx.cur);
-		if (ferror(ctx.cur)) {
-			weston_log("Timeline error in constructing entry, closing.\n");
-		} else {
-			weston_log_subscription_printf(ctx.subscription, "%s", buf);
-		}
+	if (!timeline_scope)
+		return false;
 
-		fclose(ctx.cur);
+	tl = weston_log_scope_get_user_data(timeline_scope);
 
-	}
+	return tl->subscription_count > 0;
 }
@@ -29,6 +29,7 @@
 
 #include <wayland-util.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <libweston/weston-log.h>
 #include <wayland-server-core.h>
@@ -39,6 +40,45 @@ enum timeline_type {
 	TLT_SURFACE,
 	TLT_VBLANK,
 	TLT_GPU,
+	TLT_INPUT,
+};
+
+enum timeline_record_type {
+	TLR_POINT = 0,
+	TLR_OUTPUT_DESC,
+	TLR_SURFACE_DESC,
+};
+
+#define TLR_HAS_VBLANK	(1 << 0)
+#define TLR_HAS_GPU	(1 << 1)
+#define TLR_HAS_INPUT	(1 << 2)
+
+/** One entry of the timeline ring
+ *
+ * Timeline points are recorded in this fixed-size binary form and only
+ * turned into wesgr JSON when the ring is flushed to the subscriptions.
+ * Object descriptions get their own records, so that a point only carries
+ * the object ids.
+ *
+ * For TLR_POINT, \c name indexes the interned point names and \c output
+ * and \c surface are object ids, 0 when not given. For TLR_OUTPUT_DESC and
+ * TLR_SURFACE_DESC, \c output is the described object id, \c surface the
+ * main surface id if any, and \c desc the name or label, owned by the
+ * record.
+ *
+ * @ingroup internal-log
+ */
+struct weston_timeline_record {
+	uint8_t type;			/**< enum timeline_record_type */
+	uint8_t flags;			/**< TLR_HAS_VBLANK, _GPU, _INPUT */
+	uint16_t name;
+	uint32_t output;
+	uint32_t surface;
+	uint64_t ts_ns;
+	uint64_t vblank_ns;
+	uint64_t gpu_ns;
+	uint64_t input_ns;
+	char *desc;
 };
 
 /** Timeline subscription created for each subscription
@@ -49,21 +89,21 @@ enum timeline_type {
  * @ingroup internal-log
  */
 struct weston_timeline_subscription {
-	unsigned int next_id;
-	struct wl_list objects; /**< weston_timeline_subscription_object::subscription_link */
+	uint64_t first_seq;	/**< first ring record meant for it */
 };
 
 /**
- * Created when object is first seen for a particular timeline subscription
- * Destroyed when the subscription got destroyed or object was destroyed
+ * Created when an object is first seen while the timeline is recording,
+ * destroyed with the object or with the timeline scope. Ids are shared by
+ * all subscriptions.
  *
  * @ingroup internal-log
  */
-struct weston_timeline_subscription_object {
+struct weston_timeline_object {
 	void *object;                           /**< points to the object */
 	unsigned int id;
 	bool force_refresh;
-	struct wl_list subscription_link;       /**< weston_timeline_subscription::objects */
+	struct wl_list link;                    /**< weston_timeline::objects */
 	struct wl_listener destroy_listener;
 };
 
@@ -83,6 +123,7 @@ struct weston_timeline_subscription_object {
 #define TLP_SURFACE(s) TLT_SURFACE, TYPEVERIFY(struct weston_surface *, (s))
 #define TLP_VBLANK(t) TLT_VBLANK, TYPEVERIFY(const struct timespec *, (t))
 #define TLP_GPU(t) TLT_GPU, TYPEVERIFY(const struct timespec *, (t))
+#define TLP_INPUT(t) TLT_INPUT, TYPEVERIFY(const struct timespec *, (t))
 
 /** This macro is used to add timeline points.
  *
@@ -96,8 +137,17 @@ struct weston_timeline_subscription_object {
 	weston_timeline_point(ec->timeline, __VA_ARGS__); \
 } while (0)
 
+struct weston_log_scope *
+weston_timeline_create_scope(struct weston_compositor *compositor);
+
+void
+weston_timeline_destroy_scope(struct weston_log_scope *timeline_scope);
+
 void
 weston_timeline_point(struct weston_log_scope *timeline_scope,
 		      const char *name, ...);
 
+bool
+weston_timeline_is_enabled(struct weston_log_scope *timeline_scope);
+
 #endif /* WESTON_TIMELINE_H */
@@ -30,12 +30,17 @@
 #include <libweston/libweston.h>
 
 #include "weston-log-internal.h"
+#include "flight-rec/flight-rec-format.h"
 
 #include <assert.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 
 struct weston_ring_buffer {
@@ -44,6 +49,7 @@ struct weston_ring_buffer {
 	char *buf;		/**< the buffer itself */
 	FILE *file;		/**< where to write in case we need to dump the buf */
 	bool overlap;		/**< in case buff overlaps, hint from where to print buf contents */
+	struct flight_rec_header *header; /**< for a file-backed ring, NULL otherwise */
 };
 
 /** allows easy access to the ring buffer in case of a core dump
@@ -56,6 +62,7 @@ WL_EXPORT struct weston_ring_buffer *weston_primary_flight_recorder_ring_buffer
 struct weston_debug_log_flight_recorder {
 	struct weston_log_subscriber base;
 	struct weston_ring_buffer rb;
+	size_t map_size;
 };
 
 static void
@@ -66,89 +73,38 @@ weston_ring_buffer_init(struct weston_ring_buffer *rb, size_t size, char *buf)
 	rb->buf = buf;
 	rb->overlap = false;
 	rb->file = stderr;
+	rb->header = NULL;
 }
 
-static struct weston_debug_log_flight_recorder *
-to_flight_recorder(struct weston_log_subscriber *sub)
-{
-	return container_of(sub, struct weston_debug_log_flight_recorder, base);
-}
-
-static void
-weston_log_flight_recorder_adjust_end(struct weston_ring_buffer *rb,
-				      size_t bytes_to_advance)
-{
-	if (rb->append_pos == rb->size - bytes_to_advance)
-		rb->append_pos = 0;
-	else
-		rb->append_pos += bytes_to_advance;
-}
-
-static void
-weston_log_flight_recorder_write_chunks(struct weston_ring_buffer *rb,
-					const char *data, size_t len)
-{
-	/* no of chunks that matches our buffer size */
-	size_t nr_chunks = len / rb->size;
-
-	/* bytes left that do not fill entire buffer */
-	size_t bytes_left_last_chunk = len % rb->size;
-	const char *c_data = data;
-
-	/* might overlap multiple times, memcpy is redundant,
-	 * that's why we don't even modify append_pos */
-	while (nr_chunks-- > 0) {
-		memcpy(&rb->buf[rb->append_pos], c_data, rb->size);
-		c_data += rb->size;
-	}
-
-	if (bytes_left_last_chunk)
-		memcpy(&rb->buf[rb->append_pos], c_data, bytes_left_last_chunk);
-
-	/* adjust append_pos */
-	weston_log_flight_recorder_adjust_end(rb, bytes_left_last_chunk);
-}
-
-static void
-weston_log_flight_recorder_write_chunks_overlap(struct weston_ring_buffer *rb,
-					 const char *data, size_t len)
+/** Mirror the ring state into the file header
+ *
+ * The ring bytes are stored before the position that covers them, so a
+ * reader of the file never sees a position past what was copied.
+ */
+static inline void
+weston_ring_buffer_sync_header(struct weston_ring_buffer *rb)
 {
-	size_t transfer_remains =
-		(rb->append_pos + len) - rb->size;
-	size_t transfer_to_end = len - transfer_remains;
-	const char *c_data = data;
-
-	/* transfer what remains until the end of the buffer */
-	memcpy(&rb->buf[rb->append_pos], c_data, transfer_to_end);
-	c_data += transfer_to_end;
-
-	/* reset append_pos as we filled up the buffer */
-	rb->append_pos = 0;
+	if (!rb->header)
+		return;
 
-	/* transfer what remains */
-	weston_log_flight_recorder_write_chunks(rb, c_data, transfer_remains);
-	rb->overlap = true;
+	__atomic_store_n(&rb->header->overlap, rb->overlap, __ATOMIC_RELAXED);
+	__atomic_store_n(&rb->header->append_pos, rb->append_pos,
+			 __ATOMIC_RELEASE);
 }
 
-static void
-weston_log_flight_recorder_write_data(struct weston_ring_buffer *rb,
-				      const char *data, size_t len)
+static struct weston_debug_log_flight_recorder *
+to_flight_recorder(struct weston_log_subscriber *sub)
 {
-	/*
-	 * If append_pos is at the beginning of the buffer, we determine if we
-	 * should do it in chunks, and if there are any bytes left we transfer
-	 * those as well.
-	 *
-	 * If the append_pos is somewhere inside the buffer we determine how
-	 * many bytes we need to transfer between we reach the end and overlap,
-	 * then we proceed as in the first step.
-	 */
-	if (rb->append_pos == 0)
-		weston_log_flight_recorder_write_chunks(rb, data, len);
-	else
-		weston_log_flight_recorder_write_chunks_overlap(rb, data, len);
+	return container_of(sub, struct weston_debug_log_flight_recorder, base);
 }
 
+/** Append data to the ring buffer
+ *
+ * The data is copied straight from the caller's (already formatted)
+ * buffer, in at most two pieces when it wraps around. When there is more
+ * data than the ring can hold only its tail is copied, the rest would be
+ * overwritten anyway.
+ */
 static void
 weston_log_flight_recorder_write(struct weston_log_subscriber *sub,
 				 const char *data, size_t len)
@@ -156,25 +112,25 @@ weston_log_flight_recorder_write(struct weston_log_subscriber *sub,
 	struct weston_debug_log_flight_recorder *flight_rec =
 		to_flight_recorder(sub);
 	struct weston_ring_buffer *rb = &flight_rec->rb;
+	size_t to_end;
+
+	if (len > rb->size) {
+		data += len - rb->size;
+		len = rb->size;
+	}
 
-	/* in case the data is bigger than the size of the buf */
-	if (rb->size < len) {
-		weston_log_flight_recorder_write_data(rb, data, len);
+	to_end = rb->size - rb->append_pos;
+	if (len < to_end) {
+		memcpy(&rb->buf[rb->append_pos], data, len);
+		rb->append_pos += len;
 	} else {
-		/* if we can transfer it without wrapping it do it at once */
-		if (rb->append_pos <= rb->size - len) {
-			memcpy(&rb->buf[rb->append_pos], data, len);
-
-			/*
-			 * adjust append_pos, take care of the situation were
-			 * to fill up the entire buf
-			 */
-			weston_log_flight_recorder_adjust_end(rb, len);
-		} else {
-			weston_log_flight_recorder_write_data(rb, data, len);
-		}
+		memcpy(&rb->buf[rb->append_pos], data, to_end);
+		memcpy(rb->buf, data + to_end, len - to_end);
+		rb->append_pos = len - to_end;
+		rb->overlap = true;
 	}
 
+	weston_ring_buffer_sync_header(rb);
 }
 
 static void
@@ -195,10 +151,7 @@ weston_log_subscriber_display_flight_rec_data(struct weston_ring_buffer *rb,
 		file_d = file;
 
 	if (!rb->overlap) {
-		if (rb->append_pos)
-			fwrite(rb->buf, sizeof(char), rb->append_pos, file_d);
-		else
-			fwrite(rb->buf, sizeof(char), rb->size, file_d);
+		fwrite(rb->buf, sizeof(char), rb->append_pos, file_d);
 	} else {
 		/* from append_pos to size */
 		fwrite(&rb->buf[rb->append_pos], sizeof(char),
@@ -229,10 +182,40 @@ weston_log_subscriber_destroy_flight_rec(struct weston_log_subscriber *sub)
 		weston_primary_flight_recorder_ring_buffer = NULL;
 
 	weston_log_subscriber_release(sub);
-	free(flight_rec->rb.buf);
+	if (flight_rec->rb.header)
+		munmap(flight_rec->rb.header, flight_rec->map_size);
+	else
+		free(flight_rec->rb.buf);
 	free(flight_rec);
 }
 
+static struct weston_debug_log_flight_recorder *
+weston_log_flight_recorder_create(size_t size, char *buf)
+{
+	struct weston_debug_log_flight_recorder *flight_rec;
+
+	assert("Can't create more than one flight recorder." &&
+			!weston_primary_flight_recorder_ring_buffer);
+
+	flight_rec = zalloc(sizeof(*flight_rec));
+	if (!flight_rec)
+		return NULL;
+
+	flight_rec->base.write = weston_log_flight_recorder_write;
+	flight_rec->base.destroy = weston_log_subscriber_destroy_flight_rec;
+	flight_rec->base.destroy_subscription = NULL;
+	flight_rec->base.complete = NULL;
+	wl_list_init(&flight_rec->base.subscription_list);
+
+	weston_ring_buffer_init(&flight_rec->rb, size, buf);
+	weston_primary_flight_recorder_ring_buffer = &flight_rec->rb;
+
+	/* write some data to the rb such that the memory gets mapped */
+	weston_log_flight_recorder_map_memory(flight_rec);
+
+	return flight_rec;
+}
+
 /** Create a flight recorder type of subscriber
  *
  * Allocates both the flight recorder and the underlying ring buffer. Use
@@ -248,30 +231,122 @@ weston_log_subscriber_create_flight_rec(size_t size)
 	struct weston_debug_log_flight_recorder *flight_rec;
 	char *weston_rb;
 
-	assert("Can't create more than one flight recorder." &&
-			!weston_primary_flight_recorder_ring_buffer);
+	weston_rb = zalloc(sizeof(char) * size);
+	if (!weston_rb)
+		return NULL;
 
-	flight_rec = zalloc(sizeof(*flight_rec));
-	if (!flight_rec)
+	flight_rec = weston_log_flight_recorder_create(size, weston_rb);
+	if (!flight_rec) {
+		free(weston_rb);
 		return NULL;
+	}
 
-	flight_rec->base.write = weston_log_flight_recorder_write;
-	flight_rec->base.destroy = weston_log_subscriber_destroy_flight_rec;
-	flight_rec->base.destroy_subscription = NULL;
-	flight_rec->base.complete = NULL;
-	wl_list_init(&flight_rec->base.subscription_list);
+	return &flight_rec->base;
+}
 
-	weston_rb = zalloc(sizeof(char) * size);
-	if (!weston_rb) {
-		free(flight_rec);
+/* Move a previous flight recorder file out of the way, so that the trail
+ * of a crashed compositor survives the next start. Files which do not
+ * start with a flight recorder header are left alone, for the caller to
+ * truncate.
+ */
+static int
+flight_rec_file_rotate(const char *path)
+{
+	struct flight_rec_header header;
+	char *old_path;
+	ssize_t len;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+
+	len = read(fd, &header, sizeof(header));
+	close(fd);
+	if (len != sizeof(header) ||
+	    memcmp(header.magic, FLIGHT_REC_MAGIC, sizeof(header.magic)) != 0)
+		return 0;
+
+	if (asprintf(&old_path, "%s.old", path) < 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	ret = rename(path, old_path);
+	free(old_path);
+
+	return ret;
+}
+
+/** Create a flight recorder type of subscriber, backed by a file
+ *
+ * Same as weston_log_subscriber_create_flight_rec(), but the ring buffer
+ * lives in a shared mapping of \c path, after a struct flight_rec_header
+ * which tracks where the ring ends. Writing stays a plain copy into
+ * memory, and as the page cache owns the data it outlives the compositor
+ * process: after a crash, the file can be decoded with flight-rec-decode.
+ * Surviving a machine reset depends on the kernel having written the
+ * pages back by then.
+ *
+ * If \c path already holds a flight recorder, most likely the trail of
+ * the previous run, it is renamed to \c path with ".old" appended rather
+ * than overwritten. Anything else at \c path is truncated.
+ *
+ * @param path the file to create
+ * @param size specify the maximum size (in bytes) of the backing storage
+ * for the flight recorder
+ * @returns a weston_log_subscriber object or NULL in case of failure, with
+ * errno set
+ */
+WL_EXPORT struct weston_log_subscriber *
+weston_log_subscriber_create_flight_rec_file(const char *path, size_t size)
+{
+	struct weston_debug_log_flight_recorder *flight_rec;
+	struct flight_rec_header *header;
+	size_t header_size = sizeof(*header);
+	size_t map_size = header_size + size;
+	void *map;
+	int fd;
+
+	if (size < 2 || size > UINT32_MAX) {
+		errno = EINVAL;
 		return NULL;
 	}
 
-	weston_ring_buffer_init(&flight_rec->rb, size, weston_rb);
-	weston_primary_flight_recorder_ring_buffer = &flight_rec->rb;
+	if (flight_rec_file_rotate(path) < 0)
+		return NULL;
 
-	/* write some data to the rb such that the memory gets mapped */
-	weston_log_flight_recorder_map_memory(flight_rec);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, map_size) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	header = map;
+	flight_rec = weston_log_flight_recorder_create(size,
+						       (char *) map + header_size);
+	if (!flight_rec) {
+		munmap(map, map_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	memcpy(header->magic, FLIGHT_REC_MAGIC, sizeof(header->magic));
+	header->version = FLIGHT_REC_VERSION;
+	header->header_size = header_size;
+	header->size = flight_rec->rb.size;
+	header->pid = getpid();
+
+	flight_rec->rb.header = header;
+	flight_rec->map_size = map_size;
 
 	return &flight_rec->base;
 }
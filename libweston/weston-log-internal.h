@@ -107,11 +107,10 @@ void
 weston_log_subscription_set_data(struct weston_log_subscription *sub, void *data);
 
 void
-weston_timeline_create_subscription(struct weston_log_subscription *sub,
-				    void *user_data);
+weston_log_subscription_write(struct weston_log_subscription *sub,
+			      const char *data, size_t len);
 
-void
-weston_timeline_destroy_subscription(struct weston_log_subscription *sub,
-				     void *user_data);
+void *
+weston_log_scope_get_user_data(struct weston_log_scope *scope);
 
 #endif /* WESTON_LOG_INTERNAL_H */
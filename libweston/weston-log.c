@@ -69,6 +69,11 @@ struct weston_log_context {
 	struct wl_listener compositor_destroy_listener;
 	struct wl_list scope_list; /**< weston_log_scope::compositor_link */
 	struct wl_list pending_subscription_list; /**< weston_log_subscription::source_link */
+
+	/* shared by all scopes to format messages, grown as needed */
+	char *fmt_buf;
+	size_t fmt_size;
+	bool fmt_busy;
 };
 
 /** weston-log message scope
@@ -85,6 +90,7 @@ struct weston_log_scope {
 	weston_log_scope_cb new_subscription;
 	weston_log_scope_cb destroy_subscription;
 	void *user_data;
+	struct weston_log_context *log_ctx;
 	struct wl_list compositor_link;
 	struct wl_list subscription_list;  /**< weston_log_subscription::source_link */
 };
@@ -179,7 +185,7 @@ weston_log_subscription_destroy_pending(struct weston_log_subscription *sub)
  *
  * @memberof weston_log_subscription
  */
-static void
+void
 weston_log_subscription_write(struct weston_log_subscription *sub,
 			      const char *data, size_t len)
 {
@@ -187,6 +193,67 @@ weston_log_subscription_write(struct weston_log_subscription *sub,
 		sub->owner->write(sub->owner, data, len);
 }
 
+/** Format a message for a scope
+ *
+ * The message is formatted into the log context's buffer, which is only
+ * grown when a message does not fit, so that logging does not allocate
+ * once the buffer has reached its working size. A subscriber logging
+ * from its write callback would find the buffer still in use; such
+ * nested messages, and those of scopes that outlived their context, get
+ * a heap string instead.
+ *
+ * \param len Set to the length of the formatted message.
+ * \return The message, to be handed back to weston_log_scope_format_done(),
+ * or NULL on failure.
+ */
+static char *
+weston_log_scope_vformat(struct weston_log_scope *scope, int *len,
+			 const char *fmt, va_list ap)
+{
+	struct weston_log_context *log_ctx = scope->log_ctx;
+	va_list aq;
+	char *str;
+	size_t size;
+	int n;
+
+	if (!log_ctx || log_ctx->fmt_busy) {
+		*len = vasprintf(&str, fmt, ap);
+		return *len < 0 ? NULL : str;
+	}
+
+	va_copy(aq, ap);
+	n = vsnprintf(log_ctx->fmt_buf, log_ctx->fmt_size, fmt, aq);
+	va_end(aq);
+	if (n < 0)
+		return NULL;
+
+	if ((size_t)n >= log_ctx->fmt_size) {
+		size = MAX((size_t)n + 1, 2 * log_ctx->fmt_size);
+		str = realloc(log_ctx->fmt_buf, size);
+		if (!str)
+			return NULL;
+		log_ctx->fmt_buf = str;
+		log_ctx->fmt_size = size;
+		vsnprintf(log_ctx->fmt_buf, log_ctx->fmt_size, fmt, ap);
+	}
+
+	log_ctx->fmt_busy = true;
+	*len = n;
+
+	return log_ctx->fmt_buf;
+}
+
+static void
+weston_log_scope_format_done(struct weston_log_scope *scope, char *str)
+{
+	struct weston_log_context *log_ctx = scope->log_ctx;
+
+	if (log_ctx && str == log_ctx->fmt_buf)
+		log_ctx->fmt_busy = false;
+	else
+		free(str);
+}
+
 /** Write a formatted string to the stream's subscription
  *
  * @memberof weston_log_subscription
@@ -202,10 +269,10 @@ weston_log_subscription_vprintf(struct weston_log_subscription *sub,
 	if (!weston_log_scope_is_enabled(sub->source))
 		return;
 
-	len = vasprintf(&str, fmt, ap);
-	if (len >= 0) {
+	str = weston_log_scope_vformat(sub->source, &len, fmt, ap);
+	if (str) {
 		weston_log_subscription_write(sub, str, len);
-		free(str);
+		weston_log_scope_format_done(sub->source, str);
 	} else {
 		weston_log_subscription_write(sub, oom, sizeof oom - 1);
 	}
@@ -225,6 +292,12 @@ weston_log_subscription_get_data(struct weston_log_subscription *sub)
 	return sub->data;
 }
 
+void *
+weston_log_scope_get_user_data(struct weston_log_scope *scope)
+{
+	return scope->user_data;
+}
+
 /** Creates a new subscription using the subscriber by \c owner.
  *
  * The subscription created is added to the \c owner subscription list.
@@ -438,9 +511,11 @@ weston_log_ctx_destroy(struct weston_log_context *log_ctx)
 
 	weston_log_ctx_disable_debug_protocol(log_ctx);
 
-	wl_list_for_each(scope, &log_ctx->scope_list, compositor_link)
+	wl_list_for_each(scope, &log_ctx->scope_list, compositor_link) {
 		fprintf(stderr, "Internal warning: debug scope '%s' has not been destroyed.\n",
 			   scope->name);
+		scope->log_ctx = NULL;
+	}
 
 	/* Remove head to not crash if scope removed later. */
 	wl_list_remove(&log_ctx->scope_list);
@@ -453,6 +528,7 @@ weston_log_ctx_destroy(struct weston_log_context *log_ctx)
 
 	/* pending_subscription_list should be empty at this point */
 
+	free(log_ctx->fmt_buf);
 	free(log_ctx);
 }
 
@@ -611,6 +687,7 @@ weston_log_ctx_add_log_scope(struct weston_log_context *log_ctx,
 	scope->new_subscription = new_subscription;
 	scope->destroy_subscription = destroy_subscription;
 	scope->user_data = user_data;
+	scope->log_ctx = log_ctx;
 	wl_list_init(&scope->subscription_list);
 
 	if (!scope->name || !scope->desc) {
@@ -813,11 +890,12 @@ weston_log_scope_vprintf(struct weston_log_scope *scope,
 	if (!weston_log_scope_is_enabled(scope))
 		return len;
 
-	len = vasprintf(&str, fmt, ap);
-	if (len >= 0) {
+	str = weston_log_scope_vformat(scope, &len, fmt, ap);
+	if (str) {
 		weston_log_scope_write(scope, str, len);
-		free(str);
+		weston_log_scope_format_done(scope, str);
 	} else {
+		len = -1;
 		weston_log_scope_write(scope, oom, sizeof oom - 1);
 	}
 
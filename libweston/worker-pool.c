@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A fork-join pool of worker threads.
+ *
+ * weston_worker_pool_run() hands out the jobs of a batch to the workers and
+ * to the calling thread, and returns once all of them ran. Nothing runs
+ * in between batches, so the caller knows that whatever the jobs read
+ * stays untouched while they run as long as it does not change it itself.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <libweston/zalloc.h>
+#include "worker-pool.h"
+
+struct weston_worker_pool {
+	/* one batch at a time */
+	pthread_mutex_t run_lock;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	pthread_t *threads;
+	unsigned int n_threads;
+	bool quit;
+
+	/* the batch being run, under lock */
+	uint64_t batch;
+	weston_worker_func_t func;
+	void *data;
+	unsigned int count;
+	unsigned int next;
+	unsigned int done;
+};
+
+/* Runs jobs of the current batch until none are left, with lock held */
+static void
+worker_pool_run_jobs(struct weston_worker_pool *pool)
+{
+	weston_worker_func_t func = pool->func;
+	void *data = pool->data;
+	unsigned int index;
+
+	while (pool->next < pool->count) {
+		index = pool->next++;
+
+		pthread_mutex_unlock(&pool->lock);
+		func(data, index);
+		pthread_mutex_lock(&pool->lock);
+
+		if (++pool->done == pool->count)
+			pthread_cond_signal(&pool->done_cond);
+	}
+}
+
+static void *
+worker_pool_thread(void *data)
+{
+	struct weston_worker_pool *pool = data;
+	uint64_t seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && pool->batch == seen)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->quit)
+			break;
+
+		seen = pool->batch;
+		worker_pool_run_jobs(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/** Start a worker pool
+ *
+ * \param threads The number of threads to start, besides the caller's own.
+ * \return The pool, or NULL on failure. If only some of the threads could
+ * be started, the pool works with those.
+ */
+struct weston_worker_pool *
+weston_worker_pool_create(unsigned int threads)
+{
+	struct weston_worker_pool *pool;
+	unsigned int i;
+
+	pool = zalloc(sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	if (threads > 0) {
+		pool->threads = calloc(threads, sizeof *pool->threads);
+		if (!pool->threads) {
+			free(pool);
+			return NULL;
+		}
+	}
+
+	pthread_mutex_init(&pool->run_lock, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   worker_pool_thread, pool) != 0)
+			break;
+	}
+	pool->n_threads = i;
+
+	return pool;
+}
+
+void
+weston_worker_pool_destroy(struct weston_worker_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->run_lock);
+	free(pool->threads);
+	free(pool);
+}
+
+/** The number of threads running jobs, the caller's included */
+unsigned int
+weston_worker_pool_get_size(struct weston_worker_pool *pool)
+{
+	return pool->n_threads + 1;
+}
+
+/** Run a batch of jobs and wait for all of them
+ *
+ * Calls \c func once for every index from 0 to \c count - 1, in no
+ * particular order and from any of the pool threads or the calling one.
+ * The jobs of a batch must not depend on each other.
+ *
+ * Several threads may run batches on the same pool, the batches then run
+ * one after the other.
+ */
+void
+weston_worker_pool_run(struct weston_worker_pool *pool, unsigned int count,
+		       weston_worker_func_t func, void *data)
+{
+	unsigned int i;
+
+	if (count == 0)
+		return;
+
+	/* Not worth waking anyone up */
+	if (count == 1 || pool->n_threads == 0) {
+		for (i = 0; i < count; i++)
+			func(data, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->run_lock);
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->data = data;
+	pool->count = count;
+	pool->next = 0;
+	pool->done = 0;
+	pool->batch++;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	worker_pool_run_jobs(pool);
+
+	while (pool->done < pool->count)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->run_lock);
+}
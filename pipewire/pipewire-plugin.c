@@ -26,6 +26,7 @@
 #include "pipewire-plugin.h"
 #include "backend.h"
 #include "libweston-internal.h"
+#include "capture-sink.h"
 #include "shared/timespec-util.h"
 #include <libweston/backend-drm.h>
 #include <libweston/weston-log.h>
@@ -85,19 +86,8 @@ struct pipewire_output {
 
 	struct spa_video_info_raw video_format;
 
-	struct wl_event_source *finish_frame_timer;
+	struct weston_capture_sink *sink;
 	struct wl_list link;
-	bool submitted_frame;
-	enum dpms_enum dpms;
-};
-
-struct pipewire_frame_data {
-	struct pipewire_output *output;
-	int fd;
-	int stride;
-	struct drm_fb *drm_buffer;
-	int fence_sync_fd;
-	struct wl_event_source *fence_sync_event_source;
 };
 
 static inline void init_type(struct type *type, struct spa_type_map *map)
@@ -178,13 +168,11 @@ lookup_pipewire_output(struct weston_output *base_output)
 	return NULL;
 }
 
-static void
-pipewire_output_handle_frame(struct pipewire_output *output, int fd,
-			     int stride, struct drm_fb *drm_buffer)
+static int
+pipewire_output_frame_ready(struct weston_capture_frame *frame, void *data)
 {
-	const struct weston_drm_virtual_output_api *api =
-		output->pipewire->virtual_output_api;
-	size_t size = output->output->height * stride;
+	struct pipewire_output *output = data;
+	size_t size = frame->height * frame->stride;
 	struct pw_type *t = output->pipewire->t;
 	struct pw_buffer *buffer;
 	struct spa_buffer *spa_buffer;
@@ -193,12 +181,12 @@ pipewire_output_handle_frame(struct pipewire_output *output, int fd,
 
 	if (pw_stream_get_state(output->stream, NULL) !=
 	    PW_STREAM_STATE_STREAMING)
-		goto out;
+		return -1;
 
 	buffer = pw_stream_dequeue_buffer(output->stream);
 	if (!buffer) {
 		weston_log("Failed to dequeue a pipewire buffer\n");
-		goto out;
+		return -1;
 	}
 
 	spa_buffer = buffer->buffer;
@@ -210,121 +198,37 @@ pipewire_output_handle_frame(struct pipewire_output *output, int fd,
 		h->dts_offset = 0;
 	}
 
-	ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, frame->fd, 0);
 	memcpy(spa_buffer->datas[0].data, ptr, size);
 	munmap(ptr, size);
 
 	spa_buffer->datas[0].chunk->offset = 0;
-	spa_buffer->datas[0].chunk->stride = stride;
+	spa_buffer->datas[0].chunk->stride = frame->stride;
 	spa_buffer->datas[0].chunk->size = spa_buffer->datas[0].maxsize;
 
 	pipewire_output_debug(output, "push frame");
 	pw_stream_queue_buffer(output->stream, buffer);
 
-out:
-	close(fd);
-	output->submitted_frame = true;
-	api->buffer_released(drm_buffer);
-}
-
-static int
-pipewire_output_fence_sync_handler(int fd, uint32_t mask, void *data)
-{
-	struct pipewire_frame_data *frame_data = data;
-	struct pipewire_output *output = frame_data->output;
-
-	pipewire_output_handle_frame(output, frame_data->fd, frame_data->stride,
-				     frame_data->drm_buffer);
-
-	wl_event_source_remove(frame_data->fence_sync_event_source);
-	close(frame_data->fence_sync_fd);
-	free(frame_data);
+	weston_capture_frame_release(frame);
 
 	return 0;
 }
 
+static const struct weston_capture_sink_interface pipewire_sink_impl = {
+	pipewire_output_frame_ready,
+};
+
 static int
 pipewire_output_submit_frame(struct weston_output *base_output, int fd,
 			     int stride, void *buffer)
 {
 	struct pipewire_output *output = lookup_pipewire_output(base_output);
-	struct weston_pipewire *pipewire = output->pipewire;
-	struct drm_fb *drm_buffer = buffer;
-	const struct weston_drm_virtual_output_api *api =
-		pipewire->virtual_output_api;
-	struct wl_event_loop *loop;
-	struct pipewire_frame_data *frame_data;
-	int fence_sync_fd;
 
 	pipewire_output_debug(output, "submit frame: fd = %d drm_fb = %p",
-			      fd, drm_buffer);
-
-	fence_sync_fd = api->get_fence_sync_fd(output->output);
-	if (fence_sync_fd == -1) {
-		pipewire_output_handle_frame(output, fd, stride, drm_buffer);
-		return 0;
-	}
-
-	frame_data = zalloc(sizeof *frame_data);
-	if (!frame_data) {
-		close(fence_sync_fd);
-		pipewire_output_handle_frame(output, fd, stride, drm_buffer);
-		return 0;
-	}
-
-	loop = wl_display_get_event_loop(pipewire->compositor->wl_display);
-
-	frame_data->output = output;
-	frame_data->fd = fd;
-	frame_data->stride = stride;
-	frame_data->drm_buffer = drm_buffer;
-	frame_data->fence_sync_fd = fence_sync_fd;
-	frame_data->fence_sync_event_source =
-		wl_event_loop_add_fd(loop, frame_data->fence_sync_fd,
-				     WL_EVENT_READABLE,
-				     pipewire_output_fence_sync_handler,
-				     frame_data);
+			      fd, buffer);
 
-	return 0;
-}
-
-static void
-pipewire_output_timer_update(struct pipewire_output *output)
-{
-	int64_t msec;
-	int32_t refresh;
-
-	if (pw_stream_get_state(output->stream, NULL) ==
-	    PW_STREAM_STATE_STREAMING)
-		refresh = output->output->current_mode->refresh;
-	else
-		refresh = 1000;
-
-	msec = millihz_to_nsec(refresh) / 1000000;
-	wl_event_source_timer_update(output->finish_frame_timer, msec);
-}
-
-static int
-pipewire_output_finish_frame_handler(void *data)
-{
-	struct pipewire_output *output = data;
-	const struct weston_drm_virtual_output_api *api
-		= output->pipewire->virtual_output_api;
-	struct timespec now;
-
-	if (output->submitted_frame) {
-		struct weston_compositor *c = output->pipewire->compositor;
-		output->submitted_frame = false;
-		weston_compositor_read_presentation_clock(c, &now);
-		api->finish_frame(output->output, &now, 0);
-	}
-
-	if (output->dpms == WESTON_DPMS_ON)
-		pipewire_output_timer_update(output);
-	else
-		wl_event_source_timer_update(output->finish_frame_timer, 0);
-
-	return 0;
+	return weston_capture_sink_submit_frame(output->sink, fd, stride,
+						buffer);
 }
 
 static void
@@ -356,7 +260,7 @@ pipewire_output_start_repaint_loop(struct weston_output *base_output)
 	pipewire_output_debug(output, "start repaint loop");
 	output->saved_start_repaint_loop(base_output);
 
-	pipewire_output_timer_update(output);
+	weston_capture_sink_start_repaint_loop(output->sink);
 
 	return 0;
 }
@@ -366,11 +270,7 @@ pipewire_set_dpms(struct weston_output *base_output, enum dpms_enum level)
 {
 	struct pipewire_output *output = lookup_pipewire_output(base_output);
 
-	if (output->dpms == level)
-		return;
-
-	output->dpms = level;
-	pipewire_output_finish_frame_handler(output);
+	weston_capture_sink_set_dpms(output->sink, level);
 }
 
 static int
@@ -420,34 +320,38 @@ static int
 pipewire_output_enable(struct weston_output *base_output)
 {
 	struct pipewire_output *output = lookup_pipewire_output(base_output);
-	struct weston_compositor *c = base_output->compositor;
 	const struct weston_drm_virtual_output_api *api
 		= output->pipewire->virtual_output_api;
-	struct wl_event_loop *loop;
 	int ret;
 
 	api->set_submit_frame_cb(base_output, pipewire_output_submit_frame);
 
+	output->sink = weston_capture_sink_create(base_output, api,
+						  &pipewire_sink_impl, output);
+	if (!output->sink)
+		return -1;
+
+	/* Pace slowly until a consumer starts streaming */
+	weston_capture_sink_set_idle(output->sink, true);
+
 	ret = pipewire_output_connect(output);
 	if (ret < 0)
-		return ret;
+		goto err_sink;
 
 	ret = output->saved_enable(base_output);
 	if (ret < 0)
-		return ret;
+		goto err_sink;
 
 	output->saved_start_repaint_loop = base_output->start_repaint_loop;
 	base_output->start_repaint_loop = pipewire_output_start_repaint_loop;
 	base_output->set_dpms = pipewire_set_dpms;
 
-	loop = wl_display_get_event_loop(c->wl_display);
-	output->finish_frame_timer =
-		wl_event_loop_add_timer(loop,
-					pipewire_output_finish_frame_handler,
-					output);
-	output->dpms = WESTON_DPMS_ON;
-
 	return 0;
+
+err_sink:
+	weston_capture_sink_destroy(output->sink);
+	output->sink = NULL;
+	return ret;
 }
 
 static int
@@ -455,7 +359,8 @@ pipewire_output_disable(struct weston_output *base_output)
 {
 	struct pipewire_output *output = lookup_pipewire_output(base_output);
 
-	wl_event_source_remove(output->finish_frame_timer);
+	weston_capture_sink_destroy(output->sink);
+	output->sink = NULL;
 
 	pw_stream_disconnect(output->stream);
 
@@ -473,6 +378,10 @@ pipewire_output_stream_state_changed(void *data, enum pw_stream_state old,
 			      pw_stream_state_as_string(old),
 			      pw_stream_state_as_string(state));
 
+	if (output->sink)
+		weston_capture_sink_set_idle(output->sink,
+					     state != PW_STREAM_STATE_STREAMING);
+
 	switch (state) {
 	case PW_STREAM_STATE_STREAMING:
 		weston_output_schedule_repaint(output->output);
@@ -36,6 +36,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <gst/gst.h>
 #include <gst/allocators/gstdmabuf.h>
@@ -50,6 +51,7 @@
 #include "shared/timespec-util.h"
 #include "backend.h"
 #include "libweston-internal.h"
+#include "capture-sink.h"
 
 #define MAX_RETRY_COUNT	3
 
@@ -108,11 +110,8 @@ struct remoted_output {
 	struct weston_head *head;
 
 	struct weston_remoting *remoting;
-	struct wl_event_source *finish_frame_timer;
+	struct weston_capture_sink *sink;
 	struct wl_list link;
-	bool submitted_frame;
-	int fence_sync_fd;
-	struct wl_event_source *fence_sync_event_source;
 
 	GstElement *pipeline;
 	GstAppSrc *appsrc;
@@ -120,17 +119,6 @@ struct remoted_output {
 	struct remoted_gstpipe gstpipe;
 	GstClockTime start_time;
 	int retry_count;
-	enum dpms_enum dpms;
-};
-
-struct mem_free_cb_data {
-	struct remoted_output *output;
-	void *output_buffer;
-};
-
-struct gst_frame_buffer_data {
-	struct remoted_output *output;
-	GstBuffer *buffer;
 };
 
 /* message type for pipe */
@@ -356,15 +344,6 @@ remoting_gst_bus_message_handler(struct remoted_output *output)
 	}
 }
 
-static void
-remoting_output_buffer_release(struct remoted_output *output, void *buffer)
-{
-	const struct weston_drm_virtual_output_api *api
-		= output->remoting->virtual_output_api;
-
-	api->buffer_released(buffer);
-}
-
 static int
 remoting_gstpipe_handler(int fd, uint32_t mask, void *data)
 {
@@ -386,7 +365,7 @@ remoting_gstpipe_handler(int fd, uint32_t mask, void *data)
 		remoting_gst_bus_message_handler(output);
 		break;
 	case GSTPIPE_MSG_BUFFER_RELEASE:
-		remoting_output_buffer_release(output, msg.data);
+		weston_capture_frame_release(msg.data);
 		break;
 	default:
 		weston_log("Received unknown message! msg=%d\n", msg.type);
@@ -420,6 +399,23 @@ remoting_gstpipe_init(struct weston_compositor *c,
 	return 0;
 }
 
+/* Handle the messages gstreamer has already sent, so no frame release is
+ * left in the pipe when the capture sink goes away. */
+static void
+remoting_gstpipe_flush(struct remoted_output *output)
+{
+	struct pollfd pfd = {
+		.fd = output->gstpipe.readfd,
+		.events = POLLIN,
+	};
+
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+		if (!remoting_gstpipe_handler(pfd.fd, WL_EVENT_READABLE,
+					      output))
+			break;
+	}
+}
+
 static void
 remoting_gstpipe_release(struct remoted_gstpipe *pipe)
 {
@@ -463,39 +459,15 @@ weston_remoting_get(struct weston_compositor *compositor)
 	return remoting;
 }
 
-static int
-remoting_output_finish_frame_handler(void *data)
-{
-	struct remoted_output *output = data;
-	const struct weston_drm_virtual_output_api *api
-		= output->remoting->virtual_output_api;
-	struct timespec now;
-	int64_t msec;
-
-	if (output->submitted_frame) {
-		struct weston_compositor *c = output->remoting->compositor;
-		output->submitted_frame = false;
-		weston_compositor_read_presentation_clock(c, &now);
-		api->finish_frame(output->output, &now, 0);
-	}
-
-	if (output->dpms == WESTON_DPMS_ON) {
-		msec = millihz_to_nsec(output->output->current_mode->refresh) / 1000000;
-		wl_event_source_timer_update(output->finish_frame_timer, msec);
-	} else {
-		wl_event_source_timer_update(output->finish_frame_timer, 0);
-	}
-	return 0;
-}
-
 static void
-remoting_gst_mem_free_cb(struct mem_free_cb_data *cb_data, GstMiniObject *obj)
+remoting_gst_mem_free_cb(struct weston_capture_frame *frame,
+			 GstMiniObject *obj)
 {
-	struct remoted_output *output = cb_data->output;
+	struct remoted_output *output = frame->user_data;
 	struct remoted_gstpipe *pipe = &output->gstpipe;
 	struct gstpipe_msg_data msg = {
 		.type = GSTPIPE_MSG_BUFFER_RELEASE,
-		.data = cb_data->output_buffer
+		.data = frame
 	};
 	ssize_t ret;
 
@@ -503,7 +475,6 @@ remoting_gst_mem_free_cb(struct mem_free_cb_data *cb_data, GstMiniObject *obj)
 	if (ret != sizeof(msg))
 		weston_log("ERROR: failed to write, ret=%zd, errno=%d\n", ret,
 			   errno);
-	free(cb_data);
 }
 
 static struct remoted_output *
@@ -543,91 +514,62 @@ remoting_output_gst_push_buffer(struct remoted_output *output,
 	GST_BUFFER_DURATION(buffer) = GST_CLOCK_TIME_NONE;
 
 	gst_app_src_push_buffer(output->appsrc, buffer);
-	output->submitted_frame = true;
 }
 
 static int
-remoting_output_fence_sync_handler(int fd, uint32_t mask, void *data)
-{
-	struct gst_frame_buffer_data *frame_data = data;
-	struct remoted_output *output = frame_data->output;
-
-	remoting_output_gst_push_buffer(output, frame_data->buffer);
-
-	wl_event_source_remove(output->fence_sync_event_source);
-	close(output->fence_sync_fd);
-	free(frame_data);
-
-	return 0;
-}
-
-static int
-remoting_output_frame(struct weston_output *output_base, int fd, int stride,
-		      void *output_buffer)
+remoting_output_frame_ready(struct weston_capture_frame *frame, void *data)
 {
-	struct remoted_output *output = lookup_remoted_output(output_base);
+	struct remoted_output *output = data;
 	struct weston_remoting *remoting = output->remoting;
-	struct weston_mode *mode;
-	const struct weston_drm_virtual_output_api *api
-		= output->remoting->virtual_output_api;
-	struct wl_event_loop *loop;
 	GstBuffer *buf;
 	GstMemory *mem;
 	gsize offset = 0;
-	struct mem_free_cb_data *cb_data;
-	struct gst_frame_buffer_data *frame_data;
+	int stride = frame->stride;
 
-	if (!output)
-		return -1;
-
-	cb_data = zalloc(sizeof *cb_data);
-	if (!cb_data)
+	if (!output->pipeline)
 		return -1;
 
-	mode = output->output->current_mode;
+	/* The allocator owns the fd from here on; the frame itself is
+	 * released once gstreamer lets go of the memory. */
 	buf = gst_buffer_new();
-	mem = gst_dmabuf_allocator_alloc(remoting->allocator, fd,
-					 stride * mode->height);
+	mem = gst_dmabuf_allocator_alloc(remoting->allocator,
+					 weston_capture_frame_take_fd(frame),
+					 stride * frame->height);
 	gst_buffer_append_memory(buf, mem);
 	gst_buffer_add_video_meta_full(buf,
 				       GST_VIDEO_FRAME_FLAG_NONE,
 				       output->format->gst_video_format,
-				       mode->width,
-				       mode->height,
+				       frame->width,
+				       frame->height,
 				       1,
 				       &offset,
 				       &stride);
 
-	cb_data->output = output;
-	cb_data->output_buffer = output_buffer;
+	frame->user_data = output;
 	gst_mini_object_weak_ref(GST_MINI_OBJECT(mem),
 				 (GstMiniObjectNotify)remoting_gst_mem_free_cb,
-				 cb_data);
+				 frame);
 
-	output->fence_sync_fd = api->get_fence_sync_fd(output->output);
-	/* Push buffer to gstreamer immediately on get_fence_sync_fd failure */
-	if (output->fence_sync_fd == -1) {
-		remoting_output_gst_push_buffer(output, buf);
-		return 0;
-	}
+	remoting_output_gst_push_buffer(output, buf);
 
-	frame_data = zalloc(sizeof *frame_data);
-	if (!frame_data) {
-		close(output->fence_sync_fd);
-		remoting_output_gst_push_buffer(output, buf);
-		return 0;
-	}
+	return 0;
+}
 
-	frame_data->output = output;
-	frame_data->buffer = buf;
-	loop = wl_display_get_event_loop(remoting->compositor->wl_display);
-	output->fence_sync_event_source =
-		wl_event_loop_add_fd(loop, output->fence_sync_fd,
-				     WL_EVENT_READABLE,
-				     remoting_output_fence_sync_handler,
-				     frame_data);
+static const struct weston_capture_sink_interface remoting_sink_impl = {
+	remoting_output_frame_ready,
+};
 
-	return 0;
+static int
+remoting_output_frame(struct weston_output *output_base, int fd, int stride,
+		      void *output_buffer)
+{
+	struct remoted_output *output = lookup_remoted_output(output_base);
+
+	if (!output)
+		return -1;
+
+	return weston_capture_sink_submit_frame(output->sink, fd, stride,
+						output_buffer);
 }
 
 static void
@@ -661,13 +603,10 @@ static int
 remoting_output_start_repaint_loop(struct weston_output *output)
 {
 	struct remoted_output *remoted_output = lookup_remoted_output(output);
-	int64_t msec;
 
 	remoted_output->saved_start_repaint_loop(output);
 
-	msec = millihz_to_nsec(remoted_output->output->current_mode->refresh)
-			/ 1000000;
-	wl_event_source_timer_update(remoted_output->finish_frame_timer, msec);
+	weston_capture_sink_start_repaint_loop(remoted_output->sink);
 
 	return 0;
 }
@@ -677,28 +616,28 @@ remoting_output_set_dpms(struct weston_output *base_output, enum dpms_enum level
 {
 	struct remoted_output *output = lookup_remoted_output(base_output);
 
-	if (output->dpms == level)
-		return;
-
-	output->dpms = level;
-	remoting_output_finish_frame_handler(output);
+	weston_capture_sink_set_dpms(output->sink, level);
 }
 
 static int
 remoting_output_enable(struct weston_output *output)
 {
 	struct remoted_output *remoted_output = lookup_remoted_output(output);
-	struct weston_compositor *c = output->compositor;
 	const struct weston_drm_virtual_output_api *api
 		= remoted_output->remoting->virtual_output_api;
-	struct wl_event_loop *loop;
 	int ret;
 
 	api->set_submit_frame_cb(output, remoting_output_frame);
 
+	remoted_output->sink = weston_capture_sink_create(output, api,
+							  &remoting_sink_impl,
+							  remoted_output);
+	if (!remoted_output->sink)
+		return -1;
+
 	ret = remoted_output->saved_enable(output);
 	if (ret < 0)
-		return ret;
+		goto err_sink;
 
 	remoted_output->saved_start_repaint_loop = output->start_repaint_loop;
 	output->start_repaint_loop = remoting_output_start_repaint_loop;
@@ -707,27 +646,31 @@ remoting_output_enable(struct weston_output *output)
 	ret = remoting_gst_pipeline_init(remoted_output);
 	if (ret < 0) {
 		remoted_output->saved_disable(output);
-		return ret;
+		goto err_sink;
 	}
 
-	loop = wl_display_get_event_loop(c->wl_display);
-	remoted_output->finish_frame_timer =
-		wl_event_loop_add_timer(loop,
-					remoting_output_finish_frame_handler,
-					remoted_output);
-
-	remoted_output->dpms = WESTON_DPMS_ON;
 	return 0;
+
+err_sink:
+	weston_capture_sink_destroy(remoted_output->sink);
+	remoted_output->sink = NULL;
+	return ret;
 }
 
 static int
 remoting_output_disable(struct weston_output *output)
 {
 	struct remoted_output *remoted_output = lookup_remoted_output(output);
+	struct weston_capture_sink *sink = remoted_output->sink;
 
-	wl_event_source_remove(remoted_output->finish_frame_timer);
 	remoting_gst_pipeline_deinit(remoted_output);
 
+	remoted_output->sink = NULL;
+	if (sink) {
+		remoting_gstpipe_flush(remoted_output);
+		weston_capture_sink_destroy(sink);
+	}
+
 	return remoted_output->saved_disable(output);
 }
 
@@ -26,6 +26,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,26 +41,291 @@
 
 #include <wayland-util.h>
 #include <libweston/config-parser.h>
+#include <libweston/zalloc.h>
 #include "helpers.h"
 #include "string-helpers.h"
 
 struct weston_config_entry {
 	char *key;
 	char *value;
+	struct weston_config_section *section;
 	struct wl_list link;
 };
 
 struct weston_config_section {
 	char *name;
+	uint32_t id;
+	struct weston_config *config;
 	struct wl_list entry_list;
 	struct wl_list link;
 };
 
+/*
+ * Open-addressing hash tables, built once the whole file is parsed so that
+ * lookups do not scan every section. Like the list scans they replace,
+ * they keep the first of duplicate sections or keys. Without an index,
+ * e.g. when allocating it failed, lookups fall back to the lists.
+ */
+struct config_index_slot {
+	uint32_t hash;
+	void *item;	/**< NULL for a free slot */
+};
+
+struct config_index {
+	struct config_index_slot *slots;
+	uint32_t mask;
+};
+
 struct weston_config {
 	struct wl_list section_list;
+	uint32_t section_count;
+	uint32_t entry_count;
+
+	struct config_index sections;	/**< by name */
+	struct config_index matches;	/**< entries, by section name, key
+					 * and value */
+	struct config_index entries;	/**< by section and key */
+
 	char path[PATH_MAX];
 };
 
+#define CONFIG_HASH_SEED 2166136261u
+#define CONFIG_HASH_PRIME 16777619u
+
+/* FNV-1a, with a terminator so that consecutive strings hash apart */
+static uint32_t
+config_hash_string(uint32_t hash, const char *str)
+{
+	const unsigned char *p;
+
+	for (p = (const unsigned char *)str; *p; p++) {
+		hash ^= *p;
+		hash *= CONFIG_HASH_PRIME;
+	}
+
+	hash ^= 0xff;
+	hash *= CONFIG_HASH_PRIME;
+
+	return hash;
+}
+
+static uint32_t
+config_hash_uint(uint32_t hash, uint32_t value)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, value >>= 8) {
+		hash ^= value & 0xff;
+		hash *= CONFIG_HASH_PRIME;
+	}
+
+	return hash;
+}
+
+static uint32_t
+hash_section_name(const char *name)
+{
+	return config_hash_string(CONFIG_HASH_SEED, name);
+}
+
+static uint32_t
+hash_match(const char *name, const char *key, const char *value)
+{
+	uint32_t hash = hash_section_name(name);
+
+	hash = config_hash_string(hash, key);
+
+	return config_hash_string(hash, value);
+}
+
+static uint32_t
+hash_entry(const struct weston_config_section *section, const char *key)
+{
+	return config_hash_string(config_hash_uint(CONFIG_HASH_SEED,
+						   section->id), key);
+}
+
+static bool
+config_index_init(struct config_index *index, uint32_t count)
+{
+	uint32_t size = 8;
+
+	/* at most half full */
+	while (size < count * 2)
+		size *= 2;
+
+	index->slots = calloc(size, sizeof *index->slots);
+	if (!index->slots)
+		return false;
+
+	index->mask = size - 1;
+
+	return true;
+}
+
+static void
+config_index_release(struct config_index *index)
+{
+	free(index->slots);
+	index->slots = NULL;
+	index->mask = 0;
+}
+
+/* The first slot holding an item with this hash, or the free slot after
+ * them; use config_index_next() to walk on. */
+static struct config_index_slot *
+config_index_first(struct config_index *index, uint32_t hash, uint32_t *pos)
+{
+	struct config_index_slot *slot;
+
+	for (*pos = hash & index->mask; ; *pos = (*pos + 1) & index->mask) {
+		slot = &index->slots[*pos];
+		if (!slot->item || slot->hash == hash)
+			return slot;
+	}
+}
+
+static struct config_index_slot *
+config_index_next(struct config_index *index, uint32_t hash, uint32_t *pos)
+{
+	*pos = (*pos + 1) & index->mask;
+
+	return config_index_first(index, hash, pos);
+}
+
+static bool
+section_matches(const struct weston_config_section *s, const char *name)
+{
+	return strcmp(s->name, name) == 0;
+}
+
+static bool
+match_matches(const struct weston_config_entry *e, const char *name,
+	      const char *key, const char *value)
+{
+	return strcmp(e->key, key) == 0 && strcmp(e->value, value) == 0 &&
+	       strcmp(e->section->name, name) == 0;
+}
+
+static bool
+entry_matches(const struct weston_config_entry *e,
+	      const struct weston_config_section *section, const char *key)
+{
+	return e->section == section && strcmp(e->key, key) == 0;
+}
+
+static struct weston_config_section *
+index_find_section(struct weston_config *config, const char *name)
+{
+	uint32_t hash = hash_section_name(name);
+	struct config_index_slot *slot;
+	uint32_t pos;
+
+	for (slot = config_index_first(&config->sections, hash, &pos);
+	     slot->item;
+	     slot = config_index_next(&config->sections, hash, &pos)) {
+		if (section_matches(slot->item, name))
+			return slot->item;
+	}
+
+	return NULL;
+}
+
+static struct weston_config_entry *
+index_find_match(struct weston_config *config, const char *name,
+		 const char *key, const char *value)
+{
+	uint32_t hash = hash_match(name, key, value);
+	struct config_index_slot *slot;
+	uint32_t pos;
+
+	for (slot = config_index_first(&config->matches, hash, &pos);
+	     slot->item;
+	     slot = config_index_next(&config->matches, hash, &pos)) {
+		if (match_matches(slot->item, name, key, value))
+			return slot->item;
+	}
+
+	return NULL;
+}
+
+static struct weston_config_entry *
+index_find_entry(struct weston_config *config,
+		 const struct weston_config_section *section, const char *key)
+{
+	uint32_t hash = hash_entry(section, key);
+	struct config_index_slot *slot;
+	uint32_t pos;
+
+	for (slot = config_index_first(&config->entries, hash, &pos);
+	     slot->item;
+	     slot = config_index_next(&config->entries, hash, &pos)) {
+		if (entry_matches(slot->item, section, key))
+			return slot->item;
+	}
+
+	return NULL;
+}
+
+static void
+index_insert(struct config_index *index, uint32_t hash, void *item)
+{
+	struct config_index_slot *slot;
+	uint32_t pos;
+
+	/* skip past the items of the same hash, to the free slot */
+	for (slot = config_index_first(index, hash, &pos); slot->item;
+	     slot = config_index_next(index, hash, &pos))
+		;
+
+	slot->hash = hash;
+	slot->item = item;
+}
+
+static void
+config_release_index(struct weston_config *config)
+{
+	config_index_release(&config->sections);
+	config_index_release(&config->matches);
+	config_index_release(&config->entries);
+}
+
+/* Index the config in list order, so that duplicates do not displace
+ * the first section or entry. */
+static void
+config_build_index(struct weston_config *config)
+{
+	struct weston_config_section *s;
+	struct weston_config_entry *e;
+
+	if (!config_index_init(&config->sections, config->section_count) ||
+	    !config_index_init(&config->matches, config->entry_count) ||
+	    !config_index_init(&config->entries, config->entry_count)) {
+		config_release_index(config);
+		return;
+	}
+
+	wl_list_for_each(s, &config->section_list, link) {
+		if (!index_find_section(config, s->name))
+			index_insert(&config->sections,
+				     hash_section_name(s->name), s);
+
+		wl_list_for_each(e, &s->entry_list, link) {
+			/* a repeated key is shadowed in its section */
+			if (index_find_entry(config, s, e->key))
+				continue;
+			index_insert(&config->entries,
+				     hash_entry(s, e->key), e);
+
+			if (!index_find_match(config, s->name,
+					      e->key, e->value))
+				index_insert(&config->matches,
+					     hash_match(s->name, e->key,
+							e->value), e);
+		}
+	}
+}
+
 static int
 open_config_file(struct weston_config *c, const char *name)
 {
@@ -121,6 +387,9 @@ config_section_get_entry(struct weston_config_section *section,
 
 	if (section == NULL)
 		return NULL;
+	if (section->config->entries.slots)
+		return index_find_entry(section->config, section, key);
+
 	wl_list_for_each(e, &section->entry_list, link)
 		if (strcmp(e->key, key) == 0)
 			return e;
@@ -138,6 +407,15 @@ weston_config_get_section(struct weston_config *config, const char *section,
 
 	if (config == NULL)
 		return NULL;
+
+	if (config->sections.slots) {
+		if (key == NULL)
+			return index_find_section(config, section);
+
+		e = index_find_match(config, section, key, value);
+		return e ? e->section : NULL;
+	}
+
 	wl_list_for_each(s, &config->section_list, link) {
 		if (strcmp(s->name, section) != 0)
 			continue;
@@ -354,6 +632,8 @@ config_add_section(struct weston_config *config, const char *name)
 		return NULL;
 	}
 
+	section->id = config->section_count++;
+	section->config = config;
 	wl_list_init(&section->entry_list);
 	wl_list_insert(config->section_list.prev, &section->link);
 
@@ -383,6 +663,8 @@ section_add_entry(struct weston_config_section *section,
 		return NULL;
 	}
 
+	entry->section = section;
+	section->config->entry_count++;
 	wl_list_insert(section->entry_list.prev, &entry->link);
 
 	return entry;
@@ -399,7 +681,7 @@ weston_config_parse(const char *name)
 	struct weston_config_section *section = NULL;
 	int i, fd;
 
-	config = malloc(sizeof *config);
+	config = zalloc(sizeof *config);
 	if (config == NULL)
 		return NULL;
 
@@ -467,6 +749,8 @@ weston_config_parse(const char *name)
 
 	fclose(fp);
 
+	config_build_index(config);
+
 	return config;
 }
 
@@ -521,5 +805,6 @@ weston_config_destroy(struct weston_config *config)
 		free(s);
 	}
 
+	config_release_index(config);
 	free(config);
 }
@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "shared/helpers.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+/* Headless renders to a pbuffer, which keeps its contents: after the
+ * first repaint the GL renderer only repaints the damage of the frame
+ * itself, as with a buffer age of 1. What was not repainted has to be
+ * right all the same. */
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_GL;
+	setup.width = 320;
+	setup.height = 240;
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+static void
+assert_channel_near(uint32_t pixel, int shift, int expected)
+{
+	int value = (pixel >> shift) & 0xff;
+
+	assert(abs(value - expected) <= 2);
+}
+
+static void
+assert_pixel(struct buffer *shot, int x, int y, int r, int g, int b)
+{
+	uint32_t *pixels = pixman_image_get_data(shot->image);
+	int stride = pixman_image_get_stride(shot->image) / 4;
+	uint32_t pixel = pixels[y * stride + x];
+
+	testlog("pixel at %d,%d: 0x%08x\n", x, y, pixel);
+	assert_channel_near(pixel, 16, r);
+	assert_channel_near(pixel, 8, g);
+	assert_channel_near(pixel, 0, b);
+}
+
+/* The background of the test shell, 0.16 0.32 0.48 */
+static void
+assert_background(struct buffer *shot, int x, int y)
+{
+	assert_pixel(shot, x, y, 40, 81, 122);
+}
+
+static void
+commit_and_wait(struct client *client, struct buffer *buf,
+		int x, int y, int width, int height)
+{
+	struct wl_surface *surface = client->surface->wl_surface;
+	int done;
+
+	wl_surface_attach(surface, buf->proxy, 0, 0);
+	wl_surface_damage(surface, x, y, width, height);
+	frame_callback_set(surface, &done);
+	wl_surface_commit(surface);
+	frame_callback_wait(client, &done);
+}
+
+TEST(pbuffer_partial_repaints)
+{
+	struct client *client;
+	struct surface *surface;
+	struct buffer *blue;
+	struct buffer *shot;
+	pixman_color_t color;
+
+	client = create_client_and_test_surface(50, 50, 100, 100);
+	assert(client);
+	surface = client->surface;
+
+	/* move the pointer clearly away from the surfaces */
+	weston_test_move_pointer(client->test->weston_test, 0, 1, 0, 300, 220);
+
+	fill_image_with_color(surface->buffer->image,
+			      color_rgb888(&color, 255, 0, 0));
+	commit_and_wait(client, surface->buffer, 0, 0, 100, 100);
+
+	shot = capture_screenshot_of_output(client);
+	assert_pixel(shot, 60, 60, 255, 0, 0);
+	assert_background(shot, 20, 20);
+	assert_background(shot, 200, 60);
+	buffer_destroy(shot);
+
+	/* Damages where the surface was and where it goes: the old place
+	 * has to be background again, the rest stays as it was. */
+	move_client(client, 150, 50);
+
+	shot = capture_screenshot_of_output(client);
+	assert_background(shot, 60, 60);
+	assert_background(shot, 20, 20);
+	assert_pixel(shot, 200, 60, 255, 0, 0);
+	buffer_destroy(shot);
+
+	/* Only the top left corner of the surface changes */
+	blue = create_shm_buffer_a8r8g8b8(client, 100, 100);
+	fill_image_with_color(blue->image, color_rgb888(&color, 0, 0, 255));
+	commit_and_wait(client, blue, 0, 0, 20, 20);
+
+	shot = capture_screenshot_of_output(client);
+	assert_pixel(shot, 155, 55, 0, 0, 255);
+	assert_pixel(shot, 200, 100, 255, 0, 0);
+	assert_background(shot, 60, 60);
+	buffer_destroy(shot);
+
+	/* A repaint without any damage changes nothing */
+	shot = capture_screenshot_of_output(client);
+	assert_pixel(shot, 155, 55, 0, 0, 255);
+	assert_pixel(shot, 200, 100, 255, 0, 0);
+	assert_background(shot, 60, 60);
+	buffer_destroy(shot);
+
+	buffer_destroy(blue);
+	client_destroy(client);
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <libweston/libweston.h>
+#include <libweston/backend-headless.h>
+#include "backend.h"
+#include "capture-sink.h"
+#include "shared/timespec-util.h"
+
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+
+#define CAPTURE_FRAMES 60
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_PIXMAN;
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+/* A frame consumer that does nothing with the pixels: it checks what it
+ * is handed, asks for the next frame and gives the buffer straight
+ * back, except for the very last frame which it keeps to exercise the
+ * release on destroy. */
+struct null_sink {
+	struct weston_output *output;
+	struct weston_capture_sink *sink;
+	struct weston_mode mode;
+	struct weston_head head;
+
+	int frames;
+	struct weston_capture_frame *held;
+};
+
+static struct null_sink *the_null_sink;
+
+static int
+null_sink_frame_ready(struct weston_capture_frame *frame, void *data)
+{
+	struct null_sink *ns = data;
+	struct stat st;
+
+	/* Stray repaints after the run, e.g. from the other output */
+	if (ns->held) {
+		weston_capture_frame_release(frame);
+		return 0;
+	}
+
+	assert(frame->fd >= 0);
+	assert(fstat(frame->fd, &st) == 0);
+	assert(st.st_size >= frame->stride * frame->height);
+	assert(frame->width == ns->mode.width);
+	assert(frame->height == ns->mode.height);
+	assert(frame->seq == (uint64_t) ns->frames);
+
+	/* Every frame was triggered by damaging the whole output */
+	assert(pixman_region32_not_empty(&frame->damage));
+
+	ns->frames++;
+	if (ns->frames == CAPTURE_FRAMES) {
+		ns->held = frame;
+		return 0;
+	}
+
+	weston_output_damage(ns->output);
+	weston_capture_frame_release(frame);
+
+	return 0;
+}
+
+static const struct weston_capture_sink_interface null_sink_impl = {
+	null_sink_frame_ready,
+};
+
+static int
+null_sink_submit_frame(struct weston_output *output, int fd, int stride,
+		       void *buffer)
+{
+	return weston_capture_sink_submit_frame(the_null_sink->sink, fd,
+						stride, buffer);
+}
+
+static int (*saved_start_repaint_loop)(struct weston_output *output);
+
+static int
+null_sink_start_repaint_loop(struct weston_output *output)
+{
+	saved_start_repaint_loop(output);
+	weston_capture_sink_start_repaint_loop(the_null_sink->sink);
+
+	return 0;
+}
+
+static void
+null_sink_create(struct null_sink *ns, struct weston_compositor *compositor)
+{
+	const struct weston_drm_virtual_output_api *api;
+
+	api = weston_headless_virtual_output_get_api(compositor);
+	assert(api);
+
+	memset(ns, 0, sizeof *ns);
+	the_null_sink = ns;
+
+	ns->output = api->create_output(compositor, "capture-test");
+	assert(ns->output);
+
+	/* 1 kHz so the finish_frame pacing does not dominate the run */
+	ns->mode.flags = WL_OUTPUT_MODE_CURRENT;
+	ns->mode.width = 640;
+	ns->mode.height = 480;
+	ns->mode.refresh = 1000 * 1000;
+	wl_list_insert(&ns->output->mode_list, &ns->mode.link);
+	ns->output->current_mode = &ns->mode;
+	api->set_gbm_format(ns->output, "XRGB8888");
+
+	weston_head_init(&ns->head, "capture-test");
+	ns->head.compositor = compositor;
+	weston_output_attach_head(ns->output, &ns->head);
+
+	weston_output_set_scale(ns->output, 1);
+	weston_output_set_transform(ns->output, WL_OUTPUT_TRANSFORM_NORMAL);
+
+	api->set_submit_frame_cb(ns->output, null_sink_submit_frame);
+	ns->sink = weston_capture_sink_create(ns->output, api,
+					      &null_sink_impl, ns);
+	assert(ns->sink);
+
+	assert(weston_output_enable(ns->output) == 0);
+
+	saved_start_repaint_loop = ns->output->start_repaint_loop;
+	ns->output->start_repaint_loop = null_sink_start_repaint_loop;
+}
+
+static void
+null_sink_destroy(struct null_sink *ns)
+{
+	weston_capture_sink_destroy(ns->sink);
+
+	wl_list_remove(&ns->mode.link);
+	weston_output_destroy(ns->output);
+	weston_head_release(&ns->head);
+	the_null_sink = NULL;
+}
+
+PLUGIN_TEST(capture_sink_null_consumer)
+{
+	/* struct weston_compositor *compositor; */
+	struct wl_event_loop *loop;
+	struct weston_capture_sink_stats stats;
+	struct null_sink ns;
+	struct timespec start, end;
+	int64_t elapsed_ns;
+	int i;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	null_sink_create(&ns, compositor);
+
+	weston_compositor_read_presentation_clock(compositor, &start);
+	weston_output_damage(ns.output);
+	for (i = 0; i < 100 * CAPTURE_FRAMES && !ns.held; i++)
+		wl_event_loop_dispatch(loop, 100);
+	weston_compositor_read_presentation_clock(compositor, &end);
+
+	assert(ns.frames == CAPTURE_FRAMES);
+	assert(ns.held);
+
+	weston_capture_sink_get_stats(ns.sink, &stats);
+	assert(stats.frames_submitted >= CAPTURE_FRAMES);
+	assert(stats.frames_delivered == stats.frames_submitted);
+	assert(stats.frames_rejected == 0);
+	assert(stats.damage_pixels >=
+	       (uint64_t) CAPTURE_FRAMES * ns.mode.width * ns.mode.height);
+
+	elapsed_ns = timespec_sub_to_nsec(&end, &start);
+	testlog("%d frames in %"PRId64" ms, %.1f fps\n", CAPTURE_FRAMES,
+		elapsed_ns / 1000000, CAPTURE_FRAMES * 1e9 / elapsed_ns);
+	testlog("fence wait avg %"PRIu64" us, hold avg %"PRIu64" us "
+		"max %"PRIu64" us\n",
+		stats.fence_wait_sum_ns / stats.frames_delivered / 1000,
+		stats.hold_sum_ns / (CAPTURE_FRAMES - 1) / 1000,
+		stats.hold_max_ns / 1000);
+
+	/* Destroying the sink gives the held frame back to the backend */
+	null_sink_destroy(&ns);
+}
@@ -32,6 +32,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <libweston/config-parser.h>
 
@@ -630,3 +631,103 @@ ZUC_TEST(config_test, section_from_null)
 	section = weston_config_get_section(NULL, "bucket", NULL, NULL);
 	ZUC_ASSERT_NULL(section);
 }
+
+ZUC_TEST(config_test, duplicates_keep_first)
+{
+	struct weston_config *config;
+	struct weston_config_section *section;
+	char *s;
+
+	config = load_config("[output]\n"
+			     "name=A\n"
+			     "mode=off\n"
+			     "mode=current\n"
+			     "[output]\n"
+			     "name=A\n"
+			     "mode=preferred\n"
+			     "[output]\n"
+			     "name=B\n"
+			     "name=C\n");
+	ZUC_ASSERT_NOT_NULL(config);
+
+	section = weston_config_get_section(config, "output", "name", "A");
+	ZUC_ASSERT_NOT_NULL(section);
+	ZUC_ASSERT_EQ(section,
+		      weston_config_get_section(config, "output", NULL, NULL));
+	ZUC_ASSERT_EQ(0, weston_config_section_get_string(section, "mode",
+							  &s, NULL));
+	ZUC_ASSERT_STREQ("off", s);
+	free(s);
+
+	ZUC_ASSERT_NOT_NULL(weston_config_get_section(config, "output",
+						      "name", "B"));
+	/* a repeated key is shadowed by the first one */
+	ZUC_ASSERT_NULL(weston_config_get_section(config, "output",
+						  "name", "C"));
+	ZUC_ASSERT_NULL(weston_config_get_section(config, "output",
+						  "name", "D"));
+	ZUC_ASSERT_NULL(weston_config_get_section(config, "outputs",
+						  NULL, NULL));
+
+	weston_config_destroy(config);
+}
+
+/* Like the generated weston.ini of a large video wall */
+#define BENCH_OUTPUTS 800
+#define BENCH_ROUNDS 20
+
+ZUC_TEST(config_test, many_outputs_benchmark)
+{
+	struct weston_config *config;
+	struct weston_config_section *section;
+	struct timespec begin, parsed, end;
+	char name[32], *s, *text, *p;
+	size_t size = BENCH_OUTPUTS * 128 + 64;
+	int i, round, scale;
+
+	text = malloc(size);
+	ZUC_ASSERT_NOT_NULL(text);
+
+	p = text + sprintf(text, "[core]\nidle-time=0\n");
+	for (i = 0; i < BENCH_OUTPUTS; i++)
+		p += sprintf(p, "[output]\nname=HDMI-A-%d\nmode=1920x1080\n"
+			     "transform=normal\nscale=%d\napp-ids=wall-%d\n",
+			     i, 1 + i % 3, i);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	config = load_config(text);
+	clock_gettime(CLOCK_MONOTONIC, &parsed);
+	free(text);
+	ZUC_ASSERT_NOT_NULL(config);
+
+	/* every output enable looks its section up by name */
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (i = 0; i < BENCH_OUTPUTS; i++) {
+			snprintf(name, sizeof name, "HDMI-A-%d", i);
+			section = weston_config_get_section(config, "output",
+							    "name", name);
+			ZUC_ASSERT_NOT_NULL(section);
+			weston_config_section_get_int(section, "scale",
+						      &scale, 0);
+			ZUC_ASSERT_EQ(1 + i % 3, scale);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	section = weston_config_get_section(config, "output", "name",
+					    "HDMI-A-799");
+	ZUC_ASSERT_EQ(0, weston_config_section_get_string(section, "app-ids",
+							  &s, NULL));
+	ZUC_ASSERT_STREQ("wall-799", s);
+	free(s);
+
+	printf("%d output sections: parse %.2f ms, %d lookups %.2f ms\n",
+	       BENCH_OUTPUTS,
+	       (parsed.tv_sec - begin.tv_sec) * 1e3 +
+	       (parsed.tv_nsec - begin.tv_nsec) / 1e6,
+	       BENCH_OUTPUTS * BENCH_ROUNDS,
+	       (end.tv_sec - parsed.tv_sec) * 1e3 +
+	       (end.tv_nsec - parsed.tv_nsec) / 1e6);
+
+	weston_config_destroy(config);
+}
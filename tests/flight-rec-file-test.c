@@ -0,0 +1,205 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libweston/libweston.h>
+#include "flight-rec/flight-rec-decode.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+#define RING_SIZE 4096
+
+struct recorder_file {
+	char dir[64];
+	char path[96];
+	char old_path[96];
+};
+
+static void
+recorder_file_init(struct recorder_file *rf)
+{
+	snprintf(rf->dir, sizeof(rf->dir), "/tmp/flight-rec-test-XXXXXX");
+	ZUC_ASSERT_NOT_NULL(mkdtemp(rf->dir));
+	snprintf(rf->path, sizeof(rf->path), "%s/weston.flightrec", rf->dir);
+	snprintf(rf->old_path, sizeof(rf->old_path), "%s.old", rf->path);
+}
+
+static void
+recorder_file_release(struct recorder_file *rf)
+{
+	unlink(rf->old_path);
+	unlink(rf->path);
+	rmdir(rf->dir);
+}
+
+/* One compositor run: record a message into a file-backed recorder at
+ * path, then tear it down, as weston does on exit. */
+static void
+run_recorder(const char *path, const char *message)
+{
+	struct weston_log_context *log_ctx;
+	struct weston_log_scope *scope;
+	struct weston_log_subscriber *sub;
+
+	log_ctx = weston_log_ctx_create();
+	ZUC_ASSERT_NOT_NULL(log_ctx);
+	scope = weston_log_ctx_add_log_scope(log_ctx, "test", "test scope",
+					     NULL, NULL, NULL);
+	ZUC_ASSERT_NOT_NULL(scope);
+
+	sub = weston_log_subscriber_create_flight_rec_file(path, RING_SIZE);
+	ZUC_ASSERT_NOT_NULL(sub);
+	weston_log_subscribe(log_ctx, sub, "test");
+
+	weston_log_scope_printf(scope, "%s\n", message);
+
+	weston_log_subscriber_destroy(sub);
+	weston_log_scope_destroy(scope);
+	weston_log_ctx_destroy(log_ctx);
+}
+
+/* Decodes the recorder at path like flight-rec-decode, into a string
+ * which the caller frees, or returns NULL. */
+static char *
+decode_file(const char *path)
+{
+	struct stat st;
+	char *text = NULL;
+	size_t len = 0;
+	FILE *out;
+	void *map;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	out = open_memstream(&text, &len);
+	if (!out) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	ret = flight_rec_decode(map, st.st_size, out, NULL);
+	fclose(out);
+	munmap(map, st.st_size);
+
+	if (ret < 0) {
+		free(text);
+		return NULL;
+	}
+
+	return text;
+}
+
+ZUC_TEST(flight_rec_file_test, reopen_keeps_previous_run)
+{
+	struct recorder_file rf;
+	char *text;
+
+	recorder_file_init(&rf);
+
+	run_recorder(rf.path, "first run");
+
+	text = decode_file(rf.path);
+	ZUC_ASSERT_NOT_NULL(text);
+	ZUC_ASSERT_STREQ("first run\n", text);
+	free(text);
+
+	run_recorder(rf.path, "second run");
+
+	text = decode_file(rf.old_path);
+	ZUC_ASSERT_NOT_NULL(text);
+	ZUC_ASSERT_STREQ("first run\n", text);
+	free(text);
+
+	text = decode_file(rf.path);
+	ZUC_ASSERT_NOT_NULL(text);
+	ZUC_ASSERT_STREQ("second run\n", text);
+	free(text);
+
+	/* only the previous run is kept */
+	run_recorder(rf.path, "third run");
+
+	text = decode_file(rf.old_path);
+	ZUC_ASSERT_NOT_NULL(text);
+	ZUC_ASSERT_STREQ("second run\n", text);
+	free(text);
+
+	recorder_file_release(&rf);
+}
+
+ZUC_TEST(flight_rec_file_test, other_files_are_overwritten)
+{
+	static const char junk[] = "not a flight recorder, long enough to "
+				   "cover the header";
+	struct recorder_file rf;
+	struct stat st;
+	char *text;
+	FILE *f;
+
+	recorder_file_init(&rf);
+
+	f = fopen(rf.path, "w");
+	ZUC_ASSERT_NOT_NULL(f);
+	ZUC_ASSERT_EQ(1, fwrite(junk, sizeof(junk), 1, f));
+	fclose(f);
+
+	ZUC_ASSERT_NULL(decode_file(rf.path));
+
+	run_recorder(rf.path, "first run");
+
+	ZUC_ASSERT_EQ(-1, stat(rf.old_path, &st));
+	ZUC_ASSERT_EQ(ENOENT, errno);
+
+	text = decode_file(rf.path);
+	ZUC_ASSERT_NOT_NULL(text);
+	ZUC_ASSERT_STREQ("first run\n", text);
+	free(text);
+
+	recorder_file_release(&rf);
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "libweston/libinput-queue.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+/* Without uinput (root only) there is no real device to replay from, so
+ * the events handed over are fake pointers carrying a sequence number. */
+#define SEQ_EVENT(n) ((struct libinput_event *)(uintptr_t)((n) + 1))
+#define EVENT_SEQ(e) ((uint32_t)((uintptr_t)(e) - 1))
+
+#define REPLAY_EVENTS 1000000
+
+/* devices libinput closes while the input thread is stopping */
+#define CLOSES_ON_EXIT 3
+#define FAKE_FD 42
+
+ZUC_TEST(libinput_queue_test, pops_in_order)
+{
+	struct udev_input_queue queue;
+	struct udev_input_item item = { .type = UDEV_INPUT_ITEM_EVENT };
+	uint32_t i;
+
+	ZUC_ASSERT_EQ(0, udev_input_queue_init(&queue, 4));
+
+	for (i = 0; i < 10; i++) {
+		item.event = SEQ_EVENT(i);
+		ZUC_ASSERT_TRUE(udev_input_queue_push(&queue, &item));
+	}
+
+	for (i = 0; i < 10; i++) {
+		ZUC_ASSERT_TRUE(udev_input_queue_pop(&queue, &item));
+		ZUC_ASSERT_EQ(UDEV_INPUT_ITEM_EVENT, item.type);
+		ZUC_ASSERT_EQ(i, EVENT_SEQ(item.event));
+	}
+
+	ZUC_ASSERT_FALSE(udev_input_queue_pop(&queue, &item));
+
+	udev_input_queue_release(&queue);
+}
+
+ZUC_TEST(libinput_queue_test, rejects_when_full)
+{
+	struct udev_input_queue queue;
+	struct udev_input_item item = { .type = UDEV_INPUT_ITEM_EVENT };
+	uint32_t i;
+
+	ZUC_ASSERT_EQ(0, udev_input_queue_init(&queue, 2));
+
+	for (i = 0; i < 4; i++) {
+		ZUC_ASSERT_FALSE(udev_input_queue_is_full(&queue));
+		item.event = SEQ_EVENT(i);
+		ZUC_ASSERT_TRUE(udev_input_queue_push(&queue, &item));
+	}
+
+	ZUC_ASSERT_TRUE(udev_input_queue_is_full(&queue));
+	item.event = SEQ_EVENT(4);
+	ZUC_ASSERT_FALSE(udev_input_queue_push(&queue, &item));
+
+	/* one slot freed, the rejected item fits again and comes last */
+	ZUC_ASSERT_TRUE(udev_input_queue_pop(&queue, &item));
+	ZUC_ASSERT_EQ(0, EVENT_SEQ(item.event));
+	item.event = SEQ_EVENT(4);
+	ZUC_ASSERT_TRUE(udev_input_queue_push(&queue, &item));
+
+	for (i = 1; i < 5; i++) {
+		ZUC_ASSERT_TRUE(udev_input_queue_pop(&queue, &item));
+		ZUC_ASSERT_EQ(i, EVENT_SEQ(item.event));
+	}
+
+	udev_input_queue_release(&queue);
+}
+
+static void *
+replay_thread(void *data)
+{
+	struct udev_input_queue *queue = data;
+	struct udev_input_item item = { .type = UDEV_INPUT_ITEM_EVENT };
+	uint32_t i;
+
+	for (i = 0; i < REPLAY_EVENTS; i++) {
+		item.event = SEQ_EVENT(i);
+		while (!udev_input_queue_push(queue, &item))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+ZUC_TEST(libinput_queue_test, threaded_replay_keeps_order)
+{
+	struct udev_input_queue queue;
+	struct udev_input_item item;
+	pthread_t thread;
+	uint32_t expected = 0;
+
+	/* the order the compositor uses */
+	ZUC_ASSERT_EQ(0, udev_input_queue_init(&queue, 12));
+	ZUC_ASSERT_EQ(0, pthread_create(&thread, NULL, replay_thread, &queue));
+
+	while (expected < REPLAY_EVENTS) {
+		if (!udev_input_queue_pop(&queue, &item)) {
+			sched_yield();
+			continue;
+		}
+
+		ZUC_ASSERT_EQ(UDEV_INPUT_ITEM_EVENT, item.type);
+		ZUC_ASSERT_EQ(expected, EVENT_SEQ(item.event));
+		expected++;
+	}
+
+	ZUC_ASSERT_EQ(0, pthread_join(thread, NULL));
+	ZUC_ASSERT_FALSE(udev_input_queue_pop(&queue, &item));
+
+	udev_input_queue_release(&queue);
+}
+
+/* Stands in for the input thread and the launcher, see libinput-seat.c */
+struct fake_input {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct udev_input_handoff handoff;
+	bool stop;
+	int open_result;
+	int opened;
+	int closed;
+};
+
+static void
+fake_serve_request(struct udev_input_request *request, void *data)
+{
+	struct fake_input *input = data;
+
+	switch (request->type) {
+	case UDEV_INPUT_REQUEST_OPEN:
+		input->opened++;
+		request->result = FAKE_FD;
+		break;
+	case UDEV_INPUT_REQUEST_CLOSE:
+		input->closed++;
+		request->result = 0;
+		break;
+	}
+}
+
+static void *
+stopping_thread(void *data)
+{
+	struct fake_input *input = data;
+	struct udev_input_request open_request = {
+		.type = UDEV_INPUT_REQUEST_OPEN,
+		.path = "/dev/input/event0",
+	};
+	struct udev_input_request close_request = {
+		.type = UDEV_INPUT_REQUEST_CLOSE,
+		.fd = FAKE_FD,
+	};
+	int i;
+
+	/* in the middle of libinput_dispatch(), as for a device added */
+	pthread_mutex_lock(&input->lock);
+	input->open_result = udev_input_handoff_request(&input->handoff,
+							&open_request);
+
+	/* asked to stop meanwhile, and more requests on the way out */
+	if (input->stop) {
+		for (i = 0; i < CLOSES_ON_EXIT; i++)
+			udev_input_handoff_request(&input->handoff,
+						   &close_request);
+	}
+	pthread_mutex_unlock(&input->lock);
+
+	udev_input_handoff_thread_exit(&input->handoff);
+
+	return NULL;
+}
+
+ZUC_TEST(libinput_queue_test, stop_with_pending_request)
+{
+	struct fake_input input = { 0 };
+	pthread_t thread;
+	int wake_fd;
+
+	wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	ZUC_ASSERT_TRUE(wake_fd >= 0);
+	pthread_mutex_init(&input.lock, NULL);
+	pthread_cond_init(&input.cond, NULL);
+	udev_input_handoff_init(&input.handoff, &input.lock, &input.cond,
+				wake_fd);
+
+	ZUC_ASSERT_EQ(0, pthread_create(&thread, NULL,
+					stopping_thread, &input));
+
+	/* the stop request only comes once the thread waits for us */
+	pthread_mutex_lock(&input.lock);
+	while (!input.handoff.request.pending)
+		pthread_cond_wait(&input.cond, &input.lock);
+	input.stop = true;
+	pthread_mutex_unlock(&input.lock);
+
+	/* joining right away would never return */
+	udev_input_handoff_wait_exit(&input.handoff,
+				     fake_serve_request, &input);
+	ZUC_ASSERT_EQ(0, pthread_join(thread, NULL));
+
+	ZUC_ASSERT_EQ(FAKE_FD, input.open_result);
+	ZUC_ASSERT_EQ(1, input.opened);
+	ZUC_ASSERT_EQ(CLOSES_ON_EXIT, input.closed);
+	ZUC_ASSERT_FALSE(input.handoff.request.pending);
+
+	pthread_cond_destroy(&input.cond);
+	pthread_mutex_destroy(&input.lock);
+	close(wake_fd);
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "test-config.h"
+
+/* The outputs side by side stay inside the 2000x2000 background of the
+ * test shell, so that every pixel has a known value. */
+#define BENCH_OUTPUTS 4
+#define BENCH_OUTPUT_WIDTH 480
+#define BENCH_OUTPUT_HEIGHT 960
+#define BENCH_FRAMES 100
+
+struct setup_args {
+	const char *config_file;
+	const char *name;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{ TESTSUITE_REPAINT_SEQUENTIAL_CONFIG_PATH, "sequential" },
+	{ TESTSUITE_REPAINT_PARALLEL_CONFIG_PATH, "parallel" },
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_PIXMAN;
+	setup.width = BENCH_OUTPUT_WIDTH;
+	setup.height = BENCH_OUTPUT_HEIGHT;
+	setup.config_file = arg->config_file;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args);
+
+static struct buffer *
+capture_output(struct client *client, struct output *output)
+{
+	struct buffer *buffer;
+
+	buffer = create_shm_buffer_a8r8g8b8(client, output->width,
+					    output->height);
+
+	client->test->buffer_copy_done = 0;
+	weston_test_capture_screenshot(client->test->weston_test,
+				       output->wl_output, buffer->proxy);
+	while (client->test->buffer_copy_done == 0)
+		if (wl_display_dispatch(client->wl_display) < 0)
+			break;
+
+	return buffer;
+}
+
+static void
+assert_channel_near(uint32_t pixel, int shift, int expected)
+{
+	int value = (pixel >> shift) & 0xff;
+
+	assert(abs(value - expected) <= 2);
+}
+
+/* The test surface is a 25% grey, premultiplied, over the background
+ * of the test shell, 0.16 0.32 0.48. */
+static void
+check_output(struct client *client, struct output *output)
+{
+	struct buffer *shot;
+	uint32_t *pixels;
+	int stride;
+	uint32_t pixel;
+
+	shot = capture_output(client, output);
+	pixels = pixman_image_get_data(shot->image);
+	stride = pixman_image_get_stride(shot->image) / 4;
+	pixel = pixels[(output->height / 2) * stride + output->width / 2];
+
+	assert_channel_near(pixel, 16, 0x40 + 40 * 0xbf / 0xff);
+	assert_channel_near(pixel, 8, 0x40 + 81 * 0xbf / 0xff);
+	assert_channel_near(pixel, 0, 0x40 + 122 * 0xbf / 0xff);
+
+	buffer_destroy(shot);
+}
+
+TEST(parallel_repaint_bench)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	struct client *client;
+	struct surface *surface;
+	struct output *output;
+	struct timespec start, end;
+	int64_t elapsed_ns;
+	int outputs = 0;
+	int frame;
+	int done;
+
+	client = create_client_and_test_surface(0, 0,
+						BENCH_OUTPUTS * BENCH_OUTPUT_WIDTH,
+						BENCH_OUTPUT_HEIGHT);
+	assert(client);
+	surface = client->surface;
+
+	wl_list_for_each(output, &client->output_list, link)
+		outputs++;
+	assert(outputs == BENCH_OUTPUTS);
+
+	/* Unthrottled, every frame costs what compositing all outputs
+	 * costs. The surface blends, so every pixel is work. */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (frame = 0; frame < BENCH_FRAMES; frame++) {
+		wl_surface_attach(surface->wl_surface,
+				  surface->buffer->proxy, 0, 0);
+		wl_surface_damage(surface->wl_surface, 0, 0,
+				  surface->width, surface->height);
+		frame_callback_set(surface->wl_surface, &done);
+		wl_surface_commit(surface->wl_surface);
+		frame_callback_wait(client, &done);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed_ns = timespec_sub_to_nsec(&end, &start);
+
+	testlog("%s repaint of %d outputs of %dx%d: %.2f ms per frame\n",
+		arg->name, BENCH_OUTPUTS, BENCH_OUTPUT_WIDTH,
+		BENCH_OUTPUT_HEIGHT, elapsed_ns / 1e6 / BENCH_FRAMES);
+
+	wl_list_for_each(output, &client->output_list, link)
+		check_output(client, output);
+
+	client_destroy(client);
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "shared/timespec-util.h"
+#include "relative-pointer-unstable-v1-client-protocol.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "test-config.h"
+
+/* One second of a 1000 Hz mouse */
+#define BENCH_MOTIONS 1000
+#define BENCH_INTERVAL_NSEC 1000000
+
+/* Back and forth, so that deltas which replaced each other instead of
+ * adding up would not land on the same totals */
+#define REL_MOTIONS 200
+
+struct setup_args {
+	const char *config_file;
+	bool coalesce;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{ NULL, false },
+	{ TESTSUITE_POINTER_COALESCE_CONFIG_PATH, true },
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.config_file = arg->config_file;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args);
+
+static void
+send_motion(struct client *client, const struct timespec *time, int x, int y)
+{
+	uint32_t tv_sec_hi, tv_sec_lo, tv_nsec;
+
+	timespec_to_proto(time, &tv_sec_hi, &tv_sec_lo, &tv_nsec);
+	weston_test_move_pointer(client->test->weston_test, tv_sec_hi, tv_sec_lo,
+				 tv_nsec, x, y);
+}
+
+/* Coalesced motion only arrives with the next frame, wait for it */
+static void
+wait_for_pointer(struct client *client, int x, int y)
+{
+	struct pointer *pointer = client->input->pointer;
+
+	client_roundtrip(client);
+	while (pointer->x + client->surface->x != x ||
+	       pointer->y + client->surface->y != y)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+}
+
+TEST(pointer_motion_bench)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	struct client *client;
+	struct pointer *pointer;
+	struct timespec start, deadline, now, cpu_start, cpu_end;
+	int64_t elapsed_ns, cpu_ns;
+	int i, x = 0;
+
+	client = create_client_and_test_surface(50, 50, 200, 200);
+	pointer = client->input->pointer;
+
+	/* Enter the surface before counting */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	send_motion(client, &start, 100, 100);
+	wait_for_pointer(client, 100, 100);
+	assert(pointer->focus == client->surface);
+	pointer->motion_count = 0;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_MOTIONS; i++) {
+		timespec_add_nsec(&deadline, &start,
+				  (int64_t)i * BENCH_INTERVAL_NSEC);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+
+		x = 60 + i % 100;
+		send_motion(client, &deadline, x, 100);
+		wl_display_flush(client->wl_display);
+
+		if (i % 50 == 49)
+			client_roundtrip(client);
+	}
+	wait_for_pointer(client, x, 100);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+
+	elapsed_ns = timespec_sub_to_nsec(&now, &start);
+	cpu_ns = timespec_sub_to_nsec(&cpu_end, &cpu_start);
+
+	testlog("%s: %u wl_pointer.motion for %d input events in %.3f s, "
+		"%.1f ms CPU per second of input\n",
+		arg->coalesce ? "coalesced" : "not coalesced",
+		pointer->motion_count, BENCH_MOTIONS, elapsed_ns / 1e9,
+		cpu_ns / 1e6 / (elapsed_ns / 1e9));
+
+	if (arg->coalesce)
+		assert(pointer->motion_count < BENCH_MOTIONS / 4);
+	else
+		assert(pointer->motion_count == BENCH_MOTIONS);
+
+	client_destroy(client);
+}
+
+struct relative_totals {
+	int count;
+	double dx, dy;
+	double dx_unaccel, dy_unaccel;
+};
+
+static void
+relative_pointer_handle_motion(void *data,
+			       struct zwp_relative_pointer_v1 *relative_pointer,
+			       uint32_t utime_hi, uint32_t utime_lo,
+			       wl_fixed_t dx, wl_fixed_t dy,
+			       wl_fixed_t dx_unaccel, wl_fixed_t dy_unaccel)
+{
+	struct relative_totals *totals = data;
+
+	totals->count++;
+	totals->dx += wl_fixed_to_double(dx);
+	totals->dy += wl_fixed_to_double(dy);
+	totals->dx_unaccel += wl_fixed_to_double(dx_unaccel);
+	totals->dy_unaccel += wl_fixed_to_double(dy_unaccel);
+}
+
+static const struct zwp_relative_pointer_v1_listener relative_pointer_listener = {
+	relative_pointer_handle_motion,
+};
+
+TEST(relative_motion_totals)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	struct zwp_relative_pointer_manager_v1 *manager;
+	struct zwp_relative_pointer_v1 *relative_pointer;
+	struct relative_totals totals = { 0 };
+	struct client *client;
+	struct timespec time;
+	int i, x = 100, y = 100;
+
+	client = create_client_and_test_surface(50, 50, 200, 200);
+	manager = bind_to_singleton_global(client,
+					   &zwp_relative_pointer_manager_v1_interface,
+					   1);
+	relative_pointer =
+		zwp_relative_pointer_manager_v1_get_relative_pointer(manager,
+			client->input->pointer->wl_pointer);
+	zwp_relative_pointer_v1_add_listener(relative_pointer,
+					     &relative_pointer_listener,
+					     &totals);
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	send_motion(client, &time, x, y);
+	wait_for_pointer(client, x, y);
+	client_roundtrip(client);
+	totals = (struct relative_totals) { 0 };
+
+	/* Sent without waiting, so that coalescing merges most of them */
+	for (i = 0; i < REL_MOTIONS; i++) {
+		x += i % 4 == 3 ? -7 : 3;
+		y += i % 5 == 4 ? 5 : -1;
+		timespec_add_nsec(&time, &time, BENCH_INTERVAL_NSEC);
+		send_motion(client, &time, x, y);
+	}
+	wait_for_pointer(client, x, y);
+	client_roundtrip(client);
+
+	testlog("%s: %d relative motions for %d input events\n",
+		arg->coalesce ? "coalesced" : "not coalesced",
+		totals.count, REL_MOTIONS);
+
+	assert(totals.dx == x - 100);
+	assert(totals.dy == y - 100);
+	assert(totals.dx_unaccel == x - 100);
+	assert(totals.dy_unaccel == y - 100);
+	if (arg->coalesce)
+		assert(totals.count < REL_MOTIONS);
+	else
+		assert(totals.count == REL_MOTIONS);
+
+	zwp_relative_pointer_v1_destroy(relative_pointer);
+	zwp_relative_pointer_manager_v1_destroy(manager);
+	client_destroy(client);
+}
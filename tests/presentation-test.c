@@ -38,17 +38,32 @@
 #include "weston-test-client-helper.h"
 #include "presentation-time-client-protocol.h"
 #include "weston-test-fixture-compositor.h"
+#include "test-config.h"
+
+/* The refresh rate in presentation-virtual-clock.ini, 50 Hz */
+#define VIRTUAL_REFRESH_NSEC 20000000
+
+struct setup_args {
+	const char *config_file;
+	bool virtual_clock;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{ NULL, false },
+	{ TESTSUITE_PRESENTATION_CLOCK_CONFIG_PATH, true },
+};
 
 static enum test_result_code
-fixture_setup(struct weston_test_harness *harness)
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
 {
 	struct compositor_setup setup;
 
 	compositor_setup_defaults(&setup);
+	setup.config_file = arg->config_file;
 
 	return weston_test_harness_execute_as_client(harness, &setup);
 }
-DECLARE_FIXTURE_SETUP(fixture_setup);
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args);
 
 static struct wp_presentation *
 get_presentation(struct client *client)
@@ -160,9 +175,32 @@ feedback_create(struct client *client,
 	return fb;
 }
 
+static void
+advance_clock(struct client *client, int64_t nsec)
+{
+	struct timespec delta;
+	uint32_t tv_sec_hi, tv_sec_lo, tv_nsec;
+
+	timespec_from_nsec(&delta, nsec);
+	timespec_to_proto(&delta, &tv_sec_hi, &tv_sec_lo, &tv_nsec);
+	weston_test_advance_clock(client->test->weston_test,
+				  tv_sec_hi, tv_sec_lo, tv_nsec);
+}
+
 static void
 feedback_wait(struct feedback *fb)
 {
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+
+	/* The virtual clock only moves when told to, a refresh at a time */
+	if (arg->virtual_clock) {
+		while (fb->result == FB_PENDING) {
+			advance_clock(fb->client, VIRTUAL_REFRESH_NSEC);
+			client_roundtrip(fb->client);
+		}
+		return;
+	}
+
 	while (fb->result == FB_PENDING) {
 		assert(wl_display_dispatch(fb->client->wl_display) >= 0);
 	}
@@ -228,7 +266,7 @@ TEST(test_presentation_feedback_simple)
 	struct feedback *fb;
 	struct wp_presentation *pres;
 
-	client = create_client_and_test_surface(100, 50, 123, 77);
+	client = create_client_and_unmapped_test_surface(100, 50, 123, 77);
 	assert(client);
 	pres = get_presentation(client);
 
@@ -248,3 +286,44 @@ TEST(test_presentation_feedback_simple)
 
 	feedback_destroy(fb);
 }
+
+TEST(test_presentation_virtual_clock)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	struct client *client;
+	struct feedback *fb[2];
+	struct wp_presentation *pres;
+	int64_t delta;
+	int i;
+
+	if (!arg->virtual_clock) {
+		testlog("%s: only with the virtual clock\n", __func__);
+		return;
+	}
+
+	client = create_client_and_unmapped_test_surface(100, 50, 123, 77);
+	assert(client);
+	pres = get_presentation(client);
+
+	for (i = 0; i < 2; i++) {
+		wl_surface_attach(client->surface->wl_surface,
+				  client->surface->buffer->proxy, 0, 0);
+		fb[i] = feedback_create(client, client->surface->wl_surface,
+					pres);
+		wl_surface_damage(client->surface->wl_surface, 0, 0, 100, 100);
+		wl_surface_commit(client->surface->wl_surface);
+
+		feedback_wait(fb[i]);
+		assert(fb[i]->result == FB_PRESENTED);
+		assert(fb[i]->refresh_nsec == VIRTUAL_REFRESH_NSEC);
+	}
+
+	/* Frames land exactly on the refresh grid, whatever the real time */
+	delta = timespec_sub_to_nsec(&fb[1]->time, &fb[0]->time);
+	testlog("%s: frames %" PRId64 " ns apart\n", __func__, delta);
+	assert(delta > 0);
+	assert(delta % VIRTUAL_REFRESH_NSEC == 0);
+
+	for (i = 0; i < 2; i++)
+		feedback_destroy(fb[i]);
+}
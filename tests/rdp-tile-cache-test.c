@@ -0,0 +1,208 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <pixman.h>
+
+#include "libweston/backend-rdp/rdp-tile-cache.h"
+
+#include "zunitc/zunitc.h"
+
+#define WIDTH 300
+#define HEIGHT 200
+
+struct surface {
+	uint32_t *pixels;
+	pixman_image_t *image;
+};
+
+static void
+surface_init(struct surface *s)
+{
+	s->pixels = calloc(WIDTH * HEIGHT, sizeof *s->pixels);
+	s->image = pixman_image_create_bits(PIXMAN_x8r8g8b8, WIDTH, HEIGHT,
+					    s->pixels, WIDTH * 4);
+}
+
+static void
+surface_fini(struct surface *s)
+{
+	pixman_image_unref(s->image);
+	free(s->pixels);
+}
+
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint64_t area = 0;
+	int n, i;
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+ZUC_TEST(rdp_tile_cache_test, hash_sees_single_pixel)
+{
+	uint32_t tile[RDP_TILE_SIZE * RDP_TILE_SIZE] = { 0 };
+	uint64_t h1, h2;
+	int i;
+
+	h1 = rdp_tile_hash((uint8_t *)tile, RDP_TILE_SIZE * 4,
+			   RDP_TILE_SIZE, RDP_TILE_SIZE);
+
+	for (i = 0; i < RDP_TILE_SIZE * RDP_TILE_SIZE; i += 97) {
+		tile[i] = 1;
+		h2 = rdp_tile_hash((uint8_t *)tile, RDP_TILE_SIZE * 4,
+				   RDP_TILE_SIZE, RDP_TILE_SIZE);
+		ZUC_ASSERT_NE(h1, h2);
+		tile[i] = 0;
+	}
+
+	/* Odd widths leave a 4-byte tail on every row */
+	h1 = rdp_tile_hash((uint8_t *)tile, RDP_TILE_SIZE * 4, 45, 10);
+	tile[3 * RDP_TILE_SIZE + 44] = 0xff;
+	h2 = rdp_tile_hash((uint8_t *)tile, RDP_TILE_SIZE * 4, 45, 10);
+	ZUC_ASSERT_NE(h1, h2);
+}
+
+ZUC_TEST(rdp_tile_cache_test, first_pass_sends_everything)
+{
+	struct surface s;
+	struct rdp_tile_cache *cache;
+	pixman_region32_t damage, changed;
+	int checked, dirty;
+
+	surface_init(&s);
+	cache = rdp_tile_cache_create(WIDTH, HEIGHT);
+	ZUC_ASSERT_NOT_NULL(cache);
+
+	pixman_region32_init_rect(&damage, 0, 0, WIDTH, HEIGHT);
+	pixman_region32_init(&changed);
+
+	/* 5x4 tiles, the last column and row being partial */
+	dirty = rdp_tile_cache_filter(cache, s.image, &damage, &changed,
+				      &checked);
+	ZUC_ASSERT_EQ(20, checked);
+	ZUC_ASSERT_EQ(20, dirty);
+	ZUC_ASSERT_EQ(WIDTH * HEIGHT, region_area(&changed));
+
+	/* Same content again: nothing to send */
+	dirty = rdp_tile_cache_filter(cache, s.image, &damage, &changed,
+				      &checked);
+	ZUC_ASSERT_EQ(20, checked);
+	ZUC_ASSERT_EQ(0, dirty);
+	ZUC_ASSERT_FALSE(pixman_region32_not_empty(&changed));
+
+	/* Until the peer is known to have lost it */
+	rdp_tile_cache_invalidate(cache);
+	dirty = rdp_tile_cache_filter(cache, s.image, &damage, &changed,
+				      &checked);
+	ZUC_ASSERT_EQ(20, dirty);
+
+	pixman_region32_fini(&damage);
+	pixman_region32_fini(&changed);
+	rdp_tile_cache_destroy(cache);
+	surface_fini(&s);
+}
+
+ZUC_TEST(rdp_tile_cache_test, caret_in_repainted_window)
+{
+	struct surface s;
+	struct rdp_tile_cache *cache;
+	pixman_region32_t damage, changed;
+	pixman_box32_t *extents;
+	int checked, dirty;
+
+	surface_init(&s);
+	cache = rdp_tile_cache_create(WIDTH, HEIGHT);
+	ZUC_ASSERT_NOT_NULL(cache);
+
+	pixman_region32_init_rect(&damage, 0, 0, WIDTH, HEIGHT);
+	pixman_region32_init(&changed);
+	rdp_tile_cache_filter(cache, s.image, &damage, &changed, NULL);
+
+	/* A window covering tiles (1,1)-(3,2) is damaged as a whole, but
+	 * only a caret in tile (2,1) actually changed. */
+	pixman_region32_fini(&damage);
+	pixman_region32_init_rect(&damage, 70, 70, 170, 100);
+	s.pixels[100 * WIDTH + 150] = 0xffffffff;
+	s.pixels[101 * WIDTH + 150] = 0xffffffff;
+
+	dirty = rdp_tile_cache_filter(cache, s.image, &damage, &changed,
+				      &checked);
+	ZUC_ASSERT_EQ(6, checked);
+	ZUC_ASSERT_EQ(1, dirty);
+
+	/* Clipped to the damage inside tile (2,1) */
+	extents = pixman_region32_extents(&changed);
+	ZUC_ASSERT_EQ(128, extents->x1);
+	ZUC_ASSERT_EQ(70, extents->y1);
+	ZUC_ASSERT_EQ(192, extents->x2);
+	ZUC_ASSERT_EQ(128, extents->y2);
+
+	pixman_region32_fini(&damage);
+	pixman_region32_fini(&changed);
+	rdp_tile_cache_destroy(cache);
+	surface_fini(&s);
+}
+
+ZUC_TEST(rdp_tile_cache_test, overlapping_rects_hash_once)
+{
+	struct surface s;
+	struct rdp_tile_cache *cache;
+	pixman_region32_t damage, changed;
+	int checked, dirty;
+
+	surface_init(&s);
+	cache = rdp_tile_cache_create(WIDTH, HEIGHT);
+	ZUC_ASSERT_NOT_NULL(cache);
+
+	/* Two rectangles in the same tile, plus one off the surface */
+	pixman_region32_init_rect(&damage, 0, 0, 10, 10);
+	pixman_region32_union_rect(&damage, &damage, 20, 20, 10, 10);
+	pixman_region32_union_rect(&damage, &damage, WIDTH + 10, 0, 10, 10);
+	pixman_region32_init(&changed);
+
+	dirty = rdp_tile_cache_filter(cache, s.image, &damage, &changed,
+				      &checked);
+	ZUC_ASSERT_EQ(1, checked);
+	ZUC_ASSERT_EQ(1, dirty);
+	ZUC_ASSERT_EQ(200, region_area(&changed));
+
+	pixman_region32_fini(&damage);
+	pixman_region32_fini(&changed);
+	rdp_tile_cache_destroy(cache);
+	surface_fini(&s);
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "libweston/backend-drm/recorder-queue.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+/* A software stand-in for the VA-API encoder: records the stride of
+ * every frame it sees and optionally blocks until released, so tests
+ * can hold the worker thread busy while frames pile up. */
+struct null_encoder {
+	sem_t started;
+	sem_t release;
+	int blocking;
+	int fail_at;
+
+	int count;
+	int strides[64];
+};
+
+static int
+null_encode(void *data, const struct recorder_frame *frame)
+{
+	struct null_encoder *enc = data;
+
+	if (enc->blocking) {
+		sem_post(&enc->started);
+		sem_wait(&enc->release);
+	}
+
+	if (fcntl(frame->prime_fd, F_GETFD) < 0)
+		return -1;
+
+	if (enc->count == enc->fail_at) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	if (enc->count < (int) ARRAY_LENGTH(enc->strides))
+		enc->strides[enc->count] = frame->stride;
+	enc->count++;
+
+	return 0;
+}
+
+static void
+null_encoder_init(struct null_encoder *enc, int blocking)
+{
+	memset(enc, 0, sizeof *enc);
+	sem_init(&enc->started, 0, 0);
+	sem_init(&enc->release, 0, 0);
+	enc->blocking = blocking;
+	enc->fail_at = -1;
+}
+
+static void
+null_encoder_fini(struct null_encoder *enc)
+{
+	sem_destroy(&enc->started);
+	sem_destroy(&enc->release);
+}
+
+static int
+dummy_fd(void)
+{
+	return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static void
+wait_encoded(struct recorder_queue *q, uint64_t frames)
+{
+	struct recorder_queue_stats stats;
+
+	do {
+		usleep(1000);
+		recorder_queue_get_stats(q, &stats);
+	} while (stats.frames_encoded < frames);
+}
+
+ZUC_TEST(recorder_queue_test, encodes_in_order)
+{
+	struct null_encoder enc;
+	struct recorder_queue *q;
+	struct recorder_queue_stats stats;
+	int i;
+
+	null_encoder_init(&enc, 0);
+	q = recorder_queue_create(4, RECORDER_QUEUE_POLICY_DROP,
+				  null_encode, &enc);
+	ZUC_ASSERT_NOT_NULL(q);
+
+	for (i = 0; i < 16; i++) {
+		ZUC_ASSERT_EQ(0, recorder_queue_push(q, dummy_fd(), i));
+		wait_encoded(q, i + 1);
+	}
+
+	recorder_queue_get_stats(q, &stats);
+	recorder_queue_destroy(q);
+
+	ZUC_ASSERT_EQ(16, stats.frames_submitted);
+	ZUC_ASSERT_EQ(16, stats.frames_encoded);
+	ZUC_ASSERT_EQ(0, stats.frames_dropped);
+	ZUC_ASSERT_EQ(0, stats.frames_coalesced);
+	ZUC_ASSERT_EQ(16, enc.count);
+	for (i = 0; i < 16; i++)
+		ZUC_ASSERT_EQ(i, enc.strides[i]);
+
+	null_encoder_fini(&enc);
+}
+
+ZUC_TEST(recorder_queue_test, drops_when_full)
+{
+	struct null_encoder enc;
+	struct recorder_queue *q;
+	struct recorder_queue_stats stats;
+	int i;
+
+	null_encoder_init(&enc, 1);
+	q = recorder_queue_create(4, RECORDER_QUEUE_POLICY_DROP,
+				  null_encode, &enc);
+	ZUC_ASSERT_NOT_NULL(q);
+
+	/* Frame 0 is picked up and blocks the encoder while still holding
+	 * its slot, 1-3 fill the queue, 4-9 must be rejected without
+	 * blocking us. */
+	ZUC_ASSERT_EQ(0, recorder_queue_push(q, dummy_fd(), 0));
+	sem_wait(&enc.started);
+	for (i = 1; i < 10; i++)
+		ZUC_ASSERT_EQ(0, recorder_queue_push(q, dummy_fd(), i));
+
+	for (i = 0; i < 4; i++) {
+		sem_post(&enc.release);
+		if (i < 3)
+			sem_wait(&enc.started);
+	}
+	wait_encoded(q, 4);
+
+	recorder_queue_get_stats(q, &stats);
+	recorder_queue_destroy(q);
+
+	ZUC_ASSERT_EQ(10, stats.frames_submitted);
+	ZUC_ASSERT_EQ(4, stats.frames_encoded);
+	ZUC_ASSERT_EQ(6, stats.frames_dropped);
+	for (i = 0; i < 4; i++)
+		ZUC_ASSERT_EQ(i, enc.strides[i]);
+
+	null_encoder_fini(&enc);
+}
+
+ZUC_TEST(recorder_queue_test, coalesces_to_newest)
+{
+	struct null_encoder enc;
+	struct recorder_queue *q;
+	struct recorder_queue_stats stats;
+	int i;
+
+	null_encoder_init(&enc, 1);
+	q = recorder_queue_create(8, RECORDER_QUEUE_POLICY_COALESCE,
+				  null_encode, &enc);
+	ZUC_ASSERT_NOT_NULL(q);
+
+	ZUC_ASSERT_EQ(0, recorder_queue_push(q, dummy_fd(), 0));
+	sem_wait(&enc.started);
+	for (i = 1; i < 6; i++)
+		ZUC_ASSERT_EQ(0, recorder_queue_push(q, dummy_fd(), i));
+
+	/* Release frame 0; the worker must skip straight to frame 5. */
+	sem_post(&enc.release);
+	sem_wait(&enc.started);
+	sem_post(&enc.release);
+	wait_encoded(q, 2);
+
+	recorder_queue_get_stats(q, &stats);
+	recorder_queue_destroy(q);
+
+	ZUC_ASSERT_EQ(6, stats.frames_submitted);
+	ZUC_ASSERT_EQ(2, stats.frames_encoded);
+	ZUC_ASSERT_EQ(4, stats.frames_coalesced);
+	ZUC_ASSERT_EQ(0, stats.frames_dropped);
+	ZUC_ASSERT_EQ(0, enc.strides[0]);
+	ZUC_ASSERT_EQ(5, enc.strides[1]);
+
+	null_encoder_fini(&enc);
+}
+
+ZUC_TEST(recorder_queue_test, reports_encoder_error)
+{
+	struct null_encoder enc;
+	struct recorder_queue *q;
+	struct recorder_queue_stats stats;
+	int ret;
+
+	null_encoder_init(&enc, 0);
+	enc.fail_at = 1;
+	q = recorder_queue_create(4, RECORDER_QUEUE_POLICY_DROP,
+				  null_encode, &enc);
+	ZUC_ASSERT_NOT_NULL(q);
+
+	ZUC_ASSERT_EQ(0, recorder_queue_push(q, dummy_fd(), 0));
+	wait_encoded(q, 1);
+	ZUC_ASSERT_EQ(0, recorder_queue_push(q, dummy_fd(), 1));
+
+	do {
+		usleep(1000);
+		errno = 0;
+		ret = recorder_queue_push(q, dummy_fd(), 2);
+	} while (ret == 0);
+
+	ZUC_ASSERT_EQ(-1, ret);
+	ZUC_ASSERT_EQ(ENOSPC, errno);
+
+	recorder_queue_get_stats(q, &stats);
+	recorder_queue_destroy(q);
+
+	ZUC_ASSERT_EQ(1, stats.frames_encoded);
+
+	null_encoder_fini(&enc);
+}
+
+ZUC_TEST(recorder_queue_test, destroy_discards_pending)
+{
+	struct null_encoder enc;
+	struct recorder_queue *q;
+	int fds[3];
+	int i;
+
+	null_encoder_init(&enc, 1);
+	q = recorder_queue_create(4, RECORDER_QUEUE_POLICY_DROP,
+				  null_encode, &enc);
+	ZUC_ASSERT_NOT_NULL(q);
+
+	for (i = 0; i < 3; i++) {
+		fds[i] = dummy_fd();
+		ZUC_ASSERT_EQ(0, recorder_queue_push(q, fds[i], i));
+	}
+	/* Let every frame through, in case the worker gets to more of
+	 * them before it notices the queue is going away. */
+	sem_wait(&enc.started);
+	for (i = 0; i < 3; i++)
+		sem_post(&enc.release);
+	recorder_queue_destroy(q);
+
+	/* The queue owns the fds and must have closed all of them. */
+	for (i = 0; i < 3; i++)
+		ZUC_ASSERT_EQ(-1, fcntl(fds[i], F_GETFD));
+
+	null_encoder_fini(&enc);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "test-config.h"
+
+struct setup_args {
+	const char *config_file;
+	int threads;
+	int width;
+	int height;
+	int frames;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{ TESTSUITE_RENDERER_THREADS_1_CONFIG_PATH, 1, 1920, 1080, 60 },
+	{ TESTSUITE_RENDERER_THREADS_2_CONFIG_PATH, 2, 1920, 1080, 60 },
+	{ TESTSUITE_RENDERER_THREADS_4_CONFIG_PATH, 4, 1920, 1080, 60 },
+	{ TESTSUITE_RENDERER_THREADS_1_CONFIG_PATH, 1, 3840, 2160, 20 },
+	{ TESTSUITE_RENDERER_THREADS_2_CONFIG_PATH, 2, 3840, 2160, 20 },
+	{ TESTSUITE_RENDERER_THREADS_4_CONFIG_PATH, 4, 3840, 2160, 20 },
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_PIXMAN;
+	setup.width = arg->width;
+	setup.height = arg->height;
+	setup.config_file = arg->config_file;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args);
+
+static void
+assert_channel_near(uint32_t pixel, int shift, int expected)
+{
+	int value = (pixel >> shift) & 0xff;
+
+	assert(abs(value - expected) <= 2);
+}
+
+/* The test surface is a 25% grey, premultiplied, over the background
+ * of the test shell, 0.16 0.32 0.48, which reaches the output center. */
+static void
+check_output_center(struct client *client)
+{
+	struct buffer *shot;
+	uint32_t *pixels;
+	int stride;
+	uint32_t pixel;
+
+	shot = capture_screenshot_of_output(client);
+	pixels = pixman_image_get_data(shot->image);
+	stride = pixman_image_get_stride(shot->image) / 4;
+	pixel = pixels[(client->output->height / 2) * stride +
+		       client->output->width / 2];
+
+	assert_channel_near(pixel, 16, 0x40 + 40 * 0xbf / 0xff);
+	assert_channel_near(pixel, 8, 0x40 + 81 * 0xbf / 0xff);
+	assert_channel_near(pixel, 0, 0x40 + 122 * 0xbf / 0xff);
+
+	buffer_destroy(shot);
+}
+
+TEST(renderer_threads_bench)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	struct client *client;
+	struct surface *surface;
+	struct timespec start, end;
+	int64_t elapsed_ns;
+	int frame;
+	int done;
+
+	client = create_client_and_test_surface(0, 0, arg->width, arg->height);
+	assert(client);
+	surface = client->surface;
+
+	/* Unthrottled, every frame costs what compositing the whole
+	 * output and copying it to the hardware buffer costs. */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (frame = 0; frame < arg->frames; frame++) {
+		wl_surface_attach(surface->wl_surface,
+				  surface->buffer->proxy, 0, 0);
+		wl_surface_damage(surface->wl_surface, 0, 0,
+				  surface->width, surface->height);
+		frame_callback_set(surface->wl_surface, &done);
+		wl_surface_commit(surface->wl_surface);
+		frame_callback_wait(client, &done);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed_ns = timespec_sub_to_nsec(&end, &start);
+
+	testlog("%dx%d on %d renderer threads: %.2f ms per frame\n",
+		arg->width, arg->height, arg->threads,
+		elapsed_ns / 1e6 / arg->frames);
+
+	check_output_center(client);
+
+	client_destroy(client);
+}
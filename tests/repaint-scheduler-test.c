@@ -0,0 +1,384 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libweston/repaint-scheduler.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+#define MSEC(x) ((int64_t)(x) * 1000000)
+#define USEC(x) ((int64_t)(x) * 1000)
+
+/* 60 Hz */
+#define REFRESH_NSEC 16666667
+
+/* The simulated output: presents at multiples of the refresh period, and
+ * a repaint shows up at the first vblank after its rendering completed. */
+struct sim {
+	struct weston_repaint_predictor predictor;
+	bool adaptive;
+	int64_t last_vblank;
+	int misses;
+	int64_t window;
+};
+
+static void
+sim_init(struct sim *sim, bool adaptive)
+{
+	weston_repaint_predictor_init(&sim->predictor);
+	sim->adaptive = adaptive;
+	sim->last_vblank = 100 * (int64_t)REFRESH_NSEC;
+	sim->misses = 0;
+}
+
+static void
+sim_frame(struct sim *sim, int64_t duration)
+{
+	struct weston_repaint_predictor *p = &sim->predictor;
+	int64_t target = sim->last_vblank + REFRESH_NSEC;
+	int64_t begin, done, presented;
+
+	if (sim->adaptive)
+		sim->window = weston_repaint_predictor_get_window(p,
+				REFRESH_NSEC, MSEC(7));
+	else
+		sim->window = MSEC(7);
+
+	begin = target - sim->window;
+	weston_repaint_predictor_set_target(p, target);
+	weston_repaint_predictor_frame_begin(p, begin);
+
+	/* CPU side, then GPU side */
+	done = begin + duration / 4;
+	weston_repaint_predictor_frame_done(p, done);
+	done = begin + duration;
+	weston_repaint_predictor_frame_done(p, done);
+
+	presented = target;
+	while (presented < done)
+		presented += REFRESH_NSEC;
+
+	if (weston_repaint_predictor_frame_presented(p, presented,
+						     REFRESH_NSEC))
+		sim->misses++;
+
+	sim->last_vblank = presented;
+}
+
+static void
+sim_run(struct sim *sim, int frames, int64_t duration)
+{
+	int i;
+
+	/* A little jitter, like real repaints have */
+	for (i = 0; i < frames; i++)
+		sim_frame(sim, duration + USEC(100) * (i % 5));
+}
+
+ZUC_TEST(repaint_scheduler_test, warmup_uses_fallback)
+{
+	struct weston_repaint_predictor p;
+	int i;
+
+	weston_repaint_predictor_init(&p);
+
+	for (i = 0; i < WESTON_REPAINT_WARMUP_FRAMES - 1; i++) {
+		weston_repaint_predictor_add_sample(&p, MSEC(2));
+		ZUC_ASSERT_EQ(MSEC(7),
+			      weston_repaint_predictor_get_window(&p,
+						REFRESH_NSEC, MSEC(7)));
+	}
+
+	weston_repaint_predictor_add_sample(&p, MSEC(2));
+	ZUC_ASSERT_TRUE(weston_repaint_predictor_get_window(&p, REFRESH_NSEC,
+							    MSEC(7)) < MSEC(7));
+}
+
+ZUC_TEST(repaint_scheduler_test, window_at_most_refresh)
+{
+	struct weston_repaint_predictor p;
+	int i;
+
+	weston_repaint_predictor_init(&p);
+
+	for (i = 0; i < 10; i++)
+		weston_repaint_predictor_add_sample(&p, MSEC(40));
+
+	ZUC_ASSERT_EQ(REFRESH_NSEC,
+		      weston_repaint_predictor_get_window(&p, REFRESH_NSEC,
+							  MSEC(7)));
+}
+
+ZUC_TEST(repaint_scheduler_test, counts_late_presentation)
+{
+	struct weston_repaint_predictor p;
+	int64_t target = 10 * (int64_t)REFRESH_NSEC;
+
+	weston_repaint_predictor_init(&p);
+
+	/* Nothing repainted: neither a frame nor a miss */
+	weston_repaint_predictor_set_target(&p, target);
+	ZUC_ASSERT_FALSE(weston_repaint_predictor_frame_presented(&p, target,
+								  REFRESH_NSEC));
+	ZUC_ASSERT_EQ(0, p.frames);
+
+	weston_repaint_predictor_set_target(&p, target);
+	weston_repaint_predictor_frame_begin(&p, target - MSEC(5));
+	ZUC_ASSERT_FALSE(weston_repaint_predictor_frame_presented(&p,
+				target + USEC(200), REFRESH_NSEC));
+
+	target += REFRESH_NSEC;
+	weston_repaint_predictor_set_target(&p, target);
+	weston_repaint_predictor_frame_begin(&p, target - MSEC(5));
+	ZUC_ASSERT_TRUE(weston_repaint_predictor_frame_presented(&p,
+				target + REFRESH_NSEC, REFRESH_NSEC));
+
+	ZUC_ASSERT_EQ(2, p.frames);
+	ZUC_ASSERT_EQ(1, p.misses);
+}
+
+ZUC_TEST(repaint_scheduler_test, done_before_begin_ignored)
+{
+	struct weston_repaint_predictor p;
+
+	weston_repaint_predictor_init(&p);
+
+	/* A late GPU stamp of the previous repaint */
+	weston_repaint_predictor_frame_begin(&p, MSEC(100));
+	weston_repaint_predictor_frame_done(&p, MSEC(99));
+	weston_repaint_predictor_frame_done(&p, MSEC(103));
+	weston_repaint_predictor_frame_presented(&p, MSEC(110), REFRESH_NSEC);
+
+	ZUC_ASSERT_EQ(1, p.samples);
+	ZUC_ASSERT_EQ(MSEC(3), p.mean_ns);
+}
+
+ZUC_TEST(repaint_scheduler_test, fixed_window_misses_expensive_frames)
+{
+	struct sim sim;
+
+	sim_init(&sim, false);
+	sim_run(&sim, 60, MSEC(3));
+	ZUC_ASSERT_EQ(0, sim.misses);
+
+	/* Say, HDR content showed up and every repaint tone-maps */
+	sim_run(&sim, 60, MSEC(11));
+	ZUC_ASSERT_EQ(60, sim.misses);
+}
+
+ZUC_TEST(repaint_scheduler_test, adaptive_window_follows_repaint_time)
+{
+	struct sim sim;
+
+	sim_init(&sim, true);
+	sim_run(&sim, 60, MSEC(3));
+	ZUC_ASSERT_EQ(0, sim.misses);
+	/* Cheap frames start later than the fixed window would */
+	ZUC_ASSERT_TRUE(sim.window < MSEC(6));
+
+	/* The first expensive frame may miss, the model catches up after */
+	sim_run(&sim, 60, MSEC(11));
+	ZUC_ASSERT_TRUE(sim.misses <= 1);
+	ZUC_ASSERT_TRUE(sim.window > MSEC(11));
+	ZUC_ASSERT_EQ(sim.misses, sim.predictor.misses);
+
+	/* Back to cheap frames: no misses while the window shrinks back */
+	sim.misses = 0;
+	sim_run(&sim, 120, MSEC(3));
+	ZUC_ASSERT_EQ(0, sim.misses);
+	ZUC_ASSERT_TRUE(sim.window < MSEC(6));
+	ZUC_ASSERT_EQ(240, sim.predictor.frames);
+}
+
+/* Panel range 48 - 144 Hz */
+#define VRR_MIN_PERIOD 6944444
+#define VRR_MAX_PERIOD 20833333
+
+struct vrr_sim {
+	struct weston_vrr_scheduler vrr;
+	int64_t now;
+	/* of the last content frame */
+	int repeats;
+	/* shortest and longest time between two presents */
+	int64_t min_gap;
+	int64_t max_gap;
+};
+
+static void
+vrr_sim_init(struct vrr_sim *sim, int64_t min_period, int64_t max_period)
+{
+	weston_vrr_scheduler_init(&sim->vrr, min_period, max_period);
+	sim->now = 100 * (int64_t)REFRESH_NSEC;
+	sim->repeats = 0;
+	sim->min_gap = INT64_MAX;
+	sim->max_gap = 0;
+}
+
+static void
+vrr_sim_present(struct vrr_sim *sim, int64_t when, bool content)
+{
+	int64_t gap = when - sim->vrr.last_present_ns;
+
+	if (sim->vrr.last_present_ns) {
+		sim->min_gap = MIN(sim->min_gap, gap);
+		sim->max_gap = MAX(sim->max_gap, gap);
+	}
+
+	weston_vrr_scheduler_presented(&sim->vrr, when, content);
+	sim->now = when;
+}
+
+/* Content comes every period, with the repeats the scheduler asks for in
+ * between */
+static void
+vrr_sim_run(struct vrr_sim *sim, int frames, int64_t period)
+{
+	int64_t content, repeat;
+	int i;
+
+	for (i = 0; i < frames; i++) {
+		content = sim->vrr.last_content_ns ?
+			  sim->vrr.last_content_ns + period : sim->now;
+		content = MAX(content,
+			      weston_vrr_scheduler_get_earliest(&sim->vrr));
+		vrr_sim_present(sim, content, true);
+
+		sim->repeats = 0;
+		while ((repeat = weston_vrr_scheduler_get_repeat(&sim->vrr)) &&
+		       repeat < content + period) {
+			vrr_sim_present(sim, repeat, false);
+			sim->repeats++;
+		}
+	}
+}
+
+ZUC_TEST(repaint_scheduler_test, vrr_earliest_after_min_period)
+{
+	struct weston_vrr_scheduler vrr;
+
+	weston_vrr_scheduler_init(&vrr, VRR_MIN_PERIOD, VRR_MAX_PERIOD);
+	ZUC_ASSERT_EQ(0, weston_vrr_scheduler_get_earliest(&vrr));
+	ZUC_ASSERT_EQ(0, weston_vrr_scheduler_get_repeat(&vrr));
+
+	weston_vrr_scheduler_presented(&vrr, MSEC(1000), true);
+	ZUC_ASSERT_EQ(MSEC(1000) + VRR_MIN_PERIOD,
+		      weston_vrr_scheduler_get_earliest(&vrr));
+
+	/* Repeats count as frames on the panel all the same */
+	weston_vrr_scheduler_presented(&vrr, MSEC(1020), false);
+	ZUC_ASSERT_EQ(MSEC(1020) + VRR_MIN_PERIOD,
+		      weston_vrr_scheduler_get_earliest(&vrr));
+}
+
+ZUC_TEST(repaint_scheduler_test, vrr_content_within_range_not_repeated)
+{
+	struct vrr_sim sim;
+
+	/* 50 fps */
+	vrr_sim_init(&sim, VRR_MIN_PERIOD, VRR_MAX_PERIOD);
+	vrr_sim_run(&sim, 60, MSEC(20));
+	ZUC_ASSERT_EQ(0, sim.repeats);
+	ZUC_ASSERT_EQ(MSEC(20), sim.min_gap);
+	ZUC_ASSERT_EQ(MSEC(20), sim.max_gap);
+	ZUC_ASSERT_EQ(MSEC(20), sim.vrr.content_period_ns);
+}
+
+ZUC_TEST(repaint_scheduler_test, vrr_fast_content_limited)
+{
+	struct vrr_sim sim;
+
+	/* 200 fps is faster than the panel goes */
+	vrr_sim_init(&sim, VRR_MIN_PERIOD, VRR_MAX_PERIOD);
+	vrr_sim_run(&sim, 60, MSEC(5));
+	ZUC_ASSERT_EQ(VRR_MIN_PERIOD, sim.min_gap);
+	ZUC_ASSERT_EQ(VRR_MIN_PERIOD, sim.max_gap);
+}
+
+ZUC_TEST(repaint_scheduler_test, vrr_low_framerate_compensation)
+{
+	struct vrr_sim sim;
+
+	/* 30 fps: every frame twice, 16.7 ms each, once the content rate
+	 * is known */
+	vrr_sim_init(&sim, VRR_MIN_PERIOD, VRR_MAX_PERIOD);
+	vrr_sim_run(&sim, 2, 33333333);
+	sim.min_gap = INT64_MAX;
+	sim.max_gap = 0;
+	vrr_sim_run(&sim, 60, 33333333);
+	ZUC_ASSERT_EQ(1, sim.repeats);
+	ZUC_ASSERT_TRUE(sim.max_gap <= VRR_MAX_PERIOD);
+	ZUC_ASSERT_TRUE(sim.min_gap >= 16666666);
+
+	/* 10 fps: every frame five times, 20 ms each */
+	vrr_sim_init(&sim, VRR_MIN_PERIOD, VRR_MAX_PERIOD);
+	vrr_sim_run(&sim, 2, MSEC(100));
+	sim.min_gap = INT64_MAX;
+	sim.max_gap = 0;
+	vrr_sim_run(&sim, 60, MSEC(100));
+	ZUC_ASSERT_EQ(4, sim.repeats);
+	ZUC_ASSERT_EQ(MSEC(20), sim.min_gap);
+	ZUC_ASSERT_EQ(MSEC(20), sim.max_gap);
+}
+
+ZUC_TEST(repaint_scheduler_test, vrr_narrow_range_not_compensated)
+{
+	struct vrr_sim sim;
+
+	/* 50 - 60 Hz: halves of 30 ms would be faster than 60 Hz */
+	vrr_sim_init(&sim, 16666667, MSEC(20));
+	vrr_sim_run(&sim, 60, MSEC(30));
+	ZUC_ASSERT_EQ(0, sim.repeats);
+	ZUC_ASSERT_EQ(MSEC(30), sim.min_gap);
+}
+
+ZUC_TEST(repaint_scheduler_test, vrr_stopped_content_not_repeated)
+{
+	struct vrr_sim sim;
+	int64_t repeat;
+	int repeats = 0;
+
+	vrr_sim_init(&sim, VRR_MIN_PERIOD, VRR_MAX_PERIOD);
+	vrr_sim_run(&sim, 10, 33333333);
+
+	/* No more content: repeats end within two content periods */
+	while ((repeat = weston_vrr_scheduler_get_repeat(&sim.vrr))) {
+		vrr_sim_present(&sim, repeat, false);
+		repeats++;
+		ZUC_ASSERT_TRUE(repeats < 10);
+	}
+	ZUC_ASSERT_TRUE(sim.now - sim.vrr.last_content_ns <= 2 * 33333333);
+
+	/* Content resuming after a pause starts its estimate afresh */
+	vrr_sim_present(&sim, sim.now + 2 * WESTON_VRR_CONTENT_PAUSE_NSEC,
+			true);
+	ZUC_ASSERT_EQ(0, sim.vrr.content_period_ns);
+	ZUC_ASSERT_EQ(0, weston_vrr_scheduler_get_repeat(&sim.vrr));
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "backend.h"
+#include "repaint-stats.h"
+
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+
+#define REPAINTS 30
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_PIXMAN;
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+static void
+check_summary(const struct weston_latency_summary *s)
+{
+	assert(s->min_ns <= s->p50_ns);
+	assert(s->p50_ns <= s->p90_ns);
+	assert(s->p90_ns <= s->p99_ns);
+	assert(s->p99_ns <= s->max_ns);
+	assert(s->min_ns <= s->mean_ns && s->mean_ns <= s->max_ns);
+}
+
+PLUGIN_TEST(repaint_stats_stages)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_latency_summary render, s;
+	struct wl_event_loop *loop;
+	struct weston_output *output;
+	uint64_t before;
+	int i;
+
+	assert(!wl_list_empty(&compositor->output_list));
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	weston_repaint_stats_get_summary(output, WESTON_REPAINT_STAGE_RENDER,
+					 &render);
+	before = render.count;
+
+	for (i = 0; i < 100 * REPAINTS &&
+		    render.count < before + REPAINTS; i++) {
+		weston_output_damage(output);
+		wl_event_loop_dispatch(loop, 100);
+		weston_repaint_stats_get_summary(output,
+						 WESTON_REPAINT_STAGE_RENDER,
+						 &render);
+	}
+	assert(render.count >= before + REPAINTS);
+	check_summary(&render);
+
+	/* The stages every repaint goes through */
+	weston_repaint_stats_get_summary(output,
+					 WESTON_REPAINT_STAGE_VIEW_LIST, &s);
+	assert(s.count == render.count);
+	check_summary(&s);
+
+	weston_repaint_stats_get_summary(output, WESTON_REPAINT_STAGE_DAMAGE,
+					 &s);
+	assert(s.count == render.count);
+	check_summary(&s);
+
+	testlog("render: %"PRIu64" repaints, p50 %"PRIu64" us, "
+		"p99 %"PRIu64" us, max %"PRIu64" us\n", render.count,
+		render.p50_ns / 1000, render.p99_ns / 1000,
+		render.max_ns / 1000);
+}
+
+PLUGIN_TEST(repaint_stats_percentiles)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_latency_summary s;
+	struct weston_output *output;
+	int64_t v;
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+
+	/* Nothing feeds GPU times with the pixman renderer */
+	weston_repaint_stats_get_summary(output, WESTON_REPAINT_STAGE_GPU, &s);
+	assert(s.count == 0);
+
+	for (v = 1; v <= 1000; v++)
+		weston_repaint_stats_record_ns(output, WESTON_REPAINT_STAGE_GPU,
+					       v * 1000);
+	weston_repaint_stats_record_ns(output, WESTON_REPAINT_STAGE_GPU, -1);
+
+	weston_repaint_stats_get_summary(output, WESTON_REPAINT_STAGE_GPU, &s);
+	check_summary(&s);
+	assert(s.count == 1000);
+	assert(s.min_ns == 1000);
+	assert(s.max_ns == 1000000);
+	assert(s.mean_ns == 500500);
+
+	/* Buckets are at most 1/16 wide */
+	assert(s.p50_ns >= 500000 - 500000 / 16 &&
+	       s.p50_ns <= 500000 + 500000 / 16);
+	assert(s.p90_ns >= 900000 - 900000 / 16 &&
+	       s.p90_ns <= 900000 + 900000 / 16);
+	assert(s.p99_ns >= 990000 - 990000 / 16 &&
+	       s.p99_ns <= 1000000);
+}
+
+PLUGIN_TEST(repaint_stats_input_latency)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_latency_summary s;
+	struct wl_event_loop *loop;
+	struct weston_output *output;
+	struct weston_seat seat;
+	struct timespec time;
+	int i;
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	weston_seat_init(&seat, compositor, "latency-seat");
+	weston_seat_init_pointer(&seat);
+
+	weston_input_latency_get_summary(&seat, &s);
+	assert(s.count == 0);
+
+	/* Input timestamps are in CLOCK_MONOTONIC, like evdev's */
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	notify_motion_absolute(&seat, &time, output->x + 10, output->y + 10);
+	notify_pointer_frame(&seat);
+
+	for (i = 0; i < 100 && s.count == 0; i++) {
+		weston_output_damage(output);
+		wl_event_loop_dispatch(loop, 100);
+		weston_input_latency_get_summary(&seat, &s);
+	}
+	assert(s.count == 1);
+	assert(s.min_ns > 0 && s.max_ns < 10000000000ull);
+
+	testlog("input to present: %"PRIu64" us\n", s.max_ns / 1000);
+
+	weston_seat_release(&seat);
+}
+
+PLUGIN_TEST(repaint_stats_scope)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_log_subscriber *subscriber;
+	char line[256];
+	bool found = false, found_seat = false, found_deadlines = false;
+	FILE *fp;
+
+	fp = tmpfile();
+	assert(fp);
+	subscriber = weston_log_subscriber_create_log(fp);
+	assert(subscriber);
+
+	/* The scope prints everything once, on subscription */
+	weston_log_subscribe(compositor->weston_log_ctx, subscriber,
+			     "repaint-stats");
+	weston_log_subscriber_destroy(subscriber);
+
+	rewind(fp);
+	while (fgets(line, sizeof line, fp))
+		if (strncmp(line, "  commit-to-present ", 20) == 0)
+			found = true;
+		else if (strncmp(line, "  input-to-present ", 19) == 0)
+			found_seat = true;
+		else if (strncmp(line, "  deadline misses: ", 19) == 0)
+			found_deadlines = true;
+	fclose(fp);
+
+	assert(found);
+	assert(found_deadlines);
+	assert(found_seat || wl_list_empty(&compositor->seat_list));
+}
+
+PLUGIN_TEST(repaint_stats_views)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_log_subscriber *subscriber;
+	struct weston_latency_summary render;
+	struct weston_output *output;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	struct weston_layer layer;
+	struct wl_event_loop *loop;
+	uint64_t drawn, culled, cleared, before;
+	char line[256];
+	bool found = false;
+	FILE *fp;
+	int i;
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	/* An opaque solid color over the whole output: the background of
+	 * the test shell below it needs no drawing, itself a clear only. */
+	weston_layer_init(&layer, compositor);
+	weston_layer_set_position(&layer, WESTON_LAYER_POSITION_UI);
+
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+	weston_surface_set_color(surface, 0.0, 0.0, 0.0, 1.0);
+	pixman_region32_fini(&surface->opaque);
+	pixman_region32_init_rect(&surface->opaque, 0, 0,
+				  output->width, output->height);
+	weston_surface_set_size(surface, output->width, output->height);
+	weston_view_set_position(view, output->x, output->y);
+	weston_layer_entry_insert(&layer.view_list, &view->layer_link);
+
+	weston_repaint_stats_get_summary(output, WESTON_REPAINT_STAGE_RENDER,
+					 &render);
+	before = render.count;
+	for (i = 0; i < 100 && render.count < before + 3; i++) {
+		weston_output_damage(output);
+		wl_event_loop_dispatch(loop, 100);
+		weston_repaint_stats_get_summary(output,
+						 WESTON_REPAINT_STAGE_RENDER,
+						 &render);
+	}
+	assert(render.count >= before + 3);
+
+	fp = tmpfile();
+	assert(fp);
+	subscriber = weston_log_subscriber_create_log(fp);
+	assert(subscriber);
+	weston_log_subscribe(compositor->weston_log_ctx, subscriber,
+			     "repaint-stats");
+	weston_log_subscriber_destroy(subscriber);
+
+	rewind(fp);
+	while (!found && fgets(line, sizeof line, fp))
+		found = sscanf(line, "  views: %" SCNu64 " drawn, %" SCNu64
+			       " culled, %" SCNu64 " solid clears",
+			       &drawn, &culled, &cleared) == 3;
+	fclose(fp);
+
+	assert(found);
+	testlog("views: %" PRIu64 " drawn, %" PRIu64 " culled, %" PRIu64
+		" solid clears\n", drawn, culled, cleared);
+	assert(culled >= 3);
+	assert(cleared >= 3);
+
+	weston_view_destroy(view);
+	weston_surface_destroy(surface);
+	weston_layer_unset_position(&layer);
+}
@@ -766,3 +766,100 @@ TEST(test_subsurface_destroy_permutations)
 	client_roundtrip(client);
 	testlog("tried %d destroy permutations\n", counter);
 }
+
+/* Repaint with the pending sub-surface state, which rebuilds the view
+ * list if anything in it changed. */
+static void
+commit_and_wait_repaint(struct client *client)
+{
+	struct surface *parent = client->surface;
+	int done;
+
+	wl_surface_attach(parent->wl_surface, parent->buffer->proxy, 0, 0);
+	wl_surface_damage(parent->wl_surface, 0, 0,
+			  parent->width, parent->height);
+	frame_callback_set(parent->wl_surface, &done);
+	wl_surface_commit(parent->wl_surface);
+	frame_callback_wait(client, &done);
+}
+
+/* Picking walks the view list, so it shows which view is on top */
+static struct surface *
+pointer_focus_at(struct client *client, int x, int y)
+{
+	weston_test_move_pointer(client->test->weston_test, 0, 1, 0, 0, 0);
+	client_roundtrip(client);
+	weston_test_move_pointer(client->test->weston_test, 0, 1, 0, x, y);
+	client_roundtrip(client);
+
+	return client->input->pointer->focus;
+}
+
+TEST(test_subsurface_view_list)
+{
+	struct client *client;
+	struct wl_subcompositor *subco;
+	struct wl_surface *child;
+	struct wl_subsurface *sub;
+	struct surface *parent;
+	struct surface child_marker = { 0 };
+	struct buffer *buf;
+
+	/* the child covers (120, 70) - (170, 120) */
+	client = create_client_and_test_surface(100, 50, 100, 100);
+	assert(client);
+	parent = client->surface;
+	subco = get_subcompositor(client);
+
+	child = wl_compositor_create_surface(client->wl_compositor);
+	wl_surface_set_user_data(child, &child_marker);
+	sub = wl_subcompositor_get_subsurface(subco, child, parent->wl_surface);
+	wl_subsurface_set_position(sub, 20, 20);
+	buf = create_shm_buffer_a8r8g8b8(client, 50, 50);
+
+	commit_and_wait_repaint(client);
+	assert(pointer_focus_at(client, 130, 80) == parent);
+
+	/* map */
+	wl_surface_attach(child, buf->proxy, 0, 0);
+	wl_surface_damage(child, 0, 0, 50, 50);
+	wl_surface_commit(child);
+	commit_and_wait_repaint(client);
+	assert(pointer_focus_at(client, 130, 80) == &child_marker);
+	assert(pointer_focus_at(client, 105, 55) == parent);
+
+	/* nothing changed, the view list is kept */
+	commit_and_wait_repaint(client);
+	assert(pointer_focus_at(client, 130, 80) == &child_marker);
+
+	/* restack */
+	wl_subsurface_place_below(sub, parent->wl_surface);
+	commit_and_wait_repaint(client);
+	assert(pointer_focus_at(client, 130, 80) == parent);
+
+	wl_subsurface_place_above(sub, parent->wl_surface);
+	commit_and_wait_repaint(client);
+	assert(pointer_focus_at(client, 130, 80) == &child_marker);
+
+	/* unmap */
+	wl_surface_attach(child, NULL, 0, 0);
+	wl_surface_commit(child);
+	commit_and_wait_repaint(client);
+	assert(pointer_focus_at(client, 130, 80) == parent);
+
+	/* and map again */
+	wl_surface_attach(child, buf->proxy, 0, 0);
+	wl_surface_damage(child, 0, 0, 50, 50);
+	wl_surface_commit(child);
+	commit_and_wait_repaint(client);
+	assert(pointer_focus_at(client, 130, 80) == &child_marker);
+
+	/* destroying the sub-surface unmaps it */
+	wl_subsurface_destroy(sub);
+	commit_and_wait_repaint(client);
+	assert(pointer_focus_at(client, 130, 80) == parent);
+
+	wl_surface_destroy(child);
+	buffer_destroy(buf);
+	wl_subcompositor_destroy(subco);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "timeline.h"
+#include "shared/timespec-util.h"
+
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+
+#define BENCH_POINTS 100000
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_PIXMAN;
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+static int64_t
+bench_points(struct weston_compositor *compositor,
+	     struct weston_output *output, struct weston_surface *surface)
+{
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_POINTS; i++) {
+		TL_POINT(compositor, "bench_output", TLP_OUTPUT(output),
+			 TLP_VBLANK(&start), TLP_END);
+		TL_POINT(compositor, "bench_surface", TLP_SURFACE(surface),
+			 TLP_END);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return timespec_sub_to_nsec(&end, &start);
+}
+
+static int
+count_lines(FILE *fp, const char *needle)
+{
+	char line[1024];
+	int n = 0;
+
+	rewind(fp);
+	while (fgets(line, sizeof line, fp))
+		if (strstr(line, needle))
+			n++;
+
+	return n;
+}
+
+PLUGIN_TEST(timeline_point_cost)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_log_subscriber *subscriber;
+	struct weston_output *output = NULL;
+	struct weston_surface *surface;
+	struct timespec start, end;
+	int64_t idle_ns, recording_ns, flush_ns;
+	FILE *fp;
+
+	if (!wl_list_empty(&compositor->output_list))
+		output = container_of(compositor->output_list.next,
+				      struct weston_output, link);
+	surface = weston_surface_create(compositor);
+	assert(surface);
+
+	idle_ns = bench_points(compositor, output, surface);
+
+	fp = tmpfile();
+	assert(fp);
+	subscriber = weston_log_subscriber_create_log(fp);
+	assert(subscriber);
+	weston_log_subscribe(compositor->weston_log_ctx, subscriber,
+			     "timeline");
+	assert(weston_log_scope_is_enabled(compositor->timeline));
+
+	recording_ns = bench_points(compositor, output, surface);
+
+	/* Unsubscribing writes out whatever the ring still holds */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	weston_log_subscriber_destroy(subscriber);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	flush_ns = timespec_sub_to_nsec(&end, &start);
+	fflush(fp);
+
+	assert(count_lines(fp, "\"N\":\"bench_output\"") == BENCH_POINTS);
+	assert(count_lines(fp, "\"N\":\"bench_surface\"") == BENCH_POINTS);
+	assert(count_lines(fp, "\"type\":\"weston_surface\"") >= 1);
+	if (output)
+		assert(count_lines(fp, "\"type\":\"weston_output\"") >= 1);
+	fclose(fp);
+
+	testlog("TL_POINT without subscribers: %.1f ns/point\n",
+		(double)idle_ns / (2 * BENCH_POINTS));
+	testlog("TL_POINT while recording: %.1f ns/point, "
+		"final flush %"PRId64" us\n",
+		(double)recording_ns / (2 * BENCH_POINTS), flush_ns / 1000);
+
+	weston_surface_destroy(surface);
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "backend.h"
+#include "timeline.h"
+
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+
+#define FRAMES 5
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_PIXMAN;
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+static int
+count_lines(FILE *fp, const char *needle)
+{
+	char line[1024];
+	int n = 0;
+
+	rewind(fp);
+	while (fgets(line, sizeof line, fp))
+		if (strstr(line, needle))
+			n++;
+
+	return n;
+}
+
+/* Plays the points of a client commit going through a repaint, as the
+ * compositor would emit them. */
+static void
+emit_frame(struct weston_compositor *compositor, struct weston_output *output,
+	   struct weston_surface *surface)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	TL_POINT(compositor, "core_commit_damage", TLP_SURFACE(surface),
+		 TLP_END);
+	TL_POINT(compositor, "core_repaint_begin", TLP_OUTPUT(output),
+		 TLP_END);
+	TL_POINT(compositor, "core_flush_damage", TLP_SURFACE(surface),
+		 TLP_OUTPUT(output), TLP_END);
+	TL_POINT(compositor, "core_repaint_posted", TLP_OUTPUT(output),
+		 TLP_END);
+	TL_POINT(compositor, "renderer_gpu_begin", TLP_GPU(&now),
+		 TLP_OUTPUT(output), TLP_END);
+	TL_POINT(compositor, "renderer_gpu_end", TLP_GPU(&now),
+		 TLP_OUTPUT(output), TLP_END);
+	TL_POINT(compositor, "core_repaint_finished", TLP_OUTPUT(output),
+		 TLP_VBLANK(&now), TLP_END);
+}
+
+PLUGIN_TEST(timeline_trace_flows)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_log_subscriber *subscriber;
+	struct weston_output *output;
+	struct weston_surface *surface;
+	struct wl_event_loop *loop;
+	char line[256];
+	FILE *fp;
+	int i;
+
+	assert(!wl_list_empty(&compositor->output_list));
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	fp = tmpfile();
+	assert(fp);
+	subscriber = weston_log_subscriber_create_log(fp);
+	assert(subscriber);
+	weston_log_subscribe(compositor->weston_log_ctx, subscriber,
+			     "timeline-trace");
+
+	for (i = 0; i < FRAMES; i++)
+		emit_frame(compositor, output, surface);
+
+	/* and a few real repaints on top */
+	for (i = 0; i < 3; i++) {
+		weston_output_damage(output);
+		wl_event_loop_dispatch(loop, 100);
+	}
+
+	weston_log_subscriber_destroy(subscriber);
+	fflush(fp);
+
+	rewind(fp);
+	assert(fgets(line, sizeof line, fp));
+	assert(strcmp(line, "[\n") == 0);
+
+	/* One track each for the output, its GPU and the surface */
+	assert(count_lines(fp, "\"name\":\"process_name\"") == 3);
+	assert(count_lines(fp, "\"args\":{\"name\":\"output ") >= 1);
+	assert(count_lines(fp, "\"args\":{\"name\":\"gpu ") >= 1);
+	assert(count_lines(fp, "\"args\":{\"name\":\"surface ") >= 1);
+
+	/* Every commit flows through its repaint to the presentation */
+	assert(count_lines(fp, "\"ph\":\"s\"") == FRAMES);
+	assert(count_lines(fp, "\"ph\":\"t\"") == 2 * FRAMES);
+	assert(count_lines(fp, "\"ph\":\"f\"") == FRAMES);
+
+	assert(count_lines(fp, "\"ph\":\"B\",\"name\":\"gpu\"") == FRAMES);
+	assert(count_lines(fp, "\"ph\":\"B\",\"name\":\"repaint\"") >= FRAMES);
+	assert(count_lines(fp, "\"ph\":\"B\",\"name\":\"repaint\"") ==
+	       count_lines(fp, "\"ph\":\"E\",\"name\":\"repaint\""));
+
+	fclose(fp);
+	weston_surface_destroy(surface);
+}
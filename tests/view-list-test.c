@@ -0,0 +1,252 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+
+#define BENCH_VIEWS 200
+#define BENCH_REPAINTS 1000
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = RENDERER_PIXMAN;
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+/* A mapped view on top of the layer, as a shell would put it there */
+static struct weston_view *
+create_mapped_view(struct weston_compositor *compositor,
+		   struct weston_layer *layer, int x, int y)
+{
+	struct weston_surface *surface;
+	struct weston_view *view;
+
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+
+	surface->width = 50;
+	surface->height = 50;
+	weston_view_set_position(view, x, y);
+	weston_layer_entry_insert(&layer->view_list, &view->layer_link);
+	surface->is_mapped = true;
+	view->is_mapped = true;
+
+	return view;
+}
+
+static bool
+view_in(struct weston_view *view, struct weston_view **views, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (views[i] == view)
+			return true;
+
+	return false;
+}
+
+/* Checks the order of the views in compositor::view_list, after building
+ * it the way a repaint does. Views not in 'all', i.e. of the shell, are
+ * ignored. 'expected' is NULL terminated. */
+static void
+check_view_list(struct weston_compositor *compositor,
+		struct weston_view **all, int all_count,
+		struct weston_view **expected)
+{
+	struct weston_view *view;
+	int i = 0;
+
+	weston_compositor_build_view_list(compositor);
+	assert(!compositor->view_list_needs_rebuild);
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (!view_in(view, all, all_count))
+			continue;
+
+		assert(expected[i] == view);
+		i++;
+	}
+	assert(expected[i] == NULL);
+}
+
+#define assert_view_list(...) \
+	check_view_list(compositor, all, ARRAY_LENGTH(all), \
+			(struct weston_view *[]) { __VA_ARGS__ })
+
+PLUGIN_TEST(view_list_layer_entry_moves)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_layer top, bottom;
+	struct weston_view *a, *b, *c;
+	struct weston_view *all[3];
+
+	weston_layer_init(&top, compositor);
+	weston_layer_init(&bottom, compositor);
+	weston_layer_set_position(&top, WESTON_LAYER_POSITION_UI);
+	weston_layer_set_position(&bottom, WESTON_LAYER_POSITION_NORMAL);
+
+	a = create_mapped_view(compositor, &bottom, 0, 0);
+	b = create_mapped_view(compositor, &bottom, 10, 10);
+	c = create_mapped_view(compositor, &top, 20, 20);
+	all[0] = a;
+	all[1] = b;
+	all[2] = c;
+
+	assert_view_list(c, b, a, NULL);
+
+	/* nothing changed, the cached list is kept */
+	assert(!compositor->view_list_needs_rebuild);
+	assert_view_list(c, b, a, NULL);
+
+	/* restack within the layer */
+	weston_layer_entry_remove(&a->layer_link);
+	assert(compositor->view_list_needs_rebuild);
+	weston_layer_entry_insert(&bottom.view_list, &a->layer_link);
+	assert_view_list(c, a, b, NULL);
+
+	/* move to another layer */
+	weston_layer_entry_remove(&b->layer_link);
+	weston_layer_entry_insert(&top.view_list, &b->layer_link);
+	assert_view_list(b, c, a, NULL);
+
+	/* move the layers themselves */
+	weston_layer_set_position(&bottom, WESTON_LAYER_POSITION_TOP_UI);
+	assert_view_list(a, b, c, NULL);
+
+	weston_layer_unset_position(&top);
+	assert_view_list(a, NULL);
+
+	weston_layer_set_position(&top, WESTON_LAYER_POSITION_FADE);
+	assert_view_list(b, c, a, NULL);
+
+	weston_surface_destroy(a->surface);
+	weston_surface_destroy(b->surface);
+	weston_surface_destroy(c->surface);
+	weston_layer_unset_position(&top);
+	weston_layer_unset_position(&bottom);
+}
+
+PLUGIN_TEST(view_list_view_destroy)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_layer layer;
+	struct weston_view *a, *b, *c;
+	struct weston_view *all[3];
+
+	weston_layer_init(&layer, compositor);
+	weston_layer_set_position(&layer, WESTON_LAYER_POSITION_NORMAL);
+
+	a = create_mapped_view(compositor, &layer, 0, 0);
+	b = create_mapped_view(compositor, &layer, 10, 10);
+	c = create_mapped_view(compositor, &layer, 20, 20);
+	all[0] = a;
+	all[1] = b;
+	all[2] = c;
+
+	assert_view_list(c, b, a, NULL);
+
+	/* destroying a view while the cached list is current */
+	weston_surface_destroy(b->surface);
+	assert(!compositor->view_list_needs_rebuild);
+	assert_view_list(c, a, NULL);
+
+	/* and while a rebuild is pending, with the list still holding it */
+	weston_layer_entry_remove(&a->layer_link);
+	weston_layer_entry_insert(&layer.view_list, &a->layer_link);
+	assert(compositor->view_list_needs_rebuild);
+	weston_surface_destroy(c->surface);
+	assert_view_list(a, NULL);
+
+	/* an unmapped view is never added back */
+	weston_view_unmap(a);
+	assert_view_list(NULL);
+
+	weston_surface_destroy(a->surface);
+	weston_layer_unset_position(&layer);
+}
+
+static int64_t
+bench_build_view_list(struct weston_compositor *compositor, bool rebuild)
+{
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+	for (i = 0; i < BENCH_REPAINTS; i++) {
+		/* as every repaint did before the list was cached */
+		if (rebuild)
+			compositor->view_list_needs_rebuild = true;
+		weston_compositor_build_view_list(compositor);
+	}
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+
+	return timespec_sub_to_nsec(&end, &start);
+}
+
+PLUGIN_TEST(view_list_build_cost)
+{
+	/* struct weston_compositor *compositor; */
+	struct weston_layer layer;
+	struct weston_view *views[BENCH_VIEWS];
+	int64_t rebuild_ns, cached_ns;
+	int i;
+
+	weston_layer_init(&layer, compositor);
+	weston_layer_set_position(&layer, WESTON_LAYER_POSITION_NORMAL);
+	for (i = 0; i < BENCH_VIEWS; i++)
+		views[i] = create_mapped_view(compositor, &layer, i, i);
+
+	rebuild_ns = bench_build_view_list(compositor, true);
+	cached_ns = bench_build_view_list(compositor, false);
+
+	testlog("view list of %d views: %.2f us per repaint rebuilt, "
+		"%.2f us per repaint cached\n", BENCH_VIEWS,
+		rebuild_ns / 1e3 / BENCH_REPAINTS,
+		cached_ns / 1e3 / BENCH_REPAINTS);
+
+	for (i = 0; i < BENCH_VIEWS; i++)
+		weston_surface_destroy(views[i]->surface);
+	weston_layer_unset_position(&layer);
+}
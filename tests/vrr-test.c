@@ -0,0 +1,285 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "weston-test-client-helper.h"
+#include "presentation-time-client-protocol.h"
+#include "weston-test-fixture-compositor.h"
+#include "test-config.h"
+
+/* vrr.ini: 48 to 120 Hz */
+#define REFRESH_NSEC 8333333
+/* How far the virtual clock moves at a time */
+#define STEP_NSEC 1000000
+/* Frames to let the scheduler settle */
+#define WARMUP_FRAMES 3
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.config_file = TESTSUITE_VRR_CONFIG_PATH;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+struct frame {
+	bool presented;
+	struct timespec time;
+	uint32_t refresh_nsec;
+	uint64_t seq;
+};
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi,
+		   uint32_t tv_sec_lo,
+		   uint32_t tv_nsec,
+		   uint32_t refresh_nsec,
+		   uint32_t seq_hi,
+		   uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct frame *frame = data;
+
+	frame->presented = true;
+	timespec_from_proto(&frame->time, tv_sec_hi, tv_sec_lo, tv_nsec);
+	frame->refresh_nsec = refresh_nsec;
+	frame->seq = ((uint64_t)seq_hi << 32) + seq_lo;
+}
+
+static void
+feedback_discarded(void *data,
+		   struct wp_presentation_feedback *presentation_feedback)
+{
+	assert(0 && "frame discarded");
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+static struct wp_presentation *
+get_presentation(struct client *client)
+{
+	struct global *g;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, wp_presentation_interface.name) == 0)
+			return wl_registry_bind(client->wl_registry, g->name,
+						&wp_presentation_interface, 1);
+	}
+
+	assert(0 && "no presentation found");
+	return NULL;
+}
+
+static void
+advance_clock(struct client *client, int64_t nsec)
+{
+	struct timespec delta;
+	uint32_t tv_sec_hi, tv_sec_lo, tv_nsec;
+
+	timespec_from_nsec(&delta, nsec);
+	timespec_to_proto(&delta, &tv_sec_hi, &tv_sec_lo, &tv_nsec);
+	weston_test_advance_clock(client->test->weston_test,
+				  tv_sec_hi, tv_sec_lo, tv_nsec);
+}
+
+/* Lets the clock run a step at a time, for the compositor to repaint and
+ * present in between */
+static void
+idle_for(struct client *client, int64_t nsec)
+{
+	while (nsec > 0) {
+		advance_clock(client, MIN(nsec, STEP_NSEC));
+		nsec -= STEP_NSEC;
+	}
+	client_roundtrip(client);
+}
+
+/* Commits a frame and waits for it to be presented, returns for how long */
+static int64_t
+frame_commit_wait(struct client *client, struct wp_presentation *pres,
+		  struct frame *frame)
+{
+	struct wl_surface *surface = client->surface->wl_surface;
+	struct wp_presentation_feedback *feedback;
+	int64_t waited = 0;
+
+	memset(frame, 0, sizeof *frame);
+	wl_surface_attach(surface, client->surface->buffer->proxy, 0, 0);
+	feedback = wp_presentation_feedback(pres, surface);
+	wp_presentation_feedback_add_listener(feedback, &feedback_listener,
+					      frame);
+	wl_surface_damage(surface, 0, 0, client->surface->width,
+			  client->surface->height);
+	wl_surface_commit(surface);
+	client_roundtrip(client);
+
+	/* Whatever is due right at commit time repaints first */
+	advance_clock(client, 0);
+	client_roundtrip(client);
+
+	while (!frame->presented) {
+		advance_clock(client, STEP_NSEC);
+		waited += STEP_NSEC;
+		client_roundtrip(client);
+		assert(waited < 1000000000);
+	}
+
+	wp_presentation_feedback_destroy(feedback);
+
+	return waited;
+}
+
+/* Commits a frame every period_nsec of the clock, or right after the last
+ * one was presented if 0 */
+static void
+present_frames(struct client *client, struct frame *frames, int count,
+	       int64_t period_nsec)
+{
+	struct wp_presentation *pres = get_presentation(client);
+	int64_t waited;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		waited = frame_commit_wait(client, pres, &frames[i]);
+		if (period_nsec == 0)
+			continue;
+
+		assert(waited < period_nsec);
+		idle_for(client, period_nsec - waited);
+	}
+
+	wp_presentation_destroy(pres);
+}
+
+static int64_t
+frame_delta(struct frame *frames, int i)
+{
+	return timespec_sub_to_nsec(&frames[i].time, &frames[i - 1].time);
+}
+
+TEST(vrr_presents_on_commit)
+{
+	struct client *client;
+	struct frame frames[WARMUP_FRAMES + 4];
+	int i;
+
+	/* 11 ms is not a multiple of any refresh period */
+	client = create_client_and_unmapped_test_surface(0, 0, 320, 240);
+	present_frames(client, frames, ARRAY_LENGTH(frames), 11000000);
+
+	for (i = WARMUP_FRAMES; i < (int)ARRAY_LENGTH(frames); i++) {
+		testlog("%s: frame %d after %" PRId64 " ns, seq +%" PRIu64 "\n",
+			__func__, i, frame_delta(frames, i),
+			frames[i].seq - frames[i - 1].seq);
+		assert(frames[i].refresh_nsec == 0);
+		assert(frame_delta(frames, i) == 11000000);
+		assert(frames[i].seq - frames[i - 1].seq == 1);
+	}
+
+	client_destroy(client);
+}
+
+TEST(vrr_limited_to_highest_refresh_rate)
+{
+	struct client *client;
+	struct frame frames[WARMUP_FRAMES + 4];
+	int i;
+
+	client = create_client_and_unmapped_test_surface(0, 0, 320, 240);
+	present_frames(client, frames, ARRAY_LENGTH(frames), 0);
+
+	for (i = WARMUP_FRAMES; i < (int)ARRAY_LENGTH(frames); i++) {
+		testlog("%s: frame %d after %" PRId64 " ns\n",
+			__func__, i, frame_delta(frames, i));
+		assert(frames[i].refresh_nsec == 0);
+		assert(frame_delta(frames, i) == REFRESH_NSEC);
+	}
+
+	client_destroy(client);
+}
+
+TEST(vrr_low_framerate_compensation)
+{
+	struct client *client;
+	struct frame frames[WARMUP_FRAMES + 4];
+	int i;
+
+	/* Slower than 48 Hz: every frame shows twice, for 16.5 ms each */
+	client = create_client_and_unmapped_test_surface(0, 0, 320, 240);
+	present_frames(client, frames, ARRAY_LENGTH(frames), 33000000);
+
+	for (i = WARMUP_FRAMES; i < (int)ARRAY_LENGTH(frames); i++) {
+		testlog("%s: frame %d after %" PRId64 " ns, seq +%" PRIu64 "\n",
+			__func__, i, frame_delta(frames, i),
+			frames[i].seq - frames[i - 1].seq);
+		assert(frame_delta(frames, i) == 33000000);
+		assert(frames[i].seq - frames[i - 1].seq == 2);
+	}
+
+	client_destroy(client);
+}
+
+TEST(vrr_not_for_windows)
+{
+	struct client *client;
+	struct frame frames[WARMUP_FRAMES + 2];
+	int i;
+
+	/* Not covering the output, so the refresh rate stays fixed */
+	client = create_client_and_unmapped_test_surface(0, 0, 100, 50);
+	present_frames(client, frames, ARRAY_LENGTH(frames), 11000000);
+
+	for (i = WARMUP_FRAMES; i < (int)ARRAY_LENGTH(frames); i++)
+		assert(frames[i].refresh_nsec == REFRESH_NSEC);
+
+	client_destroy(client);
+}
@@ -158,6 +158,7 @@ pointer_handle_motion(void *data, struct wl_pointer *wl_pointer,
 	pointer->x = wl_fixed_to_int(x);
 	pointer->y = wl_fixed_to_int(y);
 	pointer->motion_time_msec = time_msec;
+	pointer->motion_count++;
 	pointer->motion_time_timespec = pointer->input_timestamp;
 	pointer->input_timestamp = (struct timespec) { 0 };
 
@@ -1002,8 +1003,15 @@ surface_destroy(struct surface *surface)
 	free(surface);
 }
 
+/** Create a client with a test surface at the given position
+ *
+ * Unlike create_client_and_test_surface(), this does not commit the surface
+ * and wait for it to be shown: the first commit of the caller maps it. This
+ * suits compositors that do not repaint by themselves, as with a virtual
+ * presentation clock.
+ */
 struct client *
-create_client_and_test_surface(int x, int y, int width, int height)
+create_client_and_unmapped_test_surface(int x, int y, int width, int height)
 {
 	struct client *client;
 	struct surface *surface;
@@ -1031,6 +1039,20 @@ create_client_and_test_surface(int x, int y, int width, int height)
 				 width, height);
 	pixman_image_unref(solid);
 
+	surface->x = x;
+	surface->y = y;
+	weston_test_move_surface(client->test->weston_test, surface->wl_surface,
+				 surface->x, surface->y);
+
+	return client;
+}
+
+struct client *
+create_client_and_test_surface(int x, int y, int width, int height)
+{
+	struct client *client;
+
+	client = create_client_and_unmapped_test_surface(x, y, width, height);
 	move_client(client, x, y);
 
 	return client;
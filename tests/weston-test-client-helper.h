@@ -98,6 +98,7 @@ struct pointer {
 	uint32_t axis;
 	double axis_value;
 	uint32_t motion_time_msec;
+	uint32_t motion_count;
 	uint32_t button_time_msec;
 	uint32_t axis_time_msec;
 	uint32_t axis_stop_time_msec;
@@ -199,6 +200,9 @@ surface_destroy(struct surface *surface);
 struct client *
 create_client_and_test_surface(int x, int y, int width, int height);
 
+struct client *
+create_client_and_unmapped_test_surface(int x, int y, int width, int height);
+
 struct buffer *
 create_shm_buffer_a8r8g8b8(struct client *client, int width, int height);
 
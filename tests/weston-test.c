@@ -37,6 +37,7 @@
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
+#include <libweston/backend-headless.h>
 #include "backend.h"
 #include "libweston-internal.h"
 #include "compositor/weston.h"
@@ -211,11 +212,18 @@ move_pointer(struct wl_client *client, struct wl_resource *resource,
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 	struct weston_pointer_motion_event event = { 0 };
 	struct timespec time;
+	wl_fixed_t px = pointer->x;
+	wl_fixed_t py = pointer->y;
+
+	/* Move relative to where coalesced motion will leave the pointer */
+	if (pointer->motion_pending)
+		weston_pointer_motion_to_abs(pointer, &pointer->pending_motion,
+					     &px, &py);
 
 	event = (struct weston_pointer_motion_event) {
 		.mask = WESTON_POINTER_MOTION_REL,
-		.dx = wl_fixed_to_double(wl_fixed_from_int(x) - pointer->x),
-		.dy = wl_fixed_to_double(wl_fixed_from_int(y) - pointer->y),
+		.dx = wl_fixed_to_double(wl_fixed_from_int(x) - px),
+		.dy = wl_fixed_to_double(wl_fixed_from_int(y) - py),
 	};
 
 	timespec_from_proto(&time, tv_sec_hi, tv_sec_lo, tv_nsec);
@@ -599,6 +607,26 @@ send_touch(struct wl_client *client, struct wl_resource *resource,
 		     wl_fixed_to_double(y), touch_type);
 }
 
+static void
+advance_clock(struct wl_client *client, struct wl_resource *resource,
+	      uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	const struct weston_headless_clock_api *api;
+	struct timespec delta;
+
+	api = weston_headless_clock_get_api(test->compositor);
+	if (!api) {
+		wl_resource_post_error(resource,
+				       WESTON_TEST_ERROR_NO_VIRTUAL_CLOCK,
+				       "the backend has no virtual clock");
+		return;
+	}
+
+	timespec_from_proto(&delta, tv_sec_hi, tv_sec_lo, tv_nsec);
+	api->advance(test->compositor, timespec_to_nsec(&delta));
+}
+
 static const struct weston_test_interface test_implementation = {
 	move_surface,
 	move_pointer,
@@ -610,6 +638,7 @@ static const struct weston_test_interface test_implementation = {
 	device_add,
 	capture_screenshot,
 	send_touch,
+	advance_clock,
 };
 
 static void
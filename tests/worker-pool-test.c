@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2020 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "libweston/worker-pool.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+#define JOBS 64
+
+struct batch {
+	int runs[JOBS];
+	pthread_t thread[JOBS];
+};
+
+static void
+record_job(void *data, unsigned int index)
+{
+	struct batch *batch = data;
+
+	batch->runs[index]++;
+	batch->thread[index] = pthread_self();
+}
+
+ZUC_TEST(worker_pool_test, runs_every_job_once)
+{
+	struct weston_worker_pool *pool;
+	struct batch batch = {};
+	int round, i;
+
+	pool = weston_worker_pool_create(3);
+	ZUC_ASSERT_NOT_NULL(pool);
+	ZUC_ASSERT_EQ(4, weston_worker_pool_get_size(pool));
+
+	for (round = 1; round <= 100; round++) {
+		weston_worker_pool_run(pool, JOBS, record_job, &batch);
+
+		for (i = 0; i < JOBS; i++)
+			ZUC_ASSERT_EQ(round, batch.runs[i]);
+	}
+
+	weston_worker_pool_destroy(pool);
+}
+
+ZUC_TEST(worker_pool_test, single_job_runs_on_caller)
+{
+	struct weston_worker_pool *pool;
+	struct batch batch = {};
+
+	pool = weston_worker_pool_create(2);
+	ZUC_ASSERT_NOT_NULL(pool);
+
+	weston_worker_pool_run(pool, 1, record_job, &batch);
+	ZUC_ASSERT_EQ(1, batch.runs[0]);
+	ZUC_ASSERT_TRUE(pthread_equal(batch.thread[0], pthread_self()));
+
+	weston_worker_pool_run(pool, 0, record_job, &batch);
+	ZUC_ASSERT_EQ(1, batch.runs[0]);
+
+	weston_worker_pool_destroy(pool);
+}
+
+ZUC_TEST(worker_pool_test, works_without_threads)
+{
+	struct weston_worker_pool *pool;
+	struct batch batch = {};
+	int i;
+
+	pool = weston_worker_pool_create(0);
+	ZUC_ASSERT_NOT_NULL(pool);
+	ZUC_ASSERT_EQ(1, weston_worker_pool_get_size(pool));
+
+	weston_worker_pool_run(pool, JOBS, record_job, &batch);
+	for (i = 0; i < JOBS; i++) {
+		ZUC_ASSERT_EQ(1, batch.runs[i]);
+		ZUC_ASSERT_TRUE(pthread_equal(batch.thread[i], pthread_self()));
+	}
+
+	weston_worker_pool_destroy(pool);
+}
+
+struct caller {
+	struct weston_worker_pool *pool;
+	struct batch batch;
+};
+
+static void *
+caller_thread(void *data)
+{
+	struct caller *caller = data;
+	int round;
+
+	for (round = 0; round < 100; round++)
+		weston_worker_pool_run(caller->pool, JOBS, record_job,
+				       &caller->batch);
+
+	return NULL;
+}
+
+ZUC_TEST(worker_pool_test, concurrent_callers)
+{
+	struct weston_worker_pool *pool;
+	struct caller callers[3] = {};
+	pthread_t threads[ARRAY_LENGTH(callers)];
+	unsigned int c;
+	int i;
+
+	pool = weston_worker_pool_create(2);
+	ZUC_ASSERT_NOT_NULL(pool);
+
+	for (c = 0; c < ARRAY_LENGTH(callers); c++) {
+		callers[c].pool = pool;
+		ZUC_ASSERT_EQ(0, pthread_create(&threads[c], NULL,
+						caller_thread, &callers[c]));
+	}
+
+	for (c = 0; c < ARRAY_LENGTH(callers); c++) {
+		pthread_join(threads[c], NULL);
+		for (i = 0; i < JOBS; i++)
+			ZUC_ASSERT_EQ(100, callers[c].batch.runs[i]);
+	}
+
+	weston_worker_pool_destroy(pool);
+}